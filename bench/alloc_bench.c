@@ -0,0 +1,591 @@
+// Every allocator of libsc_alloc on the allocation patterns of the preprocessor, to choose between them and to catch regressions.
+//   token vectors:      many token vectors growing side by side one push at a time, some much longer than others, like lines and macro arguments.
+//   small strings:      identifier sized strings, all live until the end of a batch, then freed in random order.
+//   scoped temporaries: nested macro expansions, every level allocating temporaries that are freed when it is done.
+//   thread churn:       THREADS threads churning through a window of live objects of the sizes the preprocessor uses.
+//                       Every thread has an allocator of its own, except for the mallocator and the thread allocator which are shared.
+// Allocators that only free everything at once (regions, region lists, arenas) are reset at the end of every batch,
+// the others get every allocation freed.
+// Every run is made in a child process, so that the peak RSS is its own. Fragmentation is how much the RSS grew during the run
+// over the most bytes the workload had live at once, 1x being perfect. Vectors don't touch all of their capacity, so they can go a bit below.
+// Below a megabyte live a few hundred KB of RSS noise can double the ratio, so it is marked with a ~ there and only its order of magnitude counts.
+// That still shows allocators that never free during a batch growing to many times what the scoped temporaries have live.
+// The region list has small regions so that it ends up with a hundred of them or more, walking the list on every allocation shows in its ns/op.
+// The static rows are the arena and the pool called without sc_allocator (sc_alloc_static.h), with SC_VECTOR_DEFINE token vectors.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <sc_thread_alloc.h>
+#include <sc_tracking_alloc.h>
+#include <sc_vm_alloc.h>
+#include <sc_alloc_static.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ROUNDS 3
+
+#define VECTOR_BATCHES 5
+#define VECTORS 2000
+#define VECTOR_PUSHES 250000
+
+#define STRING_BATCHES 5
+#define STRINGS 200000
+#define MAX_STRING_LENGTH 40
+
+#define EXPANSION_BATCHES 5
+#define EXPANSIONS 2000
+#define MAX_DEPTH 8
+#define MAX_TEMPORARIES 4
+
+#define THREADS 4
+#define CHURN_BATCHES 4
+#define CHURN_OPERATIONS 100000
+#define WINDOW 4096
+
+// Big enough for a batch of any workload, the operating system only gives us the pages we touch.
+#define REGION_BYTES (256 * 1024 * 1024)
+// Room for the longest token vector.
+#define REGION_LIST_REGION_SIZE (256 * 1024)
+// Primary region of the fallback allocator, the rest comes from the mallocator.
+#define FALLBACK_REGION_BYTES (1024 * 1024)
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define VM_REGION_RESERVE ((size_t)1024 * 1024 * 1024)
+
+#define MIN_FRAGMENTATION_LIVE (1024 * 1024)
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+typedef enum bench_kind {
+    BENCH_MALLOCATOR,
+    BENCH_REGION,
+    BENCH_REGION_LIST,
+    BENCH_FALLBACK,
+    BENCH_ARENA,
+    BENCH_POOL,
+    BENCH_THREAD,
+    BENCH_VM_REGION,
+    BENCH_TRACKING,
+    BENCH_ARENA_STATIC,
+    BENCH_POOL_STATIC,
+    BENCH_KIND_COUNT
+} bench_kind;
+
+static const char *kind_names[BENCH_KIND_COUNT] = { "mallocator", "region", "region list", "fallback", "arena", "pool", "thread", "vm region", "tracking",
+                                                    "arena static", "pool static" };
+
+// pp_token_arena_vector's counterpart for the pool.
+SC_VECTOR_DEFINE(pp_token_pool_vector, pp_token, sc_pool)
+
+typedef struct bench_allocator {
+    bench_kind kind;
+    sc_allocator *alloc;
+    sc_allocator made;
+
+    void *region_memory;
+    sc_region region;
+    // Primary allocator of the fallback.
+    sc_allocator region_alloc;
+    sc_fallback fallback;
+    sc_region_list list;
+    sc_arena arena;
+    sc_pool pool;
+    sc_vm_region vm_region;
+    sc_tracking tracking;
+} bench_allocator;
+
+static bool bench_allocator_init(bench_allocator *bench, bench_kind kind) {
+    bench->kind = kind;
+    bench->alloc = &bench->made;
+
+    switch (kind) {
+        case BENCH_MALLOCATOR:
+            bench->alloc = mallocator();
+        break;
+        case BENCH_REGION:
+            bench->region_memory = malloc(REGION_BYTES);
+            bench->made = make_region_alloc(&bench->region, bench->region_memory, REGION_BYTES);
+            return bench->region_memory != NULL;
+        case BENCH_REGION_LIST:
+            bench->made = make_region_list_alloc(&bench->list, mallocator(), REGION_LIST_REGION_SIZE);
+        break;
+        case BENCH_FALLBACK:
+            bench->region_memory = malloc(FALLBACK_REGION_BYTES);
+            bench->region_alloc = make_region_alloc(&bench->region, bench->region_memory, FALLBACK_REGION_BYTES);
+            bench->made = make_fallback_alloc(&bench->fallback, &bench->region_alloc, mallocator());
+            return bench->region_memory != NULL;
+        case BENCH_ARENA:
+        case BENCH_ARENA_STATIC:
+            bench->made = make_arena_alloc(&bench->arena, mallocator(), ARENA_CHUNK_SIZE);
+        break;
+        case BENCH_POOL:
+        case BENCH_POOL_STATIC:
+            bench->made = make_pool_alloc(&bench->pool, mallocator());
+        break;
+        case BENCH_THREAD:
+            bench->alloc = thread_allocator();
+        break;
+        case BENCH_VM_REGION:
+            bench->made = make_vm_region_alloc(&bench->vm_region, VM_REGION_RESERVE, 0);
+            return bench->vm_region.base != NULL;
+        case BENCH_TRACKING:
+            bench->made = make_tracking_alloc(&bench->tracking, mallocator(), kind_names[kind]);
+        break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// End of a batch, everything allocated during it has been freed.
+static void bench_allocator_reset(bench_allocator *bench) {
+    switch (bench->kind) {
+        case BENCH_REGION:
+        case BENCH_FALLBACK:
+            region_clear(&bench->region);
+        break;
+        case BENCH_REGION_LIST:
+            region_list_destroy(&bench->list);
+            region_list_init(&bench->list, mallocator(), REGION_LIST_REGION_SIZE);
+        break;
+        case BENCH_ARENA:
+        case BENCH_ARENA_STATIC:
+            arena_clear(&bench->arena);
+        break;
+        case BENCH_VM_REGION:
+            vm_region_reset(&bench->vm_region);
+        break;
+        default:
+        break;
+    }
+}
+
+static void bench_allocator_destroy(bench_allocator *bench) {
+    switch (bench->kind) {
+        case BENCH_REGION:
+            free(bench->region_memory);
+        break;
+        case BENCH_FALLBACK:
+            fallback_destroy(&bench->fallback);
+            free(bench->region_memory);
+        break;
+        case BENCH_REGION_LIST:
+            region_list_destroy(&bench->list);
+        break;
+        case BENCH_ARENA:
+        case BENCH_ARENA_STATIC:
+            arena_destroy(&bench->arena);
+        break;
+        case BENCH_POOL:
+        case BENCH_POOL_STATIC:
+            pool_destroy(&bench->pool);
+        break;
+        case BENCH_VM_REGION:
+            vm_region_destroy(&bench->vm_region);
+        break;
+        case BENCH_TRACKING:
+            tracking_destroy(&bench->tracking);
+        break;
+        default:
+        break;
+    }
+}
+
+// Bytes the workload has asked for and not freed yet.
+typedef struct live_bytes {
+    size_t current;
+    size_t peak;
+} live_bytes;
+
+static void live_add(live_bytes *live, size_t size) {
+    live->current += size;
+    if (live->current > live->peak) {
+        live->peak = live->current;
+    }
+}
+
+static void live_remove(live_bytes *live, size_t size) {
+    live->current -= size;
+}
+
+// The workloads are written once over 'alloc' (sc_allocator *, sc_arena * or sc_pool *) and 'vector', the token vector type over it.
+// They use 'bench' and 'live' of the function they are expanded in, which returns what they count.
+#define DISPATCH(workload, bench) \
+    switch ((bench)->kind) { \
+        case BENCH_ARENA_STATIC: \
+            workload(&(bench)->arena, pp_token_arena_vector, pp_token_arena_vector_init) \
+        case BENCH_POOL_STATIC: \
+            workload(&(bench)->pool, pp_token_pool_vector, pp_token_pool_vector_init) \
+        default: \
+            workload((bench)->alloc, pp_token_vector, pp_token_vector_init_with) \
+    }
+
+#define TOKEN_VECTORS(alloc, vector, vector_init) { \
+    uint64_t random = 0x5CC5CC5CC; \
+    size_t pushes = 0; \
+    \
+    pp_token token = { .kind = PP_TOK_IDENTIFIER }; \
+    vector *vectors = malloc(VECTORS * sizeof(vector)); \
+    for (size_t batch = 0; batch < VECTOR_BATCHES; batch++) { \
+        for (size_t i = 0; i < VECTORS; i++) { \
+            vector_init(&vectors[i], 8, (alloc)); \
+            live_add(live, 8 * sizeof(pp_token)); \
+        } \
+        \
+        for (size_t i = 0; i < VECTOR_PUSHES; i++) { \
+            /* Vectors at the start get most of the tokens. */ \
+            size_t limit = 1 + next_random(&random) % VECTORS; \
+            vector *pushed = &vectors[next_random(&random) % limit]; \
+            \
+            size_t capacity = pushed->capacity; \
+            token.source.line = i; \
+            vector##_push(pushed, &token); \
+            if (pushed->capacity != capacity) { \
+                live_add(live, (pushed->capacity - capacity) * sizeof(pp_token)); \
+            } \
+        } \
+        \
+        for (size_t i = 0; i < VECTORS; i++) { \
+            live_remove(live, vectors[i].capacity * sizeof(pp_token)); \
+            vector##_destroy(&vectors[i]); \
+        } \
+        \
+        bench_allocator_reset(bench); \
+        pushes += VECTOR_PUSHES; \
+    } \
+    \
+    free(vectors); \
+    return pushes; \
+}
+
+// Returns the number of pushes.
+static size_t token_vectors(bench_allocator *bench, live_bytes *live) {
+    DISPATCH(TOKEN_VECTORS, bench)
+}
+
+#define SMALL_STRINGS(alloc, vector, vector_init) { \
+    uint64_t random = 0x5CC5CC5CC; \
+    size_t allocations = 0; \
+    \
+    char **strings = malloc(STRINGS * sizeof(char *)); \
+    for (size_t batch = 0; batch < STRING_BATCHES; batch++) { \
+        for (size_t i = 0; i < STRINGS; i++) { \
+            size_t length = 1 + next_random(&random) % MAX_STRING_LENGTH; \
+            strings[i] = sc_static_alloc((alloc), length + 1); \
+            memset(strings[i], 'a' + i % 26, length); \
+            strings[i][length] = '\0'; \
+            live_add(live, length + 1); \
+        } \
+        \
+        for (size_t i = STRINGS - 1; i > 0; i--) { \
+            size_t j = next_random(&random) % (i + 1); \
+            char *swap = strings[i]; \
+            strings[i] = strings[j]; \
+            strings[j] = swap; \
+        } \
+        \
+        for (size_t i = 0; i < STRINGS; i++) { \
+            live_remove(live, strlen(strings[i]) + 1); \
+            sc_static_free((alloc), strings[i]); \
+        } \
+        \
+        bench_allocator_reset(bench); \
+        allocations += STRINGS; \
+    } \
+    \
+    free(strings); \
+    return allocations; \
+}
+
+// Returns the number of strings.
+static size_t small_strings(bench_allocator *bench, live_bytes *live) {
+    DISPATCH(SMALL_STRINGS, bench)
+}
+
+// Defines 'name', returning the number of temporaries of an expansion 'depth' levels deep.
+#define DEFINE_EXPAND(name, allocator_type) \
+    static size_t name(allocator_type *alloc, live_bytes *live, uint64_t *random, size_t depth) { \
+        void *temporaries[MAX_TEMPORARIES]; \
+        size_t sizes[MAX_TEMPORARIES]; \
+        size_t count = 1 + next_random(random) % MAX_TEMPORARIES; \
+        for (size_t i = 0; i < count; i++) { \
+            /* 16 bytes to 2 KB. */ \
+            sizes[i] = (size_t)16 << next_random(random) % 8; \
+            temporaries[i] = sc_static_alloc(alloc, sizes[i]); \
+            memset(temporaries[i], 0, sizes[i]); \
+            live_add(live, sizes[i]); \
+        } \
+        \
+        size_t allocations = count; \
+        if (depth > 1) { \
+            size_t expansions = next_random(random) % 3; \
+            for (size_t i = 0; i < expansions; i++) { \
+                allocations += name(alloc, live, random, depth - 1); \
+            } \
+        } \
+        \
+        while (count > 0) { \
+            count--; \
+            live_remove(live, sizes[count]); \
+            sc_static_free(alloc, temporaries[count]); \
+        } \
+        \
+        return allocations; \
+    }
+
+DEFINE_EXPAND(expand_dynamic, sc_allocator)
+DEFINE_EXPAND(expand_arena, sc_arena)
+DEFINE_EXPAND(expand_pool, sc_pool)
+
+#undef DEFINE_EXPAND
+
+#define expand(alloc, live, random, depth) \
+    _Generic((alloc), sc_arena *: expand_arena, sc_pool *: expand_pool, sc_allocator *: expand_dynamic)((alloc), (live), (random), (depth))
+
+#define SCOPED_TEMPORARIES(alloc, vector, vector_init) { \
+    uint64_t random = 0x5CC5CC5CC; \
+    size_t allocations = 0; \
+    \
+    for (size_t batch = 0; batch < EXPANSION_BATCHES; batch++) { \
+        for (size_t i = 0; i < EXPANSIONS; i++) { \
+            allocations += expand((alloc), live, &random, MAX_DEPTH); \
+        } \
+        \
+        bench_allocator_reset(bench); \
+    } \
+    \
+    return allocations; \
+}
+
+// Returns the number of temporaries.
+static size_t scoped_temporaries(bench_allocator *bench, live_bytes *live) {
+    DISPATCH(SCOPED_TEMPORARIES, bench)
+}
+
+static const size_t churn_sizes[] = { sizeof(token_source), sizeof(pp_token), 8 * sizeof(pp_token), sizeof(pp_token_vector) * 3, sizeof(define) };
+
+typedef struct churn_thread {
+    bench_kind kind;
+    size_t index;
+    live_bytes live;
+    size_t operations;
+    bool failed;
+} churn_thread;
+
+#define CHURN(alloc, vector, vector_init) { \
+    uint64_t random = 0x5CC5CC5CC + thread->index; \
+    \
+    void **window = calloc(WINDOW, sizeof(void *)); \
+    size_t *sizes = calloc(WINDOW, sizeof(size_t)); \
+    for (size_t batch = 0; batch < CHURN_BATCHES; batch++) { \
+        for (size_t i = 0; i < CHURN_OPERATIONS; i++) { \
+            size_t slot = next_random(&random) % WINDOW; \
+            if (window[slot]) { \
+                live_remove(live, sizes[slot]); \
+                sc_static_free((alloc), window[slot]); \
+            } \
+            \
+            sizes[slot] = churn_sizes[next_random(&random) % (sizeof(churn_sizes) / sizeof(churn_sizes[0]))]; \
+            window[slot] = sc_static_alloc((alloc), sizes[slot]); \
+            memset(window[slot], 0, sizes[slot]); \
+            live_add(live, sizes[slot]); \
+        } \
+        \
+        for (size_t i = 0; i < WINDOW; i++) { \
+            if (window[i]) { \
+                live_remove(live, sizes[i]); \
+                sc_static_free((alloc), window[i]); \
+                window[i] = NULL; \
+            } \
+        } \
+        \
+        bench_allocator_reset(bench); \
+        thread->operations += CHURN_OPERATIONS; \
+    } \
+    \
+    free(sizes); \
+    free(window); \
+    return 0; \
+}
+
+static int churn_with(churn_thread *thread, bench_allocator *bench) {
+    live_bytes *live = &thread->live;
+    DISPATCH(CHURN, bench)
+}
+
+static int churn(void *data) {
+    churn_thread *thread = data;
+
+    bench_allocator bench;
+    if (!bench_allocator_init(&bench, thread->kind)) {
+        thread->failed = true;
+        return 0;
+    }
+
+    churn_with(thread, &bench);
+    bench_allocator_destroy(&bench);
+    return 0;
+}
+
+#undef DISPATCH
+#undef TOKEN_VECTORS
+#undef SMALL_STRINGS
+#undef expand
+#undef SCOPED_TEMPORARIES
+#undef CHURN
+
+// The threads peaks are added up, they may not have been at the same time.
+static size_t thread_churn(bench_kind kind, live_bytes *live, bool *failed) {
+    thrd_t threads[THREADS];
+    churn_thread data[THREADS];
+    for (size_t i = 0; i < THREADS; i++) {
+        data[i] = (churn_thread) { .kind = kind, .index = i };
+        thrd_create(&threads[i], churn, &data[i]);
+    }
+
+    size_t operations = 0;
+    for (size_t i = 0; i < THREADS; i++) {
+        thrd_join(threads[i], NULL);
+        operations += data[i].operations;
+        live->peak += data[i].live.peak;
+        *failed = *failed || data[i].failed;
+    }
+
+    return operations;
+}
+
+typedef struct bench_workload {
+    const char *name;
+    // What ns are counted per, allocating and freeing it included.
+    const char *unit;
+    // Single threaded workloads get an allocator, threaded ones (run == NULL) make their own.
+    size_t (*run)(bench_allocator *, live_bytes *);
+} bench_workload;
+
+static const bench_workload workloads[] = {
+    { "token vectors", "push", token_vectors },
+    { "small strings", "string", small_strings },
+    { "scoped temporaries", "temporary", scoped_temporaries },
+    { "thread churn", "operation", NULL },
+};
+
+typedef struct bench_result {
+    double ms;
+    size_t operations;
+    // In KB, at the start of the run and at its peak.
+    long start_rss;
+    long peak_rss;
+    size_t peak_live;
+} bench_result;
+
+static long peak_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool run_child(const bench_workload *workload, bench_kind kind, bench_result *result) {
+    *result = (bench_result) { .start_rss = peak_rss() };
+    live_bytes live = { 0 };
+    bool failed = false;
+
+    double start = now_ms();
+    if (workload->run) {
+        bench_allocator bench;
+        if (!bench_allocator_init(&bench, kind)) {
+            return false;
+        }
+
+        result->operations = workload->run(&bench, &live);
+        bench_allocator_destroy(&bench);
+    } else {
+        result->operations = thread_churn(kind, &live, &failed);
+    }
+
+    result->ms = now_ms() - start;
+    result->peak_rss = peak_rss();
+    result->peak_live = live.peak;
+    return !failed;
+}
+
+// Runs the workload in a child process, the RSS high water mark of which starts at what we use now.
+static bool run(const bench_workload *workload, bench_kind kind, bench_result *result) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipe_fds[0]);
+        bench_result child_result;
+        if (run_child(workload, kind, &child_result)) {
+            ssize_t written = write(pipe_fds[1], &child_result, sizeof(child_result));
+            (void)written;
+        }
+        _exit(0);
+    }
+
+    close(pipe_fds[1]);
+    bool ok = child > 0 && read(pipe_fds[0], result, sizeof(*result)) == sizeof(*result);
+    close(pipe_fds[0]);
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+    }
+
+    return ok;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        const bench_workload *workload = &workloads[i];
+        printf("%s\n", workload->name);
+        printf("  %-12s %9s/%-9s %11s %14s\n", "allocator", "ns", workload->unit, "peak RSS", "fragmentation");
+
+        for (bench_kind kind = 0; kind < BENCH_KIND_COUNT; kind++) {
+            // Fastest run, the memory use is the same for all of them.
+            bench_result best = { 0 };
+            bool ok = true;
+            for (int round = 0; round < ROUNDS && ok; round++) {
+                bench_result result;
+                ok = run(workload, kind, &result);
+                if (ok && (round == 0 || result.ms < best.ms)) {
+                    best = result;
+                }
+            }
+
+            if (!ok) {
+                printf("  %-12s %19s\n", kind_names[kind], "failed");
+                continue;
+            }
+
+            printf("  %-12s %19.2f %8.1f MB", kind_names[kind], best.ms * 1e6 / best.operations, best.peak_rss / 1024.0);
+            long grown = best.peak_rss > best.start_rss ? best.peak_rss - best.start_rss : 0;
+            double fragmentation = best.peak_live ? grown * 1024.0 / best.peak_live : 0;
+            if (best.peak_live > MIN_FRAGMENTATION_LIVE) {
+                printf(" %13.2fx\n", fragmentation);
+            } else {
+                char approximate[32];
+                snprintf(approximate, sizeof(approximate), "~%.0fx", fragmentation);
+                printf(" %14s\n", approximate);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Compares the ways file_load can bring a file into memory: load time and peak RSS.
+// Each mode runs in its own process so that peak RSS is measured separately.
+// With no arguments, a generated 64 MB file is used.
+#define _DEFAULT_SOURCE
+#include <sc_file_io.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ROUNDS 10
+#define GENERATED_SIZE (64 * 1024 * 1024)
+
+typedef struct load_mode {
+    const char *name;
+    int flags;
+} load_mode;
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Loads every file and reads all of its bytes, like the tokenizer would.
+static void run_mode(load_mode *mode, char **paths, int path_count) {
+    sc_file *files = malloc(path_count * sizeof(sc_file));
+    size_t checksum = 0;
+
+    double start = now_ms();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < path_count; i++) {
+            file_load_with(&files[i], paths[i], mallocator(), mode->flags);
+            for (long int j = 0; j < files[i].size; j++) {
+                checksum += (unsigned char)files[i].contents[j];
+            }
+        }
+
+        for (int i = 0; i < path_count; i++) {
+            if (files[i].contents) {
+                file_destroy(&files[i]);
+            }
+        }
+    }
+    double elapsed = now_ms() - start;
+
+    printf("%-24s %10.3f ms/round (checksum %zx)", mode->name, elapsed / ROUNDS, checksum);
+    fflush(stdout);
+    free(files);
+}
+
+static char *generate_file() {
+    static char path[] = "/tmp/scc_file_load_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char line[] = "static int some_identifier = 42; // And a comment to make the line longer.\n";
+    size_t line_len = strlen(line);
+    for (size_t written = 0; written + line_len <= GENERATED_SIZE; written += line_len) {
+        if (write(fd, line, line_len) != (ssize_t)line_len) {
+            break;
+        }
+    }
+
+    close(fd);
+    return path;
+}
+
+int main(int argc, char *argv[]) {
+    char **paths = argv + 1;
+    int path_count = argc - 1;
+
+    char *generated = NULL;
+    if (path_count == 0) {
+        generated = generate_file();
+        if (!generated) {
+            fprintf(stderr, "Could not create a temporary file.\n");
+            return 1;
+        }
+
+        paths = &generated;
+        path_count = 1;
+    }
+
+    load_mode modes[] = {
+        { "read", 0 },
+        { "mmap", FILE_LOAD_MMAP },
+        { "mmap + sequential", FILE_LOAD_MMAP | FILE_LOAD_SEQUENTIAL },
+        { "mmap + populate", FILE_LOAD_MMAP | FILE_LOAD_POPULATE },
+    };
+
+    // Warm the page cache so that every mode starts from the same place.
+    for (int i = 0; i < path_count; i++) {
+        sc_file file;
+        file_load_with(&file, paths[i], mallocator(), 0);
+        if (file.contents) {
+            file_destroy(&file);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        fflush(stdout);
+
+        pid_t child = fork();
+        if (child == 0) {
+            run_mode(&modes[i], paths, path_count);
+            _exit(0);
+        }
+
+        int status;
+        struct rusage usage;
+        wait4(child, &status, 0, &usage);
+        printf(", peak RSS %ld KB, %ld minor faults\n", usage.ru_maxrss, usage.ru_minflt);
+    }
+
+    if (generated) {
+        unlink(generated);
+    }
+
+    return 0;
+}
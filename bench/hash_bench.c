@@ -0,0 +1,122 @@
+// Content hashing throughput, compared to the time it takes to load the same file.
+// With no arguments, a generated 64 MB file is used.
+#define _DEFAULT_SOURCE
+#include <sc_file_io.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 10
+#define GENERATED_SIZE (64 * 1024 * 1024)
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char *generate_file() {
+    static char path[] = "/tmp/scc_hash_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char line[] = "static int some_identifier = 42; // And a comment to make the line longer.\n";
+    size_t line_len = strlen(line);
+    for (size_t written = 0; written + line_len <= GENERATED_SIZE; written += line_len) {
+        if (write(fd, line, line_len) != (ssize_t)line_len) {
+            break;
+        }
+    }
+
+    close(fd);
+    return path;
+}
+
+static void report(const char *name, double ms, size_t bytes) {
+    printf("%-24s %10.3f ms/round %8.2f GB/s\n", name, ms / ROUNDS, (double)bytes * ROUNDS / (ms / 1000.0) / 1e9);
+}
+
+static void bench_load(const char *name, char **paths, int path_count, int flags) {
+    size_t bytes = 0;
+    uint64_t checksum = 0;
+
+    double start = now_ms();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < path_count; i++) {
+            sc_file file;
+            file_load_with(&file, paths[i], mallocator(), flags);
+            if (!file.contents) {
+                continue;
+            }
+
+            bytes += round == 0 ? (size_t)file.size : 0;
+            checksum += file.hashed ? file.hash.low : (unsigned char)file.contents[file.size / 2];
+            file_destroy(&file);
+        }
+    }
+
+    report(name, now_ms() - start, bytes);
+    if (checksum == 42) {
+        printf("(checksum %llx)\n", (unsigned long long)checksum);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char **paths = argv + 1;
+    int path_count = argc - 1;
+
+    char *generated = NULL;
+    if (path_count == 0) {
+        generated = generate_file();
+        if (!generated) {
+            fprintf(stderr, "Could not create a temporary file.\n");
+            return 1;
+        }
+
+        paths = &generated;
+        path_count = 1;
+    }
+
+    // Hashing alone, on contents that are already in memory.
+    sc_file *files = malloc(path_count * sizeof(sc_file));
+    size_t bytes = 0;
+    for (int i = 0; i < path_count; i++) {
+        file_load_with(&files[i], paths[i], mallocator(), 0);
+        bytes += files[i].contents ? (size_t)files[i].size : 0;
+    }
+
+    uint64_t checksum = 0;
+    double start = now_ms();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < path_count; i++) {
+            if (files[i].contents) {
+                checksum ^= sc_hash_bytes(files[i].contents, files[i].size).low;
+            }
+        }
+    }
+    report("hash only", now_ms() - start, bytes);
+
+    for (int i = 0; i < path_count; i++) {
+        if (files[i].contents) {
+            file_destroy(&files[i]);
+        }
+    }
+    free(files);
+
+    bench_load("read", paths, path_count, 0);
+    bench_load("read + hash", paths, path_count, FILE_LOAD_HASH);
+    bench_load("mmap", paths, path_count, FILE_LOAD_MMAP);
+    bench_load("mmap + hash", paths, path_count, FILE_LOAD_MMAP | FILE_LOAD_HASH);
+
+    if (checksum == 42) {
+        printf("(checksum %llx)\n", (unsigned long long)checksum);
+    }
+
+    if (generated) {
+        unlink(generated);
+    }
+
+    return 0;
+}
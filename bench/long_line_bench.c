@@ -0,0 +1,133 @@
+// Preprocesses a file made of a single 50 MB logical line: time and peak RSS.
+// Text lines are lexed in windows of TOKENIZER_LINE_WINDOW bytes, so peak RSS should not depend on the length of the line.
+// Build with -DTOKENIZER_LINE_WINDOW=0x7fffffffffffffff to compare against lexing the whole line at once.
+// Each mode runs in its own process so that peak RSS is measured separately.
+// With no arguments, the input is generated.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define GENERATED_SIZE (50 * 1024 * 1024)
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char *generate_file() {
+    static char path[] = "/tmp/scc_long_line_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char header[] = "#define VALUE 42\n#define ADD(a, b) ((a) + (b))\n";
+    char chunk[] = "int some_identifier = ADD(VALUE, 1); char *text = \"a string literal\"; /* comment */ ";
+    size_t chunk_len = strlen(chunk);
+
+    bool ok = write(fd, header, strlen(header)) == (ssize_t)strlen(header);
+    for (size_t written = 0; ok && written + chunk_len <= GENERATED_SIZE; written += chunk_len) {
+        ok = write(fd, chunk, chunk_len) == (ssize_t)chunk_len;
+    }
+    ok = ok && write(fd, "\n", 1) == 1;
+
+    close(fd);
+    if (!ok) {
+        unlink(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+static void run(const char *path, bool streaming) {
+    sc_file_cache cache;
+    file_cache_init(&cache, mallocator());
+
+    tokenizer_state state;
+    sc_file_stream stream;
+    if (streaming) {
+        if (!file_stream_open(&stream, path, FILE_STREAM_CHUNK_SIZE)) {
+            sc_error(true, "Could not open '%s'.", path);
+        }
+        tokenizer_state_init_stream(&state, &cache, &stream, path);
+    } else {
+        sc_file_cache_handle handle = file_cache_load(&cache, path);
+        if (!handle.cache) {
+            sc_error(true, "Could not open '%s'.", path);
+        }
+        tokenizer_state_init(&state, handle);
+    }
+
+    pp_token_vector line_vec;
+    pp_token_vector_init(&line_vec, 128);
+    token_vector output;
+    token_vector_init(&output, 128);
+
+    preprocessor_state pp_state;
+    preprocessor_state_init(&pp_state, &state, &output, &line_vec, NULL);
+
+    size_t tokens = 0;
+    size_t calls = 0;
+
+    double start = now_ms();
+    bool ok = true;
+    while (ok) {
+        ok = preprocess_line(&pp_state);
+        tokens += output.size;
+        calls++;
+        preprocessor_release_output(&output);
+    }
+    double elapsed = now_ms() - start;
+
+    printf("%-8s %10.3f ms %8.2f MB/s, %zu tokens in %zu calls", streaming ? "stream" : "file", elapsed,
+           GENERATED_SIZE / (elapsed / 1000.0) / (1024 * 1024), tokens, calls);
+    fflush(stdout);
+
+    tokenizer_state_destroy(&state);
+    if (streaming) {
+        file_stream_close(&stream);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char *path = argc > 1 ? argv[1] : NULL;
+
+    char *generated = NULL;
+    if (!path) {
+        generated = path = generate_file();
+        if (!generated) {
+            fprintf(stderr, "Could not create a temporary file.\n");
+            return 1;
+        }
+    }
+
+    printf("Line window: %zu bytes\n", (size_t)TOKENIZER_LINE_WINDOW);
+
+    bool modes[] = { false, true };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        fflush(stdout);
+
+        pid_t child = fork();
+        if (child == 0) {
+            run(path, modes[i]);
+            _exit(0);
+        }
+
+        int status;
+        struct rusage usage;
+        wait4(child, &status, 0, &usage);
+        printf(", peak RSS %ld KB\n", usage.ru_maxrss);
+    }
+
+    if (generated) {
+        unlink(generated);
+    }
+
+    return 0;
+}
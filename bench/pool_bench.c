@@ -0,0 +1,117 @@
+// Pool allocator against the mallocator, on alloc/free patterns that look like macro expansion.
+//   calls:       nested function like macro calls, each one allocating its argument array and argument vectors,
+//                all freed in reverse order when the call is done.
+//   interleaved: a window of live objects of the sizes the preprocessor uses, freed in allocation order as new ones come in.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 5
+#define CALLS 2000000
+#define INTERLEAVED_OPERATIONS 20000000
+#define WINDOW 4096
+#define MAX_DEPTH 4
+#define MAX_ARGUMENTS 6
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Returns the number of allocations.
+static size_t bench_calls(sc_allocator *alloc) {
+    uint64_t random = 0x5CC5CC5CC;
+    size_t allocations = 0;
+
+    void *live[MAX_DEPTH * (MAX_ARGUMENTS + 1)];
+    for (size_t call = 0; call < CALLS; call++) {
+        size_t depth = 1 + next_random(&random) % MAX_DEPTH;
+        size_t count = 0;
+
+        for (size_t level = 0; level < depth; level++) {
+            size_t arguments = 1 + next_random(&random) % MAX_ARGUMENTS;
+            pp_token_vector *args = sc_alloc(alloc, arguments * sizeof(pp_token_vector));
+            live[count++] = args;
+
+            for (size_t i = 0; i < arguments; i++) {
+                args[i].memory = sc_alloc(alloc, 8 * sizeof(pp_token));
+                args[i].memory[0].kind = PP_TOK_IDENTIFIER;
+                live[count++] = args[i].memory;
+            }
+        }
+
+        allocations += count;
+        while (count > 0) {
+            sc_free(alloc, live[--count]);
+        }
+    }
+
+    return allocations;
+}
+
+static size_t bench_interleaved(sc_allocator *alloc) {
+    static const size_t sizes[] = { sizeof(token_source), sizeof(pp_token), 8 * sizeof(pp_token), sizeof(pp_token_vector) * 3, sizeof(define) };
+    uint64_t random = 0x5CC5CC5CC;
+
+    void **window = calloc(WINDOW, sizeof(void *));
+    for (size_t i = 0; i < INTERLEAVED_OPERATIONS; i++) {
+        size_t slot = i % WINDOW;
+        if (window[slot]) {
+            sc_free(alloc, window[slot]);
+        }
+
+        size_t size = sizes[next_random(&random) % (sizeof(sizes) / sizeof(sizes[0]))];
+        window[slot] = sc_alloc(alloc, size);
+        memset(window[slot], 0, sizeof(void *) * 2);
+    }
+
+    for (size_t i = 0; i < WINDOW; i++) {
+        if (window[i]) {
+            sc_free(alloc, window[i]);
+        }
+    }
+
+    free(window);
+    return INTERLEAVED_OPERATIONS;
+}
+
+static void run(const char *pattern, size_t (*bench)(sc_allocator *)) {
+    double malloc_ms = 0;
+    double pool_ms = 0;
+    size_t allocations = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_ms();
+        allocations = bench(mallocator());
+        malloc_ms += now_ms() - start;
+
+        sc_pool pool;
+        sc_allocator pool_alloc = make_pool_alloc(&pool, mallocator());
+        start = now_ms();
+        bench(&pool_alloc);
+        sc_destroy_allocator(&pool_alloc);
+        pool_ms += now_ms() - start;
+    }
+
+    malloc_ms /= ROUNDS;
+    pool_ms /= ROUNDS;
+    printf("%-12s %zu allocations\n", pattern, allocations);
+    printf("  %-10s %10.3f ms %8.2f ns/allocation\n", "mallocator", malloc_ms, malloc_ms * 1e6 / allocations);
+    printf("  %-10s %10.3f ms %8.2f ns/allocation (%.2fx)\n", "pool", pool_ms, pool_ms * 1e6 / allocations, malloc_ms / pool_ms);
+}
+
+int main() {
+    run("calls", bench_calls);
+    run("interleaved", bench_interleaved);
+    return 0;
+}
@@ -0,0 +1,172 @@
+// Allocator calls through sc_allocator against the same calls resolved at compile time (sc_alloc_static.h).
+//   arena vector: token vectors in a scratch arena, filled and thrown away by rewinding, like macro substitution temporaries.
+//                 Dynamic is pp_token_vector over an arena sc_allocator, static is pp_token_arena_vector.
+//   pool objects: nested macro calls allocating their argument arrays and argument vectors from a pool, freed in reverse order.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <sc_alloc_static.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 5
+#define VECTORS 2000000
+#define MAX_PUSHES 96
+#define CALLS 2000000
+#define MAX_DEPTH 4
+#define MAX_ARGUMENTS 6
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Returns the number of tokens pushed.
+static size_t arena_vector_dynamic(sc_arena *arena, sc_allocator *alloc) {
+    uint64_t random = 0x5CC5CC5CC;
+    size_t pushes = 0;
+    size_t sum = 0;
+
+    pp_token token = { .kind = PP_TOK_IDENTIFIER };
+    for (size_t i = 0; i < VECTORS; i++) {
+        sc_arena_mark mark = arena_mark(arena);
+        size_t count = 1 + next_random(&random) % MAX_PUSHES;
+
+        pp_token_vector vector;
+        pp_token_vector_init_with(&vector, 8, alloc);
+        for (size_t j = 0; j < count; j++) {
+            token.source.line = j;
+            pp_token_vector_push(&vector, &token);
+        }
+
+        sum += vector.memory[vector.size - 1].source.line;
+        pp_token_vector_destroy(&vector);
+        arena_rewind(arena, mark);
+        pushes += count;
+    }
+
+    return pushes + (sum == 42);
+}
+
+static size_t arena_vector_static(sc_arena *arena, sc_allocator *alloc) {
+    (void)alloc;
+    uint64_t random = 0x5CC5CC5CC;
+    size_t pushes = 0;
+    size_t sum = 0;
+
+    pp_token token = { .kind = PP_TOK_IDENTIFIER };
+    for (size_t i = 0; i < VECTORS; i++) {
+        sc_arena_mark mark = arena_mark(arena);
+        size_t count = 1 + next_random(&random) % MAX_PUSHES;
+
+        pp_token_arena_vector vector;
+        pp_token_arena_vector_init(&vector, 8, arena);
+        for (size_t j = 0; j < count; j++) {
+            token.source.line = j;
+            pp_token_arena_vector_push(&vector, &token);
+        }
+
+        sum += vector.memory[vector.size - 1].source.line;
+        pp_token_arena_vector_destroy(&vector);
+        arena_rewind(arena, mark);
+        pushes += count;
+    }
+
+    return pushes + (sum == 42);
+}
+
+// The same code for both, only the type of 'alloc' changes.
+#define POOL_CALLS(alloc) \
+    uint64_t random = 0x5CC5CC5CC; \
+    size_t allocations = 0; \
+    \
+    void *live[MAX_DEPTH * (MAX_ARGUMENTS + 1)]; \
+    for (size_t call = 0; call < CALLS; call++) { \
+        size_t depth = 1 + next_random(&random) % MAX_DEPTH; \
+        size_t count = 0; \
+        \
+        for (size_t level = 0; level < depth; level++) { \
+            size_t arguments = 1 + next_random(&random) % MAX_ARGUMENTS; \
+            pp_token_vector *args = sc_static_alloc(alloc, arguments * sizeof(pp_token_vector)); \
+            live[count++] = args; \
+            \
+            for (size_t i = 0; i < arguments; i++) { \
+                args[i].memory = sc_static_alloc(alloc, 8 * sizeof(pp_token)); \
+                args[i].memory[0].kind = PP_TOK_IDENTIFIER; \
+                live[count++] = args[i].memory; \
+            } \
+        } \
+        \
+        allocations += count; \
+        while (count > 0) { \
+            sc_static_free(alloc, live[--count]); \
+        } \
+    } \
+    \
+    return allocations;
+
+static size_t pool_objects_dynamic(sc_pool *pool, sc_allocator *alloc) {
+    (void)pool;
+    POOL_CALLS(alloc)
+}
+
+static size_t pool_objects_static(sc_pool *pool, sc_allocator *alloc) {
+    (void)alloc;
+    POOL_CALLS(pool)
+}
+
+#undef POOL_CALLS
+
+static double time_arena(size_t (*bench)(sc_arena *, sc_allocator *), size_t *operations) {
+    sc_arena arena;
+    sc_allocator alloc = make_arena_alloc(&arena, mallocator(), 16 * 1024);
+    double start = now_ms();
+    *operations = bench(&arena, &alloc);
+    double elapsed = now_ms() - start;
+    arena_destroy(&arena);
+    return elapsed;
+}
+
+static double time_pool(size_t (*bench)(sc_pool *, sc_allocator *), size_t *operations) {
+    sc_pool pool;
+    sc_allocator alloc = make_pool_alloc(&pool, mallocator());
+    double start = now_ms();
+    *operations = bench(&pool, &alloc);
+    double elapsed = now_ms() - start;
+    pool_destroy(&pool);
+    return elapsed;
+}
+
+static void report(const char *pattern, const char *unit, double dynamic_ms, double static_ms, size_t operations) {
+    printf("%-14s %zu %s\n", pattern, operations, unit);
+    printf("  %-10s %10.3f ms %8.2f ns/operation\n", "dynamic", dynamic_ms, dynamic_ms * 1e6 / operations);
+    printf("  %-10s %10.3f ms %8.2f ns/operation (%.2fx)\n", "static", static_ms, static_ms * 1e6 / operations, dynamic_ms / static_ms);
+}
+
+int main() {
+    double dynamic_ms = 0;
+    double static_ms = 0;
+    size_t operations = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        dynamic_ms += time_arena(arena_vector_dynamic, &operations);
+        static_ms += time_arena(arena_vector_static, &operations);
+    }
+    report("arena vector", "pushes", dynamic_ms / ROUNDS, static_ms / ROUNDS, operations);
+
+    dynamic_ms = 0;
+    static_ms = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        dynamic_ms += time_pool(pool_objects_dynamic, &operations);
+        static_ms += time_pool(pool_objects_static, &operations);
+    }
+    report("pool objects", "allocations", dynamic_ms / ROUNDS, static_ms / ROUNDS, operations);
+    return 0;
+}
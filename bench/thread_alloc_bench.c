@@ -0,0 +1,169 @@
+// Thread local allocator against the mallocator, with several threads allocating at once.
+//   local:   every thread churns through a window of live objects of the sizes the preprocessor uses, freeing its own memory.
+//   handoff: in every phase, each thread allocates a batch of objects and frees the batch its neighbour allocated in the phase before,
+//            so every free comes from another thread. Threads are started again for every phase, which also reuses the heaps of exited threads.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <sc_thread_alloc.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#define ROUNDS 3
+#define THREADS 4
+#define LOCAL_OPERATIONS 2000000
+#define WINDOW 4096
+#define PHASES 16
+#define BATCH 100000
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static const size_t sizes[] = { sizeof(token_source), sizeof(pp_token), 8 * sizeof(pp_token), sizeof(pp_token_vector) * 3, sizeof(define) };
+
+typedef struct bench_thread {
+    sc_allocator *alloc;
+    size_t index;
+    // Handoff batches, [phase % 2][thread].
+    void **(*batches)[THREADS];
+    size_t phase;
+} bench_thread;
+
+static int local_thread(void *data) {
+    bench_thread *thread = data;
+    uint64_t random = 0x5CC5CC5CC + thread->index;
+
+    void **window = calloc(WINDOW, sizeof(void *));
+    for (size_t i = 0; i < LOCAL_OPERATIONS; i++) {
+        size_t slot = i % WINDOW;
+        if (window[slot]) {
+            sc_free(thread->alloc, window[slot]);
+        }
+
+        window[slot] = sc_alloc(thread->alloc, sizes[next_random(&random) % (sizeof(sizes) / sizeof(sizes[0]))]);
+        memset(window[slot], 0, sizeof(void *) * 2);
+    }
+
+    for (size_t i = 0; i < WINDOW; i++) {
+        sc_free(thread->alloc, window[i]);
+    }
+
+    free(window);
+    return 0;
+}
+
+static int handoff_thread(void *data) {
+    bench_thread *thread = data;
+    uint64_t random = 0x5CC5CC5CC + thread->index * PHASES + thread->phase;
+
+    void **mine = thread->batches[thread->phase % 2][thread->index];
+    void **theirs = thread->batches[(thread->phase + 1) % 2][(thread->index + 1) % THREADS];
+    for (size_t i = 0; i < BATCH; i++) {
+        if (theirs[i]) {
+            sc_free(thread->alloc, theirs[i]);
+            theirs[i] = NULL;
+        }
+
+        mine[i] = sc_alloc(thread->alloc, sizes[next_random(&random) % (sizeof(sizes) / sizeof(sizes[0]))]);
+        memset(mine[i], 0, sizeof(void *) * 2);
+    }
+
+    return 0;
+}
+
+// Returns the number of allocations.
+static size_t bench_local(sc_allocator *alloc) {
+    thrd_t threads[THREADS];
+    bench_thread data[THREADS];
+    for (size_t i = 0; i < THREADS; i++) {
+        data[i] = (bench_thread) { .alloc = alloc, .index = i };
+        thrd_create(&threads[i], local_thread, &data[i]);
+    }
+
+    for (size_t i = 0; i < THREADS; i++) {
+        thrd_join(threads[i], NULL);
+    }
+
+    return (size_t)THREADS * LOCAL_OPERATIONS;
+}
+
+static size_t bench_handoff(sc_allocator *alloc) {
+    void **batches[2][THREADS];
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t t = 0; t < THREADS; t++) {
+            batches[i][t] = calloc(BATCH, sizeof(void *));
+        }
+    }
+
+    for (size_t phase = 0; phase < PHASES; phase++) {
+        thrd_t threads[THREADS];
+        bench_thread data[THREADS];
+        for (size_t i = 0; i < THREADS; i++) {
+            data[i] = (bench_thread) { .alloc = alloc, .index = i, .batches = batches, .phase = phase };
+            thrd_create(&threads[i], handoff_thread, &data[i]);
+        }
+
+        for (size_t i = 0; i < THREADS; i++) {
+            thrd_join(threads[i], NULL);
+        }
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t t = 0; t < THREADS; t++) {
+            for (size_t k = 0; k < BATCH; k++) {
+                sc_free(alloc, batches[i][t][k]);
+            }
+            free(batches[i][t]);
+        }
+    }
+
+    return (size_t)PHASES * THREADS * BATCH;
+}
+
+static void run(const char *pattern, size_t (*bench)(sc_allocator *)) {
+    double malloc_ms = 0;
+    double thread_ms = 0;
+    size_t allocations = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_ms();
+        allocations = bench(mallocator());
+        malloc_ms += now_ms() - start;
+
+        start = now_ms();
+        bench(thread_allocator());
+        thread_ms += now_ms() - start;
+    }
+
+    malloc_ms /= ROUNDS;
+    thread_ms /= ROUNDS;
+    printf("%-12s %zu allocations on %d threads\n", pattern, allocations, THREADS);
+    printf("  %-10s %10.3f ms %8.2f ns/allocation\n", "mallocator", malloc_ms, malloc_ms * 1e6 / allocations);
+    printf("  %-10s %10.3f ms %8.2f ns/allocation (%.2fx)\n", "thread", thread_ms, thread_ms * 1e6 / allocations, malloc_ms / thread_ms);
+}
+
+int main() {
+    run("local", bench_local);
+    run("handoff", bench_handoff);
+
+    // The main thread freed the last batches, those are still waiting for their heaps to be taken over.
+    sc_thread_stats stats[THREADS + 1];
+    size_t count = thread_allocator_stats(stats, THREADS + 1);
+    printf("%zu heaps\n", count);
+    for (size_t i = 0; i < count && i < THREADS + 1; i++) {
+        printf("  heap %zu (%s): %zu allocations, %zu frees (%zu remote), %zu bytes live, %zu bytes peak\n", stats[i].id,
+               stats[i].active ? "active" : "idle", stats[i].allocations, stats[i].frees, stats[i].remote_frees, stats[i].bytes, stats[i].peak_bytes);
+    }
+    return 0;
+}
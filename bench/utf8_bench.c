@@ -0,0 +1,126 @@
+// UTF-8 validation throughput, compared to the time it takes to preprocess the same file.
+// With no arguments, a generated ASCII only file and a generated file with multibyte characters in comments and strings are used.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <sc_utf8.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 10
+#define GENERATED_SIZE (16 * 1024 * 1024)
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char *generate_file(char *path, const char *line) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    size_t line_len = strlen(line);
+    for (size_t written = 0; written + line_len <= GENERATED_SIZE; written += line_len) {
+        if (write(fd, line, line_len) != (ssize_t)line_len) {
+            break;
+        }
+    }
+
+    close(fd);
+    return path;
+}
+
+static double validate_ms(sc_file *file, sc_utf8_status (*validate)(const void *, size_t), sc_utf8_status *status) {
+    double start = now_ms();
+    for (int round = 0; round < ROUNDS; round++) {
+        *status = validate(file->contents, file->size);
+    }
+
+    return (now_ms() - start) / ROUNDS;
+}
+
+static double preprocess_ms(const char *path) {
+    sc_file_cache cache;
+    file_cache_init(&cache, mallocator());
+
+    sc_file_cache_handle handle = file_cache_load(&cache, path);
+    if (!handle.cache) {
+        sc_error(true, "Could not open '%s'.", path);
+    }
+
+    tokenizer_state state;
+    tokenizer_state_init(&state, handle);
+
+    pp_token_vector line_vec;
+    pp_token_vector_init(&line_vec, 128);
+    token_vector output;
+    token_vector_init(&output, 128);
+
+    preprocessor_state pp_state;
+    preprocessor_state_init(&pp_state, &state, &output, &line_vec, NULL);
+
+    double start = now_ms();
+    while (preprocess_line(&pp_state)) {
+        preprocessor_release_output(&output);
+    }
+    preprocessor_release_output(&output);
+    double elapsed = now_ms() - start;
+
+    tokenizer_state_destroy(&state);
+    file_cache_destroy(&cache);
+    return elapsed;
+}
+
+static void bench_file(const char *path) {
+    sc_file file;
+    file_load_with(&file, (char *)path, mallocator(), 0);
+    if (!file.contents) {
+        fprintf(stderr, "Could not open '%s'.\n", path);
+        return;
+    }
+
+    static const char *status_names[] = { "ascii", "valid", "invalid" };
+
+    sc_utf8_status status;
+    double validate = validate_ms(&file, sc_utf8_validate, &status);
+    double scalar = validate_ms(&file, sc_utf8_validate_scalar, &status);
+    double preprocess = preprocess_ms(path);
+
+    double gb = (double)file.size / 1e9;
+    printf("%s (%ld bytes, %s)\n", path, file.size, status_names[status]);
+    printf("  %-12s %10.3f ms %8.2f GB/s %6.2f%% of preprocessing\n", sc_utf8_kernel(), validate, gb / (validate / 1000.0),
+           validate / preprocess * 100.0);
+    printf("  %-12s %10.3f ms %8.2f GB/s %6.2f%% of preprocessing\n", "scalar", scalar, gb / (scalar / 1000.0),
+           scalar / preprocess * 100.0);
+    printf("  %-12s %10.3f ms\n", "preprocess", preprocess);
+
+    file_destroy(&file);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            bench_file(argv[i]);
+        }
+        return 0;
+    }
+
+    char ascii_path[] = "/tmp/scc_utf8_ascii_XXXXXX";
+    char utf8_path[] = "/tmp/scc_utf8_multibyte_XXXXXX";
+    char *ascii = generate_file(ascii_path, "static int some_identifier = 42; // And a comment to make the line longer.\n");
+    char *utf8 = generate_file(utf8_path, "static const char *greeting = \"Grüße, 世界\"; // Ünïcödé in a comment, 🙂.\n");
+    if (!ascii || !utf8) {
+        fprintf(stderr, "Could not create a temporary file.\n");
+        return 1;
+    }
+
+    bench_file(ascii);
+    bench_file(utf8);
+
+    unlink(ascii);
+    unlink(utf8);
+    return 0;
+}
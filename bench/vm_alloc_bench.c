@@ -0,0 +1,166 @@
+// Arena chunks from the mallocator against chunks from a reserved address range (sc_vm_region), with and without huge pages.
+//   fill:   an arena filled with token sized objects until it holds TOTAL_SIZE bytes, then thrown away (and the region reset).
+//   lookup: random reads over the objects of a filled arena, where huge pages save TLB misses.
+//   growth: a single buffer grown by doubling up to TOTAL_SIZE with sc_realloc, the way token vectors grow. An operation is 4 KB of growth.
+#define _DEFAULT_SOURCE
+#include <preprocessor.h>
+#include <sc_vm_alloc.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 5
+#define TOTAL_SIZE ((size_t)256 * 1024 * 1024)
+#define RESERVE_SIZE ((size_t)64 * 1024 * 1024 * 1024)
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define LOOKUPS 20000000
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+typedef struct backing {
+    const char *name;
+    // NULL for the mallocator.
+    sc_vm_region *region;
+    sc_allocator alloc;
+} backing;
+
+static void backing_reset(backing *backing) {
+    if (backing->region) {
+        vm_region_reset(backing->region);
+    }
+}
+
+// Returns the objects, allocated in 'arena'.
+static pp_token **fill(sc_arena *arena, backing *backing, size_t *count) {
+    arena_init(arena, &backing->alloc, ARENA_CHUNK_SIZE);
+
+    size_t capacity = TOTAL_SIZE / sizeof(pp_token);
+    pp_token **objects = malloc(capacity * sizeof(pp_token *));
+    for (size_t i = 0; i < capacity; i++) {
+        pp_token *token = arena_alloc(arena, sizeof(pp_token));
+        token->kind = PP_TOK_IDENTIFIER;
+        token->source.line = i;
+        objects[i] = token;
+    }
+
+    *count = capacity;
+    return objects;
+}
+
+static double bench_fill(backing *backing, size_t *operations) {
+    double start = now_ms();
+    sc_arena arena;
+    size_t count;
+    pp_token **objects = fill(&arena, backing, &count);
+    arena_destroy(&arena);
+    backing_reset(backing);
+    double elapsed = now_ms() - start;
+
+    free(objects);
+    *operations = count;
+    return elapsed;
+}
+
+static double bench_lookup(backing *backing, size_t *operations) {
+    sc_arena arena;
+    size_t count;
+    pp_token **objects = fill(&arena, backing, &count);
+
+    uint64_t random = 0x5CC5CC5CC;
+    size_t sum = 0;
+    double start = now_ms();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sum += objects[next_random(&random) % count]->source.line;
+    }
+    double elapsed = now_ms() - start;
+
+    if (sum == 42) {
+        printf("\n");
+    }
+
+    arena_destroy(&arena);
+    backing_reset(backing);
+    free(objects);
+    *operations = LOOKUPS;
+    return elapsed;
+}
+
+static double bench_growth(backing *backing, size_t *operations) {
+    double start = now_ms();
+    size_t size = 4096;
+    char *buffer = sc_alloc(&backing->alloc, size);
+    memset(buffer, 1, size);
+    while (size < TOTAL_SIZE) {
+        buffer = sc_realloc(&backing->alloc, buffer, size, size * 2);
+        memset(buffer + size, 1, size);
+        size *= 2;
+    }
+
+    sc_free(&backing->alloc, buffer);
+    backing_reset(backing);
+    double elapsed = now_ms() - start;
+
+    *operations = size / 4096;
+    return elapsed;
+}
+
+static void run(const char *pattern, double (*bench)(backing *, size_t *), backing *backings, size_t backing_count) {
+    printf("%s\n", pattern);
+
+    double baseline = 0;
+    for (size_t i = 0; i < backing_count; i++) {
+        double best = 0;
+        size_t operations = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            double elapsed = bench(&backings[i], &operations);
+            if (round == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        if (i == 0) {
+            baseline = best;
+        }
+        printf("  %-12s %10.3f ms %8.2f ns/operation (%.2fx)\n", backings[i].name, best, best * 1e6 / operations, baseline / best);
+    }
+}
+
+int main() {
+    sc_vm_region region;
+    sc_vm_region huge_region;
+
+    backing backings[3];
+    size_t backing_count = 0;
+    backings[backing_count++] = (backing) { .name = "mallocator", .region = NULL, .alloc = *mallocator() };
+
+    sc_allocator region_alloc = make_vm_region_alloc(&region, RESERVE_SIZE, 0);
+    if (region.base) {
+        backings[backing_count++] = (backing) { .name = "vm", .region = &region, .alloc = region_alloc };
+    } else {
+        fprintf(stderr, "Could not reserve %zu bytes.\n", RESERVE_SIZE);
+    }
+
+    sc_allocator huge_region_alloc = make_vm_region_alloc(&huge_region, RESERVE_SIZE, VM_REGION_HUGE_PAGES);
+    if (huge_region.base) {
+        backings[backing_count++] = (backing) { .name = "vm huge", .region = &huge_region, .alloc = huge_region_alloc };
+    }
+
+    run("fill", bench_fill, backings, backing_count);
+    run("lookup", bench_lookup, backings, backing_count);
+    run("growth", bench_growth, backings, backing_count);
+
+    vm_region_destroy(&region);
+    vm_region_destroy(&huge_region);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef HEADER_CACHE_H__
+#define HEADER_CACHE_H__
+
+#include <macros.h>
+
+// The header cache remembers what preprocessing a header produced, so that including it again under the same relevant macro state
+// can replay the result instead of preprocessing the header again.
+// The "relevant macro state" is every macro the header looked up before defining or undefining it itself,
+// along with its definition (or the fact that it was not defined) at that time.
+// This works like a very lightweight module cache, it is mostly useful for big common headers that are included many times.
+
+// Every macro a header looked at or changed.
+typedef struct pp_macro_record {
+    string name;
+
+    // The header looked the macro up before changing it, the result depends on it.
+    bool dependency;
+    // State of the macro at the time, 'definition' is only valid if 'defined' is set.
+    bool defined;
+    define definition;
+
+    // The header (or one of its includes) did a #define or #undef of the macro.
+    bool changed;
+} pp_macro_record;
+
+// A header we are currently preprocessing for the first time (under the current macro state).
+typedef struct pp_header_recording {
+    // Hash map of name -> macro record.
+    pp_macro_record *records;
+    size_t record_count;
+    size_t record_capacity;
+    // Indices into 'records' + 1, 0 for empty slots. Always a power of two and at most half full.
+    size_t *slots;
+    size_t slot_count;
+
+    // Tokens the header produced and where each line of output starts.
+    pp_token_vector output;
+    struct {
+        size_t *starts;
+        // #line counter at the time of each line.
+        size_t *numbers;
+        size_t count;
+        size_t capacity;
+    } lines;
+    // Which preprocessed line the last output line came from.
+    size_t last_line_id;
+
+    // Errors reported before the header started, we don't cache headers that report errors.
+    size_t error_count;
+    // Set when the header does something we can't replay.
+    bool poisoned;
+
+    // Everything the recording holds, the header cache takes it over as it is.
+    sc_allocator *allocator;
+} pp_header_recording;
+
+// Preprocessing result of a header, along with the macro state it depends on.
+typedef struct pp_header_result {
+    // Id of the header in the file cache, see sc_file.
+    size_t file_id;
+
+    // Macros the result depends on and what they were.
+    pp_macro_record *dependencies;
+    size_t dependency_count;
+
+    // Macros the header changed, with their state at the end of the header.
+    pp_macro_record *changes;
+    size_t change_count;
+
+    pp_token_vector output;
+    size_t *line_starts;
+    size_t *line_numbers;
+    size_t line_count;
+} pp_header_result;
+
+typedef struct pp_header_cache {
+    pp_header_result *results;
+    size_t size;
+    size_t capacity;
+
+    size_t hits;
+    size_t misses;
+
+    // For the results and the recordings they come from.
+    sc_allocator *allocator;
+} pp_header_cache;
+
+void header_cache_init(pp_header_cache *cache);
+void header_cache_init_with(pp_header_cache *cache, sc_allocator *allocator);
+void header_cache_destroy(pp_header_cache *cache);
+
+// Finds a result for the file whose dependencies all match the current macros, NULL if there is none.
+// Updates the hit and miss counters.
+pp_header_result *header_cache_find(pp_header_cache *cache, size_t file_id, define_table *table);
+// Applies the macro changes of the header to 'table', the definitions are copied with the table's allocator.
+void header_result_apply(pp_header_result *result, define_table *table);
+
+pp_header_recording *header_recording_create(size_t error_count);
+// Recordings end up in a header cache, they must use its allocator.
+pp_header_recording *header_recording_create_with(size_t error_count, sc_allocator *allocator);
+void header_recording_destroy(pp_header_recording *recording);
+
+// The header looked up a macro.
+void header_recording_query(pp_header_recording *recording, define_table *table, string *name);
+// The header defined or undefined a macro.
+void header_recording_change(pp_header_recording *recording, string *name);
+// The header produced a token, 'line_id' identifies the preprocessed line and 'line_number' is the #line counter.
+void header_recording_push(pp_header_recording *recording, pp_token *token, size_t line_id, size_t line_number);
+
+// Turns the recording into a result and destroys it, unless it was poisoned or errors were reported since it started.
+void header_cache_store(pp_header_cache *cache, size_t file_id, pp_header_recording *recording, define_table *table, size_t error_count);
+
+#endif
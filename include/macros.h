@@ -1,68 +1,81 @@
-#ifndef MACROS_H__
-#define MACROS_H__
-
-#include <strings.h>
-#include <token_vector.h>
-
-#ifndef MACRO_ARGUMENT_DECL_BLOCK_SIZE
-    #define MACRO_ARGUMENT_DECL_BLOCK_SIZE 16
-#endif
-
-// Argument decls take ownership of the argument tokens' data.
-typedef struct macro_argument_decl {
-    string *arguments;
-
-    // Does not count the "varargs" argument.
-    size_t argument_count;
-    bool has_varargs;
-    size_t capacity;
-
-    // This is used to differenciate between no arg function like macros and object like macros.
-    bool none;
-} macro_argument_decl;
-
-bool macro_argument_decl_is_empty(macro_argument_decl *decl);
-void macro_argument_decl_init_empty(macro_argument_decl *decl);
-void macro_argument_decl_init(macro_argument_decl *decl);
-bool macro_argument_decl_has(macro_argument_decl *decl, string *arg);
-void macro_argument_decl_add(macro_argument_decl *decl, string *arg);
-void macro_argument_decl_destroy(macro_argument_decl *decl);
-
-// Defines take ownership of the name token's data.
-// On correct redefinitions, destroy the redefinitions' strings. (as well as trhe args strings)
-typedef struct define {
-    string define_name;
-    macro_argument_decl args;
-    pp_token_vector replacement_list;
-    bool active;
-
-    struct {
-        string path;
-        size_t line;
-        size_t column;
-    } source;
-} define;
-
-void define_init_empty(define *def, string *define_name);
-void define_destroy(define *def);
-
-typedef struct define_table {
-    define *defines;
-    size_t define_count;
-    size_t capacity;
-} define_table;
-
-void define_table_init(define_table *table);
-define *define_table_lookup(define_table *table, string *def_name);
-void define_table_add(define_table *table, define *def);
-void define_table_destroy(define_table *table);
-
-bool define_exists(define_table *table, string *def_name);
-
-struct preprocessor_state;
-void do_define(size_t index, struct preprocessor_state *state);
-void fully_substitute(size_t index, struct preprocessor_state *state, pp_token_vector *out);
-
-void continue_multiline_macro_function_call(struct preprocessor_state *state, size_t *index, pp_token_vector *vec, pp_token_vector *out);
-
-#endif
+#ifndef MACROS_H__
+#define MACROS_H__
+
+#include <strings.h>
+#include <token_vector.h>
+
+#ifndef MACRO_ARGUMENT_DECL_BLOCK_SIZE
+    #define MACRO_ARGUMENT_DECL_BLOCK_SIZE 16
+#endif
+
+// Argument decls take ownership of the argument tokens' data.
+typedef struct macro_argument_decl {
+    string *arguments;
+
+    // Does not count the "varargs" argument.
+    size_t argument_count;
+    bool has_varargs;
+    size_t capacity;
+
+    // This is used to differenciate between no arg function like macros and object like macros.
+    bool none;
+
+    sc_allocator *allocator;
+} macro_argument_decl;
+
+bool macro_argument_decl_is_empty(macro_argument_decl *decl);
+void macro_argument_decl_init_empty(macro_argument_decl *decl);
+void macro_argument_decl_init(macro_argument_decl *decl);
+void macro_argument_decl_init_with(macro_argument_decl *decl, sc_allocator *allocator);
+bool macro_argument_decl_has(macro_argument_decl *decl, string *arg);
+void macro_argument_decl_add(macro_argument_decl *decl, string *arg);
+void macro_argument_decl_destroy(macro_argument_decl *decl);
+
+// Defines take ownership of the name token's data.
+// On correct redefinitions, destroy the redefinitions' strings. (as well as trhe args strings)
+typedef struct define {
+    string define_name;
+    macro_argument_decl args;
+    pp_token_vector replacement_list;
+    bool active;
+
+    struct {
+        string path;
+        size_t line;
+        size_t column;
+    } source;
+} define;
+
+void define_init_empty(define *def, string *define_name);
+// The name, path, argument names and replacement list get their memory from 'allocator'. Replacement tokens are moved in, their data keeps its allocator.
+void define_init_empty_with(define *def, string *define_name, sc_allocator *allocator);
+// Deep copy, 'dest' does not share any memory with 'src'.
+void define_copy(define *dest, define *src);
+// Everything 'dest' holds, token data included, gets its memory from 'allocator'.
+void define_copy_with(define *dest, define *src, sc_allocator *allocator);
+void define_destroy(define *def);
+// Same arguments and replacement list (ignoring the amount of whitespace), as required for redefinitions.
+bool macro_defs_compatible(define *left, define *right);
+
+typedef struct define_table {
+    define *defines;
+    size_t define_count;
+    size_t capacity;
+    sc_allocator *allocator;
+} define_table;
+
+void define_table_init(define_table *table);
+void define_table_init_with(define_table *table, sc_allocator *allocator);
+define *define_table_lookup(define_table *table, string *def_name);
+void define_table_add(define_table *table, define *def);
+void define_table_destroy(define_table *table);
+
+bool define_exists(define_table *table, string *def_name);
+
+struct preprocessor_state;
+void do_define(size_t index, struct preprocessor_state *state);
+void fully_substitute(size_t index, struct preprocessor_state *state, pp_token_vector *out);
+
+void continue_multiline_macro_function_call(struct preprocessor_state *state, size_t *index, pp_token_vector *vec, pp_token_vector *out);
+
+#endif
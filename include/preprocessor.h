@@ -1,76 +1,171 @@
-#ifndef PREPROCESSOR_H__
-#define PREPROCESSOR_H__
-
-/*
-TODO List:
-- Write if, elif etc.
-- Write include.
-- User defined macros.
-- Add a token source stack to pp_tokens, copy it over from the preprocessing state when we push tokens out to output vectors.
-- Write nice error messages (like the tokenizer's) for the preprocessor (using the token source stack).
-
-Future:
-- Rewrite the preprocessor (at least macro handling) to be correct (at least every example of the C11 standard).
-*/
-
-#include <macros.h>
-#include <token_vector.h>
-
-typedef struct pp_branch {
-    size_t nesting;
-    bool ignoring;
-} pp_branch;
-
-typedef struct preprocessor_state {
-    // This is switched then reset on #includes
-    tokenizer_state *tok_state;
-    token_vector *translation_unit;
-
-    pp_token_vector *line_vec;
-
-    struct {
-        token_source *memory;
-        size_t stack_size;
-        size_t stack_capacity;
-    } source_stack;
-
-    size_t if_nesting;
-
-    struct {
-        pp_branch *memory;
-        size_t size;
-        size_t capacity;
-    } branch_stack;
-
-    define_table def_table;
-
-    // Set by #line directive
-    struct {
-        string path;
-        size_t line;
-    } line;
-
-    // Context for function like macro call across lines.
-    struct {
-        bool opened_call;
-        define *macro;
-        size_t nested_parentheses;
-        size_t current_argument;
-        pp_token *macro_ident;
-        pp_token_vector *args;
-    } macro_context;
-} preprocessor_state;
-
-void preprocessor_state_init(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec);
-
-bool preprocess_line(preprocessor_state *state);
-
-void preprocessor_clean_macro_context(preprocessor_state *state);
-
-token_source *preprocessor_source_tail(preprocessor_state *state);
-void preprocessor_pop_source(preprocessor_state *state);
-
-// TODO: Public interface for defines passed through -D
-// TODO: Builtin defines
-
-#endif
+#ifndef PREPROCESSOR_H__
+#define PREPROCESSOR_H__
+
+/*
+TODO List:
+- Write if, elif etc.
+- Macro expanded includes.
+- User defined macros.
+- Add a token source stack to pp_tokens, copy it over from the preprocessing state when we push tokens out to output vectors.
+- Write nice error messages (like the tokenizer's) for the preprocessor (using the token source stack).
+
+Future:
+- Rewrite the preprocessor (at least macro handling) to be correct (at least every example of the C11 standard).
+*/
+
+#include <macros.h>
+#include <token_vector.h>
+#include <header_cache.h>
+
+#ifndef PP_MAX_INCLUDE_DEPTH
+    #define PP_MAX_INCLUDE_DEPTH 200
+#endif
+
+typedef struct pp_branch {
+    size_t nesting;
+    bool ignoring;
+} pp_branch;
+
+// A file we are reading because of an #include.
+typedef struct pp_include_frame {
+    tokenizer_state tok_state;
+
+    // #line state of the including file, restored once we are done.
+    struct {
+        string path;
+        size_t line;
+    } saved_line;
+
+    // Conditional nesting at the #include, which must match the nesting at the end of the file.
+    size_t if_nesting;
+
+    // Id of the file in the file cache, see sc_file.
+    size_t file_id;
+    // Set while we record the header's result for the header cache.
+    pp_header_recording *recording;
+    // Set when we replay a result from the header cache instead of reading the file, tok_state is unused then.
+    pp_header_result *replay;
+    size_t replay_line;
+} pp_include_frame;
+
+typedef struct preprocessor_state {
+    // Used for the stacks, the define table and the expansion pool.
+    sc_allocator *allocator;
+
+    // This is switched then reset on #includes
+    tokenizer_state *tok_state;
+    // The tokenizer state of the file we were asked to preprocess.
+    tokenizer_state *main_tok_state;
+    token_vector *translation_unit;
+
+    pp_token_vector *line_vec;
+
+    struct {
+        token_source *memory;
+        size_t stack_size;
+        size_t stack_capacity;
+    } source_stack;
+
+    size_t if_nesting;
+
+    struct {
+        pp_branch *memory;
+        size_t size;
+        size_t capacity;
+    } branch_stack;
+
+    define_table def_table;
+
+    // Searched for <> includes and for "" includes that are not next to the including file.
+    // Can be NULL.
+    sc_path_table *include_paths;
+
+    struct {
+        pp_include_frame *memory;
+        size_t size;
+        size_t capacity;
+    } include_stack;
+
+    // Can be NULL.
+    pp_header_cache *header_cache;
+    // Counts preprocess_line calls, used to split recorded header output into lines.
+    size_t lines_processed;
+
+    // Only directives are processed, text lines are neither expanded nor output.
+    bool directives_only;
+
+    // Set when preprocess_line only got through a window of a long text line (see TOKENIZER_LINE_WINDOW).
+    // The output of the next call continues the same line.
+    bool line_continues;
+    // Did any window of the current long line have tokens? The line is only counted once it ends.
+    bool line_window_tokens;
+
+    // Set by #line directive
+    struct {
+        string path;
+        size_t line;
+    } line;
+
+    // Context for function like macro call across lines.
+    struct {
+        bool opened_call;
+        define *macro;
+        size_t nested_parentheses;
+        size_t current_argument;
+        pp_token *macro_ident;
+        pp_token_vector *args;
+    } macro_context;
+
+    // Small objects allocated and freed for every macro call, like the argument arrays and the token vectors of the expansion.
+    // The state must not move once initialized, the allocator points to the pool.
+    sc_pool expansion_pool;
+    sc_allocator expansion_allocator;
+    // Temporaries of a single macro substitution, rewound when it is done. Substitutions nest, so their marks do too.
+    // Only for vectors that don't grow once a nested substitution starts, since that one would rewind their new memory.
+    sc_arena scratch;
+    sc_allocator scratch_allocator;
+} preprocessor_state;
+
+void preprocessor_state_init(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec,
+                             sc_path_table *include_paths);
+void preprocessor_state_init_with(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec,
+                                  sc_path_table *include_paths, sc_allocator *allocator);
+// Once every line has been preprocessed. Frees the define table too, but not the tokenizer state, the line vector or the output.
+void preprocessor_state_destroy(preprocessor_state *state);
+
+void preprocessor_use_header_cache(preprocessor_state *state, pp_header_cache *cache);
+// Only processes directives (conditionals, includes, macro definitions), which is all we need to know what files a translation unit includes.
+// Text lines are skipped without being lexed. The header cache is not used in this mode, since replayed headers would hide their own includes.
+// Must be called before the first line is preprocessed.
+void preprocessor_directives_only(preprocessor_state *state);
+
+bool preprocess_line(preprocessor_state *state);
+// Frees what preprocessing allocated for the tokens in an output vector and empties it.
+// Lets callers that write the output line by line keep memory use independent of the input size.
+void preprocessor_release_output(token_vector *vec);
+
+// Writes preprocessed tokens as text, one line of output for every line of input that had tokens.
+typedef struct pp_text_writer {
+    sc_output *out;
+    // Long lines come out in several calls, we only end the line after the last one.
+    bool line_open;
+    bool space;
+} pp_text_writer;
+
+void pp_text_writer_init(pp_text_writer *writer, sc_output *out);
+// Call with the output of every preprocess_line call.
+void pp_text_writer_line(pp_text_writer *writer, preprocessor_state *state, token_vector *line);
+
+// Every macro lookup and change made while preprocessing needs to go through these, so that headers we record know what they depend on.
+define *preprocessor_lookup_define(preprocessor_state *state, string *name);
+void preprocessor_macro_changed(preprocessor_state *state, string *name);
+
+void preprocessor_clean_macro_context(preprocessor_state *state);
+
+token_source *preprocessor_source_tail(preprocessor_state *state);
+void preprocessor_pop_source(preprocessor_state *state);
+
+// TODO: Public interface for defines passed through -D
+// TODO: Builtin defines
+
+#endif
@@ -1,78 +1,317 @@
-#ifndef SC_ALLOC_H__
-#define SC_ALLOC_H__
-
-#include <stddef.h>
-#include <stdlib.h>
-#include <stdbool.h>
-#include <assert.h>
-
-typedef void* (*alloc_func)(void*, size_t);
-typedef void (*free_func)(void*, void*);
-typedef void (*destroy_func)(void*);
-
-// Allocator interface
-typedef struct sc_allocator {
-    alloc_func alloc;
-    free_func free;
-    destroy_func destroy;
-    void *state;
-} sc_allocator;
-
-void *sc_alloc(sc_allocator *alloc, size_t size);
-void sc_free(sc_allocator *alloc, void *memory);
-void sc_destroy_allocator(sc_allocator *alloc);
-
-// Get the mallocator.
-sc_allocator *mallocator();
-
-// Region interface
-// The region does not own the memory it manages.
-typedef struct sc_region {
-    void *memory;
-    size_t index;
-    size_t size;
-} sc_region;
-
-void init_region(sc_region *region, void *memory, size_t size);
-void destroy_region(sc_region *region);
-
-bool region_can_allocate(sc_region *region, size_t size);
-bool region_owns(sc_region *region, void *memory);
-void region_clear(sc_region *region);
-
-// init + make_alloc_from
-sc_allocator make_region_alloc(sc_region *region, void *memory, size_t size);
-sc_allocator make_alloc_from_region(sc_region *region);
-
-typedef struct sc_region_list_node {
-    sc_region region;
-    struct sc_region_list_node *next;
-} sc_region_list_node;
-
-// Each node is stored in the previous region, so you only ever call into the backing allocator for the region memory.
-// You should destroy the region list after a substantial amount of objects have been "freed", since it will just keep on requesting more and more memory.
-// The goal is to allocate substantial chunks of memory to improve cache locality in certain parts of your application, not to be used as a general purpose allocator.
-typedef struct sc_region_list {
-    sc_region_list_node root;
-    sc_allocator *backing_allocator;
-    size_t region_size;
-} sc_region_list;
-
-void region_list_init(sc_region_list *list, sc_allocator *backing, size_t region_size);
-void region_list_destroy(sc_region_list *list);
-
-sc_allocator make_region_list_alloc(sc_region_list *list, sc_allocator *backing, size_t region_size);
-sc_allocator make_alloc_from_region_list(sc_region_list *list);
-
-typedef struct sc_fallback {
-    sc_allocator *primary;
-    sc_allocator *fallback;
-} sc_fallback;
-
-void fallback_init(sc_fallback *alloc, sc_allocator *primary, sc_allocator *fallback);
-void fallback_destroy(sc_fallback *alloc);
-
-sc_allocator make_fallback_alloc(sc_fallback *fb, sc_allocator *primary, sc_allocator *fallback);
-sc_allocator make_alloc_from_fallback(sc_fallback *fb);
-
-#endif
+#ifndef SC_ALLOC_H__
+#define SC_ALLOC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+typedef void* (*alloc_func)(void*, size_t);
+typedef void (*free_func)(void*, void*);
+typedef void (*destroy_func)(void*);
+typedef void* (*resize_func)(void*, void*, size_t, size_t);
+typedef bool (*owns_func)(void*, void*);
+
+// Allocator interface
+typedef struct sc_allocator {
+    alloc_func alloc;
+    free_func free;
+    destroy_func destroy;
+    // Can be NULL, sc_realloc then allocates, copies and frees.
+    resize_func resize;
+    // Can be NULL for allocators that can't tell, like the mallocator.
+    owns_func owns;
+    void *state;
+} sc_allocator;
+
+void *sc_alloc(sc_allocator *alloc, size_t size);
+// Zeroed memory for 'count' elements, NULL if the size overflows.
+void *sc_calloc(sc_allocator *alloc, size_t count, size_t size);
+// 'old_size' is the size the memory was allocated or last resized with, we don't keep track of it.
+// Allocates when 'memory' is NULL. Returns NULL if we're out of memory, the old memory is then left alone.
+void *sc_realloc(sc_allocator *alloc, void *memory, size_t old_size, size_t new_size);
+void sc_free(sc_allocator *alloc, void *memory);
+// Was 'memory' allocated by 'alloc'? Only for allocators with an owns function.
+bool sc_owns(sc_allocator *alloc, void *memory);
+void sc_destroy_allocator(sc_allocator *alloc);
+
+// Get the mallocator.
+sc_allocator *mallocator();
+
+// Alignment of the memory every allocator returns, enough for any type.
+#define SC_ALLOC_ALIGNMENT _Alignof(max_align_t)
+
+// Region interface
+// The region does not own the memory it manages.
+typedef struct sc_region {
+    void *memory;
+    size_t index;
+    size_t size;
+} sc_region;
+
+void region_init(sc_region *region, void *memory, size_t size);
+void region_destroy(sc_region *region);
+
+bool region_can_allocate(sc_region *region, size_t size);
+// The end of the region is not ours: zero sized allocations take a byte, so nothing we hand out starts there.
+bool region_owns(sc_region *region, void *memory);
+void region_clear(sc_region *region);
+
+// init + make_alloc_from
+sc_allocator make_region_alloc(sc_region *region, void *memory, size_t size);
+sc_allocator make_alloc_from_region(sc_region *region);
+
+typedef struct sc_region_list_node {
+    sc_region region;
+    struct sc_region_list_node *next;
+} sc_region_list_node;
+
+// Each node is stored in the previous region, so you only ever call into the backing allocator for the region memory.
+// You should destroy the region list after a substantial amount of objects have been "freed", since it will just keep on requesting more and more memory.
+// The goal is to allocate substantial chunks of memory to improve cache locality in certain parts of your application, not to be used as a general purpose allocator.
+typedef struct sc_region_list {
+    sc_region_list_node root;
+    // Last node of the list, the only one we allocate from.
+    sc_region_list_node *current;
+    sc_allocator *backing_allocator;
+    size_t region_size;
+} sc_region_list;
+
+void region_list_init(sc_region_list *list, sc_allocator *backing, size_t region_size);
+void region_list_destroy(sc_region_list *list);
+// Walks every region.
+bool region_list_owns(sc_region_list *list, void *memory);
+
+sc_allocator make_region_list_alloc(sc_region_list *list, sc_allocator *backing, size_t region_size);
+sc_allocator make_alloc_from_region_list(sc_region_list *list);
+
+// Maximum size of the chunks of an arena, oversized allocations aside.
+#ifndef ARENA_MAX_CHUNK_SIZE
+    #define ARENA_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+#endif
+
+// Memory given back by arena_rewind and arena_clear is filled with ARENA_POISON_BYTE, to make using it afterwards show.
+// Under AddressSanitizer it is also poisoned, so that any access to it is reported.
+// On by default in debug builds.
+#ifndef ARENA_POISON
+    #ifdef NDEBUG
+        #define ARENA_POISON 0
+    #else
+        #define ARENA_POISON 1
+    #endif
+#endif
+
+#define ARENA_POISON_BYTE 0xDD
+
+#if defined(__SANITIZE_ADDRESS__)
+    #define SC_ARENA_ASAN 1
+#elif defined(__has_feature)
+    #if __has_feature(address_sanitizer)
+        #define SC_ARENA_ASAN 1
+    #endif
+#endif
+
+#if ARENA_POISON && defined(SC_ARENA_ASAN)
+    #include <sanitizer/asan_interface.h>
+    #define ARENA_UNPOISON(memory, size) ASAN_UNPOISON_MEMORY_REGION(memory, size)
+#else
+    #define ARENA_UNPOISON(memory, size) ((void)(memory), (void)(size))
+#endif
+
+// Chunk header, the memory follows it.
+typedef struct sc_arena_chunk {
+    struct sc_arena_chunk *next;
+    size_t size;
+} sc_arena_chunk;
+
+// Chunked bump arena.
+// Allocating bumps a pointer into the current chunk. When it runs out, we get a new chunk from the backing allocator,
+// twice as big as the previous one up to ARENA_MAX_CHUNK_SIZE.
+// Allocations bigger than half a chunk get a chunk of their own, and we keep allocating from the current one.
+// Memory is never freed one allocation at a time, only all at once by arena_clear or arena_destroy,
+// or everything allocated since a mark by arena_rewind.
+typedef struct sc_arena {
+    // Newest chunk first, oversized ones included.
+    sc_arena_chunk *chunks;
+    // The chunk we allocate from.
+    sc_arena_chunk *current;
+    char *cursor;
+    char *end;
+
+    // Largest chunk freed by arena_rewind, kept so that allocating around the same mark over and over doesn't hit the backing allocator.
+    sc_arena_chunk *spare;
+
+    sc_allocator *backing_allocator;
+    // Size of the next chunk.
+    size_t chunk_size;
+} sc_arena;
+
+// Everything allocated after the mark is freed by rewinding to it.
+typedef struct sc_arena_mark {
+    sc_arena_chunk *chunks;
+    sc_arena_chunk *current;
+    char *cursor;
+    char *end;
+} sc_arena_mark;
+
+void arena_init(sc_arena *arena, sc_allocator *backing, size_t chunk_size);
+void arena_destroy(sc_arena *arena);
+// Frees every chunk but the current one, which we start allocating from again.
+void arena_clear(sc_arena *arena);
+
+static inline sc_arena_mark arena_mark(sc_arena *arena) {
+    return (sc_arena_mark) { .chunks = arena->chunks, .current = arena->current, .cursor = arena->cursor, .end = arena->end };
+}
+
+// Marks must be rewound to in the reverse order they were taken, like a stack. Rewinding to a mark also drops the ones taken after it.
+void arena_rewind(sc_arena *arena, sc_arena_mark mark);
+
+void *arena_alloc_slow(sc_arena *arena, size_t size, size_t alignment);
+
+// 'alignment' must be a power of two. Returns NULL if the backing allocator does.
+// Zero sized allocations take a byte, so that they never land on the end of a chunk.
+static inline void *arena_alloc_aligned(sc_arena *arena, size_t size, size_t alignment) {
+    if (size == 0) {
+        size = 1;
+    }
+
+    uintptr_t start = ((uintptr_t)arena->cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (start <= (uintptr_t)arena->end && size <= (uintptr_t)arena->end - start) {
+        arena->cursor = (char *)start + size;
+        ARENA_UNPOISON((void *)start, size);
+        return (void *)start;
+    }
+
+    return arena_alloc_slow(arena, size, alignment);
+}
+
+static inline void *arena_alloc(sc_arena *arena, size_t size) {
+    return arena_alloc_aligned(arena, size, SC_ALLOC_ALIGNMENT);
+}
+
+void *arena_realloc_slow(sc_arena *arena, void *memory, size_t old_size, size_t new_size);
+
+// Grows or shrinks in place if 'memory' is the last thing we allocated and still fits in its chunk, copies otherwise.
+static inline void *arena_realloc(sc_arena *arena, void *memory, size_t old_size, size_t new_size) {
+    if (memory && (char *)memory + old_size == arena->cursor && new_size <= (size_t)(arena->end - (char *)memory)) {
+        if (new_size > old_size) {
+            ARENA_UNPOISON(arena->cursor, new_size - old_size);
+        }
+        arena->cursor = (char *)memory + new_size;
+        return memory;
+    }
+
+    return arena_realloc_slow(arena, memory, old_size, new_size);
+}
+
+// Walks every chunk.
+bool arena_owns(sc_arena *arena, void *memory);
+
+sc_allocator make_arena_alloc(sc_arena *arena, sc_allocator *backing, size_t chunk_size);
+sc_allocator make_alloc_from_arena(sc_arena *arena);
+
+// Pools carve pages of this size out of slabs of POOL_PAGES_PER_SLAB pages, every page serving a single size class.
+// Must be a power of two.
+#ifndef POOL_PAGE_SIZE
+    #define POOL_PAGE_SIZE (64 * 1024)
+#endif
+
+#ifndef POOL_PAGES_PER_SLAB
+    #define POOL_PAGES_PER_SLAB 16
+#endif
+
+// Size classes are every multiple of SC_ALLOC_ALIGNMENT up to 256 bytes, then 512, 1024 and 2048 bytes.
+// Anything bigger goes straight to the backing allocator.
+#define POOL_MAX_SIZE 2048
+#define POOL_CLASS_COUNT (256 / SC_ALLOC_ALIGNMENT + 3)
+
+typedef struct sc_pool_class {
+    // Freed objects, each one holding a pointer to the next.
+    void *free_list;
+    // Rest of the last page we got, objects are only carved out of it when the free list is empty.
+    char *cursor;
+    char *end;
+    size_t size;
+} sc_pool_class;
+
+// Size class pool allocator, for objects of a few sizes allocated and freed all the time.
+// Freed objects go back to the free list of their size class, memory only goes back to the backing allocator on destroy.
+// The size class of an object is found from the page it is in, so objects don't need a header.
+typedef struct sc_pool {
+    sc_pool_class classes[POOL_CLASS_COUNT];
+
+    // Pages of the last slab not given to a size class yet.
+    char *next_page;
+    char *pages_end;
+
+    // Slabs we got from the backing allocator.
+    void **slabs;
+    size_t slab_count;
+    size_t slab_capacity;
+
+    // Hash set of the pages given to size classes, with the class of each page. Always a power of two and at most half full.
+    uintptr_t *pages;
+    unsigned char *page_classes;
+    size_t page_slots;
+    size_t page_count;
+
+    sc_allocator *backing_allocator;
+} sc_pool;
+
+void pool_init(sc_pool *pool, sc_allocator *backing);
+void pool_destroy(sc_pool *pool);
+
+static inline size_t pool_class_index(size_t size) {
+    if (size <= 256) {
+        return size == 0 ? 0 : (size - 1) / SC_ALLOC_ALIGNMENT;
+    } else if (size <= 512) {
+        return 256 / SC_ALLOC_ALIGNMENT;
+    } else if (size <= 1024) {
+        return 256 / SC_ALLOC_ALIGNMENT + 1;
+    }
+
+    return 256 / SC_ALLOC_ALIGNMENT + 2;
+}
+
+void *pool_alloc_slow(sc_pool *pool, size_t size);
+
+static inline void *pool_alloc(sc_pool *pool, size_t size) {
+    if (size <= POOL_MAX_SIZE) {
+        sc_pool_class *size_class = &pool->classes[pool_class_index(size)];
+        if (size_class->free_list) {
+            void *memory = size_class->free_list;
+            size_class->free_list = *(void **)memory;
+            return memory;
+        }
+    }
+
+    return pool_alloc_slow(pool, size);
+}
+
+// Also takes memory from the backing allocator, for allocations bigger than POOL_MAX_SIZE.
+void pool_free(sc_pool *pool, void *memory);
+// Doesn't move the memory if the size class stays the same.
+void *pool_realloc(sc_pool *pool, void *memory, size_t old_size, size_t new_size);
+// Was the memory allocated in one of our pages? Big allocations are not.
+// Since we can't tell for those, pool allocators have no owns function.
+bool pool_owns(sc_pool *pool, void *memory);
+
+sc_allocator make_pool_alloc(sc_pool *pool, sc_allocator *backing);
+sc_allocator make_alloc_from_pool(sc_pool *pool);
+
+// Allocates from the primary allocator, and from the fallback one when the primary is out of memory.
+// Frees go to whichever allocator owns the memory, so the primary allocator must have an owns function (regions, region lists and arenas do).
+// Memory is as aligned as the two allocators make it, there is no header.
+typedef struct sc_fallback {
+    sc_allocator *primary;
+    sc_allocator *fallback;
+} sc_fallback;
+
+void fallback_init(sc_fallback *alloc, sc_allocator *primary, sc_allocator *fallback);
+void fallback_destroy(sc_fallback *alloc);
+
+sc_allocator make_fallback_alloc(sc_fallback *fb, sc_allocator *primary, sc_allocator *fallback);
+sc_allocator make_alloc_from_fallback(sc_fallback *fb);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SC_ALLOC_STATIC_H__
+#define SC_ALLOC_STATIC_H__
+
+#include <sc_alloc.h>
+
+// Allocator calls resolved at compile time, for hot paths that know which allocator they use.
+// The macros below take an sc_arena *, an sc_pool * or an sc_allocator * and call the matching functions directly,
+// so the arena and pool fast paths are inlined instead of going through the function pointers of sc_allocator.
+// An sc_allocator * still goes through them, so code written with these macros works over any allocator on cold paths.
+
+// Arenas only free on rewind, clear or destroy.
+static inline void arena_free_static(sc_arena *arena, void *memory) {
+    (void)arena;
+    (void)memory;
+}
+
+#define sc_static_alloc(alloc, size) \
+    _Generic((alloc), sc_arena *: arena_alloc, sc_pool *: pool_alloc, sc_allocator *: sc_alloc)((alloc), (size))
+
+#define sc_static_realloc(alloc, memory, old_size, new_size) \
+    _Generic((alloc), sc_arena *: arena_realloc, sc_pool *: pool_realloc, sc_allocator *: sc_realloc)((alloc), (memory), (old_size), (new_size))
+
+#define sc_static_free(alloc, memory) \
+    _Generic((alloc), sc_arena *: arena_free_static, sc_pool *: pool_free, sc_allocator *: sc_free)((alloc), (memory))
+
+// Defines a vector of 'type' called 'name' over 'allocator_type' (sc_arena, sc_pool or sc_allocator), with the same layout and
+// functions as pp_token_vector, all static inline: name_init, name_push, name_tail and name_destroy.
+// The allocator is not copied, it must outlive the vector.
+#define SC_VECTOR_DEFINE(name, type, allocator_type) \
+    typedef struct name { \
+        type *memory; \
+        size_t size; \
+        size_t capacity; \
+        allocator_type *allocator; \
+    } name; \
+    \
+    static inline void name##_init(name *vector, size_t initial_capacity, allocator_type *allocator) { \
+        vector->size = 0; \
+        vector->capacity = initial_capacity; \
+        vector->memory = initial_capacity ? sc_static_alloc(allocator, initial_capacity * sizeof(type)) : NULL; \
+        vector->allocator = allocator; \
+    } \
+    \
+    static inline void name##_grow(name *vector) { \
+        size_t old_capacity = vector->capacity; \
+        vector->capacity = old_capacity ? old_capacity * 2 : 64; \
+        vector->memory = sc_static_realloc(vector->allocator, vector->memory, old_capacity * sizeof(type), vector->capacity * sizeof(type)); \
+    } \
+    \
+    static inline type *name##_tail(name *vector) { \
+        if (vector->size >= vector->capacity) { \
+            name##_grow(vector); \
+        } \
+        return &vector->memory[vector->size++]; \
+    } \
+    \
+    static inline void name##_push(name *vector, const type *element) { \
+        *name##_tail(vector) = *element; \
+    } \
+    \
+    static inline void name##_destroy(name *vector) { \
+        if (vector->memory) { \
+            sc_static_free(vector->allocator, vector->memory); \
+            vector->memory = NULL; \
+        } \
+        vector->size = 0; \
+        vector->capacity = 0; \
+    }
+
+#endif
@@ -1,75 +1,404 @@
-#ifndef SC_FILE_IO_H__
-#define SC_FILE_IO_H__
-
-#include <stdio.h>
-#include <sc_alloc.h>
-
-#ifndef PATH_TABLE_BLOCK_SIZE
-    #define PATH_TABLE_BLOCK_SIZE 16
-#endif
-
-#ifndef FILE_CACHE_BLOCK_SIZE
-    #define FILE_CACHE_BLOCK_SIZE 16
-#endif
-
-// Combines an absolute and a relative path
-// Returns bytes written to 'out' (including null terminator if present)
-size_t path_abs_rel_combine(const char *abs_path, const char *rel_path, size_t rel_len, char *out, size_t out_max_len);
-
-// We sue malloc/realloc/free (we could use sc_allocator if we add realloc capabilities)
-typedef struct sc_path_table {
-    const char **memory;
-    size_t capacity;
-    size_t size;
-} sc_path_table;
-
-void path_table_init(sc_path_table *table);
-// Caller needs to take care of path's memory (does not use allocator to copy over)
-void path_table_add(sc_path_table *table, const char *path);
-void path_table_destroy(sc_path_table *table);
-
-// Looks for a file from a relative path in all of the path table
-// On success (found a file), returns true and writes to 'absolute_path' for up to 'absolute_max_len' bytes.
-// On failure, returns false and does not write to 'absolute_path'
-// TODO: Could return number of bytes written instead?
-bool path_table_lookup(sc_path_table *table, const char *relative_path, char *absolute_path, size_t absolute_max_len);
-
-typedef struct sc_file {
-    char *contents;
-    long int size;
-    sc_allocator *alloc;
-
-    char *abs_path;
-} sc_file;
-
-// Note that abs_path will be stored in the sc_file.
-// If the file does not exist, returns a zero-filled sc_file. (contents = size = alloc = abs_path = 0)
-void file_load(sc_file *file, char *abs_path, sc_allocator *alloc);
-// This will __NOT__ destroy the abs_path.
-void file_destroy(sc_file *file);
-
-// Caches by absolute path.
-// 'alloc' is used for the file contents.
-typedef struct sc_file_cache {
-    sc_file *files;
-    size_t capacity;
-    size_t size;
-
-    sc_allocator *alloc;
-} sc_file_cache;
-
-typedef struct sc_file_cache_handle {
-    sc_file_cache *cache;
-    size_t index;
-} sc_file_cache_handle;
-
-void file_cache_init(sc_file_cache *cache, sc_allocator *alloc);
-sc_file_cache_handle file_cache_load(sc_file_cache *cache, const char *abs_path);
-void file_cache_unload(sc_file_cache *cache, const char *abs_path);
-void file_cache_destroy(sc_file_cache *cache);
-
-sc_file *handle_to_file(sc_file_cache_handle handle);
-
-void get_relative_path_from_file(const char *absolute_path, const char *relative_path, char *out, size_t out_max_len);
-
-#endif
+#ifndef SC_FILE_IO_H__
+#define SC_FILE_IO_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <sc_alloc.h>
+#include <sc_hash.h>
+
+#ifndef PATH_TABLE_BLOCK_SIZE
+    #define PATH_TABLE_BLOCK_SIZE 16
+#endif
+
+#ifndef FILE_CACHE_BLOCK_SIZE
+    #define FILE_CACHE_BLOCK_SIZE 16
+#endif
+
+// Default byte budget for lexed token streams kept alongside the file contents.
+#ifndef FILE_CACHE_LEXED_BUDGET
+    #define FILE_CACHE_LEXED_BUDGET (32 * 1024 * 1024)
+#endif
+
+// Default byte budget for file contents and lexed data, the cache evicts files it does not need to stay under it.
+#ifndef FILE_CACHE_BUDGET
+    #define FILE_CACHE_BUDGET ((size_t)-1)
+#endif
+
+// Initial amount of slots in the file cache's path and identity indices, must be a power of two.
+#ifndef FILE_CACHE_INDEX_SIZE
+    #define FILE_CACHE_INDEX_SIZE 64
+#endif
+
+// Initial amount of slots in the include lookup cache, must be a power of two.
+#ifndef PATH_LOOKUP_CACHE_SIZE
+    #define PATH_LOOKUP_CACHE_SIZE 256
+#endif
+
+// Combines an absolute and a relative path
+// Returns bytes written to 'out' (including null terminator if present)
+size_t path_abs_rel_combine(const char *abs_path, const char *rel_path, size_t rel_len, char *out, size_t out_max_len);
+
+// Drops repeated separators and "." components.
+// ".." components are kept, since resolving them without looking at symlinks could name a different file.
+// Returns bytes written to 'out' (including null terminator)
+size_t path_normalize(const char *path, char *out, size_t out_max_len);
+
+// A cached result of looking up a relative path in a single include directory.
+typedef struct sc_path_lookup_entry {
+    // Owned by the cache, NULL for empty slots.
+    char *relative_path;
+    size_t directory;
+    size_t hash;
+    bool exists;
+} sc_path_lookup_entry;
+
+struct sc_vfs;
+
+// We use malloc/realloc/free directly, the table lives as long as the program.
+typedef struct sc_path_table {
+    const char **memory;
+    // Directory handles used to probe for files, opened on first lookup (-1 if the directory can't be opened).
+    int *directory_fds;
+    size_t capacity;
+    size_t size;
+
+    // Caches (directory, relative path) -> exists, so repeated includes never touch the filesystem again.
+    // This includes negative results, which are the vast majority with a lot of include directories.
+    struct {
+        sc_path_lookup_entry *entries;
+        size_t capacity;
+        size_t size;
+
+        size_t hits;
+        size_t misses;
+    } lookup_cache;
+
+    // Optional, see sc_vfs.h.
+    struct sc_vfs *vfs;
+} sc_path_table;
+
+void path_table_init(sc_path_table *table);
+// Caller needs to take care of path's memory (does not use allocator to copy over)
+void path_table_add(sc_path_table *table, const char *path);
+void path_table_destroy(sc_path_table *table);
+// Forgets all cached lookups, use this if the include directories' contents changed.
+void path_table_clear_cache(sc_path_table *table);
+// In-memory files found in the include directories are found first, they are never cached.
+void path_table_use_vfs(sc_path_table *table, struct sc_vfs *vfs);
+
+// Looks for a file from a relative path in all of the path table
+// On success (found a file), returns true and writes to 'absolute_path' for up to 'absolute_max_len' bytes.
+// On failure, returns false and does not write to 'absolute_path'
+// TODO: Could return number of bytes written instead?
+bool path_table_lookup(sc_path_table *table, const char *relative_path, char *absolute_path, size_t absolute_max_len);
+
+// Files at least this big are mapped instead of read when FILE_LOAD_MMAP is set.
+// Below that, the mapping and page fault cost more than the copy.
+#ifndef FILE_MMAP_THRESHOLD
+    #define FILE_MMAP_THRESHOLD (16 * 1024)
+#endif
+
+typedef enum sc_file_load_flags {
+    // Map regular files read only instead of copying them into memory from the allocator.
+    // Pipes and other special files are always read.
+    // Note that a mapped file that gets truncated while we use it will crash us.
+    FILE_LOAD_MMAP = 1,
+    // Fault all pages in when mapping the file (MAP_POPULATE, Linux only).
+    FILE_LOAD_POPULATE = 2,
+    // Tell the kernel we read mapped files front to back.
+    FILE_LOAD_SEQUENTIAL = 4,
+    // Compute the content hash (see sc_hash128) while loading.
+    FILE_LOAD_HASH = 8,
+    // Check that the contents are valid UTF-8 (see sc_utf8.h).
+    FILE_LOAD_UTF8 = 16
+} sc_file_load_flags;
+
+#ifndef FILE_LOAD_DEFAULT
+    #define FILE_LOAD_DEFAULT (FILE_LOAD_MMAP | FILE_LOAD_SEQUENTIAL | FILE_LOAD_HASH | FILE_LOAD_UTF8)
+#endif
+
+typedef void (*lexed_destroy_func)(void *);
+
+typedef struct sc_file {
+    // Always followed by a NUL character.
+    // Mapped contents are read only.
+    char *contents;
+    long int size;
+    sc_allocator *alloc;
+    // Size of the mapping if the contents are mapped, 0 if they come from the allocator.
+    size_t mapped_size;
+    // The contents belong to someone else (see sc_vfs.h), we never free them.
+    bool external;
+
+    // Only valid if 'hashed' is set.
+    sc_hash128 hash;
+    bool hashed;
+
+    // Offset of the first byte that is not valid UTF-8, 'size' if the contents are valid or were not checked.
+    size_t utf8_error;
+    // Set once the tokenizer warned about 'utf8_error', so that including the file again does not repeat the warning.
+    bool utf8_reported;
+
+    // Which file this is on disk, no matter how it was named (not known on Windows).
+    struct {
+        unsigned long long device;
+        unsigned long long inode;
+        bool known;
+    } identity;
+
+    // Set by the file cache, unique for every file it loads.
+    // Unlike the file's index, an id is never reused when a file is evicted.
+    size_t id;
+    // Pinned files are never evicted.
+    size_t pins;
+    // Used since the eviction clock hand last went past the file.
+    bool referenced;
+    // Index + 1 of the file whose identical contents we use instead of our own, 0 if we own our contents.
+    // That file stays pinned as long as we use its contents.
+    size_t content_owner;
+
+    char *abs_path;
+
+    // Optional cached tokenization of the contents, set through file_cache_set_lexed.
+    // The file cache does not know its format, it only destroys it along with the file.
+    struct {
+        void *data;
+        size_t size;
+        lexed_destroy_func destroy;
+    } lexed;
+} sc_file;
+
+// Note that abs_path will be stored in the sc_file.
+// If the file does not exist, returns a zero-filled sc_file. (contents = size = alloc = abs_path = 0)
+// Uses FILE_LOAD_DEFAULT flags.
+void file_load(sc_file *file, char *abs_path, sc_allocator *alloc);
+// 'flags' is a combination of sc_file_load_flags.
+void file_load_with(sc_file *file, char *abs_path, sc_allocator *alloc, int flags);
+// Uses 'contents' in place, it must be followed by a NUL character and outlive the file.
+// Only FILE_LOAD_HASH and FILE_LOAD_UTF8 matter in 'flags', the file has no known identity.
+void file_load_memory(sc_file *file, char *abs_path, const char *contents, size_t size, int flags);
+// This will __NOT__ destroy the abs_path.
+void file_destroy(sc_file *file);
+
+struct sc_prefetcher;
+
+// A spelling of a path that names a cached file.
+typedef struct sc_file_cache_path {
+    // Normalized, owned by the cache, NULL for empty slots.
+    char *path;
+    size_t hash;
+    size_t file;
+} sc_file_cache_path;
+
+// Caches by normalized path, then by file identity, so that every file on disk is loaded once no matter how it is named.
+// Files with identical contents (the same header copied in several places) share a single copy of the contents.
+// 'alloc' is used for the file contents.
+// Once the contents and lexed data of the files go over the budget, unpinned files that were not used recently are evicted (CLOCK).
+// Handles to an evicted file are invalid, pin files you hold on to (the tokenizer does this for the file it reads).
+typedef struct sc_file_cache {
+    // Unloaded files leave a hole with a NULL abs_path, which later loads reuse.
+    sc_file *files;
+    size_t capacity;
+    size_t size;
+
+    struct {
+        size_t *memory;
+        size_t size;
+        size_t capacity;
+    } holes;
+
+    // Every path we loaded a file from, once and in load order, whether the file is still loaded or not.
+    // Tokens and macros keep pointing at the path of the file they come from, so paths outlive their files. Files point into
+    // this list, reloading an evicted file takes its path back, so the list only grows with files we never saw before.
+    struct {
+        char **memory;
+        size_t size;
+        size_t capacity;
+
+        // Hash map of path -> index + 1, 0 for empty slots.
+        size_t *slots;
+        size_t slot_count;
+    } loaded_paths;
+
+    // Bytes of file contents we hold and how many (including lexed data) we are allowed to hold.
+    size_t bytes;
+    size_t budget;
+    size_t clock_hand;
+    size_t next_id;
+
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    // Files that were loaded with the same contents as a file we already had.
+    size_t deduplicated;
+
+    // Hash map of path -> file index, with every spelling we have seen for each file.
+    struct {
+        sc_file_cache_path *entries;
+        size_t capacity;
+        size_t size;
+    } paths;
+
+    // Hash map of (device, inode) -> file index + 1, 0 for empty slots.
+    struct {
+        size_t *slots;
+        size_t capacity;
+        size_t size;
+    } identities;
+
+    // Hash map of content hash -> index + 1 of the file that owns those contents, 0 for empty slots.
+    struct {
+        size_t *slots;
+        size_t capacity;
+        size_t size;
+    } contents;
+
+    sc_allocator *alloc;
+
+    // Bytes of lexed data we hold and how many we are allowed to hold.
+    size_t lexed_bytes;
+    size_t lexed_budget;
+
+    // Optional, see sc_prefetch.h.
+    struct sc_prefetcher *prefetcher;
+    // Optional, see sc_vfs.h.
+    struct sc_vfs *vfs;
+} sc_file_cache;
+
+typedef struct sc_file_cache_handle {
+    sc_file_cache *cache;
+    size_t index;
+} sc_file_cache_handle;
+
+void file_cache_init(sc_file_cache *cache, sc_allocator *alloc);
+sc_file_cache_handle file_cache_load(sc_file_cache *cache, const char *abs_path);
+void file_cache_unload(sc_file_cache *cache, const char *abs_path);
+void file_cache_destroy(sc_file_cache *cache);
+// Files loaded from now on are scanned for includes, and files the prefetcher already loaded are taken from it.
+void file_cache_use_prefetcher(sc_file_cache *cache, struct sc_prefetcher *prefetcher);
+// In-memory files shadow files on disk from now on.
+// They don't count towards the budget and never share contents with other files.
+void file_cache_use_vfs(sc_file_cache *cache, struct sc_vfs *vfs);
+
+sc_file *handle_to_file(sc_file_cache_handle handle);
+
+// Evicts files right away if we are over the new budget.
+void file_cache_set_budget(sc_file_cache *cache, size_t budget);
+void file_cache_pin(sc_file_cache_handle handle);
+void file_cache_unpin(sc_file_cache_handle handle);
+
+// A budget of 0 disables lexed data caching.
+void file_cache_set_lexed_budget(sc_file_cache *cache, size_t budget);
+// Would 'size' more bytes of lexed data fit in the budget?
+bool file_cache_lexed_fits(sc_file_cache *cache, size_t size);
+// The cache takes ownership of 'data' and calls 'destroy' on it when the file is unloaded.
+// Returns false and does not take ownership if it does not fit in the budget.
+bool file_cache_set_lexed(sc_file_cache_handle handle, void *data, size_t size, lexed_destroy_func destroy);
+// NULL if the file has no lexed data.
+void *file_cache_get_lexed(sc_file_cache_handle handle);
+
+// Returns false if the file was loaded without FILE_LOAD_HASH.
+bool file_cache_get_hash(sc_file_cache_handle handle, sc_hash128 *hash);
+// Finds a file with these contents, returns a handle with a NULL cache if there is none.
+sc_file_cache_handle file_cache_find_contents(sc_file_cache *cache, sc_hash128 hash);
+
+// Reads input front to back in chunks, for input we can't or don't want to hold in memory at once (pipes, generated sources).
+// Only the part of the input that was not consumed yet stays in the buffer.
+typedef struct sc_file_stream {
+    FILE *file;
+    // Always NUL terminated.
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    size_t chunk_size;
+    bool eof;
+    sc_allocator *alloc;
+} sc_file_stream;
+
+#ifndef FILE_STREAM_CHUNK_SIZE
+    #define FILE_STREAM_CHUNK_SIZE (64 * 1024)
+#endif
+
+// "-" opens standard input. Returns false if the file can't be opened.
+bool file_stream_open(sc_file_stream *stream, const char *path, size_t chunk_size);
+// The buffer gets its memory from 'alloc'.
+bool file_stream_open_with(sc_file_stream *stream, const char *path, size_t chunk_size, sc_allocator *alloc);
+void file_stream_close(sc_file_stream *stream);
+// Drops the first 'consumed' bytes of the buffer and reads one more chunk after what is left, unless we are at EOF.
+// The buffer may move. Returns the amount of bytes read.
+size_t file_stream_refill(sc_file_stream *stream, size_t consumed);
+
+struct sc_output;
+
+typedef bool (*output_flush_func)(void *, struct sc_output *);
+typedef bool (*output_close_func)(void *, struct sc_output *);
+
+// Where buffered output goes, so that front ends can write anywhere with the same formatting code.
+typedef struct sc_output_sink {
+    // Takes the buffered bytes and makes room for more, by emptying the buffer or handing out another one.
+    // Output starts with no buffer, so the first write asks the sink for one.
+    output_flush_func flush;
+    // Takes the buffered bytes and releases the sink, called once.
+    output_close_func close;
+    void *state;
+} sc_output_sink;
+
+// Output is copied into large buffers and handed to the sink only when they are full.
+typedef struct sc_output {
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    sc_output_sink sink;
+    // Set once the sink fails, everything written after that is dropped.
+    bool failed;
+} sc_output;
+
+#ifndef OUTPUT_BUFFER_SIZE
+    #define OUTPUT_BUFFER_SIZE (256 * 1024)
+#endif
+
+// Must be a multiple of the page size.
+#ifndef OUTPUT_MAP_WINDOW
+    #define OUTPUT_MAP_WINDOW (16 * 1024 * 1024)
+#endif
+
+void output_init(sc_output *out, sc_output_sink sink);
+// Returns false if the file can't be opened.
+bool output_open(sc_output *out, const char *path);
+// The buffer and the sink state get their memory from 'alloc'.
+bool output_open_with(sc_output *out, const char *path, sc_allocator *alloc);
+// Writes straight into the file, mapped OUTPUT_MAP_WINDOW bytes at a time, which saves copying the buffers.
+// The file is grown a window at a time and truncated to what we wrote on close.
+// Note that running out of disk space while writing to the mapping will crash us.
+// Returns false if the file can't be opened or is not a regular file (always on Windows).
+bool output_open_mapped(sc_output *out, const char *path);
+// The sink state gets its memory from 'alloc', the output goes straight to the mapping.
+bool output_open_mapped_with(sc_output *out, const char *path, sc_allocator *alloc);
+// Returns false if any of the output could not be written.
+bool output_close(sc_output *out);
+void output_write_slow(sc_output *out, const char *data, size_t size);
+
+static inline void output_write(sc_output *out, const char *data, size_t size) {
+    if (size <= out->capacity - out->size) {
+        memcpy(out->buffer + out->size, data, size);
+        out->size += size;
+    } else {
+        output_write_slow(out, data, size);
+    }
+}
+
+static inline void output_putc(sc_output *out, char c) {
+    if (out->size < out->capacity) {
+        out->buffer[out->size++] = c;
+    } else {
+        output_write_slow(out, &c, 1);
+    }
+}
+
+static inline void output_puts(sc_output *out, const char *str) {
+    output_write(out, str, strlen(str));
+}
+
+void get_relative_path_from_file(const char *absolute_path, const char *relative_path, char *out, size_t out_max_len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SC_HASH_H__
+#define SC_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hashing used throughout the compiler.
+// None of these are cryptographic, they only need to be fast and spread well.
+
+#define SC_FNV_OFFSET ((size_t)14695981039346656037ULL)
+
+// FNV-1a, for short keys like names and paths.
+// Pass SC_FNV_OFFSET as 'seed', or the hash of a previous part of the key to hash several parts as one.
+size_t sc_fnv1a(const void *data, size_t size, size_t seed);
+size_t sc_fnv1a_string(const char *str);
+
+// 128 bit content hash for whole files.
+// The input is processed in 32 byte stripes over four independent 64 bit lanes, so the multiplications of different lanes
+// can run in parallel and the compiler is free to vectorize.
+typedef struct sc_hash128 {
+    uint64_t low;
+    uint64_t high;
+} sc_hash128;
+
+// Streaming state, the result is the same no matter how the input is split between updates.
+typedef struct sc_hash_state {
+    uint64_t lanes[4];
+    unsigned char buffer[32];
+    size_t buffered;
+    uint64_t total;
+} sc_hash_state;
+
+void sc_hash_init(sc_hash_state *state);
+void sc_hash_update(sc_hash_state *state, const void *data, size_t size);
+sc_hash128 sc_hash_final(sc_hash_state *state);
+
+sc_hash128 sc_hash_bytes(const void *data, size_t size);
+
+static inline bool sc_hash_equals(sc_hash128 a, sc_hash128 b) {
+    return a.low == b.low && a.high == b.high;
+}
+
+#endif
@@ -1,2 +1,2 @@
-#include "sc_logging.h"
-#include "sc_file_io.h"
+#include "sc_logging.h"
+#include "sc_file_io.h"
@@ -0,0 +1,91 @@
+#ifndef SC_PREFETCH_H__
+#define SC_PREFETCH_H__
+
+#include <sc_file_io.h>
+
+#ifndef __STDC_NO_THREADS__
+    #include <threads.h>
+#endif
+
+// The prefetcher loads files we are likely to include soon on a background thread.
+// Whenever the file cache loads a file, the file is quickly scanned for lines that look like includes.
+// The background thread resolves and loads those (scanning them in turn), so they are already in memory when the preprocessor gets to them.
+// The scan ignores comments, conditionals and macros, so some files are loaded for nothing, which only costs background work.
+// Without C11 threads the prefetcher does nothing.
+
+// An include we found while scanning a file.
+typedef struct sc_prefetch_request {
+    char *name;
+    // Path of the file containing the include, for "" includes.
+    char *includer;
+    bool quoted;
+} sc_prefetch_request;
+
+typedef struct sc_prefetcher {
+    // Our own copy of the include directories, path tables are not thread safe.
+    sc_path_table include_paths;
+    // The VFS of the include directories, NULL if they have none. Files in it are never loaded in the background,
+    // the file cache reads them from the VFS itself. Read from the background thread, so it must not change while we run.
+    struct sc_vfs *vfs;
+
+    struct {
+        sc_prefetch_request *memory;
+        size_t size;
+        size_t capacity;
+    } queue;
+
+    // Used for everything we allocate, from both threads: the files we load, the queue, the seen paths.
+    sc_allocator *alloc;
+
+    // Files loaded in the background that the file cache did not take yet.
+    // Their contents and paths use 'alloc'.
+    struct {
+        sc_file *memory;
+        size_t size;
+        size_t capacity;
+    } loaded;
+
+    // Every path we loaded or tried to load, or that the file cache loaded itself.
+    struct {
+        char **slots;
+        size_t size;
+        size_t capacity;
+    } seen;
+
+    // Path the background thread is loading right now, NULL if none.
+    const char *loading;
+
+    // Files loaded in the background, and how many of those the file cache used.
+    size_t prefetched;
+    size_t used;
+
+    bool stop;
+
+#ifndef __STDC_NO_THREADS__
+    mtx_t lock;
+    // Signaled when there are new requests or when we need to stop.
+    cnd_t wake;
+    // Signaled when the background thread is done loading a file.
+    cnd_t loaded_signal;
+    thrd_t thread;
+#endif
+} sc_prefetcher;
+
+// Copies the include directories over (but not the path memory, see path_table_add) and starts the background thread.
+// If the include directories use a VFS (see path_table_use_vfs), so does the prefetcher: set it before this.
+void prefetcher_init(sc_prefetcher *prefetcher, sc_path_table *include_paths);
+// 'alloc' is used from the background thread, so it must be thread safe (the mallocator and tracking allocators over it are).
+// Files keep it for their contents when the file cache takes them, giving the prefetcher the cache's allocator keeps them counted with the cache's.
+void prefetcher_init_with(sc_prefetcher *prefetcher, sc_path_table *include_paths, sc_allocator *alloc);
+// Stops the background thread and destroys any file that was never taken.
+void prefetcher_destroy(sc_prefetcher *prefetcher);
+
+// Queues the includes of a file we loaded.
+void prefetcher_scan(sc_prefetcher *prefetcher, sc_file *file);
+// If the file was prefetched, moves it to 'file' and returns true. 'abs_path' must be normalized (see path_normalize).
+// The file comes without a path, the caller gives it its own.
+// Otherwise, makes sure we won't load it in the background and returns false.
+// Waits for the file if the background thread is loading it.
+bool prefetcher_take(sc_prefetcher *prefetcher, const char *abs_path, sc_file *file);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SC_THREAD_ALLOC_H__
+#define SC_THREAD_ALLOC_H__
+
+#include <sc_alloc.h>
+
+// Thread local allocator, for running preprocessors on several threads without them all fighting over malloc.
+// Every thread gets a heap of its own the first time it allocates: a pool (see sc_pool) that only that thread touches, so allocating never takes a lock.
+// Every allocation remembers its heap in a small header. Memory freed by the thread that owns its heap goes straight back to the pool.
+// Memory freed by any other thread is pushed on a lock free list of the owning heap, which the owner takes back the next time it allocates
+// or calls thread_allocator_collect.
+// The heap of a thread that exits is kept, and handed to the next thread that needs one.
+// Without C11 threads or atomics, thread_allocator is the mallocator.
+
+// Counters of a heap. Frees from other threads are only counted once the owner takes them back.
+typedef struct sc_thread_stats {
+    size_t id;
+    // Cleared when the thread exits, until another thread takes the heap over.
+    bool active;
+    size_t allocations;
+    size_t frees;
+    // Frees made by other threads, also counted in 'frees'.
+    size_t remote_frees;
+    // Bytes allocated and not freed yet, headers aside.
+    size_t bytes;
+    size_t peak_bytes;
+} sc_thread_stats;
+
+// The same allocator for every thread, it allocates from the heap of the calling thread.
+// Memory can be freed or resized from any thread.
+sc_allocator *thread_allocator();
+
+// Takes back the memory other threads freed. Threads that free a lot of memory from others but rarely allocate should call this now and then.
+void thread_allocator_collect();
+
+// Fills 'stats' with the counters of up to 'max' heaps, and returns how many heaps there are.
+size_t thread_allocator_stats(sc_thread_stats *stats, size_t max);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SC_TRACKING_ALLOC_H__
+#define SC_TRACKING_ALLOC_H__
+
+#include <sc_alloc.h>
+#include <stdio.h>
+
+#ifndef __STDC_NO_ATOMICS__
+#include <stdatomic.h>
+typedef atomic_size_t tracking_counter;
+#else
+typedef size_t tracking_counter;
+#endif
+
+// Allocation sizes are counted in power of two buckets: up to 16 bytes, up to 32 bytes, ... up to 1 MB, and bigger.
+#define TRACKING_BUCKET_COUNT 18
+
+// Wraps another allocator and keeps count of what goes through it, for one subsystem.
+// Every allocation gets a small header with its size, so that frees can be counted in bytes. Counting is a few additions,
+// cheap enough to leave on in release builds. The counters are atomic, so it is thread safe if the allocator it wraps is.
+// The counters are what is live when they are read: memory never freed before a report shows up in the current bytes.
+typedef struct sc_tracking {
+    sc_allocator *backing_allocator;
+    // Subsystem name, for reports.
+    const char *name;
+
+    tracking_counter current_bytes;
+    tracking_counter peak_bytes;
+    tracking_counter allocations;
+    tracking_counter frees;
+    tracking_counter resizes;
+    // Allocations and resizes by (new) size.
+    tracking_counter histogram[TRACKING_BUCKET_COUNT];
+} sc_tracking;
+
+void tracking_init(sc_tracking *tracking, sc_allocator *backing, const char *name);
+void tracking_destroy(sc_tracking *tracking);
+
+// Prints a table of the counters of 'count' trackers, then their histograms. Bytes not freed yet are reported as live.
+void tracking_report(FILE *out, sc_tracking *trackers, size_t count);
+
+// The allocator has an owns function if the backing allocator has one.
+sc_allocator make_tracking_alloc(sc_tracking *tracking, sc_allocator *backing, const char *name);
+sc_allocator make_alloc_from_tracking(sc_tracking *tracking);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SC_UTF8_H__
+#define SC_UTF8_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// UTF-8 validation of source files.
+// Valid means well formed as in the Unicode standard: no overlong encodings, surrogates or code points past U+10FFFF.
+
+typedef enum sc_utf8_status {
+    SC_UTF8_ASCII,
+    SC_UTF8_VALID,
+    SC_UTF8_INVALID
+} sc_utf8_status;
+
+// Picks the fastest kernel the CPU supports at runtime.
+sc_utf8_status sc_utf8_validate(const void *data, size_t size);
+// Works everywhere, checks 8 bytes at a time while the input is ASCII.
+sc_utf8_status sc_utf8_validate_scalar(const void *data, size_t size);
+// Name of the kernel sc_utf8_validate uses on this machine.
+const char *sc_utf8_kernel();
+
+// Offset of the first byte that does not start a valid sequence, 'size' if the input is valid.
+// This is the scalar kernel, it is meant for reporting errors.
+size_t sc_utf8_find_error(const void *data, size_t size);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SC_VFS_H__
+#define SC_VFS_H__
+
+#include <sc_file_io.h>
+
+// In-memory files that shadow the filesystem, for unsaved editor buffers or generated headers.
+// File caches and path tables using the VFS look here before they touch the disk (see file_cache_use_vfs and path_table_use_vfs).
+// Contents are never copied: they belong to the caller, who must keep them alive and unchanged while they are registered
+// and while a file cache holds the file. Changing a file the file cache already loaded needs a file_cache_unload.
+
+// Initial amount of slots in the path index, must be a power of two.
+#ifndef VFS_INDEX_SIZE
+    #define VFS_INDEX_SIZE 64
+#endif
+
+typedef struct sc_vfs_file {
+    // Normalized, owned by the VFS, NULL for empty slots.
+    char *path;
+    size_t hash;
+    const char *contents;
+    size_t size;
+} sc_vfs_file;
+
+typedef struct sc_vfs {
+    // Hash map of normalized path -> file.
+    sc_vfs_file *files;
+    size_t capacity;
+    size_t size;
+} sc_vfs;
+
+void vfs_init(sc_vfs *vfs);
+void vfs_destroy(sc_vfs *vfs);
+
+// 'contents' must be followed by a NUL character, like sc_file contents.
+// Replaces the file if there already is one at that path.
+void vfs_add(sc_vfs *vfs, const char *path, const char *contents, size_t size);
+// Returns false if there was no file at that path.
+bool vfs_remove(sc_vfs *vfs, const char *path);
+// 'path' must be normalized (see path_normalize). Returns NULL if there is no file at that path.
+sc_vfs_file *vfs_find(sc_vfs *vfs, const char *path);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SC_VM_ALLOC_H__
+#define SC_VM_ALLOC_H__
+
+#include <sc_alloc.h>
+
+// Granularity we commit memory at. With VM_REGION_HUGE_PAGES, VM_REGION_HUGE_PAGE_SIZE instead.
+#ifndef VM_REGION_COMMIT_SIZE
+    #define VM_REGION_COMMIT_SIZE (256 * 1024)
+#endif
+
+#ifndef VM_REGION_HUGE_PAGE_SIZE
+    #define VM_REGION_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+typedef enum sc_vm_region_flags {
+    // Align the reservation to VM_REGION_HUGE_PAGE_SIZE and ask for transparent huge pages (MADV_HUGEPAGE, Linux only).
+    VM_REGION_HUGE_PAGES = 1
+} sc_vm_region_flags;
+
+// Region over a range of address space reserved with mmap, for backing arenas and other allocators with big chunks.
+// The reservation can be far bigger than the memory we will use: pages are only committed (made writable) as allocations reach them,
+// so memory the region never hands out costs nothing. Consecutive allocations are contiguous, and the last one grows in place,
+// so nothing is ever copied until the reservation runs out.
+// Like sc_region, freeing does nothing, vm_region_reset gives everything back at once.
+// Not available on Windows, vm_region_init fails.
+typedef struct sc_vm_region {
+    char *base;
+    size_t reserved;
+    // Bytes from 'base' we can use right now.
+    size_t committed;
+    size_t index;
+    size_t commit_size;
+} sc_vm_region;
+
+// 'reserve' is rounded up to the commit granularity. Returns false if we could not reserve the address space.
+bool vm_region_init(sc_vm_region *region, size_t reserve, int flags);
+void vm_region_destroy(sc_vm_region *region);
+// Gives the committed pages back to the system (MADV_DONTNEED), they read as zero when we touch them again.
+// The reservation and what is committed stay, so allocating again only costs page faults.
+void vm_region_reset(sc_vm_region *region);
+bool vm_region_owns(sc_vm_region *region, void *memory);
+
+// init + make_alloc_from. The allocator can't be used if init failed, check 'region->base'.
+sc_allocator make_vm_region_alloc(sc_vm_region *region, size_t reserve, int flags);
+sc_allocator make_alloc_from_vm_region(sc_vm_region *region);
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef TOKEN_STREAM_H__
+#define TOKEN_STREAM_H__
+
+#include <preprocessor.h>
+#include <stdint.h>
+
+// Binary serialization of a preprocessed translation unit, for later stages running in other processes.
+// Readers map the file and use the tables in place, nothing is parsed.
+//
+// Layout, every section 8 byte aligned and in the byte order of the writer (readers reject the other one):
+//   header
+//   string offsets   (string_count + 1) uint64_t, string i is the bytes [offsets[i], offsets[i + 1] - 1) of the string data
+//   string data      every string followed by a NUL character
+//   sources          source_count token_stream_source, the include and macro expansion chains
+//   contexts         context_count token_stream_context
+//   tokens           token_count token_stream_token
+//
+// Strings (spellings, paths, macro names), sources and contexts are interned, so a token only holds indices.
+// Token lines are stored as the difference with the line of the previous token, which tends to be 0 or 1.
+
+#define TOKEN_STREAM_MAGIC "SCCTOKS"
+#define TOKEN_STREAM_VERSION 1
+#define TOKEN_STREAM_BYTE_ORDER 0x01020304u
+
+// No source, for tokens that come straight from a file.
+#define TOKEN_STREAM_NO_SOURCE UINT32_MAX
+
+typedef struct token_stream_header {
+    // TOKEN_STREAM_MAGIC with its NUL character.
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t string_count;
+    uint64_t source_count;
+    uint64_t context_count;
+    uint64_t token_count;
+
+    // From the start of the file.
+    uint64_t string_offsets_offset;
+    uint64_t string_data_offset;
+    uint64_t string_data_size;
+    uint64_t sources_offset;
+    uint64_t contexts_offset;
+    uint64_t tokens_offset;
+    uint64_t file_size;
+} token_stream_header;
+
+// One entry of a token's source stack other than the file it comes from (see token_source).
+typedef struct token_stream_source {
+    // TSRC_INCLUDE or TSRC_MACRO.
+    uint32_t kind;
+    // Include path or macro name.
+    uint32_t name;
+    uint32_t line;
+    uint32_t column;
+    // Source of the include or expansion this one happened in, TOKEN_STREAM_NO_SOURCE for the outermost one.
+    uint32_t parent;
+} token_stream_source;
+
+// Everything tokens of a run usually have in common.
+typedef struct token_stream_context {
+    // Innermost include or expansion, TOKEN_STREAM_NO_SOURCE if there is none.
+    uint32_t source;
+    // File the token was read from.
+    uint32_t path;
+    // Path set by #line.
+    uint32_t line_path;
+    uint32_t padding;
+    // The #line counter is the line in the file plus this.
+    int64_t line_offset;
+} token_stream_context;
+
+// Set in token_stream_token flags.
+// There is whitespace after the token (see token.has_whitespace), not before it.
+#define TOKEN_STREAM_WHITESPACE 1
+// The token starts a line of output.
+#define TOKEN_STREAM_LINE_START 2
+
+typedef struct token_stream_token {
+    // token_kind
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t padding;
+    uint32_t spelling;
+    uint32_t context;
+    int32_t line_delta;
+    uint32_t column;
+} token_stream_token;
+
+// Builds the tables while preprocessing, the file is only written once we have them all.
+typedef struct token_stream_writer {
+    struct {
+        char *data;
+        size_t size;
+        size_t capacity;
+
+        // (string_count + 1) entries.
+        uint64_t *offsets;
+        size_t count;
+        size_t offsets_capacity;
+
+        // Hash map of string -> index + 1, 0 for empty slots. Always a power of two and at most half full.
+        uint32_t *slots;
+        size_t slot_count;
+    } strings;
+
+    struct {
+        token_stream_source *memory;
+        size_t size;
+        size_t capacity;
+
+        uint32_t *slots;
+        size_t slot_count;
+    } sources;
+
+    struct {
+        token_stream_context *memory;
+        size_t size;
+        size_t capacity;
+
+        uint32_t *slots;
+        size_t slot_count;
+    } contexts;
+
+    struct {
+        token_stream_token *memory;
+        size_t size;
+        size_t capacity;
+    } tokens;
+
+    size_t previous_line;
+    // See pp_text_writer.
+    bool line_open;
+    // Set when a table outgrew its 32 bit indices.
+    bool overflow;
+
+    sc_allocator *alloc;
+} token_stream_writer;
+
+void token_stream_writer_init(token_stream_writer *writer);
+// The tables get their memory from 'alloc'.
+void token_stream_writer_init_with(token_stream_writer *writer, sc_allocator *alloc);
+void token_stream_writer_destroy(token_stream_writer *writer);
+// Call with the output of every preprocess_line call.
+void token_stream_writer_line(token_stream_writer *writer, preprocessor_state *state, token_vector *line);
+// Returns false if the translation unit is too big for the format.
+bool token_stream_writer_finish(token_stream_writer *writer, sc_output *out);
+
+typedef struct token_stream {
+    sc_file file;
+
+    const token_stream_header *header;
+    const uint64_t *string_offsets;
+    const char *string_data;
+    const token_stream_source *sources;
+    const token_stream_context *contexts;
+    const token_stream_token *tokens;
+} token_stream;
+
+// Returns false if the file does not exist or is not a token stream we can read.
+// Only the header, sources and contexts are checked here, tokens are checked as the cursor gets to them.
+bool token_stream_open(token_stream *stream, const char *path);
+void token_stream_close(token_stream *stream);
+// NULL if 'index' is out of bounds. 'size' can be NULL.
+const char *token_stream_string(const token_stream *stream, uint32_t index, size_t *size);
+
+// A token with its tables looked up.
+typedef struct token_stream_entry {
+    token_kind kind;
+    const char *data;
+    size_t size;
+    // Whitespace after the token.
+    bool has_whitespace;
+    bool line_start;
+
+    const char *path;
+    size_t line;
+    size_t column;
+
+    // #line state.
+    const char *line_path;
+    size_t line_line;
+
+    // Innermost include or expansion, NULL if there is none. Follow 'parent' for the rest.
+    const token_stream_source *source;
+} token_stream_entry;
+
+typedef struct token_stream_cursor {
+    const token_stream *stream;
+    size_t index;
+    int64_t line;
+    // Set when a token refers to something that is not in the tables.
+    bool failed;
+} token_stream_cursor;
+
+void token_stream_cursor_init(token_stream_cursor *cursor, const token_stream *stream);
+// Returns false at the end of the stream or if the cursor failed.
+bool token_stream_next(token_stream_cursor *cursor, token_stream_entry *entry);
+
+#endif
@@ -1,33 +1,46 @@
-#ifndef TOKEN_VECTOR_H__
-#define TOKEN_VECTOR_H__
-
-#include <tokenizer.h>
-
-typedef struct pp_token_vector {
-    pp_token *memory;
-    size_t size;
-    size_t capacity;
-} pp_token_vector;
-
-void pp_token_vector_init_empty(pp_token_vector *vector);
-void pp_token_vector_init(pp_token_vector *vector, size_t initial_capacity);
-// Copies the token into the token vector memory.
-void pp_token_vector_push(pp_token_vector *vector, const pp_token *token);
-void pp_token_vector_destroy(pp_token_vector *vector);
-// Gives a pointer to a new element to be constructed like the caller sees fit.
-pp_token *pp_token_vector_tail(pp_token_vector *vector);
-
-typedef struct token_vector {
-    token *memory;
-    size_t size;
-    size_t capacity;
-} token_vector;
-
-void token_vector_init(token_vector *vector, size_t initial_capacity);
-// Copies the token into the token vector memory.
-void token_vector_push(token_vector *vector, const token *token);
-void token_vector_destroy(token_vector *vector);
-// Gives a pointer to a new element to be constructed like the caller sees fit.
-token *token_vector_tail(token_vector *vector);
-
-#endif
+#ifndef TOKEN_VECTOR_H__
+#define TOKEN_VECTOR_H__
+
+#include <tokenizer.h>
+#include <sc_alloc_static.h>
+
+typedef struct pp_token_vector {
+    pp_token *memory;
+    size_t size;
+    size_t capacity;
+    sc_allocator *allocator;
+} pp_token_vector;
+
+void pp_token_vector_init_empty(pp_token_vector *vector);
+void pp_token_vector_init(pp_token_vector *vector, size_t initial_capacity);
+void pp_token_vector_init_with(pp_token_vector *vector, size_t initial_capacity, sc_allocator *allocator);
+// Copies the token into the token vector memory.
+void pp_token_vector_push(pp_token_vector *vector, const pp_token *token);
+void pp_token_vector_destroy(pp_token_vector *vector);
+// Gives a pointer to a new element to be constructed like the caller sees fit.
+pp_token *pp_token_vector_tail(pp_token_vector *vector);
+
+// Token vector over an arena, for the temporaries of macro substitutions (see preprocessor_state.scratch).
+// Pushing and growing are inlined, destroying does nothing, the memory goes away when the arena is rewound.
+SC_VECTOR_DEFINE(pp_token_arena_vector, pp_token, sc_arena)
+
+typedef struct token_vector {
+    token *memory;
+    size_t size;
+    size_t capacity;
+    sc_allocator *allocator;
+
+    // What the tokens point to (their source stacks), released with them by preprocessor_release_output.
+    sc_arena storage;
+} token_vector;
+
+void token_vector_init(token_vector *vector, size_t initial_capacity);
+// The storage arena gets its chunks from the allocator too.
+void token_vector_init_with(token_vector *vector, size_t initial_capacity, sc_allocator *allocator);
+// Copies the token into the token vector memory.
+void token_vector_push(token_vector *vector, const token *token);
+void token_vector_destroy(token_vector *vector);
+// Gives a pointer to a new element to be constructed like the caller sees fit.
+token *token_vector_tail(token_vector *vector);
+
+#endif
@@ -0,0 +1,325 @@
+#include <header_cache.h>
+#include <sc_hash.h>
+#include <string.h>
+
+static size_t name_hash(string *name) {
+    return sc_fnv1a(string_data(name), string_size(name), SC_FNV_OFFSET);
+}
+
+// Our definitions are deep copies, so we also own the tokens' data.
+static void definition_destroy(define *def) {
+    for (size_t i = 0; i < def->replacement_list.size; i++) {
+        string_destroy(&def->replacement_list.memory[i].data);
+    }
+
+    string_destroy(&def->source.path);
+    define_destroy(def);
+}
+
+static void record_destroy(pp_macro_record *record) {
+    string_destroy(&record->name);
+    if (record->defined) {
+        definition_destroy(&record->definition);
+    }
+}
+
+// Remembers what the macro currently is.
+static void record_snapshot(pp_macro_record *record, define_table *table, sc_allocator *allocator) {
+    define *def = define_table_lookup(table, &record->name);
+    record->defined = def && def->active;
+
+    if (record->defined) {
+        define_copy_with(&record->definition, def, allocator);
+    }
+}
+
+static void output_destroy(pp_token_vector *output) {
+    for (size_t i = 0; i < output->size; i++) {
+        string_destroy(&output->memory[i].data);
+    }
+
+    pp_token_vector_destroy(output);
+}
+
+pp_header_recording *header_recording_create(size_t error_count) {
+    return header_recording_create_with(error_count, mallocator());
+}
+
+pp_header_recording *header_recording_create_with(size_t error_count, sc_allocator *allocator) {
+    pp_header_recording *recording = sc_alloc(allocator, sizeof(pp_header_recording));
+    recording->allocator = allocator;
+
+    recording->record_count = 0;
+    recording->record_capacity = 16;
+    recording->records = sc_alloc(allocator, recording->record_capacity * sizeof(pp_macro_record));
+    recording->slot_count = 32;
+    recording->slots = sc_calloc(allocator, recording->slot_count, sizeof(size_t));
+
+    pp_token_vector_init_empty(&recording->output);
+    recording->output.allocator = allocator;
+    recording->lines.count = 0;
+    recording->lines.capacity = 16;
+    recording->lines.starts = sc_alloc(allocator, recording->lines.capacity * sizeof(size_t));
+    recording->lines.numbers = sc_alloc(allocator, recording->lines.capacity * sizeof(size_t));
+    recording->last_line_id = (size_t)-1;
+
+    recording->error_count = error_count;
+    recording->poisoned = false;
+    return recording;
+}
+
+void header_recording_destroy(pp_header_recording *recording) {
+    for (size_t i = 0; i < recording->record_count; i++) {
+        record_destroy(&recording->records[i]);
+    }
+
+    sc_allocator *allocator = recording->allocator;
+    sc_free(allocator, recording->records);
+    sc_free(allocator, recording->slots);
+    output_destroy(&recording->output);
+    sc_free(allocator, recording->lines.starts);
+    sc_free(allocator, recording->lines.numbers);
+    sc_free(allocator, recording);
+}
+
+// Returns the slot of the record with that name or the empty slot where it belongs.
+static size_t *recording_slot(pp_header_recording *recording, string *name, size_t hash) {
+    size_t mask = recording->slot_count - 1;
+    size_t index = hash & mask;
+
+    while (recording->slots[index] != 0) {
+        if (string_equals(&recording->records[recording->slots[index] - 1].name, name)) {
+            break;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    return &recording->slots[index];
+}
+
+// Makes room for one more record.
+static void recording_reserve_one(pp_header_recording *recording) {
+    if (recording->record_count >= recording->record_capacity) {
+        recording->record_capacity *= 2;
+        recording->records = sc_realloc(recording->allocator, recording->records, recording->record_capacity / 2 * sizeof(pp_macro_record),
+                                        recording->record_capacity * sizeof(pp_macro_record));
+    }
+
+    if ((recording->record_count + 1) * 2 <= recording->slot_count) {
+        return;
+    }
+
+    sc_free(recording->allocator, recording->slots);
+    recording->slot_count *= 2;
+    recording->slots = sc_calloc(recording->allocator, recording->slot_count, sizeof(size_t));
+
+    for (size_t i = 0; i < recording->record_count; i++) {
+        string *name = &recording->records[i].name;
+        *recording_slot(recording, name, name_hash(name)) = i + 1;
+    }
+}
+
+static pp_macro_record *recording_add(pp_header_recording *recording, size_t *slot, string *name) {
+    pp_macro_record *record = &recording->records[recording->record_count++];
+    *slot = recording->record_count;
+
+    string_copy_with(&record->name, name, recording->allocator);
+    record->dependency = false;
+    record->defined = false;
+    record->changed = false;
+    return record;
+}
+
+void header_recording_query(pp_header_recording *recording, define_table *table, string *name) {
+    recording_reserve_one(recording);
+    size_t *slot = recording_slot(recording, name, name_hash(name));
+
+    // We either already depend on it or the header changed it itself, in which case it is not a dependency.
+    if (*slot != 0) {
+        return;
+    }
+
+    pp_macro_record *record = recording_add(recording, slot, name);
+    record->dependency = true;
+    record_snapshot(record, table, recording->allocator);
+}
+
+void header_recording_change(pp_header_recording *recording, string *name) {
+    recording_reserve_one(recording);
+    size_t *slot = recording_slot(recording, name, name_hash(name));
+
+    if (*slot != 0) {
+        recording->records[*slot - 1].changed = true;
+    } else {
+        recording_add(recording, slot, name)->changed = true;
+    }
+}
+
+void header_recording_push(pp_header_recording *recording, pp_token *token, size_t line_id, size_t line_number) {
+    if (line_id != recording->last_line_id) {
+        if (recording->lines.count >= recording->lines.capacity) {
+            size_t old_size = recording->lines.capacity * sizeof(size_t);
+            recording->lines.capacity *= 2;
+            recording->lines.starts = sc_realloc(recording->allocator, recording->lines.starts, old_size, recording->lines.capacity * sizeof(size_t));
+            recording->lines.numbers = sc_realloc(recording->allocator, recording->lines.numbers, old_size, recording->lines.capacity * sizeof(size_t));
+        }
+
+        recording->lines.starts[recording->lines.count] = recording->output.size;
+        recording->lines.numbers[recording->lines.count] = line_number;
+        recording->lines.count++;
+        recording->last_line_id = line_id;
+    }
+
+    pp_token_copy_with(pp_token_vector_tail(&recording->output), token, recording->allocator);
+}
+
+void header_cache_init(pp_header_cache *cache) {
+    header_cache_init_with(cache, mallocator());
+}
+
+void header_cache_init_with(pp_header_cache *cache, sc_allocator *allocator) {
+    cache->allocator = allocator;
+    cache->size = 0;
+    cache->capacity = 16;
+    cache->results = sc_alloc(allocator, cache->capacity * sizeof(pp_header_result));
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void header_cache_destroy(pp_header_cache *cache) {
+    for (size_t i = 0; i < cache->size; i++) {
+        pp_header_result *result = &cache->results[i];
+
+        for (size_t j = 0; j < result->dependency_count; j++) {
+            record_destroy(&result->dependencies[j]);
+        }
+        for (size_t j = 0; j < result->change_count; j++) {
+            record_destroy(&result->changes[j]);
+        }
+
+        sc_free(cache->allocator, result->dependencies);
+        sc_free(cache->allocator, result->changes);
+        output_destroy(&result->output);
+        sc_free(cache->allocator, result->line_starts);
+        sc_free(cache->allocator, result->line_numbers);
+    }
+
+    sc_free(cache->allocator, cache->results);
+    cache->results = NULL;
+    cache->size = 0;
+    cache->capacity = 0;
+}
+
+void header_cache_store(pp_header_cache *cache, size_t file_id, pp_header_recording *recording, define_table *table, size_t error_count) {
+    if (recording->poisoned || error_count != recording->error_count) {
+        header_recording_destroy(recording);
+        return;
+    }
+
+    // The result takes over the memory of the recording.
+    assert(recording->allocator == cache->allocator);
+    if (cache->size >= cache->capacity) {
+        cache->capacity *= 2;
+        cache->results = sc_realloc(cache->allocator, cache->results, cache->capacity / 2 * sizeof(pp_header_result),
+                                    cache->capacity * sizeof(pp_header_result));
+    }
+
+    pp_header_result *result = &cache->results[cache->size++];
+    result->file_id = file_id;
+
+    size_t dependency_count = 0, change_count = 0;
+    for (size_t i = 0; i < recording->record_count; i++) {
+        dependency_count += recording->records[i].dependency ? 1 : 0;
+        change_count += recording->records[i].changed ? 1 : 0;
+    }
+
+    result->dependencies = sc_alloc(cache->allocator, dependency_count * sizeof(pp_macro_record));
+    result->dependency_count = 0;
+    result->changes = sc_alloc(cache->allocator, change_count * sizeof(pp_macro_record));
+    result->change_count = 0;
+
+    for (size_t i = 0; i < recording->record_count; i++) {
+        pp_macro_record *record = &recording->records[i];
+
+        // The state of changed macros is whatever it is at the end of the header.
+        if (record->changed) {
+            pp_macro_record *change = &result->changes[result->change_count++];
+            string_copy_with(&change->name, &record->name, cache->allocator);
+            change->dependency = false;
+            change->changed = true;
+            record_snapshot(change, table, cache->allocator);
+        }
+
+        // Dependencies move over as they are.
+        if (record->dependency) {
+            result->dependencies[result->dependency_count++] = *record;
+        } else {
+            record_destroy(record);
+        }
+    }
+
+    result->output = recording->output;
+    result->line_starts = recording->lines.starts;
+    result->line_numbers = recording->lines.numbers;
+    result->line_count = recording->lines.count;
+
+    // Everything else was moved to the result.
+    sc_free(cache->allocator, recording->records);
+    sc_free(cache->allocator, recording->slots);
+    sc_free(cache->allocator, recording);
+}
+
+static bool dependency_matches(pp_macro_record *dependency, define_table *table) {
+    define *def = define_table_lookup(table, &dependency->name);
+    bool defined = def && def->active;
+
+    if (defined != dependency->defined) {
+        return false;
+    }
+
+    return !defined || macro_defs_compatible(def, &dependency->definition);
+}
+
+pp_header_result *header_cache_find(pp_header_cache *cache, size_t file_id, define_table *table) {
+    for (size_t i = 0; i < cache->size; i++) {
+        pp_header_result *result = &cache->results[i];
+        if (result->file_id != file_id) {
+            continue;
+        }
+
+        bool matches = true;
+        for (size_t j = 0; j < result->dependency_count && matches; j++) {
+            matches = dependency_matches(&result->dependencies[j], table);
+        }
+
+        if (matches) {
+            cache->hits++;
+            return result;
+        }
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+void header_result_apply(pp_header_result *result, define_table *table) {
+    for (size_t i = 0; i < result->change_count; i++) {
+        pp_macro_record *change = &result->changes[i];
+        define *def = define_table_lookup(table, &change->name);
+
+        if (change->defined) {
+            // define_table_add only replaces inactive macros.
+            if (def) {
+                def->active = false;
+            }
+
+            define copy;
+            define_copy_with(&copy, &change->definition, table->allocator);
+            copy.active = true;
+            define_table_add(table, &copy);
+        } else if (def) {
+            def->active = false;
+        }
+    }
+}
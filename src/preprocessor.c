@@ -1,397 +1,756 @@
-#include <preprocessor.h>
-#include <macros.h>
-
-#include <string.h>
-#include <ctype.h>
-
-static void push_token(pp_token *src, preprocessor_state *state);
-
-static bool is_keyword(string *data) {
-    #define IS(L) STRING_EQUALS_LITERAL(data, L)
-    // Get ready for a huge return statement.
-    return IS("auto") || IS("break") || IS("case") || IS("char") || IS("const") || IS("continue") || IS("default") || IS("do")
-        || IS("double") || IS("else") || IS("enum") || IS("extern") || IS("float") || IS("for") || IS("goto") || IS("if")
-        || IS("inline") || IS("int") || IS("long") || IS("register") || IS("restrict") || IS("return") || IS("short")
-        || IS("signed") || IS("sizeof") || IS("static") || IS("struct") || IS("switch") || IS("typedef") || IS("union")
-        || IS("unsigned") || IS("void") | IS("volatile") || IS("while") || IS("_Alignas") || IS("_Alignof") || IS("_Atomic")
-        || IS("_Bool") || IS("_Complex") || IS("_Generic") || IS("_Imaginary") || IS("_Noreturn") || IS("_Static_assert")
-        || IS("_Thread_local");
-    #undef IS
-}
-
-static void add_branch(preprocessor_state *state, size_t nesting, bool ignoring) {
-    if (state->branch_stack.size >= state->branch_stack.capacity) {
-        // Just have a couple floating.
-        state->branch_stack.capacity = state->branch_stack.size + 2;
-        state->branch_stack.memory = realloc(state->branch_stack.memory, state->branch_stack.capacity * sizeof(pp_branch));
-    }
-
-    state->branch_stack.memory[state->branch_stack.size++] = (pp_branch) { .nesting = nesting, .ignoring = ignoring };
-}
-
-static void pop_branch(preprocessor_state *state) {
-    assert(state->branch_stack.size > 0);
-    state->branch_stack.size--;
-}
-
-static size_t latest_branch_nesting(preprocessor_state *state) {
-    assert(state->branch_stack.size > 0);
-    return state->branch_stack.memory[state->branch_stack.size - 1].nesting;
-}
-
-static void latest_branch_flip(preprocessor_state *state) {
-    assert(state->branch_stack.size > 0);
-    state->branch_stack.memory[state->branch_stack.size - 1].nesting = !state->branch_stack.memory[state->branch_stack.size - 1].nesting;
-}
-
-static bool ignoring(preprocessor_state *state) {
-    return state->branch_stack.size > 0 && state->branch_stack.memory[state->branch_stack.size - 1].ignoring;
-}
-
-static void do_ifdef(bool must_be_defined, size_t index, preprocessor_state *state) {
-    assert(!ignoring(state));
-
-    pp_token_vector *vec = state->line_vec;
-    pp_token *tokens = vec->memory;
-
-    state->if_nesting++;
-
-    if (index == vec->size || tokens[index].kind != PP_TOK_IDENTIFIER) {
-        sc_error(false, "Expected macro name after #%s", must_be_defined ? "ifdef" : "ifndef");
-        return;
-    }
-
-    // TODO: Handle builtins (in define_exists)
-    add_branch(state, state->if_nesting - 1, define_exists(&state->def_table, &tokens[index].data) != must_be_defined);
-
-    // Check for extra tokens
-    index++;
-    if (index != vec->size) {
-        sc_error(false, "Expected only macro name after #%s", must_be_defined ? "ifdef" : "ifndef");
-    }
-}
-
-static void handle_directive(size_t index, preprocessor_state *state) {
-    pp_token_vector *vec = state->line_vec;
-    pp_token *tokens = vec->memory;
-
-    if (tokens[index].kind != PP_TOK_IDENTIFIER) {
-        // TODO: Good errors.
-        sc_error(false, "Non-identifier directive...");
-        return;
-    }
-
-    string *directive = &tokens[index].data;
-
-    #define IS(L) STRING_EQUALS_LITERAL(directive, L)
-
-    // TODO: These don't actually work for nested conditions all the time :/
-    // We should probably have some stack of ignored-until-nestings.
-    if (IS("endif")) {
-        // If nesting being zero here is impossible, since we are still ignoring.
-        state->if_nesting--;
-        if (state->if_nesting == latest_branch_nesting(state)) {
-            pop_branch(state);
-        }
-
-        index++;
-        if (index != vec->size) {
-            sc_error(true, "#endif expected no parameters");
-        }
-        return;
-    } else if (IS("else")) {
-        if (state->if_nesting == 0) {
-            sc_error(false, "#else without condition.");
-            return;
-        }
-
-        // TODO: Check if + 1 is correct.
-        if (state->if_nesting == latest_branch_nesting(state) + 1) {
-            latest_branch_flip(state);
-        }
-
-        index++;
-        if (index != vec->size) {
-            sc_error(true, "#else expected no parameters");
-        }
-        return;
-    } else if (IS("elif")) {
-        // TODO: Do stuff here
-    }
-
-    if (ignoring(state)) {
-        if (IS("ifndef") || IS("if") || IS("ifdef")) {
-            state->if_nesting++;
-            // Check for superfluous tokens here.
-        } else if (IS("elif")) {
-            // Stop ignoring if at correct nesting and condition is true
-            // Check for superfluous tokens.
-        } else if (!IS("define") && !IS("include") && !IS("pragma") && !IS("line") && !IS("line") && !IS("error") && !IS("undef")) {
-            sc_error(false, "Unknown directive '%s'", string_data(directive));
-            return;
-        }
-    } else {
-        if (IS("ifdef")) {
-            index++;
-            do_ifdef(true, index, state);
-        } else if (IS("ifndef")) {
-            index++;
-            do_ifdef(false, index, state);
-        } else if (IS("if")) {
-            // TODO;
-        } else if (IS("elif")) {
-            // TODO;
-        } else if (IS("define")) {
-            // Go go!
-            index++;
-            do_define(index, state);
-        }
-        // TODO: Add rest of directives
-        // TODO: Error on unknown directive
-        else if (IS("error")) {
-            if (!tokens[index].has_whitespace) {
-                sc_error(false, "Expected whitespace between #error directive and error tokens.");
-                return;
-            }
-
-            index++;
-            // TODO: ERROR REPORTING
-            string str;
-            string_init(&str, 0);
-            for (size_t i = index; i < vec->size; i++) {
-                string_append(&str, &tokens[i].data);
-                if (tokens[i].has_whitespace) {
-                    string_push(&str, ' ');
-                }
-            }
-            sc_error(false, string_data(&str));
-            string_destroy(&str);
-        } else if (IS("line")) {
-            if (!tokens[index].has_whitespace) {
-                sc_error(false, "Expected whitespace between #line and line number.");
-                return;
-            }
-
-            index++;
-
-            if (tokens[index].kind != PP_TOK_NUMBER) {
-                sc_error(false, "Expected line number after #line directive.");
-                return;
-            }
-
-            // Steal the token's data.
-            const char *num_data = string_data(&tokens[index].data);
-            // Parse it to an integer, if we can.
-            for (size_t i = 0; i < string_size(&tokens[index].data); i++) {
-                if (!isdigit(num_data[i])) {
-                    sc_error(false, "Expected a decimal line number in #line directive.");
-                    return;
-                }
-            }
-
-            // TODO: Write our own, better version (with bounds/error checking, faster [see folly talk])...
-            state->line.line = strtoull(num_data, NULL, 10) - 1;
-            index++;
-
-            if (index != vec->size) {
-                if (!tokens[index - 1].has_whitespace) {
-                    sc_error(false, "Expected withespace between #line number and #line path.");
-                    return;
-                }
-
-                if (tokens[index].kind != PP_TOK_STR_LITERAL) {
-                    sc_error(false, "Expected a string literal as a second argument of the #line directive.");
-                    return;
-                }
-
-                // Remove quotes
-                // TODO: Unescape this.
-                substring(&state->line.path, &tokens[index].data, 1, -1);
-                index++;
-                if (index != vec->size) {
-                    sc_error(false, "#line directive can have two arguments at most.");
-                    return;
-                }
-            }
-        } else if (IS("undef")) {
-            index++;
-
-            if (index == vec->size || tokens[index].kind != PP_TOK_IDENTIFIER) {
-                sc_error(false, "Expected macro name as argument of #undef.");
-                return;
-            }
-
-            define *entry = define_table_lookup(&state->def_table, &tokens[index].data);
-            if (entry && entry->active) {
-                entry->active = false;
-            } else {
-                sc_warning("Called #undef on already undefined macro '%s'", string_data(&tokens[index].data));
-            }
-        }
-    }
-
-    #undef IS
-}
-
-bool preprocess_line(preprocessor_state *state) {
-    state->line_vec->size = 0;
-    bool result = tokenize_line(state->line_vec, state->tok_state);
-
-    pp_token_vector *vec = state->line_vec;
-    pp_token *tokens = vec->memory;
-
-    size_t idx = 0;
-
-    if (vec->size == 0) {
-        return result;
-    }
-
-    if (tokens[idx].kind == PP_TOK_HASH) {
-        if (state->macro_context.macro != NULL) {
-            // We're in a macro call, this is an error.
-            sc_error(false, "Malformed function like macro call.");
-            preprocessor_clean_macro_context(state);
-        }
-        // Preprocessor directive.
-        idx++;
-
-        // No op.
-        if (idx == vec->size) {
-            return result;
-        }
-
-        handle_directive(idx, state);
-    } else if (!ignoring(state)) {
-        // TODO: Handle _Pragmas
-        // TODO: move this token vector into preprocessor_state, don't create it for each line...
-        pp_token_vector out;
-        pp_token_vector_init(&out, 16);
-
-        if (state->macro_context.macro != NULL) {
-            continue_multiline_macro_function_call(state, &idx, state->line_vec, &out);
-            // This skips the closing parenthesis if the function call is over.
-            // Otherwise, we are already over the vector size.
-            idx++;
-        }
-
-        if (idx < vec->size) {
-            fully_substitute(idx, state, &out);
-        }
-
-        for (size_t i = 0; i < out.size; i++) {
-            push_token(&out.memory[i], state);
-        }
-
-        pp_token_vector_destroy(&out);
-    }
-
-    // Increment the "#line" counter on text lines only.
-    state->line.line++;
-
-    if (!result && state->macro_context.macro != NULL) {
-        sc_error(false, "Malformed function like macro call.");
-    }
-
-    return result;
-}
-
-void push_token(pp_token *src, preprocessor_state *state) {
-    token *dest = token_vector_tail(state->translation_unit);
-
-    assert(src->kind != PP_TOK_HEADER_NAME && src->kind != PP_TOK_PLACEMARKER);
-    if (src->kind == PP_TOK_OTHER || src->kind == PP_TOK_HASH || src->kind == PP_TOK_DOUBLEHASH || src->kind == PP_TOK_CONCAT_DOUBLEHASH) {
-        sc_error(false, "Token '%s' made it out of preprocessing...", string_data(&src->data));
-        state->translation_unit->size--;
-        return;
-    }
-
-    // Ok, lets pass over our current sources and add the default file one.
-    dest->stack_size = state->source_stack.stack_size + 1;
-    dest->source_stack = malloc(dest->stack_size * sizeof(token_source));
-
-    dest->has_whitespace = src->has_whitespace;
-
-    memcpy(dest->source_stack, state->source_stack.memory, state->source_stack.stack_size * sizeof(token_source));
-    dest->source_stack[state->source_stack.stack_size] = (token_source) {
-        .kind = TSRC_FILE,
-        .file.line = src->source.line,
-        .file.column = src->source.column
-    };
-    string_from_ptr_size(&dest->source_stack[state->source_stack.stack_size].file.path, src->source.path, strlen(src->source.path));
-    // TODO: Number parsing, string and character escaping and other fun stuff.
-    string_copy(&dest->data, &src->data);
-
-    // Pass over #line set stuff.
-    string_copy(&dest->line.path, &state->line.path);
-    dest->line.line = state->line.line;
-
-    // Punctuators.
-    if (src->kind >= PP_TOK_DOT && src->kind <= PP_TOK_COLON) {
-        dest->kind = (src->kind - PP_TOK_DOT) + TOK_DOT;
-    } else if (src->kind == PP_TOK_IDENTIFIER) {
-        // Ok, let's break it DOWN.
-        if (is_keyword(&dest->data)) {
-            dest->kind = TOK_KEYWORD;
-        } else {
-            dest->kind = TOK_IDENTIFIER;
-        }
-    }
-    // TODO: Other stuff
-}
-
-void preprocessor_state_init(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec) {
-    state->tok_state = tok_state;
-    state->translation_unit = translation_unit;
-    state->line_vec = line_vec;
-
-    // Default starting stack of 32 elements.
-    state->source_stack.memory = malloc(32 * sizeof(token_source));
-    state->source_stack.stack_size = 0;
-    state->source_stack.stack_capacity = 32;
-
-    state->if_nesting = 0;
-
-    state->branch_stack.memory = malloc(8 * sizeof(pp_branch));
-    state->branch_stack.size = 0;
-    state->branch_stack.capacity = 8;
-
-    define_table_init(&state->def_table);
-
-    string_init(&state->line.path, 0);
-    state->line.line = 0;
-
-    state->macro_context.opened_call = false;
-    state->macro_context.macro = NULL;
-}
-
-token_source *preprocessor_source_tail(preprocessor_state *state) {
-    if (state->source_stack.stack_size == state->source_stack.stack_capacity) {
-        state->source_stack.stack_capacity *= 2;
-        state->source_stack.memory = realloc(state->source_stack.memory, state->source_stack.stack_capacity * sizeof(token_source));
-    }
-
-    return &state->source_stack.memory[state->source_stack.stack_size++];
-}
-
-// TODO: Destroy the source.
-void preprocessor_pop_source(preprocessor_state *state) {
-    assert(state->source_stack.stack_size > 0);
-    state->source_stack.stack_size--;
-}
-
-void preprocessor_clean_macro_context(preprocessor_state *state) {
-    assert(state->macro_context.macro != NULL);
-
-    size_t nargs = state->macro_context.macro->args.argument_count;
-    bool variadic = state->macro_context.macro->args.has_varargs;
-
-    if (state->macro_context.opened_call && nargs + (variadic ? 1 : 0) > 0) {
-        for (size_t i = 0; i <= state->macro_context.current_argument; i++) {
-            pp_token_vector_destroy(&state->macro_context.args[i]);
-        }
-    }
-
-    state->macro_context.macro = NULL;
-    state->macro_context.opened_call = false;
-    free(state->macro_context.args);
-}
+#include <preprocessor.h>
+#include <macros.h>
+
+#include <string.h>
+#include <ctype.h>
+
+// Macro substitutions rarely need more than this for their temporaries, deep nesting grows the scratch arena.
+#ifndef PP_SCRATCH_CHUNK_SIZE
+    #define PP_SCRATCH_CHUNK_SIZE (16 * 1024)
+#endif
+
+static void push_token(pp_token *src, preprocessor_state *state);
+
+static bool is_keyword(string *data) {
+    #define IS(L) STRING_EQUALS_LITERAL(data, L)
+    // Get ready for a huge return statement.
+    return IS("auto") || IS("break") || IS("case") || IS("char") || IS("const") || IS("continue") || IS("default") || IS("do")
+        || IS("double") || IS("else") || IS("enum") || IS("extern") || IS("float") || IS("for") || IS("goto") || IS("if")
+        || IS("inline") || IS("int") || IS("long") || IS("register") || IS("restrict") || IS("return") || IS("short")
+        || IS("signed") || IS("sizeof") || IS("static") || IS("struct") || IS("switch") || IS("typedef") || IS("union")
+        || IS("unsigned") || IS("void") | IS("volatile") || IS("while") || IS("_Alignas") || IS("_Alignof") || IS("_Atomic")
+        || IS("_Bool") || IS("_Complex") || IS("_Generic") || IS("_Imaginary") || IS("_Noreturn") || IS("_Static_assert")
+        || IS("_Thread_local");
+    #undef IS
+}
+
+static void add_branch(preprocessor_state *state, size_t nesting, bool ignoring) {
+    if (state->branch_stack.size >= state->branch_stack.capacity) {
+        // Just have a couple floating.
+        size_t old_capacity = state->branch_stack.capacity;
+        state->branch_stack.capacity = state->branch_stack.size + 2;
+        state->branch_stack.memory = sc_realloc(state->allocator, state->branch_stack.memory, old_capacity * sizeof(pp_branch),
+                                                state->branch_stack.capacity * sizeof(pp_branch));
+    }
+
+    state->branch_stack.memory[state->branch_stack.size++] = (pp_branch) { .nesting = nesting, .ignoring = ignoring };
+}
+
+static void pop_branch(preprocessor_state *state) {
+    assert(state->branch_stack.size > 0);
+    state->branch_stack.size--;
+}
+
+static size_t latest_branch_nesting(preprocessor_state *state) {
+    assert(state->branch_stack.size > 0);
+    return state->branch_stack.memory[state->branch_stack.size - 1].nesting;
+}
+
+static void latest_branch_flip(preprocessor_state *state) {
+    assert(state->branch_stack.size > 0);
+    state->branch_stack.memory[state->branch_stack.size - 1].ignoring = !state->branch_stack.memory[state->branch_stack.size - 1].ignoring;
+}
+
+static bool ignoring(preprocessor_state *state) {
+    return state->branch_stack.size > 0 && state->branch_stack.memory[state->branch_stack.size - 1].ignoring;
+}
+
+static void do_ifdef(bool must_be_defined, size_t index, preprocessor_state *state) {
+    assert(!ignoring(state));
+
+    pp_token_vector *vec = state->line_vec;
+    pp_token *tokens = vec->memory;
+
+    state->if_nesting++;
+
+    if (index == vec->size || tokens[index].kind != PP_TOK_IDENTIFIER) {
+        sc_error(false, "Expected macro name after #%s", must_be_defined ? "ifdef" : "ifndef");
+        return;
+    }
+
+    // TODO: Handle builtins (in define_exists)
+    define *macro = preprocessor_lookup_define(state, &tokens[index].data);
+    add_branch(state, state->if_nesting - 1, (macro && macro->active) != must_be_defined);
+
+    // Check for extra tokens
+    index++;
+    if (index != vec->size) {
+        sc_error(false, "Expected only macro name after #%s", must_be_defined ? "ifdef" : "ifndef");
+    }
+}
+
+define *preprocessor_lookup_define(preprocessor_state *state, string *name) {
+    for (size_t i = 0; i < state->include_stack.size; i++) {
+        if (state->include_stack.memory[i].recording) {
+            header_recording_query(state->include_stack.memory[i].recording, &state->def_table, name);
+        }
+    }
+
+    return define_table_lookup(&state->def_table, name);
+}
+
+void preprocessor_macro_changed(preprocessor_state *state, string *name) {
+    for (size_t i = 0; i < state->include_stack.size; i++) {
+        if (state->include_stack.memory[i].recording) {
+            header_recording_change(state->include_stack.memory[i].recording, name);
+        }
+    }
+}
+
+// Marks every header we are recording as impossible to replay.
+static void poison_recordings(preprocessor_state *state) {
+    for (size_t i = 0; i < state->include_stack.size; i++) {
+        if (state->include_stack.memory[i].recording) {
+            state->include_stack.memory[i].recording->poisoned = true;
+        }
+    }
+}
+
+// If 'replay' is set, we don't read the file but hand out the lines of the cached result instead.
+static void push_include(preprocessor_state *state, sc_file_cache_handle handle, pp_token *directive, pp_header_result *replay) {
+    if (state->include_stack.size >= state->include_stack.capacity) {
+        size_t old_capacity = state->include_stack.capacity;
+        state->include_stack.capacity = state->include_stack.capacity == 0 ? 8 : state->include_stack.capacity * 2;
+        state->include_stack.memory = sc_realloc(state->allocator, state->include_stack.memory, old_capacity * sizeof(pp_include_frame),
+                                                 state->include_stack.capacity * sizeof(pp_include_frame));
+    }
+
+    pp_include_frame *frame = &state->include_stack.memory[state->include_stack.size++];
+
+    // The included file starts with a fresh #line state.
+    frame->saved_line.path = state->line.path;
+    frame->saved_line.line = state->line.line;
+    string_init(&state->line.path, 0);
+    state->line.line = 0;
+
+    frame->if_nesting = state->if_nesting;
+    frame->file_id = handle_to_file(handle)->id;
+    frame->replay = replay;
+    frame->replay_line = 0;
+    frame->recording = NULL;
+
+    if (!replay) {
+        tokenizer_state_init_with(&frame->tok_state, handle, state->main_tok_state->allocator);
+        if (state->directives_only) {
+            tokenizer_directives_only(&frame->tok_state);
+        }
+        // The stack may have been reallocated, so we always point at the top frame.
+        state->tok_state = &frame->tok_state;
+
+        if (state->header_cache && !state->directives_only) {
+            frame->recording = header_recording_create_with(sc_error_count(), state->header_cache->allocator);
+        }
+    }
+
+    token_source *source = preprocessor_source_tail(state);
+    source->kind = TSRC_INCLUDE;
+    string_from_ptr_size_with(&source->include.path, directive->source.path, strlen(directive->source.path), state->allocator);
+    source->include.line = directive->source.line;
+    source->include.column = directive->source.column;
+}
+
+static void pop_include(preprocessor_state *state) {
+    assert(state->include_stack.size > 0);
+    pp_include_frame *frame = &state->include_stack.memory[--state->include_stack.size];
+
+    if (!frame->replay && state->if_nesting != frame->if_nesting) {
+        sc_error(false, "Unterminated conditional directive in included file '%s'.", frame->tok_state.path);
+
+        // Don't let the included file's branches leak into the including file.
+        state->if_nesting = frame->if_nesting;
+        while (state->branch_stack.size > 0 && latest_branch_nesting(state) >= state->if_nesting) {
+            pop_branch(state);
+        }
+    }
+
+    if (frame->recording) {
+        header_cache_store(state->header_cache, frame->file_id, frame->recording, &state->def_table, sc_error_count());
+    }
+
+    string_destroy(&state->line.path);
+    state->line.path = frame->saved_line.path;
+    state->line.line = frame->saved_line.line;
+
+    if (!frame->replay) {
+        tokenizer_state_destroy(&frame->tok_state);
+    }
+    preprocessor_pop_source(state);
+
+    // Replayed headers never include anything, so the top frame (if any) is always a file we are reading.
+    state->tok_state = state->include_stack.size > 0 ? &state->include_stack.memory[state->include_stack.size - 1].tok_state
+                                                     : state->main_tok_state;
+}
+
+// Pushes the next line of a header replayed from the header cache.
+static void replay_include_line(preprocessor_state *state) {
+    pp_include_frame *frame = &state->include_stack.memory[state->include_stack.size - 1];
+    pp_header_result *result = frame->replay;
+    size_t line = frame->replay_line++;
+
+    size_t end = line + 1 < result->line_count ? result->line_starts[line + 1] : result->output.size;
+    state->line.line = result->line_numbers[line];
+    state->line_continues = false;
+    for (size_t i = result->line_starts[line]; i < end; i++) {
+        push_token(&result->output.memory[i], state);
+    }
+
+    if (frame->replay_line == result->line_count) {
+        pop_include(state);
+    }
+}
+
+// Uses a cached result instead of preprocessing the header again.
+static void replay_include(preprocessor_state *state, pp_header_result *result, sc_file_cache_handle handle, pp_token *directive) {
+    // Headers we are recording depend on whatever the replayed header depends on.
+    for (size_t i = 0; i < result->dependency_count; i++) {
+        preprocessor_lookup_define(state, &result->dependencies[i].name);
+    }
+
+    header_result_apply(result, &state->def_table);
+    for (size_t i = 0; i < result->change_count; i++) {
+        preprocessor_macro_changed(state, &result->changes[i].name);
+    }
+
+    // Typically a header that was skipped by its include guard.
+    if (result->line_count == 0) {
+        return;
+    }
+
+    push_include(state, handle, directive, result);
+}
+
+static void do_include(size_t index, preprocessor_state *state) {
+    pp_token_vector *vec = state->line_vec;
+    pp_token *tokens = vec->memory;
+
+    // TODO: Macro expanded includes.
+    if (index == vec->size || tokens[index].kind != PP_TOK_HEADER_NAME) {
+        sc_error(false, "Expected header name after #include.");
+        return;
+    }
+
+    if (index + 1 != vec->size) {
+        sc_error(false, "Expected only header name after #include.");
+        return;
+    }
+
+    if (state->include_stack.size >= PP_MAX_INCLUDE_DEPTH) {
+        sc_error(false, "Maximum include depth of %d exceeded.", PP_MAX_INCLUDE_DEPTH);
+        return;
+    }
+
+    // Strip the quotes or angle brackets.
+    string *header_name = &tokens[index].data;
+    size_t name_len = string_size(header_name) - 2;
+    if (name_len + 1 > FILENAME_MAX) {
+        sc_error(false, "Header name too long in #include.");
+        return;
+    }
+
+    char name[FILENAME_MAX];
+    memcpy(name, string_data(header_name) + 1, name_len);
+    name[name_len] = '\0';
+
+    sc_file_cache *cache = state->tok_state->handle.cache;
+    sc_file_cache_handle handle = { .cache = NULL, .index = 0 };
+    char path[FILENAME_MAX];
+
+    // Absolute paths are used as they are, "" includes are first looked up next to the including file.
+    if (name[0] == '/') {
+        handle = file_cache_load(cache, name);
+    } else if (string_data(header_name)[0] == '"') {
+        get_relative_path_from_file(state->tok_state->path, name, path, FILENAME_MAX);
+        handle = file_cache_load(cache, path);
+    }
+
+    if (!handle.cache && name[0] != '/' && state->include_paths && path_table_lookup(state->include_paths, name, path, FILENAME_MAX)) {
+        handle = file_cache_load(cache, path);
+    }
+
+    if (!handle.cache) {
+        sc_error(false, "Could not find included file '%s'.", name);
+        return;
+    }
+
+    if (state->header_cache && !state->directives_only) {
+        pp_header_result *result = header_cache_find(state->header_cache, handle_to_file(handle)->id, &state->def_table);
+        if (result) {
+            replay_include(state, result, handle, &tokens[index - 1]);
+            return;
+        }
+    }
+
+    push_include(state, handle, &tokens[index - 1], NULL);
+}
+
+static void handle_directive(size_t index, preprocessor_state *state) {
+    pp_token_vector *vec = state->line_vec;
+    pp_token *tokens = vec->memory;
+
+    if (tokens[index].kind != PP_TOK_IDENTIFIER) {
+        // TODO: Good errors.
+        sc_error(false, "Non-identifier directive...");
+        return;
+    }
+
+    string *directive = &tokens[index].data;
+
+    #define IS(L) STRING_EQUALS_LITERAL(directive, L)
+
+    // TODO: These don't actually work for nested conditions all the time :/
+    // We should probably have some stack of ignored-until-nestings.
+    if (IS("endif")) {
+        // If nesting being zero here is impossible, since we are still ignoring.
+        state->if_nesting--;
+        if (state->if_nesting == latest_branch_nesting(state)) {
+            pop_branch(state);
+        }
+
+        index++;
+        if (index != vec->size) {
+            sc_error(true, "#endif expected no parameters");
+        }
+        return;
+    } else if (IS("else")) {
+        if (state->if_nesting == 0) {
+            sc_error(false, "#else without condition.");
+            return;
+        }
+
+        // TODO: Check if + 1 is correct.
+        if (state->if_nesting == latest_branch_nesting(state) + 1) {
+            latest_branch_flip(state);
+        }
+
+        index++;
+        if (index != vec->size) {
+            sc_error(true, "#else expected no parameters");
+        }
+        return;
+    } else if (IS("elif")) {
+        // TODO: Do stuff here
+    }
+
+    if (ignoring(state)) {
+        if (IS("ifndef") || IS("if") || IS("ifdef")) {
+            state->if_nesting++;
+            // Check for superfluous tokens here.
+        } else if (IS("elif")) {
+            // Stop ignoring if at correct nesting and condition is true
+            // Check for superfluous tokens.
+        } else if (!IS("define") && !IS("include") && !IS("pragma") && !IS("line") && !IS("line") && !IS("error") && !IS("undef")) {
+            sc_error(false, "Unknown directive '%s'", string_data(directive));
+            return;
+        }
+    } else {
+        if (IS("ifdef")) {
+            index++;
+            do_ifdef(true, index, state);
+        } else if (IS("ifndef")) {
+            index++;
+            do_ifdef(false, index, state);
+        } else if (IS("if")) {
+            // TODO;
+        } else if (IS("elif")) {
+            // TODO;
+        } else if (IS("define")) {
+            // Go go!
+            index++;
+            do_define(index, state);
+        } else if (IS("include")) {
+            index++;
+            do_include(index, state);
+        }
+        // TODO: Add rest of directives
+        // TODO: Error on unknown directive
+        else if (IS("error")) {
+            if (!tokens[index].has_whitespace) {
+                sc_error(false, "Expected whitespace between #error directive and error tokens.");
+                return;
+            }
+
+            index++;
+            // TODO: ERROR REPORTING
+            string str;
+            string_init(&str, 0);
+            for (size_t i = index; i < vec->size; i++) {
+                string_append(&str, &tokens[i].data);
+                if (tokens[i].has_whitespace) {
+                    string_push(&str, ' ');
+                }
+            }
+            sc_error(false, string_data(&str));
+            string_destroy(&str);
+        } else if (IS("line")) {
+            // We only restore the #line counter when replaying cached headers.
+            poison_recordings(state);
+
+            if (!tokens[index].has_whitespace) {
+                sc_error(false, "Expected whitespace between #line and line number.");
+                return;
+            }
+
+            index++;
+
+            if (tokens[index].kind != PP_TOK_NUMBER) {
+                sc_error(false, "Expected line number after #line directive.");
+                return;
+            }
+
+            // Steal the token's data.
+            const char *num_data = string_data(&tokens[index].data);
+            // Parse it to an integer, if we can.
+            for (size_t i = 0; i < string_size(&tokens[index].data); i++) {
+                if (!isdigit(num_data[i])) {
+                    sc_error(false, "Expected a decimal line number in #line directive.");
+                    return;
+                }
+            }
+
+            // TODO: Write our own, better version (with bounds/error checking, faster [see folly talk])...
+            state->line.line = strtoull(num_data, NULL, 10) - 1;
+            index++;
+
+            if (index != vec->size) {
+                if (!tokens[index - 1].has_whitespace) {
+                    sc_error(false, "Expected withespace between #line number and #line path.");
+                    return;
+                }
+
+                if (tokens[index].kind != PP_TOK_STR_LITERAL) {
+                    sc_error(false, "Expected a string literal as a second argument of the #line directive.");
+                    return;
+                }
+
+                // Remove quotes
+                // TODO: Unescape this.
+                string_destroy(&state->line.path);
+                string_from_ptr_size_with(&state->line.path, string_data(&tokens[index].data) + 1, string_size(&tokens[index].data) - 2,
+                                          state->allocator);
+                index++;
+                if (index != vec->size) {
+                    sc_error(false, "#line directive can have two arguments at most.");
+                    return;
+                }
+            }
+        } else if (IS("undef")) {
+            index++;
+
+            if (index == vec->size || tokens[index].kind != PP_TOK_IDENTIFIER) {
+                sc_error(false, "Expected macro name as argument of #undef.");
+                return;
+            }
+
+            define *entry = preprocessor_lookup_define(state, &tokens[index].data);
+            if (entry && entry->active) {
+                entry->active = false;
+                preprocessor_macro_changed(state, &tokens[index].data);
+            } else {
+                sc_warning("Called #undef on already undefined macro '%s'", string_data(&tokens[index].data));
+            }
+        }
+    }
+
+    #undef IS
+}
+
+static bool process_line(preprocessor_state *state) {
+    state->line_vec->size = 0;
+    // Long text lines come in windows, which are expanded like separate lines apart from a leading '#' not being a directive.
+    bool continued = state->tok_state->line_continues;
+    bool result = tokenize_line(state->line_vec, state->tok_state);
+    state->line_continues = state->tok_state->line_continues;
+    if (state->line_continues) {
+        // Replays would output the windows as separate lines.
+        poison_recordings(state);
+    }
+
+    pp_token_vector *vec = state->line_vec;
+    pp_token *tokens = vec->memory;
+
+    size_t idx = 0;
+
+    if (vec->size == 0) {
+        // The last window of a long line can be empty, the line still counts.
+        if (!state->line_continues && state->line_window_tokens) {
+            state->line.line++;
+            state->line_window_tokens = false;
+        }
+        return result;
+    }
+
+    if (tokens[idx].kind == PP_TOK_HASH && !continued) {
+        if (state->macro_context.macro != NULL) {
+            // We're in a macro call, this is an error.
+            sc_error(false, "Malformed function like macro call.");
+            preprocessor_clean_macro_context(state);
+        }
+        // Preprocessor directive.
+        idx++;
+
+        // No op.
+        if (idx == vec->size) {
+            return result;
+        }
+
+        handle_directive(idx, state);
+    } else if (!ignoring(state) && !state->directives_only) {
+        // TODO: Handle _Pragmas
+        // TODO: move this token vector into preprocessor_state, don't create it for each line...
+        pp_token_vector out;
+        pp_token_vector_init_with(&out, 16, &state->expansion_allocator);
+
+        if (state->macro_context.macro != NULL) {
+            continue_multiline_macro_function_call(state, &idx, state->line_vec, &out);
+            // This skips the closing parenthesis if the function call is over.
+            // Otherwise, we are already over the vector size.
+            idx++;
+        }
+
+        if (idx < vec->size) {
+            fully_substitute(idx, state, &out);
+        }
+
+        for (size_t i = 0; i < out.size; i++) {
+            push_token(&out.memory[i], state);
+        }
+
+        pp_token_vector_destroy(&out);
+    }
+
+    // Increment the "#line" counter on text lines only, once we are done with all windows of the line.
+    if (state->line_continues) {
+        state->line_window_tokens = true;
+    } else {
+        state->line.line++;
+        state->line_window_tokens = false;
+    }
+
+    if (!result && state->macro_context.macro != NULL) {
+        sc_error(false, "Malformed function like macro call.");
+    }
+
+    return result;
+}
+
+bool preprocess_line(preprocessor_state *state) {
+    state->lines_processed++;
+
+    if (state->include_stack.size > 0 && state->include_stack.memory[state->include_stack.size - 1].replay) {
+        replay_include_line(state);
+        return true;
+    }
+
+    size_t include_depth = state->include_stack.size;
+    bool result = process_line(state);
+
+    if (!result && state->include_stack.size > include_depth) {
+        // The last line of the file was an #include, we still have to read the included file.
+        // We will get back to this file's end once we are done with it.
+        result = true;
+    } else if (!result && state->include_stack.size > 0) {
+        // Done with an included file, go back to the including one.
+        pop_include(state);
+        result = true;
+    }
+
+    return result;
+}
+
+void preprocessor_release_output(token_vector *vec) {
+    for (size_t i = 0; i < vec->size; i++) {
+        token *tok = &vec->memory[i];
+        // Only the last source is ours, the others are shared with the source stack (see push_token).
+        string_destroy(&tok->source_stack[tok->stack_size - 1].file.path);
+        string_destroy(&tok->data);
+        string_destroy(&tok->line.path);
+    }
+
+    vec->size = 0;
+    arena_clear(&vec->storage);
+}
+
+void pp_text_writer_init(pp_text_writer *writer, sc_output *out) {
+    writer->out = out;
+    writer->line_open = false;
+    writer->space = false;
+}
+
+void pp_text_writer_line(pp_text_writer *writer, preprocessor_state *state, token_vector *line) {
+    for (size_t i = 0; i < line->size; i++) {
+        if (writer->space) {
+            output_putc(writer->out, ' ');
+        }
+
+        output_write(writer->out, string_data(&line->memory[i].data), string_size(&line->memory[i].data));
+        writer->space = line->memory[i].has_whitespace;
+    }
+    writer->line_open |= line->size != 0;
+
+    if (writer->line_open && !state->line_continues) {
+        output_putc(writer->out, '\n');
+        writer->line_open = false;
+        writer->space = false;
+    }
+}
+
+void push_token(pp_token *src, preprocessor_state *state) {
+    token *dest = token_vector_tail(state->translation_unit);
+
+    assert(src->kind != PP_TOK_HEADER_NAME && src->kind != PP_TOK_PLACEMARKER);
+    if (src->kind == PP_TOK_OTHER || src->kind == PP_TOK_HASH || src->kind == PP_TOK_DOUBLEHASH || src->kind == PP_TOK_CONCAT_DOUBLEHASH) {
+        sc_error(false, "Token '%s' made it out of preprocessing...", string_data(&src->data));
+        state->translation_unit->size--;
+        return;
+    }
+
+    for (size_t i = 0; i < state->include_stack.size; i++) {
+        if (state->include_stack.memory[i].recording) {
+            header_recording_push(state->include_stack.memory[i].recording, src, state->lines_processed, state->line.line);
+        }
+    }
+
+    // Ok, lets pass over our current sources and add the default file one.
+    dest->stack_size = state->source_stack.stack_size + 1;
+    dest->source_stack = arena_alloc(&state->translation_unit->storage, dest->stack_size * sizeof(token_source));
+
+    dest->has_whitespace = src->has_whitespace;
+
+    memcpy(dest->source_stack, state->source_stack.memory, state->source_stack.stack_size * sizeof(token_source));
+    dest->source_stack[state->source_stack.stack_size] = (token_source) {
+        .kind = TSRC_FILE,
+        .file.line = src->source.line,
+        .file.column = src->source.column
+    };
+    sc_allocator *allocator = state->translation_unit->allocator;
+    string_from_ptr_size_with(&dest->source_stack[state->source_stack.stack_size].file.path, src->source.path, strlen(src->source.path), allocator);
+    // TODO: Number parsing, string and character escaping and other fun stuff.
+    string_copy_with(&dest->data, &src->data, allocator);
+
+    // Pass over #line set stuff.
+    string_copy_with(&dest->line.path, &state->line.path, allocator);
+    dest->line.line = state->line.line;
+
+    // Punctuators.
+    if (src->kind >= PP_TOK_DOT && src->kind <= PP_TOK_COLON) {
+        dest->kind = (src->kind - PP_TOK_DOT) + TOK_DOT;
+    } else if (src->kind == PP_TOK_IDENTIFIER) {
+        // Ok, let's break it DOWN.
+        if (is_keyword(&dest->data)) {
+            dest->kind = TOK_KEYWORD;
+        } else {
+            dest->kind = TOK_IDENTIFIER;
+        }
+    } else if (src->kind == PP_TOK_NUMBER) {
+        dest->kind = TOK_NUMBER;
+    } else if (src->kind == PP_TOK_CHAR_CONST) {
+        dest->kind = TOK_CHAR_CONST;
+    } else if (src->kind == PP_TOK_STR_LITERAL) {
+        dest->kind = TOK_STR_LITERAL;
+    }
+}
+
+void preprocessor_state_init(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec,
+                             sc_path_table *include_paths) {
+    preprocessor_state_init_with(state, tok_state, translation_unit, line_vec, include_paths, mallocator());
+}
+
+void preprocessor_state_init_with(preprocessor_state *state, tokenizer_state *tok_state, token_vector *translation_unit, pp_token_vector *line_vec,
+                                  sc_path_table *include_paths, sc_allocator *allocator) {
+    state->allocator = allocator;
+    state->tok_state = tok_state;
+    state->main_tok_state = tok_state;
+    state->translation_unit = translation_unit;
+    state->line_vec = line_vec;
+
+    // Default starting stack of 32 elements.
+    state->source_stack.memory = sc_alloc(allocator, 32 * sizeof(token_source));
+    state->source_stack.stack_size = 0;
+    state->source_stack.stack_capacity = 32;
+
+    state->if_nesting = 0;
+
+    state->branch_stack.memory = sc_alloc(allocator, 8 * sizeof(pp_branch));
+    state->branch_stack.size = 0;
+    state->branch_stack.capacity = 8;
+
+    define_table_init_with(&state->def_table, allocator);
+
+    state->include_paths = include_paths;
+    state->include_stack.memory = NULL;
+    state->include_stack.size = 0;
+    state->include_stack.capacity = 0;
+
+    state->header_cache = NULL;
+    state->lines_processed = 0;
+    state->directives_only = false;
+    state->line_continues = false;
+    state->line_window_tokens = false;
+
+    string_init(&state->line.path, 0);
+    state->line.line = 0;
+
+    state->macro_context.opened_call = false;
+    state->macro_context.macro = NULL;
+
+    state->expansion_allocator = make_pool_alloc(&state->expansion_pool, allocator);
+    state->scratch_allocator = make_arena_alloc(&state->scratch, allocator, PP_SCRATCH_CHUNK_SIZE);
+}
+
+void preprocessor_state_destroy(preprocessor_state *state) {
+    assert(state->include_stack.size == 0);
+
+    sc_free(state->allocator, state->source_stack.memory);
+    sc_free(state->allocator, state->branch_stack.memory);
+    if (state->include_stack.memory) {
+        sc_free(state->allocator, state->include_stack.memory);
+    }
+
+    define_table_destroy(&state->def_table);
+    string_destroy(&state->line.path);
+
+    pool_destroy(&state->expansion_pool);
+    arena_destroy(&state->scratch);
+}
+
+void preprocessor_use_header_cache(preprocessor_state *state, pp_header_cache *cache) {
+    state->header_cache = cache;
+}
+
+void preprocessor_directives_only(preprocessor_state *state) {
+    state->directives_only = true;
+    tokenizer_directives_only(state->tok_state);
+}
+
+token_source *preprocessor_source_tail(preprocessor_state *state) {
+    if (state->source_stack.stack_size == state->source_stack.stack_capacity) {
+        state->source_stack.stack_capacity *= 2;
+        state->source_stack.memory = sc_realloc(state->allocator, state->source_stack.memory, state->source_stack.stack_size * sizeof(token_source),
+                                                state->source_stack.stack_capacity * sizeof(token_source));
+    }
+
+    return &state->source_stack.memory[state->source_stack.stack_size++];
+}
+
+// TODO: Destroy the source.
+void preprocessor_pop_source(preprocessor_state *state) {
+    assert(state->source_stack.stack_size > 0);
+    state->source_stack.stack_size--;
+}
+
+void preprocessor_clean_macro_context(preprocessor_state *state) {
+    assert(state->macro_context.macro != NULL);
+
+    size_t nargs = state->macro_context.macro->args.argument_count;
+    bool variadic = state->macro_context.macro->args.has_varargs;
+
+    if (state->macro_context.opened_call && nargs + (variadic ? 1 : 0) > 0) {
+        for (size_t i = 0; i <= state->macro_context.current_argument; i++) {
+            pp_token_vector_destroy(&state->macro_context.args[i]);
+        }
+    }
+
+    state->macro_context.macro = NULL;
+    state->macro_context.opened_call = false;
+    pool_free(&state->expansion_pool, state->macro_context.args);
+}
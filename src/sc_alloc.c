@@ -1,211 +1,703 @@
-#include <sc_alloc.h>
-
-void *sc_alloc(sc_allocator *alloc, size_t size) {
-    return alloc->alloc(alloc->state, size);
-}
-
-void sc_free(sc_allocator *alloc, void *memory) {
-    alloc->free(alloc->state, memory);
-}
-
-void sc_destroy_allocator(sc_allocator *alloc) {
-    alloc->destroy(alloc->state);
-}
-
-#define UNUSED(x) (void)(x)
-
-static void* malloc_alloc(void *state, size_t size) {
-    UNUSED(state);
-    return malloc(size);
-}
-
-static void malloc_free(void *state, void *memory) {
-    UNUSED(state);
-    free(memory);
-}
-
-static void malloc_destroy(void *state) {
-    UNUSED(state);
-    assert(!state);
-}
-
-sc_allocator *mallocator() {
-    static sc_allocator instance = (sc_allocator) { .alloc = malloc_alloc, .free = malloc_free, .destroy = malloc_destroy, .state = NULL };
-    return &instance;
-}
-
-// The region does not own the memory.
-void region_init(sc_region *region, void *memory, size_t size) {
-    *region = (sc_region) { .memory = memory, .index = 0, .size = size };
-}
-
-void region_destroy(sc_region *region) {}
-
-bool region_can_allocate(sc_region *region, size_t size) {
-    return region->index + size <= region->size;
-}
-
-bool region_owns(sc_region *region, void *memory) {
-    return memory >= region->memory && memory <= region->memory + region->size;
-}
-
-void region_clear(sc_region *region) {
-    region->index = 0;
-}
-
-static void* region_alloc(sc_region *region, size_t size) {
-    if (!region_can_allocate(region, size)) {
-        return NULL;
-    }
-
-    void *ptr = region->memory + region->index;
-    region->index += size;
-    return ptr;
-}
-
-static void region_free(sc_region *region, void *memory) {
-    assert(region_owns(region, memory));
-    // We can try to rewind the index if the memory is the last thing we allocated, but we would need the size of the allocation to do that.
-    // Instead, do nothing.
-}
-
-sc_allocator make_region_alloc(sc_region *region, void *memory, size_t size) {
-    region_init(region, memory, size);
-    return make_alloc_from_region(region);
-}
-
-sc_allocator make_alloc_from_region(sc_region *region) {
-    return (sc_allocator) { .alloc = (alloc_func)region_alloc, .free = (free_func)region_free, .destroy = (destroy_func)region_destroy, .state = (void*)region };
-}
-
-void region_list_init(sc_region_list *list, sc_allocator *backing, size_t region_size) {
-    // We always allocate the first node.
-    region_init(&list->root.region, sc_alloc(backing, region_size), region_size);
-    list->root.next = NULL;
-    list->backing_allocator = backing;
-    list->region_size = region_size;
-}
-
-void region_list_destroy(sc_region_list *list) {
-    // We have to erase memory of the regions in reverse order, since each node is held in the previous region.
-    // We don't care about the memory we are currently holding, so we are going to use the first region to store the list of regions we have to free.
-    sc_region **list_to_free = list->root.region.memory;
-    size_t count = 0;
-
-    sc_region_list_node *current = &list->root;
-    while (current->next != NULL) {
-        list_to_free[count++] = &current->region;
-        current = current->next;
-    }
-
-    // So now we just have to go in reverse order and free our regions!
-    for (size_t i = count - 1; i >= 0; i--) {
-        region_destroy(list_to_free[count]);
-    }
-}
-
-static void* region_list_alloc(sc_region_list *list, size_t size) {
-    // Let's find out where we currently are.
-    // Meanwhile, we try to allocate in the intermediate nodes where we have already allocated the next node in.
-    sc_region_list_node *current = &list->root;
-    while (current->next) {
-        current = current->next;
-
-        // FIXME: This is ugly, refactor somehow
-        if (current->next) {
-            // Ok, we've already allocated the next node.
-            // Do we fit here?
-            if (region_can_allocate(&current->next->region, size)) {
-                return region_alloc(&current->next->region, size);
-            }
-        }
-    }
-
-    // Right.
-    // So we either need a new region or can fit in the last one in the list.
-    // Note that we are checking against the size of the allocation + the size of a new node.
-    if (region_can_allocate(&current->region, size + sizeof(sc_region_list_node))) {
-        // Ok, let's go ahead and allocate.
-        return region_alloc(&current->region, size);
-    } else {
-        // Ok, let's allocate our next node, allocate its region and go on.
-        assert(region_can_allocate(&current->region, sizeof(sc_region_list_node)));
-
-        sc_region_list_node *new_node = region_alloc(&current->region, sizeof(sc_region_list_node));
-        region_init(&new_node->region, sc_alloc(list->backing_allocator, list->region_size), list->region_size);
-        new_node->next = NULL;
-
-        current->next = new_node;
-        // size would have to be huge for this to fail.
-        assert(region_can_allocate(&new_node->region, size + sizeof(sc_region_list_node)));
-        return region_alloc(&new_node->region, size);
-    }
-}
-
-// Nothing we can do.
-static void region_list_free(void *state, void *memory) {
-    UNUSED(state);
-    UNUSED(memory);
-}
-
-sc_allocator make_region_list_alloc(sc_region_list *list, sc_allocator *backing, size_t region_size) {
-    region_list_init(list, backing, region_size);
-
-    return make_alloc_from_region_list(list);
-}
-
-sc_allocator make_alloc_from_region_list(sc_region_list *list) {
-    return (sc_allocator) { .alloc = (alloc_func)region_list_alloc, .free = region_list_free, .destroy = (destroy_func)region_list_destroy, .state = (void*)list };
-}
-
-void fallback_init(sc_fallback *alloc, sc_allocator *primary, sc_allocator *fallback) {
-    alloc->primary = primary;
-    alloc->fallback = fallback;
-}
-
-void fallback_destroy(sc_fallback *alloc) {
-    UNUSED(alloc);
-}
-
-static void *fallback_alloc(sc_fallback *fb, size_t size) {
-    // We allocate an extra flag byte.
-    // 0 is primary allocator, anything else is fallback.
-    char *candidate = sc_alloc(fb->primary, size + 1);
-
-    if (!candidate) {
-        candidate = sc_alloc(fb->fallback, size + 1);
-
-        if (!candidate) {
-            return NULL;
-        }
-
-        candidate[0] = 1;
-    }
-    else {
-        candidate[0] = 0;
-    }
-
-
-    return candidate + 1;
-}
-
-static void fallback_free(sc_fallback *fb, char *memory) {
-    if (memory[-1] == 0) {
-        sc_free(fb->primary, memory - 1);
-    }
-    else {
-        sc_free(fb->fallback, memory - 1);
-    }
-}
-
-sc_allocator make_fallback_alloc(sc_fallback *fb, sc_allocator *primary, sc_allocator *fallback) {
-    fallback_init(fb, primary, fallback);
-
-    return make_alloc_from_fallback(fb);
-}
-
-sc_allocator make_alloc_from_fallback(sc_fallback *fb) {
-    return (sc_allocator) { .alloc = (alloc_func)fallback_alloc, .free = (free_func)fallback_free, .destroy = (destroy_func)fallback_destroy, .state = (void*)fb };
-}
-
-#undef UNUSED
+#include <sc_alloc.h>
+#include <string.h>
+
+void *sc_alloc(sc_allocator *alloc, size_t size) {
+    return alloc->alloc(alloc->state, size);
+}
+
+void *sc_calloc(sc_allocator *alloc, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *memory = sc_alloc(alloc, count * size);
+    if (memory) {
+        memset(memory, 0, count * size);
+    }
+    return memory;
+}
+
+// For allocators that can't do better.
+static void *copy_realloc(sc_allocator *alloc, void *memory, size_t old_size, size_t new_size) {
+    void *bigger = sc_alloc(alloc, new_size);
+    if (!bigger) {
+        return NULL;
+    }
+
+    if (memory) {
+        memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+        sc_free(alloc, memory);
+    }
+    return bigger;
+}
+
+void *sc_realloc(sc_allocator *alloc, void *memory, size_t old_size, size_t new_size) {
+    if (alloc->resize) {
+        return alloc->resize(alloc->state, memory, old_size, new_size);
+    }
+
+    return copy_realloc(alloc, memory, old_size, new_size);
+}
+
+void sc_free(sc_allocator *alloc, void *memory) {
+    alloc->free(alloc->state, memory);
+}
+
+bool sc_owns(sc_allocator *alloc, void *memory) {
+    assert(alloc->owns);
+    return alloc->owns(alloc->state, memory);
+}
+
+void sc_destroy_allocator(sc_allocator *alloc) {
+    alloc->destroy(alloc->state);
+}
+
+#define UNUSED(x) (void)(x)
+
+static void* malloc_alloc(void *state, size_t size) {
+    UNUSED(state);
+    return malloc(size);
+}
+
+static void malloc_free(void *state, void *memory) {
+    UNUSED(state);
+    free(memory);
+}
+
+static void *malloc_resize(void *state, void *memory, size_t old_size, size_t new_size) {
+    UNUSED(state);
+    UNUSED(old_size);
+    return realloc(memory, new_size);
+}
+
+static void malloc_destroy(void *state) {
+    UNUSED(state);
+    assert(!state);
+}
+
+sc_allocator *mallocator() {
+    static sc_allocator instance = (sc_allocator) { .alloc = malloc_alloc, .free = malloc_free, .destroy = malloc_destroy, .resize = malloc_resize, .owns = NULL, .state = NULL };
+    return &instance;
+}
+
+// The region does not own the memory.
+void region_init(sc_region *region, void *memory, size_t size) {
+    *region = (sc_region) { .memory = memory, .index = 0, .size = size };
+}
+
+void region_destroy(sc_region *region) {}
+
+// Bytes to skip for the next allocation to be aligned.
+static size_t region_padding(sc_region *region) {
+    uintptr_t address = (uintptr_t)region->memory + region->index;
+    return (SC_ALLOC_ALIGNMENT - address % SC_ALLOC_ALIGNMENT) % SC_ALLOC_ALIGNMENT;
+}
+
+bool region_can_allocate(sc_region *region, size_t size) {
+    size_t padding = region_padding(region);
+    return padding <= region->size - region->index && size <= region->size - region->index - padding;
+}
+
+bool region_owns(sc_region *region, void *memory) {
+    return (char *)memory >= (char *)region->memory && (char *)memory < (char *)region->memory + region->size;
+}
+
+void region_clear(sc_region *region) {
+    region->index = 0;
+}
+
+static void* region_alloc(sc_region *region, size_t size) {
+    // Zero sized allocations take a byte too, so that they never land on the end of the region, which we don't own.
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (!region_can_allocate(region, size)) {
+        return NULL;
+    }
+
+    region->index += region_padding(region);
+    void *ptr = (char *)region->memory + region->index;
+    region->index += size;
+    return ptr;
+}
+
+static void region_free(sc_region *region, void *memory) {
+    assert(region_owns(region, memory));
+    // We can try to rewind the index if the memory is the last thing we allocated, but we would need the size of the allocation to do that.
+    // Instead, do nothing.
+}
+
+// Is 'memory' the last allocation, 'old_size' bytes long?
+static bool region_is_last(sc_region *region, void *memory, size_t old_size) {
+    return memory && (char *)memory + old_size == (char *)region->memory + region->index;
+}
+
+static void *region_resize(sc_region *region, void *memory, size_t old_size, size_t new_size) {
+    if (region_is_last(region, memory, old_size)) {
+        size_t start = (char *)memory - (char *)region->memory;
+        if (new_size <= region->size - start) {
+            region->index = start + new_size;
+            return memory;
+        }
+        return NULL;
+    }
+
+    void *bigger = region_alloc(region, new_size);
+    if (bigger && memory) {
+        memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+    }
+    return bigger;
+}
+
+sc_allocator make_region_alloc(sc_region *region, void *memory, size_t size) {
+    region_init(region, memory, size);
+    return make_alloc_from_region(region);
+}
+
+sc_allocator make_alloc_from_region(sc_region *region) {
+    return (sc_allocator) { .alloc = (alloc_func)region_alloc, .free = (free_func)region_free, .destroy = (destroy_func)region_destroy,
+                            .resize = (resize_func)region_resize, .owns = (owns_func)region_owns, .state = (void*)region };
+}
+
+void region_list_init(sc_region_list *list, sc_allocator *backing, size_t region_size) {
+    // We always allocate the first node.
+    region_init(&list->root.region, sc_alloc(backing, region_size), region_size);
+    list->root.next = NULL;
+    list->current = &list->root;
+    list->backing_allocator = backing;
+    list->region_size = region_size;
+}
+
+void region_list_destroy(sc_region_list *list) {
+    // Each node is held in the previous region, so we read it before freeing that region.
+    void *memory = list->root.region.memory;
+    sc_region_list_node *next = list->root.next;
+    while (next) {
+        void *next_memory = next->region.memory;
+        sc_region_list_node *after = next->next;
+
+        sc_free(list->backing_allocator, memory);
+        memory = next_memory;
+        next = after;
+    }
+
+    sc_free(list->backing_allocator, memory);
+}
+
+bool region_list_owns(sc_region_list *list, void *memory) {
+    for (sc_region_list_node *node = &list->root; node; node = node->next) {
+        if (region_owns(&node->region, memory)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void* region_list_alloc(sc_region_list *list, size_t size) {
+    // We keep room for the next node in the current region, so that we can always link a new one.
+    sc_region *current = &list->current->region;
+    if (region_can_allocate(current, size + sizeof(sc_region_list_node) + SC_ALLOC_ALIGNMENT)) {
+        return region_alloc(current, size);
+    }
+
+    // Too big for any region.
+    if (size + sizeof(sc_region_list_node) + SC_ALLOC_ALIGNMENT > list->region_size) {
+        return NULL;
+    }
+
+    sc_region_list_node *new_node = region_alloc(current, sizeof(sc_region_list_node));
+    assert(new_node);
+    region_init(&new_node->region, sc_alloc(list->backing_allocator, list->region_size), list->region_size);
+    new_node->next = NULL;
+
+    list->current->next = new_node;
+    list->current = new_node;
+    return region_alloc(&new_node->region, size);
+}
+
+static void *region_list_resize(sc_region_list *list, void *memory, size_t old_size, size_t new_size) {
+    // Growing in place still leaves room for the next node.
+    sc_region *current = &list->current->region;
+    if (region_is_last(current, memory, old_size)) {
+        size_t start = (char *)memory - (char *)current->memory;
+        if (new_size + sizeof(sc_region_list_node) + SC_ALLOC_ALIGNMENT <= current->size - start) {
+            current->index = start + new_size;
+            return memory;
+        }
+    }
+
+    void *bigger = region_list_alloc(list, new_size);
+    if (bigger && memory) {
+        memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+    }
+    return bigger;
+}
+
+// Nothing we can do.
+static void region_list_free(void *state, void *memory) {
+    UNUSED(state);
+    UNUSED(memory);
+}
+
+sc_allocator make_region_list_alloc(sc_region_list *list, sc_allocator *backing, size_t region_size) {
+    region_list_init(list, backing, region_size);
+
+    return make_alloc_from_region_list(list);
+}
+
+sc_allocator make_alloc_from_region_list(sc_region_list *list) {
+    return (sc_allocator) { .alloc = (alloc_func)region_list_alloc, .free = region_list_free, .destroy = (destroy_func)region_list_destroy,
+                            .resize = (resize_func)region_list_resize, .owns = (owns_func)region_list_owns, .state = (void*)list };
+}
+
+// Chunk memory starts after the header, aligned.
+#define ARENA_HEADER_SIZE ((sizeof(sc_arena_chunk) + SC_ALLOC_ALIGNMENT - 1) & ~(SC_ALLOC_ALIGNMENT - 1))
+#define CHUNK_MEMORY(chunk) ((char *)(chunk) + ARENA_HEADER_SIZE)
+
+static void arena_poison(char *memory, size_t size) {
+    #if ARENA_POISON
+        // Alignment padding may still be poisoned from an earlier rewind.
+        ARENA_UNPOISON(memory, size);
+        memset(memory, ARENA_POISON_BYTE, size);
+        #ifdef SC_ARENA_ASAN
+            ASAN_POISON_MEMORY_REGION(memory, size);
+        #endif
+    #else
+        UNUSED(memory);
+        UNUSED(size);
+    #endif
+}
+
+static void arena_free_chunk(sc_arena *arena, sc_arena_chunk *chunk) {
+    // The backing allocator may touch the memory.
+    ARENA_UNPOISON(CHUNK_MEMORY(chunk), chunk->size);
+    sc_free(arena->backing_allocator, chunk);
+}
+
+static sc_arena_chunk *arena_new_chunk(sc_arena *arena, size_t size) {
+    sc_arena_chunk *chunk = sc_alloc(arena->backing_allocator, ARENA_HEADER_SIZE + size);
+    if (chunk) {
+        chunk->size = size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    return chunk;
+}
+
+static void arena_use_chunk(sc_arena *arena, sc_arena_chunk *chunk) {
+    arena->current = chunk;
+    arena->cursor = CHUNK_MEMORY(chunk);
+    arena->end = arena->cursor + chunk->size;
+}
+
+void arena_init(sc_arena *arena, sc_allocator *backing, size_t chunk_size) {
+    assert(chunk_size > 0);
+    arena->backing_allocator = backing;
+    arena->chunk_size = chunk_size;
+    arena->chunks = NULL;
+    arena->current = NULL;
+    arena->cursor = NULL;
+    arena->end = NULL;
+    arena->spare = NULL;
+
+    // We always allocate the first chunk, so the fast path never sees an empty arena.
+    sc_arena_chunk *chunk = arena_new_chunk(arena, chunk_size);
+    if (chunk) {
+        arena_use_chunk(arena, chunk);
+    }
+}
+
+void arena_destroy(sc_arena *arena) {
+    sc_arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        sc_arena_chunk *next = chunk->next;
+        arena_free_chunk(arena, chunk);
+        chunk = next;
+    }
+
+    if (arena->spare) {
+        arena_free_chunk(arena, arena->spare);
+    }
+
+    arena->chunks = NULL;
+    arena->current = NULL;
+    arena->cursor = NULL;
+    arena->end = NULL;
+    arena->spare = NULL;
+}
+
+void arena_clear(sc_arena *arena) {
+    if (!arena->current) {
+        return;
+    }
+
+    sc_arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        sc_arena_chunk *next = chunk->next;
+        if (chunk != arena->current) {
+            arena_free_chunk(arena, chunk);
+        }
+        chunk = next;
+    }
+
+    arena->chunks = arena->current;
+    arena->chunks->next = NULL;
+    arena_poison(CHUNK_MEMORY(arena->current), arena->cursor - CHUNK_MEMORY(arena->current));
+    arena_use_chunk(arena, arena->current);
+}
+
+void arena_rewind(sc_arena *arena, sc_arena_mark mark) {
+    while (arena->chunks != mark.chunks) {
+        sc_arena_chunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+
+        // Oversized chunks can be huge, we don't keep those.
+        if (chunk->size <= ARENA_MAX_CHUNK_SIZE && (!arena->spare || arena->spare->size < chunk->size)) {
+            if (arena->spare) {
+                arena_free_chunk(arena, arena->spare);
+            }
+            arena_poison(CHUNK_MEMORY(chunk), chunk == arena->current ? (size_t)(arena->cursor - CHUNK_MEMORY(chunk)) : chunk->size);
+            arena->spare = chunk;
+        } else {
+            arena_free_chunk(arena, chunk);
+        }
+    }
+
+    if (mark.current) {
+        arena_poison(mark.cursor, (mark.current == arena->current ? arena->cursor : mark.end) - mark.cursor);
+    }
+
+    arena->current = mark.current;
+    arena->cursor = mark.cursor;
+    arena->end = mark.end;
+}
+
+void *arena_alloc_slow(sc_arena *arena, size_t size, size_t alignment) {
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    if (size == 0) {
+        size = 1;
+    }
+
+    // Chunk memory is already aligned to SC_ALLOC_ALIGNMENT.
+    size_t padding = alignment > SC_ALLOC_ALIGNMENT ? alignment - SC_ALLOC_ALIGNMENT : 0;
+    if (size > SIZE_MAX - ARENA_HEADER_SIZE - padding) {
+        return NULL;
+    }
+
+    size_t needed = size + padding;
+    if (needed > arena->chunk_size / 2 || !arena->current) {
+        // A chunk of its own, we still have room in the current one.
+        sc_arena_chunk *chunk = arena_new_chunk(arena, needed);
+        if (!chunk) {
+            return NULL;
+        }
+
+        uintptr_t start = ((uintptr_t)CHUNK_MEMORY(chunk) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        return (void *)start;
+    }
+
+    if (arena->spare && arena->spare->size >= needed) {
+        sc_arena_chunk *chunk = arena->spare;
+        arena->spare = NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena_use_chunk(arena, chunk);
+    } else {
+        sc_arena_chunk *chunk = arena_new_chunk(arena, arena->chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+
+        arena_use_chunk(arena, chunk);
+        if (arena->chunk_size <= ARENA_MAX_CHUNK_SIZE / 2) {
+            arena->chunk_size *= 2;
+        }
+    }
+
+    return arena_alloc_aligned(arena, size, alignment);
+}
+
+void *arena_realloc_slow(sc_arena *arena, void *memory, size_t old_size, size_t new_size) {
+    void *bigger = arena_alloc(arena, new_size);
+    if (bigger && memory) {
+        memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+    }
+    return bigger;
+}
+
+bool arena_owns(sc_arena *arena, void *memory) {
+    for (sc_arena_chunk *chunk = arena->chunks; chunk; chunk = chunk->next) {
+        if ((char *)memory >= CHUNK_MEMORY(chunk) && (char *)memory < CHUNK_MEMORY(chunk) + chunk->size) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void *arena_alloc_default(sc_arena *arena, size_t size) {
+    return arena_alloc(arena, size);
+}
+
+// Nothing we can do either.
+static void arena_free(void *state, void *memory) {
+    UNUSED(state);
+    UNUSED(memory);
+}
+
+sc_allocator make_arena_alloc(sc_arena *arena, sc_allocator *backing, size_t chunk_size) {
+    arena_init(arena, backing, chunk_size);
+
+    return make_alloc_from_arena(arena);
+}
+
+sc_allocator make_alloc_from_arena(sc_arena *arena) {
+    return (sc_allocator) { .alloc = (alloc_func)arena_alloc_default, .free = arena_free, .destroy = (destroy_func)arena_destroy,
+                            .resize = (resize_func)arena_realloc, .owns = (owns_func)arena_owns, .state = (void*)arena };
+}
+
+#undef CHUNK_MEMORY
+#undef ARENA_HEADER_SIZE
+
+static size_t pool_page_hash(uintptr_t page) {
+    // Fibonacci hashing of the page number.
+    return (size_t)((uint64_t)(page / POOL_PAGE_SIZE) * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+// Returns the slot of the page, or the empty slot where it belongs.
+static size_t pool_page_slot(sc_pool *pool, uintptr_t page) {
+    size_t mask = pool->page_slots - 1;
+    size_t index = pool_page_hash(page) & mask;
+    while (pool->pages[index] != 0 && pool->pages[index] != page) {
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+static void pool_add_page(sc_pool *pool, uintptr_t page, size_t class_index) {
+    if ((pool->page_count + 1) * 2 > pool->page_slots) {
+        uintptr_t *old_pages = pool->pages;
+        unsigned char *old_classes = pool->page_classes;
+        size_t old_slots = pool->page_slots;
+
+        pool->page_slots = old_slots ? old_slots * 2 : 64;
+        pool->pages = calloc(pool->page_slots, sizeof(uintptr_t));
+        pool->page_classes = malloc(pool->page_slots);
+        for (size_t i = 0; i < old_slots; i++) {
+            if (old_pages[i]) {
+                size_t slot = pool_page_slot(pool, old_pages[i]);
+                pool->pages[slot] = old_pages[i];
+                pool->page_classes[slot] = old_classes[i];
+            }
+        }
+
+        free(old_pages);
+        free(old_classes);
+    }
+
+    size_t slot = pool_page_slot(pool, page);
+    pool->pages[slot] = page;
+    pool->page_classes[slot] = (unsigned char)class_index;
+    pool->page_count++;
+}
+
+static bool pool_refill(sc_pool *pool, sc_pool_class *size_class, size_t class_index) {
+    if (pool->next_page == pool->pages_end) {
+        // One more page than we use, so that we can align them.
+        void *slab = sc_alloc(pool->backing_allocator, (POOL_PAGES_PER_SLAB + 1) * POOL_PAGE_SIZE);
+        if (!slab) {
+            return false;
+        }
+
+        if (pool->slab_count == pool->slab_capacity) {
+            pool->slab_capacity = pool->slab_capacity ? pool->slab_capacity * 2 : 16;
+            pool->slabs = realloc(pool->slabs, pool->slab_capacity * sizeof(void *));
+        }
+        pool->slabs[pool->slab_count++] = slab;
+
+        uintptr_t first = ((uintptr_t)slab + POOL_PAGE_SIZE - 1) & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+        pool->next_page = (char *)first;
+        pool->pages_end = pool->next_page + POOL_PAGES_PER_SLAB * POOL_PAGE_SIZE;
+    }
+
+    char *page = pool->next_page;
+    pool->next_page += POOL_PAGE_SIZE;
+    pool_add_page(pool, (uintptr_t)page, class_index);
+
+    size_class->cursor = page;
+    size_class->end = page + POOL_PAGE_SIZE;
+    return true;
+}
+
+void pool_init(sc_pool *pool, sc_allocator *backing) {
+    for (size_t i = 0; i < POOL_CLASS_COUNT; i++) {
+        size_t size = i < 256 / SC_ALLOC_ALIGNMENT ? (i + 1) * SC_ALLOC_ALIGNMENT : (size_t)512 << (i - 256 / SC_ALLOC_ALIGNMENT);
+        pool->classes[i] = (sc_pool_class) { .free_list = NULL, .cursor = NULL, .end = NULL, .size = size };
+    }
+
+    pool->next_page = NULL;
+    pool->pages_end = NULL;
+    pool->slabs = NULL;
+    pool->slab_count = 0;
+    pool->slab_capacity = 0;
+    pool->pages = NULL;
+    pool->page_classes = NULL;
+    pool->page_slots = 0;
+    pool->page_count = 0;
+    pool->backing_allocator = backing;
+}
+
+void pool_destroy(sc_pool *pool) {
+    for (size_t i = 0; i < pool->slab_count; i++) {
+        sc_free(pool->backing_allocator, pool->slabs[i]);
+    }
+
+    free(pool->slabs);
+    free(pool->pages);
+    free(pool->page_classes);
+    pool_init(pool, pool->backing_allocator);
+}
+
+void *pool_alloc_slow(sc_pool *pool, size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        return sc_alloc(pool->backing_allocator, size);
+    }
+
+    // pool_alloc already took what was on the free list.
+    size_t class_index = pool_class_index(size);
+    sc_pool_class *size_class = &pool->classes[class_index];
+    if ((size_t)(size_class->end - size_class->cursor) < size_class->size && !pool_refill(pool, size_class, class_index)) {
+        return NULL;
+    }
+
+    void *memory = size_class->cursor;
+    size_class->cursor += size_class->size;
+    return memory;
+}
+
+void pool_free(sc_pool *pool, void *memory) {
+    if (!memory) {
+        return;
+    }
+
+    uintptr_t page = (uintptr_t)memory & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+    if (pool->page_count != 0) {
+        size_t slot = pool_page_slot(pool, page);
+        if (pool->pages[slot] == page) {
+            sc_pool_class *size_class = &pool->classes[pool->page_classes[slot]];
+            *(void **)memory = size_class->free_list;
+            size_class->free_list = memory;
+            return;
+        }
+    }
+
+    sc_free(pool->backing_allocator, memory);
+}
+
+void *pool_realloc(sc_pool *pool, void *memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return pool_alloc(pool, new_size);
+    }
+
+    if (old_size > POOL_MAX_SIZE && new_size > POOL_MAX_SIZE) {
+        return sc_realloc(pool->backing_allocator, memory, old_size, new_size);
+    }
+
+    if (old_size <= POOL_MAX_SIZE && new_size <= POOL_MAX_SIZE && pool_class_index(old_size) == pool_class_index(new_size)) {
+        return memory;
+    }
+
+    void *moved = pool_alloc(pool, new_size);
+    if (moved) {
+        memcpy(moved, memory, old_size < new_size ? old_size : new_size);
+        pool_free(pool, memory);
+    }
+    return moved;
+}
+
+bool pool_owns(sc_pool *pool, void *memory) {
+    if (pool->page_count == 0) {
+        return false;
+    }
+
+    uintptr_t page = (uintptr_t)memory & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+    return pool->pages[pool_page_slot(pool, page)] == page;
+}
+
+sc_allocator make_pool_alloc(sc_pool *pool, sc_allocator *backing) {
+    pool_init(pool, backing);
+
+    return make_alloc_from_pool(pool);
+}
+
+sc_allocator make_alloc_from_pool(sc_pool *pool) {
+    return (sc_allocator) { .alloc = (alloc_func)pool_alloc, .free = (free_func)pool_free, .destroy = (destroy_func)pool_destroy,
+                            .resize = (resize_func)pool_realloc, .owns = NULL, .state = (void*)pool };
+}
+
+void fallback_init(sc_fallback *alloc, sc_allocator *primary, sc_allocator *fallback) {
+    assert(primary->owns);
+    alloc->primary = primary;
+    alloc->fallback = fallback;
+}
+
+void fallback_destroy(sc_fallback *alloc) {
+    UNUSED(alloc);
+}
+
+static void *fallback_alloc(sc_fallback *fb, size_t size) {
+    void *memory = sc_alloc(fb->primary, size);
+    if (!memory) {
+        memory = sc_alloc(fb->fallback, size);
+    }
+
+    return memory;
+}
+
+static void fallback_free(sc_fallback *fb, void *memory) {
+    if (sc_owns(fb->primary, memory)) {
+        sc_free(fb->primary, memory);
+    } else {
+        sc_free(fb->fallback, memory);
+    }
+}
+
+static void *fallback_resize(sc_fallback *fb, void *memory, size_t old_size, size_t new_size) {
+    if (memory && !sc_owns(fb->primary, memory)) {
+        return sc_realloc(fb->fallback, memory, old_size, new_size);
+    }
+
+    void *resized = sc_realloc(fb->primary, memory, old_size, new_size);
+    if (resized) {
+        return resized;
+    }
+
+    // The primary allocator is full, the memory moves over to the fallback one.
+    resized = sc_alloc(fb->fallback, new_size);
+    if (resized && memory) {
+        memcpy(resized, memory, old_size < new_size ? old_size : new_size);
+        sc_free(fb->primary, memory);
+    }
+    return resized;
+}
+
+static bool fallback_owns(sc_fallback *fb, void *memory) {
+    return sc_owns(fb->primary, memory) || sc_owns(fb->fallback, memory);
+}
+
+sc_allocator make_fallback_alloc(sc_fallback *fb, sc_allocator *primary, sc_allocator *fallback) {
+    fallback_init(fb, primary, fallback);
+
+    return make_alloc_from_fallback(fb);
+}
+
+sc_allocator make_alloc_from_fallback(sc_fallback *fb) {
+    // We can only tell if the fallback allocator can.
+    return (sc_allocator) { .alloc = (alloc_func)fallback_alloc, .free = (free_func)fallback_free, .destroy = (destroy_func)fallback_destroy,
+                            .resize = (resize_func)fallback_resize, .owns = fb->fallback->owns ? (owns_func)fallback_owns : NULL, .state = (void*)fb };
+}
+
+#undef UNUSED
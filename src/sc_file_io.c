@@ -1,229 +1,1383 @@
-#include <sc_file_io.h>
-#include <string.h>
-
-#ifdef _WIN32
-    const char separator = '\\';
-#else
-    const char separator = '/';
-#endif
-
-// Combines an absolute and a relative path
-// Returns bytes written to 'out' (including null terminator if present)
-size_t path_abs_rel_combine(const char *abs_path, const char *rel_path, size_t rel_len, char *out, size_t out_max_len) {
-    size_t abs_len = strlen(abs_path);
-    size_t write_size = out_max_len < abs_len ? out_max_len : abs_len;
-    size_t written = write_size;
-    // We do not use the _s (safe) version since we are doing the checking ourselves
-    strncpy(out, abs_path, write_size);
-
-    // We wrote as much as we can, get out.
-    if (written == out_max_len) {
-        return written;
-    }
-
-    if (abs_path[abs_len - 1] != separator) {
-        // Add separator
-        out[abs_len] = separator;
-        written++;
-    }
-
-    // Skip past the absolute path.
-    out += written;
-
-    // Maximum write size.
-    write_size = out_max_len - written;
-
-    // We can fit the relative length + null terminator
-    if (rel_len + 1 < write_size) {
-        write_size = rel_len + 1;
-    }
-
-    strncpy(out, rel_path, write_size - 1);
-    out[write_size] = '\0';
-    written += write_size;
-    return written;
-}
-
-void path_table_init(sc_path_table *table) {
-    table->capacity = PATH_TABLE_BLOCK_SIZE;
-    table->size = 0;
-    table->memory = malloc(PATH_TABLE_BLOCK_SIZE * sizeof(char *));
-}
-
-void path_table_add(sc_path_table *table, const char *path) {
-    if (table->size >= table->capacity) {
-        // We need to reallocate.
-        table->capacity += PATH_TABLE_BLOCK_SIZE;
-        table->memory = realloc(table->memory, table->capacity * sizeof(char *));
-    }
-
-    table->memory[table->size++] = path;
-}
-
-void path_table_destroy(sc_path_table *table) {
-    table->capacity = table->size = 0;
-    free(table->memory);
-    table->memory = NULL;
-}
-
-bool path_table_lookup(sc_path_table *table, const char *relative_path, char *absolute_path, size_t absolute_max_len) {
-    if (table->size == 0) {
-        return false;
-    }
-
-    size_t rel_len = strlen(relative_path);
-
-    for (size_t i = 0; i < table->size; ++i) {
-        const char *current_path = table->memory[i];
-
-        // size_t path_abs_rel_combine(const char *abs_path, size_t abs_len, const char *rel_path, size_t rel_len, char *out, size_t out_max_len)
-        char combined_path[FILENAME_MAX];
-        size_t combined_len = path_abs_rel_combine(current_path, relative_path, rel_len, combined_path, FILENAME_MAX);
-
-        assert(combined_len <= FILENAME_MAX);
-        assert(combined_path[combined_len] == '\0');
-
-        // Check if that file exists
-        FILE *fhandle = fopen(combined_path, "r");
-        if (fhandle) {
-            // File exists, we found it guys!
-            fclose(fhandle);
-
-            size_t copied_chars = combined_len > absolute_max_len ? absolute_max_len : combined_len;
-            strncpy(absolute_path, combined_path, copied_chars);
-            return true;
-        }
-    }
-
-    return false;
-}
-
-void file_load(sc_file *file, char *abs_path, sc_allocator *alloc) {
-    FILE *stream =  fopen(abs_path, "r");
-
-    if (!stream) {
-        file->contents = NULL;
-        file->size = 0L;
-        file->alloc = NULL;
-        file->abs_path = NULL;
-        return;
-    }
-
-    file->abs_path = abs_path;
-
-    fseek(stream, 0L, SEEK_END);
-    file->size = ftell(stream);
-    rewind(stream);
-
-    file->alloc = alloc;
-    file->contents = sc_alloc(alloc, file->size + 1);
-
-    fread(file->contents, 1, file->size, stream);
-    file->contents[file->size] = '\0';
-
-    fclose(stream);
-}
-
-void file_destroy(sc_file *file) {
-    sc_free(file->alloc, file->contents);
-    file->size = 0L;
-    file->alloc = NULL;
-    file->contents = NULL;
-    file->abs_path = NULL;
-}
-
-void file_cache_init(sc_file_cache *cache, sc_allocator *alloc) {
-    cache->alloc = alloc;
-    cache->size = 0;
-    cache->capacity = FILE_CACHE_BLOCK_SIZE;
-
-    cache->files = malloc(FILE_CACHE_BLOCK_SIZE * sizeof(sc_file));
-}
-
-sc_file_cache_handle file_cache_load(sc_file_cache *cache, const char *abs_path) {
-    for (size_t i = 0; i < cache->size; ++i) {
-        // Look up wether we already own this file.
-        if (!strcmp(cache->files[i].abs_path, abs_path)) {
-            // Already have it!
-            return (sc_file_cache_handle) { .cache = cache, .index = i };
-        }
-    }
-
-    // Ok, we need to add the file.
-    if (cache->size >= cache->capacity) {
-        // Need to reallocate.
-        cache->capacity += FILE_CACHE_BLOCK_SIZE;
-        cache->files = realloc(cache->files, cache->capacity * sizeof(sc_file));
-    }
-
-    // We will use our allocator to keep the absolute path.
-    size_t path_len = strlen(abs_path);
-    char *new_abs_path = sc_alloc(cache->alloc, path_len + 1);
-    strncpy(new_abs_path, abs_path, path_len);
-    new_abs_path[path_len] = '\0';
-
-    file_load(&cache->files[cache->size++], new_abs_path, cache->alloc);
-    if (!cache->files[cache->size - 1].contents) {
-        cache->size--;
-        // File does not exist.
-        return (sc_file_cache_handle) { .cache = NULL, .index = 0 };
-    }
-
-    return (sc_file_cache_handle) { .cache = cache, .index = cache->size - 1 };
-}
-
-// This simply unloads the file memory (destroys the sc_file), doesn't rearange things.
-void file_cache_unload(sc_file_cache *cache, const char *abs_path) {
-    for (size_t i = 0; i < cache->size; ++i) {
-        // Look up wether we already own this file.
-        if (!strcmp(cache->files[i].abs_path, abs_path)) {
-            // Already have it!
-            sc_free(cache->alloc, cache->files[i].abs_path);
-            file_destroy(&cache->files[i]);
-        }
-    }
-}
-
-void file_cache_destroy(sc_file_cache *cache) {
-    // Destroy all our files
-    for (size_t i = 0; i < cache->size; ++i) {
-        sc_free(cache->alloc, cache->files[i].abs_path);
-        file_destroy(&cache->files[i]);
-    }
-
-    cache->size = 0;
-    cache->capacity = 0;
-    free(cache->files);
-    cache->files = NULL;
-    cache->alloc = NULL;
-}
-
-sc_file *handle_to_file(sc_file_cache_handle handle) {
-    return &handle.cache->files[handle.index];
-}
-
-// TODO: WE NEED SEPARATOR CONVERSION TO '/' (for win32)
-
-void get_relative_path_from_file(const char *absolute_path, const char *relative_path, char *out, size_t out_max_len) {
-    // Right
-    // Let's copy up to our last directory separator.
-    // (actually, let's find it first :P)
-    size_t abs_len = strlen(absolute_path), rel_len = strlen(relative_path);
-    size_t last_sep_index = 0;
-    for (size_t i = 0; i < abs_len; i++) {
-        if (absolute_path[i] == separator) {
-            last_sep_index = i;
-        }
-    }
-
-    // Copy up to there (including that character).
-    // "abc/" -> lsi = 3
-    size_t written = last_sep_index + 1 < out_max_len ? last_sep_index + 1 : out_max_len;
-    strncpy(out, absolute_path, written);
-
-    if (written == out_max_len) return;
-
-    out += written;
-    written = rel_len + 1 > (out_max_len - written) ? out_max_len - written : rel_len + 1;
-    strncpy(out, relative_path, written);
-}
+#ifndef _WIN32
+    // For openat and friends, and MAP_POPULATE/MAP_ANONYMOUS.
+    #define _POSIX_C_SOURCE 200809L
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <sc_file_io.h>
+#include <sc_prefetch.h>
+#include <sc_vfs.h>
+#include <sc_hash.h>
+#include <sc_utf8.h>
+#include <string.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#ifdef _WIN32
+    const char separator = '\\';
+#else
+    const char separator = '/';
+#endif
+
+// Combines an absolute and a relative path
+// Returns bytes written to 'out' (including null terminator if present)
+size_t path_abs_rel_combine(const char *abs_path, const char *rel_path, size_t rel_len, char *out, size_t out_max_len) {
+    size_t abs_len = strlen(abs_path);
+    size_t write_size = out_max_len < abs_len ? out_max_len : abs_len;
+    size_t written = write_size;
+    // We do not use the _s (safe) version since we are doing the checking ourselves
+    strncpy(out, abs_path, write_size);
+
+    // We wrote as much as we can, get out.
+    if (written == out_max_len) {
+        return written;
+    }
+
+    if (abs_path[abs_len - 1] != separator) {
+        // Add separator
+        out[abs_len] = separator;
+        written++;
+    }
+
+    // Skip past the absolute path.
+    out += written;
+
+    // Maximum write size.
+    write_size = out_max_len - written;
+
+    // We can fit the relative length + null terminator
+    if (rel_len + 1 < write_size) {
+        write_size = rel_len + 1;
+    }
+
+    strncpy(out, rel_path, write_size - 1);
+    out[write_size - 1] = '\0';
+    written += write_size;
+    return written;
+}
+
+// Directory handle that has not been opened yet.
+#define DIRECTORY_NOT_OPENED -2
+
+void path_table_init(sc_path_table *table) {
+    table->capacity = PATH_TABLE_BLOCK_SIZE;
+    table->size = 0;
+    table->memory = malloc(PATH_TABLE_BLOCK_SIZE * sizeof(char *));
+    table->directory_fds = malloc(PATH_TABLE_BLOCK_SIZE * sizeof(int));
+
+    table->lookup_cache.capacity = PATH_LOOKUP_CACHE_SIZE;
+    table->lookup_cache.size = 0;
+    table->lookup_cache.hits = 0;
+    table->lookup_cache.misses = 0;
+    table->lookup_cache.entries = calloc(PATH_LOOKUP_CACHE_SIZE, sizeof(sc_path_lookup_entry));
+
+    table->vfs = NULL;
+}
+
+void path_table_add(sc_path_table *table, const char *path) {
+    if (table->size >= table->capacity) {
+        // We need to reallocate.
+        table->capacity += PATH_TABLE_BLOCK_SIZE;
+        table->memory = realloc(table->memory, table->capacity * sizeof(char *));
+        table->directory_fds = realloc(table->directory_fds, table->capacity * sizeof(int));
+    }
+
+    table->directory_fds[table->size] = DIRECTORY_NOT_OPENED;
+    table->memory[table->size++] = path;
+}
+
+void path_table_clear_cache(sc_path_table *table) {
+    for (size_t i = 0; i < table->lookup_cache.capacity; i++) {
+        free(table->lookup_cache.entries[i].relative_path);
+        table->lookup_cache.entries[i].relative_path = NULL;
+    }
+
+    table->lookup_cache.size = 0;
+}
+
+void path_table_destroy(sc_path_table *table) {
+    path_table_clear_cache(table);
+    free(table->lookup_cache.entries);
+    table->lookup_cache.entries = NULL;
+    table->lookup_cache.capacity = 0;
+
+    #ifndef _WIN32
+        for (size_t i = 0; i < table->size; i++) {
+            if (table->directory_fds[i] >= 0) {
+                close(table->directory_fds[i]);
+            }
+        }
+    #endif
+
+    table->capacity = table->size = 0;
+    free(table->memory);
+    free(table->directory_fds);
+    table->memory = NULL;
+    table->directory_fds = NULL;
+}
+
+// FNV-1a over the directory index and the relative path.
+static size_t lookup_hash(size_t directory, const char *relative_path, size_t rel_len) {
+    return sc_fnv1a(relative_path, rel_len, sc_fnv1a(&directory, sizeof(directory), SC_FNV_OFFSET));
+}
+
+// Returns the entry matching the key or the empty slot where it should be inserted.
+// The capacity is a power of two and the cache is never full, so linear probing always terminates.
+static sc_path_lookup_entry *lookup_cache_find(sc_path_table *table, size_t directory, const char *relative_path, size_t hash) {
+    size_t mask = table->lookup_cache.capacity - 1;
+    size_t index = hash & mask;
+
+    while (true) {
+        sc_path_lookup_entry *entry = &table->lookup_cache.entries[index];
+        if (!entry->relative_path) {
+            return entry;
+        }
+
+        if (entry->hash == hash && entry->directory == directory && !strcmp(entry->relative_path, relative_path)) {
+            return entry;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Keeps the load factor under 1/2.
+static void lookup_cache_reserve_one(sc_path_table *table) {
+    if ((table->lookup_cache.size + 1) * 2 <= table->lookup_cache.capacity) {
+        return;
+    }
+
+    sc_path_lookup_entry *old_entries = table->lookup_cache.entries;
+    size_t old_capacity = table->lookup_cache.capacity;
+
+    table->lookup_cache.capacity *= 2;
+    table->lookup_cache.entries = calloc(table->lookup_cache.capacity, sizeof(sc_path_lookup_entry));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].relative_path) {
+            *lookup_cache_find(table, old_entries[i].directory, old_entries[i].relative_path, old_entries[i].hash) = old_entries[i];
+        }
+    }
+
+    free(old_entries);
+}
+
+// Actually asks the filesystem.
+static bool directory_has_file(sc_path_table *table, size_t directory, const char *relative_path, size_t rel_len) {
+    #ifndef _WIN32
+        // We keep the directories open and probe relative to them, so the kernel doesn't have to walk the directory's path every time.
+        if (table->directory_fds[directory] == DIRECTORY_NOT_OPENED) {
+            table->directory_fds[directory] = open(table->memory[directory], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+
+        int dir_fd = table->directory_fds[directory];
+        if (dir_fd < 0) {
+            return false;
+        }
+
+        int fd = openat(dir_fd, relative_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        // Directories open just fine, but we can't include them.
+        struct stat info;
+        bool is_file = fstat(fd, &info) == 0 && !S_ISDIR(info.st_mode);
+        close(fd);
+        return is_file;
+    #else
+        char combined_path[FILENAME_MAX];
+        path_abs_rel_combine(table->memory[directory], relative_path, rel_len, combined_path, FILENAME_MAX);
+
+        FILE *fhandle = fopen(combined_path, "r");
+        if (fhandle) {
+            fclose(fhandle);
+            return true;
+        }
+        return false;
+    #endif
+}
+
+bool path_table_lookup(sc_path_table *table, const char *relative_path, char *absolute_path, size_t absolute_max_len) {
+    if (table->size == 0) {
+        return false;
+    }
+
+    size_t rel_len = strlen(relative_path);
+
+    for (size_t i = 0; i < table->size; ++i) {
+        if (table->vfs && table->vfs->size > 0) {
+            char combined_path[FILENAME_MAX];
+            char normalized[FILENAME_MAX];
+            path_abs_rel_combine(table->memory[i], relative_path, rel_len, combined_path, FILENAME_MAX);
+            size_t normalized_len = path_normalize(combined_path, normalized, FILENAME_MAX);
+
+            if (vfs_find(table->vfs, normalized)) {
+                size_t copied_chars = normalized_len > absolute_max_len ? absolute_max_len : normalized_len;
+                strncpy(absolute_path, normalized, copied_chars);
+                return true;
+            }
+        }
+
+        size_t hash = lookup_hash(i, relative_path, rel_len);
+
+        lookup_cache_reserve_one(table);
+        sc_path_lookup_entry *entry = lookup_cache_find(table, i, relative_path, hash);
+
+        if (entry->relative_path) {
+            table->lookup_cache.hits++;
+        } else {
+            table->lookup_cache.misses++;
+
+            entry->relative_path = malloc(rel_len + 1);
+            memcpy(entry->relative_path, relative_path, rel_len + 1);
+            entry->directory = i;
+            entry->hash = hash;
+            entry->exists = directory_has_file(table, i, relative_path, rel_len);
+            table->lookup_cache.size++;
+        }
+
+        if (!entry->exists) {
+            continue;
+        }
+
+        const char *current_path = table->memory[i];
+
+        char combined_path[FILENAME_MAX];
+        size_t combined_len = path_abs_rel_combine(current_path, relative_path, rel_len, combined_path, FILENAME_MAX);
+
+        assert(combined_len <= FILENAME_MAX);
+        assert(combined_path[combined_len - 1] == '\0');
+
+        // File exists, we found it guys!
+        size_t copied_chars = combined_len > absolute_max_len ? absolute_max_len : combined_len;
+        strncpy(absolute_path, combined_path, copied_chars);
+        return true;
+    }
+
+    return false;
+}
+
+#undef DIRECTORY_NOT_OPENED
+
+void path_table_use_vfs(sc_path_table *table, struct sc_vfs *vfs) {
+    table->vfs = vfs;
+}
+
+static void file_init(sc_file *file, char *abs_path, sc_allocator *alloc) {
+    file->abs_path = abs_path;
+    file->alloc = alloc;
+    file->mapped_size = 0;
+    file->external = false;
+    file->identity.known = false;
+    file->hashed = false;
+    file->lexed.data = NULL;
+    file->lexed.size = 0;
+    file->lexed.destroy = NULL;
+}
+
+static void file_not_found(sc_file *file) {
+    file->contents = NULL;
+    file->size = 0L;
+    file->alloc = NULL;
+    file->abs_path = NULL;
+    file->mapped_size = 0;
+    file->external = false;
+}
+
+static void file_check_utf8(sc_file *file, int flags) {
+    file->utf8_error = (size_t)file->size;
+    file->utf8_reported = false;
+    if (!(flags & FILE_LOAD_UTF8)) {
+        return;
+    }
+
+    // The fast kernels only say whether there is an error, finding it is slower but we only do that once.
+    if (sc_utf8_validate(file->contents, file->size) == SC_UTF8_INVALID) {
+        file->utf8_error = sc_utf8_find_error(file->contents, file->size);
+    }
+}
+
+#ifdef _WIN32
+
+void file_load_with(sc_file *file, char *abs_path, sc_allocator *alloc, int flags) {
+    FILE *stream =  fopen(abs_path, "rb");
+
+    if (!stream) {
+        file_not_found(file);
+        return;
+    }
+
+    file_init(file, abs_path, alloc);
+
+    fseek(stream, 0L, SEEK_END);
+    file->size = ftell(stream);
+    rewind(stream);
+
+    file->contents = sc_alloc(alloc, file->size + 1);
+
+    fread(file->contents, 1, file->size, stream);
+    file->contents[file->size] = '\0';
+
+    if (flags & FILE_LOAD_HASH) {
+        file->hash = sc_hash_bytes(file->contents, file->size);
+        file->hashed = true;
+    }
+    file_check_utf8(file, flags);
+
+    fclose(stream);
+}
+
+#else
+
+// Maps a regular file read only.
+// The bytes past the end of the file in its last page read as zero, which gives us the trailing NUL without copying anything.
+// If the file fills its last page exactly, we map it over a slightly larger anonymous (zero filled) mapping instead.
+static bool file_map(sc_file *file, int fd, size_t size, int flags) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    int map_flags = MAP_PRIVATE;
+    #ifdef MAP_POPULATE
+        if (flags & FILE_LOAD_POPULATE) {
+            map_flags |= MAP_POPULATE;
+        }
+    #endif
+
+    char *memory;
+    size_t mapped_size;
+    if (size % page_size != 0) {
+        mapped_size = size;
+        memory = mmap(NULL, size, PROT_READ, map_flags, fd, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+    } else {
+        mapped_size = size + page_size;
+        char *reserved = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+            return false;
+        }
+
+        memory = mmap(reserved, size, PROT_READ, map_flags | MAP_FIXED, fd, 0);
+        if (memory == MAP_FAILED) {
+            munmap(reserved, mapped_size);
+            return false;
+        }
+    }
+
+    if (flags & FILE_LOAD_SEQUENTIAL) {
+        posix_madvise(memory, size, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(memory, size, POSIX_MADV_WILLNEED);
+    }
+
+    file->contents = memory;
+    file->size = (long int)size;
+    file->mapped_size = mapped_size;
+
+    if (flags & FILE_LOAD_HASH) {
+        file->hash = sc_hash_bytes(memory, size);
+        file->hashed = true;
+    }
+    return true;
+}
+
+// Reads until EOF, for pipes and special files we can't know the size of in advance.
+// The content hash is computed as we go, while the data we just read is still in the cache.
+static bool file_read(sc_file *file, int fd, size_t size_hint, int flags) {
+    size_t capacity = size_hint > 0 ? size_hint + 1 : 4096;
+    size_t size = 0;
+    char *memory = sc_alloc(file->alloc, capacity);
+
+    sc_hash_state hash;
+    sc_hash_init(&hash);
+
+    while (true) {
+        if (size + 1 >= capacity) {
+            // Regular files are read up to the size they had when we opened them.
+            if (size_hint > 0) {
+                break;
+            }
+
+            memory = sc_realloc(file->alloc, memory, capacity, capacity * 2);
+            capacity *= 2;
+        }
+
+        ssize_t bytes = read(fd, memory + size, capacity - size - 1);
+        if (bytes < 0) {
+            sc_free(file->alloc, memory);
+            return false;
+        } else if (bytes == 0) {
+            break;
+        }
+
+        if (flags & FILE_LOAD_HASH) {
+            sc_hash_update(&hash, memory + size, (size_t)bytes);
+        }
+        size += (size_t)bytes;
+    }
+
+    memory[size] = '\0';
+    file->contents = memory;
+    file->size = (long int)size;
+
+    if (flags & FILE_LOAD_HASH) {
+        file->hash = sc_hash_final(&hash);
+        file->hashed = true;
+    }
+    return true;
+}
+
+void file_load_with(sc_file *file, char *abs_path, sc_allocator *alloc, int flags) {
+    int fd = open(abs_path, O_RDONLY);
+
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || S_ISDIR(info.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        file_not_found(file);
+        return;
+    }
+
+    file_init(file, abs_path, alloc);
+    file->identity.device = (unsigned long long)info.st_dev;
+    file->identity.inode = (unsigned long long)info.st_ino;
+    file->identity.known = true;
+
+    bool regular = S_ISREG(info.st_mode);
+    size_t size = regular ? (size_t)info.st_size : 0;
+
+    bool loaded = false;
+    if ((flags & FILE_LOAD_MMAP) && regular && size >= FILE_MMAP_THRESHOLD) {
+        loaded = file_map(file, fd, size, flags);
+    }
+
+    if (loaded || file_read(file, fd, size, flags)) {
+        file_check_utf8(file, flags);
+    } else {
+        file_not_found(file);
+    }
+
+    close(fd);
+}
+
+#endif
+
+void file_load(sc_file *file, char *abs_path, sc_allocator *alloc) {
+    file_load_with(file, abs_path, alloc, FILE_LOAD_DEFAULT);
+}
+
+void file_load_memory(sc_file *file, char *abs_path, const char *contents, size_t size, int flags) {
+    assert(contents[size] == '\0');
+
+    file_init(file, abs_path, NULL);
+    file->external = true;
+    // Never written to, like mapped contents.
+    file->contents = (char *)contents;
+    file->size = (long int)size;
+
+    if (flags & FILE_LOAD_HASH) {
+        file->hash = sc_hash_bytes(contents, size);
+        file->hashed = true;
+    }
+    file_check_utf8(file, flags);
+}
+
+void file_destroy(sc_file *file) {
+    if (file->lexed.data) {
+        file->lexed.destroy(file->lexed.data);
+        file->lexed.data = NULL;
+        file->lexed.size = 0;
+    }
+
+    // Files sharing another file's contents have none of their own.
+    if (file->contents && !file->external) {
+        #ifndef _WIN32
+            if (file->mapped_size != 0) {
+                munmap(file->contents, file->mapped_size);
+            } else {
+                sc_free(file->alloc, file->contents);
+            }
+        #else
+            sc_free(file->alloc, file->contents);
+        #endif
+    }
+    file->mapped_size = 0;
+    file->size = 0L;
+    file->alloc = NULL;
+    file->contents = NULL;
+    file->abs_path = NULL;
+}
+
+size_t path_normalize(const char *path, char *out, size_t out_max_len) {
+    if (out_max_len == 0) {
+        return 0;
+    }
+
+    size_t written = 0;
+    if (*path == separator) {
+        out[written++] = separator;
+    }
+
+    const char *c = path;
+    while (*c) {
+        while (*c == separator) c++;
+
+        const char *component = c;
+        while (*c && *c != separator) c++;
+
+        size_t len = c - component;
+        if (len == 0 || (len == 1 && *component == '.')) {
+            continue;
+        }
+
+        bool needs_separator = written > 0 && out[written - 1] != separator;
+        if (written + needs_separator + len + 1 > out_max_len) {
+            break;
+        }
+
+        if (needs_separator) {
+            out[written++] = separator;
+        }
+        memcpy(out + written, component, len);
+        written += len;
+    }
+
+    if (written == 0 && out_max_len > 1) {
+        out[written++] = '.';
+    }
+
+    out[written] = '\0';
+    return written + 1;
+}
+
+static size_t identity_hash(unsigned long long device, unsigned long long inode) {
+    unsigned long long hash = (inode ^ (device << 32 | device >> 32)) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash ^ hash >> 29);
+}
+
+// Returns the entry for the path or the empty slot where it belongs.
+static sc_file_cache_path *path_index_find(sc_file_cache *cache, const char *path, size_t hash) {
+    size_t mask = cache->paths.capacity - 1;
+    size_t index = hash & mask;
+
+    while (true) {
+        sc_file_cache_path *entry = &cache->paths.entries[index];
+        if (!entry->path || (entry->hash == hash && !strcmp(entry->path, path))) {
+            return entry;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Returns the slot of the file with that identity or the empty slot where it belongs.
+static size_t *identity_index_find(sc_file_cache *cache, unsigned long long device, unsigned long long inode) {
+    size_t mask = cache->identities.capacity - 1;
+    size_t index = identity_hash(device, inode) & mask;
+
+    while (true) {
+        size_t *slot = &cache->identities.slots[index];
+        if (*slot == 0) {
+            return slot;
+        }
+
+        sc_file *file = &cache->files[*slot - 1];
+        if (file->identity.device == device && file->identity.inode == inode) {
+            return slot;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Returns the slot of the file owning contents with that hash or the empty slot where it belongs.
+static size_t *content_index_find(sc_file_cache *cache, sc_hash128 hash) {
+    size_t mask = cache->contents.capacity - 1;
+    size_t index = (size_t)hash.low & mask;
+
+    while (true) {
+        size_t *slot = &cache->contents.slots[index];
+        if (*slot == 0 || sc_hash_equals(cache->files[*slot - 1].hash, hash)) {
+            return slot;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Rebuilds the indices with room for at least one more entry, leaving out everything that belongs to file 'dropped'.
+// Removing a file is rare enough that we don't bother with deletion in place.
+static void file_cache_reindex(sc_file_cache *cache, size_t dropped) {
+    sc_file_cache_path *old_entries = cache->paths.entries;
+    size_t old_capacity = cache->paths.capacity;
+
+    while ((cache->paths.size + 1) * 2 > cache->paths.capacity) {
+        cache->paths.capacity *= 2;
+    }
+
+    cache->paths.entries = sc_calloc(cache->alloc, cache->paths.capacity, sizeof(sc_file_cache_path));
+    cache->paths.size = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old_entries[i].path) {
+            continue;
+        }
+
+        if (old_entries[i].file == dropped) {
+            sc_free(cache->alloc, old_entries[i].path);
+        } else {
+            *path_index_find(cache, old_entries[i].path, old_entries[i].hash) = old_entries[i];
+            cache->paths.size++;
+        }
+    }
+    sc_free(cache->alloc, old_entries);
+
+    size_t *old_slots = cache->identities.slots;
+    old_capacity = cache->identities.capacity;
+
+    while ((cache->identities.size + 1) * 2 > cache->identities.capacity) {
+        cache->identities.capacity *= 2;
+    }
+
+    cache->identities.slots = sc_calloc(cache->alloc, cache->identities.capacity, sizeof(size_t));
+    cache->identities.size = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != 0 && old_slots[i] - 1 != dropped) {
+            sc_file *file = &cache->files[old_slots[i] - 1];
+            *identity_index_find(cache, file->identity.device, file->identity.inode) = old_slots[i];
+            cache->identities.size++;
+        }
+    }
+    sc_free(cache->alloc, old_slots);
+
+    old_slots = cache->contents.slots;
+    old_capacity = cache->contents.capacity;
+
+    while ((cache->contents.size + 1) * 2 > cache->contents.capacity) {
+        cache->contents.capacity *= 2;
+    }
+
+    cache->contents.slots = sc_calloc(cache->alloc, cache->contents.capacity, sizeof(size_t));
+    cache->contents.size = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != 0 && old_slots[i] - 1 != dropped) {
+            *content_index_find(cache, cache->files[old_slots[i] - 1].hash) = old_slots[i];
+            cache->contents.size++;
+        }
+    }
+    sc_free(cache->alloc, old_slots);
+}
+
+static void path_index_add(sc_file_cache *cache, sc_file_cache_path *entry, const char *path, size_t hash, size_t file) {
+    size_t len = strlen(path);
+    entry->path = sc_alloc(cache->alloc, len + 1);
+    memcpy(entry->path, path, len + 1);
+    entry->hash = hash;
+    entry->file = file;
+    cache->paths.size++;
+}
+
+void file_cache_init(sc_file_cache *cache, sc_allocator *alloc) {
+    cache->alloc = alloc;
+    cache->size = 0;
+    cache->capacity = FILE_CACHE_BLOCK_SIZE;
+    cache->lexed_bytes = 0;
+    cache->lexed_budget = FILE_CACHE_LEXED_BUDGET;
+    cache->prefetcher = NULL;
+    cache->vfs = NULL;
+
+    cache->files = sc_alloc(alloc, FILE_CACHE_BLOCK_SIZE * sizeof(sc_file));
+
+    cache->paths.capacity = FILE_CACHE_INDEX_SIZE;
+    cache->paths.size = 0;
+    cache->paths.entries = sc_calloc(alloc, FILE_CACHE_INDEX_SIZE, sizeof(sc_file_cache_path));
+
+    cache->identities.capacity = FILE_CACHE_INDEX_SIZE;
+    cache->identities.size = 0;
+    cache->identities.slots = sc_calloc(alloc, FILE_CACHE_INDEX_SIZE, sizeof(size_t));
+
+    cache->contents.capacity = FILE_CACHE_INDEX_SIZE;
+    cache->contents.size = 0;
+    cache->contents.slots = sc_calloc(alloc, FILE_CACHE_INDEX_SIZE, sizeof(size_t));
+
+    cache->holes.memory = NULL;
+    cache->holes.size = 0;
+    cache->holes.capacity = 0;
+
+    cache->loaded_paths.memory = NULL;
+    cache->loaded_paths.size = 0;
+    cache->loaded_paths.capacity = 0;
+    cache->loaded_paths.slot_count = FILE_CACHE_INDEX_SIZE;
+    cache->loaded_paths.slots = sc_calloc(alloc, FILE_CACHE_INDEX_SIZE, sizeof(size_t));
+
+    cache->bytes = 0;
+    cache->budget = FILE_CACHE_BUDGET;
+    cache->clock_hand = 0;
+    cache->next_id = 0;
+
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->deduplicated = 0;
+}
+
+#define NO_FILE ((size_t)-1)
+
+// Returns the slot of 'path' in the loaded path index or the empty slot where it belongs.
+static size_t *loaded_path_find(sc_file_cache *cache, const char *path, size_t hash) {
+    size_t mask = cache->loaded_paths.slot_count - 1;
+    size_t index = hash & mask;
+
+    while (true) {
+        size_t *slot = &cache->loaded_paths.slots[index];
+        if (*slot == 0 || !strcmp(cache->loaded_paths.memory[*slot - 1], path)) {
+            return slot;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Keeps the path of a file we just loaded, 'path' must be allocated with the cache allocator and not be in the list yet.
+static void loaded_path_add(sc_file_cache *cache, char *path, size_t hash) {
+    if ((cache->loaded_paths.size + 1) * 2 > cache->loaded_paths.slot_count) {
+        sc_free(cache->alloc, cache->loaded_paths.slots);
+        cache->loaded_paths.slot_count *= 2;
+        cache->loaded_paths.slots = sc_calloc(cache->alloc, cache->loaded_paths.slot_count, sizeof(size_t));
+        for (size_t i = 0; i < cache->loaded_paths.size; i++) {
+            const char *loaded = cache->loaded_paths.memory[i];
+            *loaded_path_find(cache, loaded, sc_fnv1a_string(loaded)) = i + 1;
+        }
+    }
+
+    if (cache->loaded_paths.size >= cache->loaded_paths.capacity) {
+        size_t old_capacity = cache->loaded_paths.capacity;
+        cache->loaded_paths.capacity = old_capacity == 0 ? 16 : old_capacity * 2;
+        cache->loaded_paths.memory = sc_realloc(cache->alloc, cache->loaded_paths.memory, old_capacity * sizeof(char *),
+                                                cache->loaded_paths.capacity * sizeof(char *));
+    }
+
+    *loaded_path_find(cache, path, hash) = cache->loaded_paths.size + 1;
+    cache->loaded_paths.memory[cache->loaded_paths.size++] = path;
+}
+
+// Unloads a file, leaving a hole.
+static void file_cache_drop(sc_file_cache *cache, size_t index) {
+    sc_file *file = &cache->files[index];
+    file_cache_reindex(cache, index);
+
+    if (file->content_owner != 0) {
+        cache->files[file->content_owner - 1].pins--;
+        file->contents = NULL;
+    } else if (!file->external) {
+        cache->bytes -= file->size;
+    }
+    cache->lexed_bytes -= file->lexed.size;
+
+    if (cache->holes.size >= cache->holes.capacity) {
+        size_t old_capacity = cache->holes.capacity;
+        cache->holes.capacity = old_capacity == 0 ? 16 : old_capacity * 2;
+        cache->holes.memory = sc_realloc(cache->alloc, cache->holes.memory, old_capacity * sizeof(size_t), cache->holes.capacity * sizeof(size_t));
+    }
+    cache->holes.memory[cache->holes.size++] = index;
+
+    file_destroy(file);
+}
+
+// Evicts unpinned files that were not used recently until we are under budget, never evicting 'keep'.
+static void file_cache_evict(sc_file_cache *cache, size_t keep) {
+    // Two turns of the clock are enough to clear every reference bit and then evict everything we can.
+    for (size_t steps = 0; steps < 2 * cache->size && cache->bytes + cache->lexed_bytes > cache->budget; steps++) {
+        size_t index = cache->clock_hand;
+        cache->clock_hand = (cache->clock_hand + 1) % cache->size;
+
+        sc_file *file = &cache->files[index];
+        if (!file->abs_path || file->pins > 0 || index == keep) {
+            continue;
+        }
+
+        if (file->referenced) {
+            file->referenced = false;
+            continue;
+        }
+
+        file_cache_drop(cache, index);
+        cache->evictions++;
+    }
+}
+
+sc_file_cache_handle file_cache_load(sc_file_cache *cache, const char *abs_path) {
+    char normalized[FILENAME_MAX];
+    path_normalize(abs_path, normalized, FILENAME_MAX);
+    size_t hash = sc_fnv1a_string(normalized);
+
+    if ((cache->paths.size + 1) * 2 > cache->paths.capacity || (cache->identities.size + 1) * 2 > cache->identities.capacity
+        || (cache->contents.size + 1) * 2 > cache->contents.capacity) {
+        file_cache_reindex(cache, NO_FILE);
+    }
+
+    sc_file_cache_path *entry = path_index_find(cache, normalized, hash);
+    if (entry->path) {
+        // Already have it!
+        cache->hits++;
+        cache->files[entry->file].referenced = true;
+        return (sc_file_cache_handle) { .cache = cache, .index = entry->file };
+    }
+
+    // In-memory files shadow the disk, whether or not there is a file there.
+    sc_vfs_file *memory_file = cache->vfs ? vfs_find(cache->vfs, normalized) : NULL;
+
+    #ifndef _WIN32
+        if (!memory_file) {
+            // A different spelling of a file we already have (other relative path, symlink).
+            struct stat info;
+            if (stat(normalized, &info) != 0 || S_ISDIR(info.st_mode)) {
+                return (sc_file_cache_handle) { .cache = NULL, .index = 0 };
+            }
+
+            size_t *slot = identity_index_find(cache, (unsigned long long)info.st_dev, (unsigned long long)info.st_ino);
+            if (*slot != 0) {
+                cache->hits++;
+                cache->files[*slot - 1].referenced = true;
+                path_index_add(cache, entry, normalized, hash, *slot - 1);
+                return (sc_file_cache_handle) { .cache = cache, .index = *slot - 1 };
+            }
+        }
+    #endif
+
+    // Ok, we need to add the file, in a hole if we have one.
+    size_t index;
+    if (cache->holes.size > 0) {
+        index = cache->holes.memory[--cache->holes.size];
+    } else {
+        if (cache->size >= cache->capacity) {
+            // Need to reallocate.
+            cache->capacity += FILE_CACHE_BLOCK_SIZE;
+            cache->files = sc_realloc(cache->alloc, cache->files, (cache->capacity - FILE_CACHE_BLOCK_SIZE) * sizeof(sc_file),
+                                      cache->capacity * sizeof(sc_file));
+        }
+
+        index = cache->size++;
+        cache->files[index].abs_path = NULL;
+    }
+
+    // We will use our allocator to keep the absolute path, unless we already have it from an evicted file.
+    size_t *loaded_slot = loaded_path_find(cache, normalized, hash);
+    bool new_path = *loaded_slot == 0;
+    char *new_abs_path;
+    if (new_path) {
+        size_t path_len = strlen(normalized);
+        new_abs_path = sc_alloc(cache->alloc, path_len + 1);
+        memcpy(new_abs_path, normalized, path_len + 1);
+    } else {
+        new_abs_path = cache->loaded_paths.memory[*loaded_slot - 1];
+    }
+
+    sc_file *file = &cache->files[index];
+    if (memory_file) {
+        file_load_memory(file, new_abs_path, memory_file->contents, memory_file->size, FILE_LOAD_DEFAULT);
+
+        if (cache->prefetcher) {
+            prefetcher_scan(cache->prefetcher, file);
+        }
+    } else if (cache->prefetcher && prefetcher_take(cache->prefetcher, normalized, file)) {
+        // Prefetched files use the prefetcher's allocator, the file keeps track of that for its contents.
+        file->abs_path = new_abs_path;
+    } else {
+        file_load(file, new_abs_path, cache->alloc);
+        if (!file->contents) {
+            if (new_path) {
+                sc_free(cache->alloc, new_abs_path);
+            }
+
+            // Give the slot back.
+            if (index == cache->size - 1) {
+                cache->size--;
+            } else {
+                cache->holes.size++;
+            }
+
+            // File does not exist.
+            return (sc_file_cache_handle) { .cache = NULL, .index = 0 };
+        }
+
+        if (cache->prefetcher) {
+            prefetcher_scan(cache->prefetcher, file);
+        }
+    }
+
+    cache->misses++;
+    file->id = cache->next_id++;
+    file->pins = 0;
+    file->referenced = true;
+    file->content_owner = 0;
+
+    // In-memory contents can go away with their file, nobody else may use them.
+    if (file->hashed && !file->external) {
+        size_t *slot = content_index_find(cache, file->hash);
+        sc_file *owner = *slot != 0 ? &cache->files[*slot - 1] : NULL;
+
+        if (owner && owner->size == file->size && !memcmp(owner->contents, file->contents, file->size)) {
+            // Same contents as a file we have, use those.
+            // Destroying the file here is fine, it has no lexed data yet and the path is kept separately.
+            char *path = file->abs_path;
+            file_destroy(file);
+            file->abs_path = path;
+            file->contents = owner->contents;
+            file->size = owner->size;
+            file->alloc = owner->alloc;
+
+            file->content_owner = *slot;
+            owner->pins++;
+            cache->deduplicated++;
+        } else if (!owner) {
+            *slot = index + 1;
+            cache->contents.size++;
+        }
+    }
+
+    if (file->content_owner == 0 && !file->external) {
+        cache->bytes += file->size;
+    }
+
+    path_index_add(cache, entry, normalized, hash, index);
+    if (new_path) {
+        loaded_path_add(cache, new_abs_path, hash);
+    }
+
+    if (file->identity.known) {
+        size_t *slot = identity_index_find(cache, file->identity.device, file->identity.inode);
+        // The file could have been replaced since we looked at it, then we just don't index it by identity.
+        if (*slot == 0) {
+            *slot = index + 1;
+            cache->identities.size++;
+        }
+    }
+
+    // Only now that the file is indexed, since eviction rebuilds the indices.
+    file_cache_evict(cache, index);
+
+    return (sc_file_cache_handle) { .cache = cache, .index = index };
+}
+
+// This simply unloads the file memory (destroys the sc_file), doesn't rearange things.
+// Handles to other files stay valid.
+void file_cache_unload(sc_file_cache *cache, const char *abs_path) {
+    char normalized[FILENAME_MAX];
+    path_normalize(abs_path, normalized, FILENAME_MAX);
+
+    sc_file_cache_path *entry = path_index_find(cache, normalized, sc_fnv1a_string(normalized));
+    if (!entry->path) {
+        return;
+    }
+
+    assert(cache->files[entry->file].pins == 0);
+    file_cache_drop(cache, entry->file);
+}
+
+void file_cache_destroy(sc_file_cache *cache) {
+    // Destroy all our files, skipping unloaded ones.
+    for (size_t i = 0; i < cache->size; ++i) {
+        if (cache->files[i].abs_path) {
+            if (cache->files[i].content_owner != 0) {
+                cache->files[i].contents = NULL;
+            }
+
+            file_destroy(&cache->files[i]);
+        }
+    }
+
+    // Paths of loaded and unloaded files alike.
+    for (size_t i = 0; i < cache->loaded_paths.size; i++) {
+        sc_free(cache->alloc, cache->loaded_paths.memory[i]);
+    }
+    if (cache->loaded_paths.memory) {
+        sc_free(cache->alloc, cache->loaded_paths.memory);
+    }
+    sc_free(cache->alloc, cache->loaded_paths.slots);
+    if (cache->holes.memory) {
+        sc_free(cache->alloc, cache->holes.memory);
+    }
+    cache->loaded_paths.memory = NULL;
+    cache->loaded_paths.slots = NULL;
+    cache->holes.memory = NULL;
+    cache->loaded_paths.size = cache->loaded_paths.capacity = cache->loaded_paths.slot_count = 0;
+    cache->holes.size = cache->holes.capacity = 0;
+
+    for (size_t i = 0; i < cache->paths.capacity; i++) {
+        if (cache->paths.entries[i].path) {
+            sc_free(cache->alloc, cache->paths.entries[i].path);
+        }
+    }
+    sc_free(cache->alloc, cache->paths.entries);
+    sc_free(cache->alloc, cache->identities.slots);
+    sc_free(cache->alloc, cache->contents.slots);
+    cache->paths.entries = NULL;
+    cache->identities.slots = NULL;
+    cache->contents.slots = NULL;
+    cache->contents.size = cache->contents.capacity = 0;
+    cache->paths.size = cache->paths.capacity = 0;
+    cache->identities.size = cache->identities.capacity = 0;
+
+    cache->size = 0;
+    cache->capacity = 0;
+    cache->bytes = 0;
+    cache->lexed_bytes = 0;
+    sc_free(cache->alloc, cache->files);
+    cache->files = NULL;
+    cache->alloc = NULL;
+}
+
+bool file_cache_get_hash(sc_file_cache_handle handle, sc_hash128 *hash) {
+    sc_file *file = handle_to_file(handle);
+    if (!file->hashed) {
+        return false;
+    }
+
+    *hash = file->hash;
+    return true;
+}
+
+sc_file_cache_handle file_cache_find_contents(sc_file_cache *cache, sc_hash128 hash) {
+    size_t slot = *content_index_find(cache, hash);
+    if (slot == 0) {
+        return (sc_file_cache_handle) { .cache = NULL, .index = 0 };
+    }
+
+    return (sc_file_cache_handle) { .cache = cache, .index = slot - 1 };
+}
+
+void file_cache_set_budget(sc_file_cache *cache, size_t budget) {
+    cache->budget = budget;
+    file_cache_evict(cache, NO_FILE);
+}
+
+void file_cache_pin(sc_file_cache_handle handle) {
+    handle_to_file(handle)->pins++;
+}
+
+void file_cache_unpin(sc_file_cache_handle handle) {
+    sc_file *file = handle_to_file(handle);
+    assert(file->pins > 0);
+    file->pins--;
+}
+
+#undef NO_FILE
+
+void file_cache_use_prefetcher(sc_file_cache *cache, struct sc_prefetcher *prefetcher) {
+    cache->prefetcher = prefetcher;
+}
+
+void file_cache_use_vfs(sc_file_cache *cache, struct sc_vfs *vfs) {
+    cache->vfs = vfs;
+}
+
+sc_file *handle_to_file(sc_file_cache_handle handle) {
+    return &handle.cache->files[handle.index];
+}
+
+void file_cache_set_lexed_budget(sc_file_cache *cache, size_t budget) {
+    cache->lexed_budget = budget;
+}
+
+bool file_cache_lexed_fits(sc_file_cache *cache, size_t size) {
+    // Lexed data never causes evictions, it only uses what is left of the overall budget.
+    return cache->lexed_bytes + size <= cache->lexed_budget && cache->bytes + cache->lexed_bytes + size <= cache->budget;
+}
+
+bool file_cache_set_lexed(sc_file_cache_handle handle, void *data, size_t size, lexed_destroy_func destroy) {
+    sc_file *file = handle_to_file(handle);
+
+    // Replacing existing data frees up its part of the budget.
+    size_t old_size = file->lexed.data ? file->lexed.size : 0;
+    if (size > old_size && !file_cache_lexed_fits(handle.cache, size - old_size)) {
+        return false;
+    }
+
+    if (file->lexed.data) {
+        file->lexed.destroy(file->lexed.data);
+    }
+
+    handle.cache->lexed_bytes = handle.cache->lexed_bytes - old_size + size;
+    file->lexed.data = data;
+    file->lexed.size = size;
+    file->lexed.destroy = destroy;
+    return true;
+}
+
+void *file_cache_get_lexed(sc_file_cache_handle handle) {
+    return handle_to_file(handle)->lexed.data;
+}
+
+bool file_stream_open(sc_file_stream *stream, const char *path, size_t chunk_size) {
+    return file_stream_open_with(stream, path, chunk_size, mallocator());
+}
+
+bool file_stream_open_with(sc_file_stream *stream, const char *path, size_t chunk_size, sc_allocator *alloc) {
+    stream->file = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!stream->file) {
+        return false;
+    }
+
+    stream->alloc = alloc;
+    stream->chunk_size = chunk_size;
+    stream->capacity = chunk_size + 1;
+    stream->buffer = sc_alloc(alloc, stream->capacity);
+    stream->buffer[0] = '\0';
+    stream->size = 0;
+    stream->eof = false;
+    return true;
+}
+
+void file_stream_close(sc_file_stream *stream) {
+    if (stream->file != stdin) {
+        fclose(stream->file);
+    }
+
+    sc_free(stream->alloc, stream->buffer);
+    stream->buffer = NULL;
+    stream->file = NULL;
+    stream->size = stream->capacity = 0;
+}
+
+size_t file_stream_refill(sc_file_stream *stream, size_t consumed) {
+    assert(consumed <= stream->size);
+
+    memmove(stream->buffer, stream->buffer + consumed, stream->size - consumed);
+    stream->size -= consumed;
+
+    if (stream->eof) {
+        stream->buffer[stream->size] = '\0';
+        return 0;
+    }
+
+    // Only grows when the caller holds on to more than a chunk, for lines longer than that.
+    if (stream->size + stream->chunk_size + 1 > stream->capacity) {
+        size_t old_capacity = stream->capacity;
+        while (stream->size + stream->chunk_size + 1 > stream->capacity) {
+            stream->capacity *= 2;
+        }
+        stream->buffer = sc_realloc(stream->alloc, stream->buffer, old_capacity, stream->capacity);
+    }
+
+    size_t read = fread(stream->buffer + stream->size, 1, stream->chunk_size, stream->file);
+    if (read < stream->chunk_size) {
+        stream->eof = true;
+    }
+
+    stream->size += read;
+    stream->buffer[stream->size] = '\0';
+    return read;
+}
+
+void output_init(sc_output *out, sc_output_sink sink) {
+    out->buffer = NULL;
+    out->size = 0;
+    out->capacity = 0;
+    out->sink = sink;
+    out->failed = false;
+}
+
+void output_write_slow(sc_output *out, const char *data, size_t size) {
+    while (size > 0 && !out->failed) {
+        size_t room = out->capacity - out->size;
+        if (room == 0) {
+            if (!out->sink.flush(out->sink.state, out)) {
+                out->failed = true;
+                out->size = out->capacity = 0;
+                return;
+            }
+
+            assert(out->size < out->capacity);
+            continue;
+        }
+
+        size_t part = size < room ? size : room;
+        memcpy(out->buffer + out->size, data, part);
+        out->size += part;
+        data += part;
+        size -= part;
+    }
+}
+
+bool output_close(sc_output *out) {
+    if (out->failed) {
+        out->size = 0;
+    }
+
+    // Always close, the sink holds on to resources.
+    bool ok = out->sink.close(out->sink.state, out) && !out->failed;
+    out->buffer = NULL;
+    out->size = out->capacity = 0;
+    return ok;
+}
+
+typedef struct output_file {
+    FILE *file;
+    char *memory;
+    sc_allocator *alloc;
+} output_file;
+
+static bool output_file_flush(output_file *state, sc_output *out) {
+    bool ok = fwrite(out->buffer, 1, out->size, state->file) == out->size;
+
+    out->buffer = state->memory;
+    out->size = 0;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    return ok;
+}
+
+static bool output_file_close(output_file *state, sc_output *out) {
+    bool ok = fwrite(out->buffer, 1, out->size, state->file) == out->size;
+    ok = fclose(state->file) == 0 && ok;
+
+    sc_allocator *alloc = state->alloc;
+    sc_free(alloc, state->memory);
+    sc_free(alloc, state);
+    return ok;
+}
+
+bool output_open(sc_output *out, const char *path) {
+    return output_open_with(out, path, mallocator());
+}
+
+bool output_open_with(sc_output *out, const char *path, sc_allocator *alloc) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    // We only ever write whole buffers, stdio buffering would be a second copy.
+    setvbuf(file, NULL, _IONBF, 0);
+
+    output_file *state = sc_alloc(alloc, sizeof(output_file));
+    state->file = file;
+    state->memory = sc_alloc(alloc, OUTPUT_BUFFER_SIZE);
+    state->alloc = alloc;
+
+    output_init(out, (sc_output_sink) { .flush = (output_flush_func)output_file_flush, .close = (output_close_func)output_file_close,
+                                        .state = state });
+    out->buffer = state->memory;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    return true;
+}
+
+#ifndef _WIN32
+
+typedef struct output_mapped {
+    int fd;
+    char *map;
+    // File offset of the output buffer, everything before it is written.
+    size_t written;
+    sc_allocator *alloc;
+} output_mapped;
+
+static bool output_mapped_flush(output_mapped *state, sc_output *out) {
+    size_t end = state->written + out->size;
+    if (state->map) {
+        munmap(state->map, OUTPUT_MAP_WINDOW);
+        state->map = NULL;
+    }
+
+    // Mappings start on a page boundary, the next window may start with the end of the page we are in.
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_offset = end - end % page_size;
+    if (ftruncate(state->fd, (off_t)(map_offset + OUTPUT_MAP_WINDOW)) != 0) {
+        return false;
+    }
+
+    char *map = mmap(NULL, OUTPUT_MAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, (off_t)map_offset);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    state->map = map;
+    state->written = end;
+    out->buffer = map + (end - map_offset);
+    out->size = 0;
+    out->capacity = OUTPUT_MAP_WINDOW - (end - map_offset);
+    return true;
+}
+
+static bool output_mapped_close(output_mapped *state, sc_output *out) {
+    size_t end = state->written + out->size;
+    if (state->map) {
+        munmap(state->map, OUTPUT_MAP_WINDOW);
+    }
+
+    bool ok = ftruncate(state->fd, (off_t)end) == 0;
+    ok = close(state->fd) == 0 && ok;
+
+    sc_free(state->alloc, state);
+    return ok;
+}
+
+bool output_open_mapped_with(sc_output *out, const char *path, sc_allocator *alloc) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    output_mapped *state = sc_alloc(alloc, sizeof(output_mapped));
+    state->fd = fd;
+    state->map = NULL;
+    state->written = 0;
+    state->alloc = alloc;
+
+    output_init(out, (sc_output_sink) { .flush = (output_flush_func)output_mapped_flush, .close = (output_close_func)output_mapped_close,
+                                        .state = state });
+    return true;
+}
+
+#else
+
+bool output_open_mapped_with(sc_output *out, const char *path, sc_allocator *alloc) {
+    (void)out;
+    (void)path;
+    (void)alloc;
+    return false;
+}
+
+#endif
+
+bool output_open_mapped(sc_output *out, const char *path) {
+    return output_open_mapped_with(out, path, mallocator());
+}
+
+// TODO: WE NEED SEPARATOR CONVERSION TO '/' (for win32)
+
+void get_relative_path_from_file(const char *absolute_path, const char *relative_path, char *out, size_t out_max_len) {
+    // Right
+    // Let's copy up to our last directory separator.
+    // (actually, let's find it first :P)
+    size_t abs_len = strlen(absolute_path), rel_len = strlen(relative_path);
+    // Length of the directory part, zero if the file is in the working directory.
+    size_t dir_len = 0;
+    for (size_t i = 0; i < abs_len; i++) {
+        if (absolute_path[i] == separator) {
+            dir_len = i + 1;
+        }
+    }
+
+    // Copy up to there (including that character).
+    // "abc/" -> dir_len = 4
+    size_t written = dir_len < out_max_len ? dir_len : out_max_len;
+    strncpy(out, absolute_path, written);
+
+    if (written == out_max_len) return;
+
+    out += written;
+    written = rel_len + 1 > (out_max_len - written) ? out_max_len - written : rel_len + 1;
+    strncpy(out, relative_path, written);
+}
@@ -0,0 +1,165 @@
+#include <sc_hash.h>
+#include <string.h>
+
+size_t sc_fnv1a(const void *data, size_t size, size_t seed) {
+    const unsigned char *bytes = data;
+
+    size_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= (size_t)1099511628211ULL;
+    }
+
+    return hash;
+}
+
+size_t sc_fnv1a_string(const char *str) {
+    size_t hash = SC_FNV_OFFSET;
+    for (; *str; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= (size_t)1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// The lane round and primes are the ones of xxHash64.
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little endian read.
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap64(value);
+    #endif
+    return value;
+}
+
+static inline uint64_t round64(uint64_t lane, uint64_t input) {
+    lane += input * PRIME2;
+    lane = rotl(lane, 31);
+    return lane * PRIME1;
+}
+
+static inline uint64_t avalanche(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// The hot loop, stripes go through the four lanes independently.
+static void process_stripes(uint64_t lanes[4], const unsigned char *data, size_t stripes) {
+    uint64_t l0 = lanes[0], l1 = lanes[1], l2 = lanes[2], l3 = lanes[3];
+
+    for (size_t i = 0; i < stripes; i++, data += 32) {
+        l0 = round64(l0, read64(data));
+        l1 = round64(l1, read64(data + 8));
+        l2 = round64(l2, read64(data + 16));
+        l3 = round64(l3, read64(data + 24));
+    }
+
+    lanes[0] = l0;
+    lanes[1] = l1;
+    lanes[2] = l2;
+    lanes[3] = l3;
+}
+
+void sc_hash_init(sc_hash_state *state) {
+    state->lanes[0] = PRIME1 + PRIME2;
+    state->lanes[1] = PRIME2;
+    state->lanes[2] = 0;
+    state->lanes[3] = 0 - PRIME1;
+    state->buffered = 0;
+    state->total = 0;
+}
+
+void sc_hash_update(sc_hash_state *state, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    state->total += size;
+
+    // Complete a partial stripe first.
+    if (state->buffered > 0) {
+        size_t needed = 32 - state->buffered;
+        size_t copied = size < needed ? size : needed;
+
+        memcpy(state->buffer + state->buffered, bytes, copied);
+        state->buffered += copied;
+        bytes += copied;
+        size -= copied;
+
+        if (state->buffered < 32) {
+            return;
+        }
+
+        process_stripes(state->lanes, state->buffer, 1);
+        state->buffered = 0;
+    }
+
+    process_stripes(state->lanes, bytes, size / 32);
+    bytes += size & ~(size_t)31;
+    size &= 31;
+
+    memcpy(state->buffer, bytes, size);
+    state->buffered = size;
+}
+
+sc_hash128 sc_hash_final(sc_hash_state *state) {
+    uint64_t *lanes = state->lanes;
+
+    // Every lane takes part in both halves, mixed differently.
+    uint64_t low = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    uint64_t high = rotl(lanes[0], 41) ^ rotl(lanes[1], 29) ^ rotl(lanes[2], 17) ^ rotl(lanes[3], 5);
+
+    for (int i = 0; i < 4; i++) {
+        low = (low ^ round64(0, lanes[i])) * PRIME1 + PRIME4;
+        high = (high ^ round64(PRIME5, lanes[i])) * PRIME2 + PRIME3;
+    }
+
+    low += state->total;
+    high ^= state->total * PRIME5;
+
+    // The last partial stripe, eight bytes at a time, then byte by byte.
+    const unsigned char *tail = state->buffer;
+    size_t size = state->buffered;
+
+    for (; size >= 8; size -= 8, tail += 8) {
+        uint64_t k = round64(0, read64(tail));
+        low = rotl(low ^ k, 27) * PRIME1 + PRIME4;
+        high = rotl(high + k, 31) * PRIME2 + PRIME5;
+    }
+
+    for (; size > 0; size--, tail++) {
+        low = rotl(low ^ (*tail * PRIME5), 11) * PRIME1;
+        high = rotl(high + (*tail * PRIME1), 13) * PRIME3;
+    }
+
+    sc_hash128 result;
+    result.low = avalanche(low + high);
+    result.high = avalanche(high ^ rotl(low, 32));
+    return result;
+}
+
+sc_hash128 sc_hash_bytes(const void *data, size_t size) {
+    sc_hash_state state;
+    sc_hash_init(&state);
+    sc_hash_update(&state, data, size);
+    return sc_hash_final(&state);
+}
+
+#undef PRIME1
+#undef PRIME2
+#undef PRIME3
+#undef PRIME4
+#undef PRIME5
@@ -0,0 +1,342 @@
+#include <sc_prefetch.h>
+#include <sc_hash.h>
+#include <sc_vfs.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+
+#ifndef __STDC_NO_THREADS__
+
+static char *copy_string(sc_allocator *alloc, const char *str) {
+    size_t len = strlen(str);
+    char *copy = sc_alloc(alloc, len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+static char **seen_slot(sc_prefetcher *prefetcher, const char *path) {
+    size_t mask = prefetcher->seen.capacity - 1;
+    size_t index = sc_fnv1a_string(path) & mask;
+
+    while (prefetcher->seen.slots[index] && strcmp(prefetcher->seen.slots[index], path)) {
+        index = (index + 1) & mask;
+    }
+
+    return &prefetcher->seen.slots[index];
+}
+
+// Returns true if the path was already seen.
+// Must be called with the lock held.
+static bool mark_seen(sc_prefetcher *prefetcher, const char *path) {
+    if (*seen_slot(prefetcher, path)) {
+        return true;
+    }
+
+    if ((prefetcher->seen.size + 1) * 2 > prefetcher->seen.capacity) {
+        char **old_slots = prefetcher->seen.slots;
+        size_t old_capacity = prefetcher->seen.capacity;
+
+        prefetcher->seen.capacity *= 2;
+        prefetcher->seen.slots = sc_calloc(prefetcher->alloc, prefetcher->seen.capacity, sizeof(char *));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_slots[i]) {
+                *seen_slot(prefetcher, old_slots[i]) = old_slots[i];
+            }
+        }
+
+        sc_free(prefetcher->alloc, old_slots);
+    }
+
+    *seen_slot(prefetcher, path) = copy_string(prefetcher->alloc, path);
+    prefetcher->seen.size++;
+    return false;
+}
+
+// Must be called with the lock held.
+static void push_request(sc_prefetcher *prefetcher, const char *name, size_t name_len, const char *includer, bool quoted) {
+    if (prefetcher->queue.size >= prefetcher->queue.capacity) {
+        prefetcher->queue.capacity *= 2;
+        prefetcher->queue.memory = sc_realloc(prefetcher->alloc, prefetcher->queue.memory, prefetcher->queue.capacity / 2 * sizeof(sc_prefetch_request),
+                                              prefetcher->queue.capacity * sizeof(sc_prefetch_request));
+    }
+
+    sc_prefetch_request *request = &prefetcher->queue.memory[prefetcher->queue.size++];
+    request->name = sc_alloc(prefetcher->alloc, name_len + 1);
+    memcpy(request->name, name, name_len);
+    request->name[name_len] = '\0';
+    request->includer = copy_string(prefetcher->alloc, includer);
+    request->quoted = quoted;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Finds lines that look like '#include "name"' or '#include <name>' and queues them.
+// Must be called with the lock held.
+static void scan_includes(sc_prefetcher *prefetcher, const char *path, const char *data, size_t size) {
+    const char *end = data + size;
+    const char *line = data;
+
+    while (line < end) {
+        const char *next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+
+        const char *c = line;
+        while (c < next && is_blank(*c)) c++;
+
+        if (c < next && *c == '#') {
+            c++;
+            while (c < next && is_blank(*c)) c++;
+
+            if (next - c > 7 && !strncmp(c, "include", 7)) {
+                c += 7;
+                while (c < next && is_blank(*c)) c++;
+
+                if (c < next && (*c == '"' || *c == '<')) {
+                    char closing = *c == '"' ? '"' : '>';
+                    const char *name = ++c;
+                    while (c < next && *c != closing && *c != '\n') c++;
+
+                    if (c < next && *c == closing && c != name) {
+                        push_request(prefetcher, name, c - name, path, closing == '"');
+                    }
+                }
+            }
+        }
+
+        line = next;
+    }
+}
+
+// Loads a file in the background unless someone else already did.
+// Returns false if the file does not exist.
+static bool prefetch_file(sc_prefetcher *prefetcher, const char *unnormalized_path) {
+    // The file cache hands us normalized paths too.
+    char path[FILENAME_MAX];
+    path_normalize(unnormalized_path, path, FILENAME_MAX);
+
+    mtx_lock(&prefetcher->lock);
+    if (mark_seen(prefetcher, path)) {
+        mtx_unlock(&prefetcher->lock);
+        return true;
+    }
+
+    // The file cache reads in-memory files from the VFS, whatever is on disk at that path.
+    if (prefetcher->vfs && vfs_find(prefetcher->vfs, path)) {
+        mtx_unlock(&prefetcher->lock);
+        return true;
+    }
+
+    prefetcher->loading = path;
+    mtx_unlock(&prefetcher->lock);
+
+    // Faulting the pages in is the whole point of loading the file early.
+    sc_file file;
+    char *path_copy = copy_string(prefetcher->alloc, path);
+    file_load_with(&file, path_copy, prefetcher->alloc, FILE_LOAD_DEFAULT | FILE_LOAD_POPULATE);
+
+    mtx_lock(&prefetcher->lock);
+    prefetcher->loading = NULL;
+
+    bool exists = file.contents != NULL;
+    if (exists) {
+        if (prefetcher->loaded.size >= prefetcher->loaded.capacity) {
+            prefetcher->loaded.capacity *= 2;
+            prefetcher->loaded.memory = sc_realloc(prefetcher->alloc, prefetcher->loaded.memory, prefetcher->loaded.capacity / 2 * sizeof(sc_file),
+                                                   prefetcher->loaded.capacity * sizeof(sc_file));
+        }
+
+        prefetcher->loaded.memory[prefetcher->loaded.size++] = file;
+        prefetcher->prefetched++;
+
+        // The contents are ours until the file cache takes the file, which can't happen while we hold the lock.
+        scan_includes(prefetcher, path, file.contents, file.size);
+    } else {
+        // A file that isn't there has no path, the copy is still ours.
+        sc_free(prefetcher->alloc, path_copy);
+    }
+
+    cnd_broadcast(&prefetcher->loaded_signal);
+    mtx_unlock(&prefetcher->lock);
+    return exists;
+}
+
+static int prefetch_thread(void *data) {
+    sc_prefetcher *prefetcher = data;
+
+    mtx_lock(&prefetcher->lock);
+    while (true) {
+        while (prefetcher->queue.size == 0 && !prefetcher->stop) {
+            cnd_wait(&prefetcher->wake, &prefetcher->lock);
+        }
+
+        if (prefetcher->stop) {
+            break;
+        }
+
+        // Most recently found includes first, they tend to be the ones we need next.
+        sc_prefetch_request request = prefetcher->queue.memory[--prefetcher->queue.size];
+        mtx_unlock(&prefetcher->lock);
+
+        // Same lookup order as the preprocessor.
+        char path[FILENAME_MAX];
+        bool found = false;
+        if (request.name[0] == '/') {
+            found = prefetch_file(prefetcher, request.name);
+        } else if (request.quoted) {
+            get_relative_path_from_file(request.includer, request.name, path, FILENAME_MAX);
+            found = prefetch_file(prefetcher, path);
+        }
+
+        if (!found && request.name[0] != '/' && path_table_lookup(&prefetcher->include_paths, request.name, path, FILENAME_MAX)) {
+            prefetch_file(prefetcher, path);
+        }
+
+        sc_free(prefetcher->alloc, request.name);
+        sc_free(prefetcher->alloc, request.includer);
+
+        mtx_lock(&prefetcher->lock);
+    }
+    mtx_unlock(&prefetcher->lock);
+
+    return 0;
+}
+
+void prefetcher_init_with(sc_prefetcher *prefetcher, sc_path_table *include_paths, sc_allocator *alloc) {
+    prefetcher->alloc = alloc;
+    path_table_init(&prefetcher->include_paths);
+    for (size_t i = 0; i < include_paths->size; i++) {
+        path_table_add(&prefetcher->include_paths, include_paths->memory[i]);
+    }
+
+    // Without it, lookups would find the files the VFS hides and we would load them for nothing.
+    prefetcher->vfs = include_paths->vfs;
+    path_table_use_vfs(&prefetcher->include_paths, prefetcher->vfs);
+
+    prefetcher->queue.size = 0;
+    prefetcher->queue.capacity = 64;
+    prefetcher->queue.memory = sc_alloc(alloc, prefetcher->queue.capacity * sizeof(sc_prefetch_request));
+
+    prefetcher->loaded.size = 0;
+    prefetcher->loaded.capacity = 16;
+    prefetcher->loaded.memory = sc_alloc(alloc, prefetcher->loaded.capacity * sizeof(sc_file));
+
+    prefetcher->seen.size = 0;
+    prefetcher->seen.capacity = 256;
+    prefetcher->seen.slots = sc_calloc(alloc, prefetcher->seen.capacity, sizeof(char *));
+
+    prefetcher->loading = NULL;
+    prefetcher->prefetched = 0;
+    prefetcher->used = 0;
+    prefetcher->stop = false;
+
+    mtx_init(&prefetcher->lock, mtx_plain);
+    cnd_init(&prefetcher->wake);
+    cnd_init(&prefetcher->loaded_signal);
+    thrd_create(&prefetcher->thread, prefetch_thread, prefetcher);
+}
+
+void prefetcher_destroy(sc_prefetcher *prefetcher) {
+    mtx_lock(&prefetcher->lock);
+    prefetcher->stop = true;
+    cnd_signal(&prefetcher->wake);
+    mtx_unlock(&prefetcher->lock);
+
+    thrd_join(prefetcher->thread, NULL);
+
+    mtx_destroy(&prefetcher->lock);
+    cnd_destroy(&prefetcher->wake);
+    cnd_destroy(&prefetcher->loaded_signal);
+
+    for (size_t i = 0; i < prefetcher->queue.size; i++) {
+        sc_free(prefetcher->alloc, prefetcher->queue.memory[i].name);
+        sc_free(prefetcher->alloc, prefetcher->queue.memory[i].includer);
+    }
+    sc_free(prefetcher->alloc, prefetcher->queue.memory);
+
+    for (size_t i = 0; i < prefetcher->loaded.size; i++) {
+        sc_free(prefetcher->alloc, prefetcher->loaded.memory[i].abs_path);
+        file_destroy(&prefetcher->loaded.memory[i]);
+    }
+    sc_free(prefetcher->alloc, prefetcher->loaded.memory);
+
+    for (size_t i = 0; i < prefetcher->seen.capacity; i++) {
+        if (prefetcher->seen.slots[i]) {
+            sc_free(prefetcher->alloc, prefetcher->seen.slots[i]);
+        }
+    }
+    sc_free(prefetcher->alloc, prefetcher->seen.slots);
+
+    path_table_destroy(&prefetcher->include_paths);
+}
+
+void prefetcher_scan(sc_prefetcher *prefetcher, sc_file *file) {
+    mtx_lock(&prefetcher->lock);
+    size_t queued = prefetcher->queue.size;
+    scan_includes(prefetcher, file->abs_path, file->contents, file->size);
+
+    if (prefetcher->queue.size != queued) {
+        cnd_signal(&prefetcher->wake);
+    }
+    mtx_unlock(&prefetcher->lock);
+}
+
+bool prefetcher_take(sc_prefetcher *prefetcher, const char *abs_path, sc_file *file) {
+    mtx_lock(&prefetcher->lock);
+
+    while (prefetcher->loading && !strcmp(prefetcher->loading, abs_path)) {
+        cnd_wait(&prefetcher->loaded_signal, &prefetcher->lock);
+    }
+
+    for (size_t i = 0; i < prefetcher->loaded.size; i++) {
+        if (!strcmp(prefetcher->loaded.memory[i].abs_path, abs_path)) {
+            *file = prefetcher->loaded.memory[i];
+            prefetcher->loaded.memory[i] = prefetcher->loaded.memory[--prefetcher->loaded.size];
+            sc_free(prefetcher->alloc, file->abs_path);
+            file->abs_path = NULL;
+            prefetcher->used++;
+
+            mtx_unlock(&prefetcher->lock);
+            return true;
+        }
+    }
+
+    // The caller loads it, don't do it twice.
+    mark_seen(prefetcher, abs_path);
+    mtx_unlock(&prefetcher->lock);
+    return false;
+}
+
+#else
+
+void prefetcher_init_with(sc_prefetcher *prefetcher, sc_path_table *include_paths, sc_allocator *alloc) {
+    prefetcher->alloc = alloc;
+    prefetcher->vfs = include_paths->vfs;
+    prefetcher->prefetched = 0;
+    prefetcher->used = 0;
+}
+
+void prefetcher_destroy(sc_prefetcher *prefetcher) {
+    UNUSED(prefetcher);
+}
+
+void prefetcher_scan(sc_prefetcher *prefetcher, sc_file *file) {
+    UNUSED(prefetcher);
+    UNUSED(file);
+}
+
+bool prefetcher_take(sc_prefetcher *prefetcher, const char *abs_path, sc_file *file) {
+    UNUSED(prefetcher);
+    UNUSED(abs_path);
+    UNUSED(file);
+    return false;
+}
+
+#endif
+
+void prefetcher_init(sc_prefetcher *prefetcher, sc_path_table *include_paths) {
+    prefetcher_init_with(prefetcher, include_paths, mallocator());
+}
+
+#undef UNUSED
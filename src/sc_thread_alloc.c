@@ -0,0 +1,273 @@
+#include <sc_thread_alloc.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+
+#if !defined(__STDC_NO_THREADS__) && !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+#include <threads.h>
+
+struct sc_thread_heap;
+
+// In front of every allocation.
+typedef struct sc_block_header {
+    // Once the block is on the remote list of its heap, the next block of the list instead.
+    union {
+        struct sc_thread_heap *owner;
+        struct sc_block_header *next;
+    };
+    size_t size;
+} sc_block_header;
+
+#define HEADER_SIZE ((sizeof(sc_block_header) + SC_ALLOC_ALIGNMENT - 1) & ~(SC_ALLOC_ALIGNMENT - 1))
+
+typedef struct sc_thread_heap {
+    // Only ever touched by the thread that owns the heap.
+    sc_pool pool;
+    // Blocks freed by other threads.
+    _Atomic(sc_block_header *) remote;
+
+    // Only written by the owner, so they don't need read-modify-write operations, but they are read by thread_allocator_stats.
+    atomic_size_t allocations;
+    atomic_size_t frees;
+    atomic_size_t remote_frees;
+    atomic_size_t bytes;
+    atomic_size_t peak_bytes;
+
+    // The rest is protected by the registry lock.
+    size_t id;
+    bool active;
+    struct sc_thread_heap *next;
+} sc_thread_heap;
+
+// Every heap we ever made, for stats and to reuse the ones of threads that exited.
+static struct {
+    mtx_t lock;
+    sc_thread_heap *heaps;
+    size_t heap_count;
+    // Its destructor runs when a thread exits.
+    tss_t exit_key;
+} registry;
+
+static once_flag registry_once = ONCE_FLAG_INIT;
+
+static _Thread_local sc_thread_heap *current_heap = NULL;
+
+#define COUNTER_ADD(counter, value) \
+    atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + (value), memory_order_relaxed)
+#define COUNTER_SUB(counter, value) \
+    atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) - (value), memory_order_relaxed)
+
+static void heap_release_block(sc_thread_heap *heap, sc_block_header *header) {
+    COUNTER_ADD(heap->frees, 1);
+    COUNTER_SUB(heap->bytes, header->size);
+    pool_free(&heap->pool, header);
+}
+
+// Must be called by the owner.
+static void heap_collect(sc_thread_heap *heap) {
+    sc_block_header *header = atomic_exchange_explicit(&heap->remote, NULL, memory_order_acquire);
+    while (header) {
+        sc_block_header *next = header->next;
+        COUNTER_ADD(heap->remote_frees, 1);
+        heap_release_block(heap, header);
+        header = next;
+    }
+}
+
+static void heap_exit(void *data) {
+    sc_thread_heap *heap = data;
+    heap_collect(heap);
+
+    mtx_lock(&registry.lock);
+    heap->active = false;
+    mtx_unlock(&registry.lock);
+
+    current_heap = NULL;
+}
+
+static void registry_init() {
+    mtx_init(&registry.lock, mtx_plain);
+    registry.heaps = NULL;
+    registry.heap_count = 0;
+    tss_create(&registry.exit_key, heap_exit);
+}
+
+// Takes over the heap of a thread that exited, or makes a new one.
+static sc_thread_heap *heap_attach() {
+    call_once(&registry_once, registry_init);
+
+    mtx_lock(&registry.lock);
+    sc_thread_heap *heap = registry.heaps;
+    while (heap && heap->active) {
+        heap = heap->next;
+    }
+
+    if (!heap) {
+        heap = malloc(sizeof(sc_thread_heap));
+        if (!heap) {
+            mtx_unlock(&registry.lock);
+            return NULL;
+        }
+
+        pool_init(&heap->pool, mallocator());
+        atomic_init(&heap->remote, NULL);
+        atomic_init(&heap->allocations, 0);
+        atomic_init(&heap->frees, 0);
+        atomic_init(&heap->remote_frees, 0);
+        atomic_init(&heap->bytes, 0);
+        atomic_init(&heap->peak_bytes, 0);
+        heap->id = registry.heap_count++;
+        heap->next = registry.heaps;
+        registry.heaps = heap;
+    }
+
+    heap->active = true;
+    mtx_unlock(&registry.lock);
+
+    tss_set(registry.exit_key, heap);
+    current_heap = heap;
+    return heap;
+}
+
+static void *thread_alloc(void *state, size_t size) {
+    UNUSED(state);
+    sc_thread_heap *heap = current_heap ? current_heap : heap_attach();
+    if (!heap || size > SIZE_MAX - HEADER_SIZE) {
+        return NULL;
+    }
+
+    if (atomic_load_explicit(&heap->remote, memory_order_relaxed)) {
+        heap_collect(heap);
+    }
+
+    sc_block_header *header = pool_alloc(&heap->pool, HEADER_SIZE + size);
+    if (!header) {
+        return NULL;
+    }
+
+    header->owner = heap;
+    header->size = size;
+
+    COUNTER_ADD(heap->allocations, 1);
+    COUNTER_ADD(heap->bytes, size);
+    size_t bytes = atomic_load_explicit(&heap->bytes, memory_order_relaxed);
+    if (bytes > atomic_load_explicit(&heap->peak_bytes, memory_order_relaxed)) {
+        atomic_store_explicit(&heap->peak_bytes, bytes, memory_order_relaxed);
+    }
+
+    return (char *)header + HEADER_SIZE;
+}
+
+static void thread_free(void *state, void *memory) {
+    UNUSED(state);
+    if (!memory) {
+        return;
+    }
+
+    sc_block_header *header = (sc_block_header *)((char *)memory - HEADER_SIZE);
+    sc_thread_heap *heap = header->owner;
+    if (heap == current_heap) {
+        heap_release_block(heap, header);
+        return;
+    }
+
+    // Not ours, the owner gives it back to its pool.
+    header->next = atomic_load_explicit(&heap->remote, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&heap->remote, &header->next, header, memory_order_release, memory_order_relaxed)) {
+    }
+}
+
+static void *thread_resize(void *state, void *memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return thread_alloc(state, new_size);
+    }
+
+    sc_block_header *header = (sc_block_header *)((char *)memory - HEADER_SIZE);
+    sc_thread_heap *heap = header->owner;
+    if (heap == current_heap && new_size <= SIZE_MAX - HEADER_SIZE) {
+        sc_block_header *resized = pool_realloc(&heap->pool, header, HEADER_SIZE + old_size, HEADER_SIZE + new_size);
+        if (!resized) {
+            return NULL;
+        }
+
+        resized->size = new_size;
+        COUNTER_ADD(heap->bytes, new_size);
+        COUNTER_SUB(heap->bytes, old_size);
+        size_t bytes = atomic_load_explicit(&heap->bytes, memory_order_relaxed);
+        if (bytes > atomic_load_explicit(&heap->peak_bytes, memory_order_relaxed)) {
+            atomic_store_explicit(&heap->peak_bytes, bytes, memory_order_relaxed);
+        }
+        return (char *)resized + HEADER_SIZE;
+    }
+
+    // Allocated by another thread, it moves to our heap.
+    void *moved = thread_alloc(state, new_size);
+    if (moved) {
+        memcpy(moved, memory, old_size < new_size ? old_size : new_size);
+        thread_free(state, memory);
+    }
+    return moved;
+}
+
+static void thread_destroy(void *state) {
+    UNUSED(state);
+}
+
+sc_allocator *thread_allocator() {
+    static sc_allocator instance = (sc_allocator) { .alloc = thread_alloc, .free = thread_free, .destroy = thread_destroy, .resize = thread_resize, .owns = NULL, .state = NULL };
+    return &instance;
+}
+
+void thread_allocator_collect() {
+    if (current_heap) {
+        heap_collect(current_heap);
+    }
+}
+
+size_t thread_allocator_stats(sc_thread_stats *stats, size_t max) {
+    call_once(&registry_once, registry_init);
+
+    mtx_lock(&registry.lock);
+    size_t count = 0;
+    for (sc_thread_heap *heap = registry.heaps; heap; heap = heap->next, count++) {
+        if (count < max) {
+            stats[count] = (sc_thread_stats) {
+                .id = heap->id,
+                .active = heap->active,
+                .allocations = atomic_load_explicit(&heap->allocations, memory_order_relaxed),
+                .frees = atomic_load_explicit(&heap->frees, memory_order_relaxed),
+                .remote_frees = atomic_load_explicit(&heap->remote_frees, memory_order_relaxed),
+                .bytes = atomic_load_explicit(&heap->bytes, memory_order_relaxed),
+                .peak_bytes = atomic_load_explicit(&heap->peak_bytes, memory_order_relaxed)
+            };
+        }
+    }
+    mtx_unlock(&registry.lock);
+
+    return count;
+}
+
+#undef COUNTER_SUB
+#undef COUNTER_ADD
+#undef HEADER_SIZE
+
+#else
+
+sc_allocator *thread_allocator() {
+    return mallocator();
+}
+
+void thread_allocator_collect() {
+}
+
+size_t thread_allocator_stats(sc_thread_stats *stats, size_t max) {
+    UNUSED(stats);
+    UNUSED(max);
+    return 0;
+}
+
+#endif
+
+#undef UNUSED
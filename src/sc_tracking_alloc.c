@@ -0,0 +1,164 @@
+#include <sc_tracking_alloc.h>
+
+#define UNUSED(x) (void)(x)
+
+// In front of every allocation, SC_ALLOC_ALIGNMENT bytes to keep the memory aligned.
+#define HEADER_SIZE SC_ALLOC_ALIGNMENT
+
+// Relaxed is enough, the counters are only statistics.
+#ifndef __STDC_NO_ATOMICS__
+#define COUNTER_ADD(counter, value) atomic_fetch_add_explicit(&(counter), (value), memory_order_relaxed)
+#define COUNTER_SUB(counter, value) atomic_fetch_sub_explicit(&(counter), (value), memory_order_relaxed)
+#define COUNTER_LOAD(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+#else
+#define COUNTER_ADD(counter, value) ((counter) += (value), (counter) - (value))
+#define COUNTER_SUB(counter, value) ((counter) -= (value), (counter) + (value))
+#define COUNTER_LOAD(counter) (counter)
+#endif
+
+static size_t tracking_bucket(size_t size) {
+    size_t bucket = 0;
+    size_t limit = 16;
+    while (size > limit && bucket < TRACKING_BUCKET_COUNT - 1) {
+        limit *= 2;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void tracking_grow(sc_tracking *tracking, size_t size) {
+    size_t current = COUNTER_ADD(tracking->current_bytes, size) + size;
+#ifndef __STDC_NO_ATOMICS__
+    size_t peak = COUNTER_LOAD(tracking->peak_bytes);
+    while (current > peak &&
+           !atomic_compare_exchange_weak_explicit(&tracking->peak_bytes, &peak, current, memory_order_relaxed, memory_order_relaxed)) {
+    }
+#else
+    if (current > tracking->peak_bytes) {
+        tracking->peak_bytes = current;
+    }
+#endif
+}
+
+void tracking_init(sc_tracking *tracking, sc_allocator *backing, const char *name) {
+    *tracking = (sc_tracking) { .backing_allocator = backing, .name = name };
+}
+
+void tracking_destroy(sc_tracking *tracking) {
+    UNUSED(tracking);
+}
+
+static void *tracking_alloc(sc_tracking *tracking, size_t size) {
+    if (size > SIZE_MAX - HEADER_SIZE) {
+        return NULL;
+    }
+
+    char *memory = sc_alloc(tracking->backing_allocator, HEADER_SIZE + size);
+    if (!memory) {
+        return NULL;
+    }
+
+    *(size_t *)memory = size;
+    COUNTER_ADD(tracking->allocations, 1);
+    COUNTER_ADD(tracking->histogram[tracking_bucket(size)], 1);
+    tracking_grow(tracking, size);
+    return memory + HEADER_SIZE;
+}
+
+static void tracking_free(sc_tracking *tracking, void *memory) {
+    if (!memory) {
+        return;
+    }
+
+    char *header = (char *)memory - HEADER_SIZE;
+    COUNTER_ADD(tracking->frees, 1);
+    COUNTER_SUB(tracking->current_bytes, *(size_t *)header);
+    sc_free(tracking->backing_allocator, header);
+}
+
+static void *tracking_resize(sc_tracking *tracking, void *memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return tracking_alloc(tracking, new_size);
+    }
+
+    if (new_size > SIZE_MAX - HEADER_SIZE) {
+        return NULL;
+    }
+
+    // We know the size better than the caller.
+    UNUSED(old_size);
+    char *header = (char *)memory - HEADER_SIZE;
+    size_t size = *(size_t *)header;
+    char *resized = sc_realloc(tracking->backing_allocator, header, HEADER_SIZE + size, HEADER_SIZE + new_size);
+    if (!resized) {
+        return NULL;
+    }
+
+    *(size_t *)resized = new_size;
+    COUNTER_ADD(tracking->resizes, 1);
+    COUNTER_ADD(tracking->histogram[tracking_bucket(new_size)], 1);
+    COUNTER_SUB(tracking->current_bytes, size);
+    tracking_grow(tracking, new_size);
+    return resized + HEADER_SIZE;
+}
+
+static bool tracking_owns(sc_tracking *tracking, void *memory) {
+    return sc_owns(tracking->backing_allocator, (char *)memory - HEADER_SIZE);
+}
+
+void tracking_report(FILE *out, sc_tracking *trackers, size_t count) {
+    fprintf(out, "%-16s %14s %14s %12s %12s %12s\n", "Memory", "live bytes", "peak bytes", "allocations", "frees", "resizes");
+    for (size_t i = 0; i < count; i++) {
+        sc_tracking *tracking = &trackers[i];
+        fprintf(out, "%-16s %14zu %14zu %12zu %12zu %12zu\n", tracking->name, (size_t)COUNTER_LOAD(tracking->current_bytes),
+                (size_t)COUNTER_LOAD(tracking->peak_bytes), (size_t)COUNTER_LOAD(tracking->allocations),
+                (size_t)COUNTER_LOAD(tracking->frees), (size_t)COUNTER_LOAD(tracking->resizes));
+    }
+
+    static const char *units[] = { "B", "KB", "MB" };
+    for (size_t i = 0; i < count; i++) {
+        sc_tracking *tracking = &trackers[i];
+        fprintf(out, "%s sizes:", tracking->name);
+
+        size_t limit = 16;
+        for (size_t bucket = 0; bucket < TRACKING_BUCKET_COUNT; bucket++, limit *= 2) {
+            size_t sizes = COUNTER_LOAD(tracking->histogram[bucket]);
+            if (sizes == 0) {
+                continue;
+            }
+
+            size_t unit = 0;
+            size_t shown = limit;
+            while (shown >= 1024 && unit < 2) {
+                shown /= 1024;
+                unit++;
+            }
+
+            if (bucket == TRACKING_BUCKET_COUNT - 1) {
+                fprintf(out, " >%zu %s: %zu", shown / 2, units[unit], sizes);
+            } else {
+                fprintf(out, " <=%zu %s: %zu", shown, units[unit], sizes);
+            }
+        }
+        fputc('\n', out);
+    }
+}
+
+sc_allocator make_tracking_alloc(sc_tracking *tracking, sc_allocator *backing, const char *name) {
+    tracking_init(tracking, backing, name);
+
+    return make_alloc_from_tracking(tracking);
+}
+
+sc_allocator make_alloc_from_tracking(sc_tracking *tracking) {
+    return (sc_allocator) { .alloc = (alloc_func)tracking_alloc, .free = (free_func)tracking_free, .destroy = (destroy_func)tracking_destroy,
+                            .resize = (resize_func)tracking_resize,
+                            .owns = tracking->backing_allocator->owns ? (owns_func)tracking_owns : NULL, .state = (void*)tracking };
+}
+
+#undef COUNTER_LOAD
+#undef COUNTER_SUB
+#undef COUNTER_ADD
+#undef HEADER_SIZE
+#undef UNUSED
@@ -0,0 +1,290 @@
+#include <sc_utf8.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define SC_UTF8_AVX2
+    #include <immintrin.h>
+#endif
+
+#define ASCII_MASK 0x8080808080808080ULL
+
+// Number of ASCII bytes the input starts with.
+static size_t ascii_prefix(const unsigned char *bytes, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        if (word & ASCII_MASK) {
+            break;
+        }
+    }
+
+    while (i < size && bytes[i] < 0x80) {
+        i++;
+    }
+
+    return i;
+}
+
+size_t sc_utf8_find_error(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+
+    size_t i = 0;
+    while (true) {
+        i += ascii_prefix(bytes + i, size - i);
+        if (i >= size) {
+            return size;
+        }
+
+        // Allowed range of the second byte, see table 3-7 of the Unicode standard.
+        unsigned char c = bytes[i];
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        size_t length;
+        if (c >= 0xC2 && c <= 0xDF) {
+            length = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            length = 3;
+            if (c == 0xE0) {
+                low = 0xA0;
+            } else if (c == 0xED) {
+                high = 0x9F;
+            }
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            length = 4;
+            if (c == 0xF0) {
+                low = 0x90;
+            } else if (c == 0xF4) {
+                high = 0x8F;
+            }
+        } else {
+            return i;
+        }
+
+        if (size - i < length || bytes[i + 1] < low || bytes[i + 1] > high) {
+            return i;
+        }
+
+        for (size_t k = 2; k < length; k++) {
+            if ((bytes[i + k] & 0xC0) != 0x80) {
+                return i;
+            }
+        }
+
+        i += length;
+    }
+}
+
+sc_utf8_status sc_utf8_validate_scalar(const void *data, size_t size) {
+    size_t ascii = ascii_prefix(data, size);
+    if (ascii == size) {
+        return SC_UTF8_ASCII;
+    }
+
+    return sc_utf8_find_error((const unsigned char *)data + ascii, size - ascii) == size - ascii ? SC_UTF8_VALID : SC_UTF8_INVALID;
+}
+
+#ifdef SC_UTF8_AVX2
+
+// The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte" (2021).
+// Every error shows up in the first two bytes of a sequence, so three 16 entry tables indexed by the nibbles of each byte
+// and the previous one flag them, except for missing continuation bytes of 3 and 4 byte sequences, which are checked apart.
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define LOOKUP16(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    _mm256_setr_epi8(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p)
+
+// The input shifted right by 'n' bytes, shifting in the end of the previous block.
+#define PREVIOUS(input, previous, n) _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - n)
+
+static inline AVX2 __m256i high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+static inline AVX2 __m256i check_special_cases(__m256i input, __m256i previous1) {
+    __m256i byte_1_high = _mm256_shuffle_epi8(LOOKUP16(
+        // 0_______ ________
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        // 10______ ________
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        // 1100____ ________
+        TOO_SHORT | OVERLONG_2,
+        // 1101____ ________
+        TOO_SHORT,
+        // 1110____ ________
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        // 1111____ ________
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4), high_nibbles(previous1));
+
+    __m256i byte_1_low = _mm256_shuffle_epi8(LOOKUP16(
+        // ____0000 ________
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        // ____0001 ________
+        CARRY | OVERLONG_2,
+        // ____001_ ________
+        CARRY, CARRY,
+        // ____0100 ________
+        CARRY | TOO_LARGE,
+        // ____0101 ________ to ____1100 ________
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        // ____1101 ________
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        // ____111_ ________
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000),
+        _mm256_and_si256(previous1, _mm256_set1_epi8(0x0F)));
+
+    __m256i byte_2_high = _mm256_shuffle_epi8(LOOKUP16(
+        // ________ 0_______
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        // ________ 1000____
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        // ________ 1001____
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        // ________ 101_____
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        // ________ 11______
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT), high_nibbles(input));
+
+    return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+}
+
+static inline AVX2 __m256i check_block(__m256i input, __m256i previous) {
+    __m256i special = check_special_cases(input, PREVIOUS(input, previous, 1));
+
+    // Third and fourth bytes of 3 and 4 byte sequences must be continuations, the tables flagged those as TWO_CONTS.
+    __m256i third = _mm256_subs_epu8(PREVIOUS(input, previous, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(PREVIOUS(input, previous, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+    return _mm256_xor_si256(must_continue, special);
+}
+
+// Non zero where a sequence starting in the last three bytes of the block does not fit in it.
+static inline AVX2 __m256i incomplete_end(__m256i input) {
+    __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+
+typedef struct avx2_state {
+    __m256i error;
+    __m256i previous;
+    __m256i previous_incomplete;
+    bool ascii;
+} avx2_state;
+
+static inline AVX2 void avx2_step(avx2_state *state, __m256i input) {
+    if (_mm256_movemask_epi8(input) == 0) {
+        state->error = _mm256_or_si256(state->error, state->previous_incomplete);
+    } else {
+        state->ascii = false;
+        state->error = _mm256_or_si256(state->error, check_block(input, state->previous));
+        state->previous_incomplete = incomplete_end(input);
+    }
+
+    state->previous = input;
+}
+
+static AVX2 sc_utf8_status validate_avx2(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+
+    avx2_state state = {
+        .error = _mm256_setzero_si256(),
+        .previous = _mm256_setzero_si256(),
+        .previous_incomplete = _mm256_setzero_si256(),
+        .ascii = true
+    };
+
+    // Source files are mostly ASCII, so we check four blocks at once before looking at them one by one.
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i input0 = _mm256_loadu_si256((const __m256i *)(bytes + i));
+        __m256i input1 = _mm256_loadu_si256((const __m256i *)(bytes + i + 32));
+        __m256i input2 = _mm256_loadu_si256((const __m256i *)(bytes + i + 64));
+        __m256i input3 = _mm256_loadu_si256((const __m256i *)(bytes + i + 96));
+
+        __m256i any = _mm256_or_si256(_mm256_or_si256(input0, input1), _mm256_or_si256(input2, input3));
+        if (_mm256_movemask_epi8(any) == 0) {
+            state.error = _mm256_or_si256(state.error, state.previous_incomplete);
+            state.previous = input3;
+            continue;
+        }
+
+        avx2_step(&state, input0);
+        avx2_step(&state, input1);
+        avx2_step(&state, input2);
+        avx2_step(&state, input3);
+    }
+
+    for (; i + 32 <= size; i += 32) {
+        avx2_step(&state, _mm256_loadu_si256((const __m256i *)(bytes + i)));
+    }
+
+    if (i < size) {
+        // Padding with NUL characters, which are ASCII.
+        unsigned char tail[32] = { 0 };
+        memcpy(tail, bytes + i, size - i);
+        avx2_step(&state, _mm256_loadu_si256((const __m256i *)tail));
+    }
+
+    __m256i error = _mm256_or_si256(state.error, state.previous_incomplete);
+    if (!_mm256_testz_si256(error, error)) {
+        return SC_UTF8_INVALID;
+    }
+
+    return state.ascii ? SC_UTF8_ASCII : SC_UTF8_VALID;
+}
+
+#undef PREVIOUS
+#undef LOOKUP16
+#undef AVX2
+#undef CARRY
+#undef TWO_CONTS
+#undef OVERLONG_4
+#undef TOO_LARGE_1000
+#undef OVERLONG_2
+#undef SURROGATE
+#undef TOO_LARGE
+#undef OVERLONG_3
+#undef TOO_LONG
+#undef TOO_SHORT
+
+#endif
+
+sc_utf8_status sc_utf8_validate(const void *data, size_t size) {
+    #ifdef SC_UTF8_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return validate_avx2(data, size);
+        }
+    #endif
+
+    return sc_utf8_validate_scalar(data, size);
+}
+
+const char *sc_utf8_kernel() {
+    #ifdef SC_UTF8_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return "avx2";
+        }
+    #endif
+
+    return "scalar";
+}
+
+#undef ASCII_MASK
@@ -0,0 +1,107 @@
+#include <sc_vfs.h>
+#include <sc_hash.h>
+#include <string.h>
+
+// Returns the file at that path or the empty slot where it belongs.
+static sc_vfs_file *vfs_slot(sc_vfs *vfs, const char *path, size_t hash) {
+    size_t mask = vfs->capacity - 1;
+    size_t index = hash & mask;
+
+    while (true) {
+        sc_vfs_file *file = &vfs->files[index];
+        if (!file->path || (file->hash == hash && !strcmp(file->path, path))) {
+            return file;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Rebuilds the index with room for at least one more file, leaving out 'dropped'.
+// Removing a file is rare enough that we don't bother with deletion in place.
+static void vfs_reindex(sc_vfs *vfs, sc_vfs_file *dropped) {
+    sc_vfs_file *old_files = vfs->files;
+    size_t old_capacity = vfs->capacity;
+
+    while ((vfs->size + 1) * 2 > vfs->capacity) {
+        vfs->capacity *= 2;
+    }
+
+    vfs->files = calloc(vfs->capacity, sizeof(sc_vfs_file));
+    vfs->size = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old_files[i].path) {
+            continue;
+        }
+
+        if (&old_files[i] == dropped) {
+            free(old_files[i].path);
+        } else {
+            *vfs_slot(vfs, old_files[i].path, old_files[i].hash) = old_files[i];
+            vfs->size++;
+        }
+    }
+
+    free(old_files);
+}
+
+void vfs_init(sc_vfs *vfs) {
+    vfs->capacity = VFS_INDEX_SIZE;
+    vfs->size = 0;
+    vfs->files = calloc(VFS_INDEX_SIZE, sizeof(sc_vfs_file));
+}
+
+void vfs_destroy(sc_vfs *vfs) {
+    for (size_t i = 0; i < vfs->capacity; i++) {
+        free(vfs->files[i].path);
+    }
+
+    free(vfs->files);
+    vfs->files = NULL;
+    vfs->size = vfs->capacity = 0;
+}
+
+void vfs_add(sc_vfs *vfs, const char *path, const char *contents, size_t size) {
+    assert(contents[size] == '\0');
+
+    char normalized[FILENAME_MAX];
+    size_t len = path_normalize(path, normalized, FILENAME_MAX);
+    size_t hash = sc_fnv1a_string(normalized);
+
+    if ((vfs->size + 1) * 2 > vfs->capacity) {
+        vfs_reindex(vfs, NULL);
+    }
+
+    sc_vfs_file *file = vfs_slot(vfs, normalized, hash);
+    if (!file->path) {
+        file->path = malloc(len);
+        memcpy(file->path, normalized, len);
+        file->hash = hash;
+        vfs->size++;
+    }
+
+    file->contents = contents;
+    file->size = size;
+}
+
+bool vfs_remove(sc_vfs *vfs, const char *path) {
+    char normalized[FILENAME_MAX];
+    path_normalize(path, normalized, FILENAME_MAX);
+
+    sc_vfs_file *file = vfs_slot(vfs, normalized, sc_fnv1a_string(normalized));
+    if (!file->path) {
+        return false;
+    }
+
+    vfs_reindex(vfs, file);
+    return true;
+}
+
+sc_vfs_file *vfs_find(sc_vfs *vfs, const char *path) {
+    if (vfs->size == 0) {
+        return NULL;
+    }
+
+    sc_vfs_file *file = vfs_slot(vfs, path, sc_fnv1a_string(path));
+    return file->path ? file : NULL;
+}
@@ -0,0 +1,181 @@
+#ifndef _WIN32
+    // For MAP_ANONYMOUS, MAP_NORESERVE and MADV_HUGEPAGE.
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <sc_vm_alloc.h>
+#include <string.h>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
+
+#define UNUSED(x) (void)(x)
+
+static size_t round_up(size_t size, size_t granularity) {
+    return (size + granularity - 1) / granularity * granularity;
+}
+
+#ifdef _WIN32
+
+bool vm_region_init(sc_vm_region *region, size_t reserve, int flags) {
+    UNUSED(reserve);
+    UNUSED(flags);
+    *region = (sc_vm_region) { .base = NULL, .reserved = 0, .committed = 0, .index = 0, .commit_size = VM_REGION_COMMIT_SIZE };
+    return false;
+}
+
+void vm_region_destroy(sc_vm_region *region) {
+    UNUSED(region);
+}
+
+void vm_region_reset(sc_vm_region *region) {
+    region->index = 0;
+}
+
+static bool vm_region_commit(sc_vm_region *region, size_t size) {
+    UNUSED(region);
+    UNUSED(size);
+    return false;
+}
+
+#else
+
+bool vm_region_init(sc_vm_region *region, size_t reserve, int flags) {
+    size_t commit_size = flags & VM_REGION_HUGE_PAGES ? VM_REGION_HUGE_PAGE_SIZE : VM_REGION_COMMIT_SIZE;
+    *region = (sc_vm_region) { .base = NULL, .reserved = 0, .committed = 0, .index = 0, .commit_size = commit_size };
+    if (reserve == 0 || reserve > SIZE_MAX - 2 * commit_size) {
+        return false;
+    }
+
+    // Reserved but not committed: no access, and not counted against the commit limit.
+    reserve = round_up(reserve, commit_size);
+    size_t mapped = flags & VM_REGION_HUGE_PAGES ? reserve + VM_REGION_HUGE_PAGE_SIZE : reserve;
+    char *memory = mmap(NULL, mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    if (flags & VM_REGION_HUGE_PAGES) {
+        // Huge pages need huge page aligned addresses, we give back what is before and after.
+        char *aligned = (char *)(((uintptr_t)memory + VM_REGION_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(VM_REGION_HUGE_PAGE_SIZE - 1));
+        if (aligned != memory) {
+            munmap(memory, aligned - memory);
+        }
+        if (aligned + reserve != memory + mapped) {
+            munmap(aligned + reserve, memory + mapped - (aligned + reserve));
+        }
+        memory = aligned;
+
+        #ifdef MADV_HUGEPAGE
+            madvise(memory, reserve, MADV_HUGEPAGE);
+        #endif
+    }
+
+    region->base = memory;
+    region->reserved = reserve;
+    return true;
+}
+
+void vm_region_destroy(sc_vm_region *region) {
+    if (region->base) {
+        munmap(region->base, region->reserved);
+    }
+
+    region->base = NULL;
+    region->reserved = 0;
+    region->committed = 0;
+    region->index = 0;
+}
+
+void vm_region_reset(sc_vm_region *region) {
+    if (region->committed > 0) {
+        madvise(region->base, region->committed, MADV_DONTNEED);
+    }
+    region->index = 0;
+}
+
+// Makes sure the first 'size' bytes are committed.
+static bool vm_region_commit(sc_vm_region *region, size_t size) {
+    if (size > region->reserved) {
+        return false;
+    }
+
+    size_t committed = round_up(size, region->commit_size);
+    if (committed > region->reserved) {
+        committed = region->reserved;
+    }
+
+    if (mprotect(region->base + region->committed, committed - region->committed, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+
+    region->committed = committed;
+    return true;
+}
+
+#endif
+
+bool vm_region_owns(sc_vm_region *region, void *memory) {
+    return region->base && (char *)memory >= region->base && (char *)memory < region->base + region->reserved;
+}
+
+static void *vm_region_alloc(sc_vm_region *region, size_t size) {
+    // Zero sized allocations take a byte too, so that they never land on the end of the reservation, which we don't own.
+    if (size == 0) {
+        size = 1;
+    }
+
+    size_t start = round_up(region->index, SC_ALLOC_ALIGNMENT);
+    if (start > region->reserved || size > region->reserved - start) {
+        return NULL;
+    }
+
+    if (start + size > region->committed && !vm_region_commit(region, start + size)) {
+        return NULL;
+    }
+
+    region->index = start + size;
+    return region->base + start;
+}
+
+static void vm_region_free(void *state, void *memory) {
+    UNUSED(state);
+    UNUSED(memory);
+}
+
+static void *vm_region_resize(sc_vm_region *region, void *memory, size_t old_size, size_t new_size) {
+    // The last allocation grows in place.
+    if (memory && (char *)memory + old_size == region->base + region->index) {
+        size_t start = (char *)memory - region->base;
+        if (new_size > region->reserved - start) {
+            return NULL;
+        }
+
+        if (start + new_size > region->committed && !vm_region_commit(region, start + new_size)) {
+            return NULL;
+        }
+
+        region->index = start + new_size;
+        return memory;
+    }
+
+    void *bigger = vm_region_alloc(region, new_size);
+    if (bigger && memory) {
+        memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+    }
+    return bigger;
+}
+
+sc_allocator make_vm_region_alloc(sc_vm_region *region, size_t reserve, int flags) {
+    vm_region_init(region, reserve, flags);
+
+    return make_alloc_from_vm_region(region);
+}
+
+sc_allocator make_alloc_from_vm_region(sc_vm_region *region) {
+    return (sc_allocator) { .alloc = (alloc_func)vm_region_alloc, .free = vm_region_free, .destroy = (destroy_func)vm_region_destroy,
+                            .resize = (resize_func)vm_region_resize, .owns = (owns_func)vm_region_owns, .state = (void*)region };
+}
+
+#undef UNUSED
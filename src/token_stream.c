@@ -0,0 +1,427 @@
+#include <token_stream.h>
+#include <sc_hash.h>
+#include <string.h>
+
+#define TABLE_SLOTS 1024
+
+static void *grow(sc_allocator *alloc, void *memory, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) {
+        return memory;
+    }
+
+    size_t old_capacity = *capacity;
+    while (*capacity < needed) {
+        *capacity = *capacity == 0 ? 256 : *capacity * 2;
+    }
+
+    return sc_realloc(alloc, memory, old_capacity * element_size, *capacity * element_size);
+}
+
+// Finds the slot of an element equal to 'key' in one of the interning hash maps, or the empty slot where it belongs.
+// 'equals' compares the key against the element at an index.
+static uint32_t *find_slot(uint32_t *slots, size_t slot_count, size_t hash, const void *key,
+                           bool (*equals)(token_stream_writer *, uint32_t, const void *), token_stream_writer *writer) {
+    size_t mask = slot_count - 1;
+    size_t index = hash & mask;
+
+    while (slots[index] != 0 && !equals(writer, slots[index] - 1, key)) {
+        index = (index + 1) & mask;
+    }
+
+    return &slots[index];
+}
+
+// Doubles the hash map if adding one more element would make it more than half full.
+static void reserve_slot(uint32_t **slots, size_t *slot_count, size_t size, size_t (*hash)(token_stream_writer *, uint32_t),
+                         token_stream_writer *writer) {
+    if ((size + 1) * 2 <= *slot_count) {
+        return;
+    }
+
+    sc_free(writer->alloc, *slots);
+    *slot_count *= 2;
+    *slots = sc_calloc(writer->alloc, *slot_count, sizeof(uint32_t));
+
+    size_t mask = *slot_count - 1;
+    for (uint32_t i = 0; i < size; i++) {
+        size_t index = hash(writer, i) & mask;
+        while ((*slots)[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        (*slots)[index] = i + 1;
+    }
+}
+
+typedef struct string_key {
+    const char *data;
+    size_t size;
+} string_key;
+
+static bool string_equals_key(token_stream_writer *writer, uint32_t index, const void *key) {
+    const string_key *string = key;
+    uint64_t start = writer->strings.offsets[index];
+    uint64_t size = writer->strings.offsets[index + 1] - start - 1;
+    return size == string->size && !memcmp(writer->strings.data + start, string->data, size);
+}
+
+static size_t string_hash(token_stream_writer *writer, uint32_t index) {
+    uint64_t start = writer->strings.offsets[index];
+    return sc_fnv1a(writer->strings.data + start, writer->strings.offsets[index + 1] - start - 1, SC_FNV_OFFSET);
+}
+
+static uint32_t intern_string(token_stream_writer *writer, const char *data, size_t size) {
+    reserve_slot(&writer->strings.slots, &writer->strings.slot_count, writer->strings.count, string_hash, writer);
+
+    string_key key = { .data = data, .size = size };
+    uint32_t *slot = find_slot(writer->strings.slots, writer->strings.slot_count, sc_fnv1a(data, size, SC_FNV_OFFSET), &key,
+                               string_equals_key, writer);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    if (writer->strings.count >= UINT32_MAX - 1) {
+        writer->overflow = true;
+        return 0;
+    }
+
+    writer->strings.data = grow(writer->alloc, writer->strings.data, &writer->strings.capacity, writer->strings.size + size + 1, 1);
+    memcpy(writer->strings.data + writer->strings.size, data, size);
+    writer->strings.data[writer->strings.size + size] = '\0';
+    writer->strings.size += size + 1;
+
+    writer->strings.offsets = grow(writer->alloc, writer->strings.offsets, &writer->strings.offsets_capacity, writer->strings.count + 2, sizeof(uint64_t));
+    writer->strings.offsets[++writer->strings.count] = writer->strings.size;
+
+    *slot = (uint32_t)writer->strings.count;
+    return *slot - 1;
+}
+
+static bool source_equals(token_stream_writer *writer, uint32_t index, const void *key) {
+    return !memcmp(&writer->sources.memory[index], key, sizeof(token_stream_source));
+}
+
+static size_t source_hash(token_stream_writer *writer, uint32_t index) {
+    return sc_fnv1a(&writer->sources.memory[index], sizeof(token_stream_source), SC_FNV_OFFSET);
+}
+
+static uint32_t intern_source(token_stream_writer *writer, token_stream_source *source) {
+    reserve_slot(&writer->sources.slots, &writer->sources.slot_count, writer->sources.size, source_hash, writer);
+
+    uint32_t *slot = find_slot(writer->sources.slots, writer->sources.slot_count, sc_fnv1a(source, sizeof(token_stream_source), SC_FNV_OFFSET),
+                               source, source_equals, writer);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    if (writer->sources.size >= TOKEN_STREAM_NO_SOURCE - 1) {
+        writer->overflow = true;
+        return TOKEN_STREAM_NO_SOURCE;
+    }
+
+    writer->sources.memory = grow(writer->alloc, writer->sources.memory, &writer->sources.capacity, writer->sources.size + 1, sizeof(token_stream_source));
+    writer->sources.memory[writer->sources.size++] = *source;
+    *slot = (uint32_t)writer->sources.size;
+    return *slot - 1;
+}
+
+static bool context_equals(token_stream_writer *writer, uint32_t index, const void *key) {
+    return !memcmp(&writer->contexts.memory[index], key, sizeof(token_stream_context));
+}
+
+static size_t context_hash(token_stream_writer *writer, uint32_t index) {
+    return sc_fnv1a(&writer->contexts.memory[index], sizeof(token_stream_context), SC_FNV_OFFSET);
+}
+
+static uint32_t intern_context(token_stream_writer *writer, token_stream_context *context) {
+    reserve_slot(&writer->contexts.slots, &writer->contexts.slot_count, writer->contexts.size, context_hash, writer);
+
+    uint32_t *slot = find_slot(writer->contexts.slots, writer->contexts.slot_count,
+                               sc_fnv1a(context, sizeof(token_stream_context), SC_FNV_OFFSET), context, context_equals, writer);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    if (writer->contexts.size >= UINT32_MAX - 1) {
+        writer->overflow = true;
+        return 0;
+    }
+
+    writer->contexts.memory = grow(writer->alloc, writer->contexts.memory, &writer->contexts.capacity, writer->contexts.size + 1, sizeof(token_stream_context));
+    writer->contexts.memory[writer->contexts.size++] = *context;
+    *slot = (uint32_t)writer->contexts.size;
+    return *slot - 1;
+}
+
+void token_stream_writer_init(token_stream_writer *writer) {
+    token_stream_writer_init_with(writer, mallocator());
+}
+
+void token_stream_writer_init_with(token_stream_writer *writer, sc_allocator *alloc) {
+    memset(writer, 0, sizeof(token_stream_writer));
+    writer->alloc = alloc;
+
+    writer->strings.offsets = grow(writer->alloc, NULL, &writer->strings.offsets_capacity, 1, sizeof(uint64_t));
+    writer->strings.offsets[0] = 0;
+
+    writer->strings.slot_count = writer->sources.slot_count = writer->contexts.slot_count = TABLE_SLOTS;
+    writer->strings.slots = sc_calloc(alloc, TABLE_SLOTS, sizeof(uint32_t));
+    writer->sources.slots = sc_calloc(alloc, TABLE_SLOTS, sizeof(uint32_t));
+    writer->contexts.slots = sc_calloc(alloc, TABLE_SLOTS, sizeof(uint32_t));
+}
+
+void token_stream_writer_destroy(token_stream_writer *writer) {
+    sc_free(writer->alloc, writer->strings.data);
+    sc_free(writer->alloc, writer->strings.offsets);
+    sc_free(writer->alloc, writer->strings.slots);
+    sc_free(writer->alloc, writer->sources.memory);
+    sc_free(writer->alloc, writer->sources.slots);
+    sc_free(writer->alloc, writer->contexts.memory);
+    sc_free(writer->alloc, writer->contexts.slots);
+    sc_free(writer->alloc, writer->tokens.memory);
+    memset(writer, 0, sizeof(token_stream_writer));
+}
+
+static uint32_t narrow(token_stream_writer *writer, size_t value) {
+    if (value > UINT32_MAX) {
+        writer->overflow = true;
+        return UINT32_MAX;
+    }
+
+    return (uint32_t)value;
+}
+
+static void record_token(token_stream_writer *writer, token *tok, bool line_start) {
+    // Every entry but the last one is an include or macro expansion, the last one is the file the token comes from.
+    uint32_t source = TOKEN_STREAM_NO_SOURCE;
+    for (size_t i = 0; i + 1 < tok->stack_size; i++) {
+        token_source *entry = &tok->source_stack[i];
+        string *name = entry->kind == TSRC_MACRO ? &entry->macro.name : &entry->include.path;
+
+        token_stream_source record;
+        memset(&record, 0, sizeof(record));
+        record.kind = entry->kind;
+        record.name = intern_string(writer, string_data(name), string_size(name));
+        record.line = narrow(writer, entry->kind == TSRC_MACRO ? entry->macro.line : entry->include.line);
+        record.column = narrow(writer, entry->kind == TSRC_MACRO ? entry->macro.column : entry->include.column);
+        record.parent = source;
+        source = intern_source(writer, &record);
+    }
+
+    token_source *file = &tok->source_stack[tok->stack_size - 1];
+
+    token_stream_context context;
+    memset(&context, 0, sizeof(context));
+    context.source = source;
+    context.path = intern_string(writer, string_data(&file->file.path), string_size(&file->file.path));
+    context.line_path = intern_string(writer, string_data(&tok->line.path), string_size(&tok->line.path));
+    context.line_offset = (int64_t)tok->line.line - (int64_t)file->file.line;
+
+    int64_t line_delta = (int64_t)file->file.line - (int64_t)writer->previous_line;
+    if (line_delta < INT32_MIN || line_delta > INT32_MAX) {
+        writer->overflow = true;
+    }
+    writer->previous_line = file->file.line;
+
+    writer->tokens.memory = grow(writer->alloc, writer->tokens.memory, &writer->tokens.capacity, writer->tokens.size + 1, sizeof(token_stream_token));
+    writer->tokens.memory[writer->tokens.size++] = (token_stream_token) {
+        .kind = (uint8_t)tok->kind,
+        .flags = (tok->has_whitespace ? TOKEN_STREAM_WHITESPACE : 0) | (line_start ? TOKEN_STREAM_LINE_START : 0),
+        .padding = 0,
+        .spelling = intern_string(writer, string_data(&tok->data), string_size(&tok->data)),
+        .context = intern_context(writer, &context),
+        .line_delta = (int32_t)line_delta,
+        .column = narrow(writer, file->file.column)
+    };
+}
+
+void token_stream_writer_line(token_stream_writer *writer, preprocessor_state *state, token_vector *line) {
+    for (size_t i = 0; i < line->size; i++) {
+        record_token(writer, &line->memory[i], !writer->line_open && i == 0);
+    }
+    writer->line_open |= line->size != 0;
+
+    if (!state->line_continues) {
+        writer->line_open = false;
+    }
+}
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+// Writes the section followed by the padding to the next 8 byte boundary. Empty tables may not have memory yet.
+static void write_section(sc_output *out, const void *data, uint64_t size) {
+    static const char zeros[8] = { 0 };
+    if (size != 0) {
+        output_write(out, data, size);
+    }
+    output_write(out, zeros, ALIGN8(size) - size);
+}
+
+bool token_stream_writer_finish(token_stream_writer *writer, sc_output *out) {
+    if (writer->overflow) {
+        return false;
+    }
+
+    token_stream_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TOKEN_STREAM_MAGIC, sizeof(header.magic));
+    header.version = TOKEN_STREAM_VERSION;
+    header.byte_order = TOKEN_STREAM_BYTE_ORDER;
+
+    header.string_count = writer->strings.count;
+    header.source_count = writer->sources.size;
+    header.context_count = writer->contexts.size;
+    header.token_count = writer->tokens.size;
+
+    uint64_t string_offsets_size = (writer->strings.count + 1) * sizeof(uint64_t);
+    uint64_t sources_size = writer->sources.size * sizeof(token_stream_source);
+    uint64_t contexts_size = writer->contexts.size * sizeof(token_stream_context);
+    uint64_t tokens_size = writer->tokens.size * sizeof(token_stream_token);
+
+    header.string_offsets_offset = ALIGN8(sizeof(header));
+    header.string_data_offset = header.string_offsets_offset + ALIGN8(string_offsets_size);
+    header.string_data_size = writer->strings.size;
+    header.sources_offset = header.string_data_offset + ALIGN8(writer->strings.size);
+    header.contexts_offset = header.sources_offset + ALIGN8(sources_size);
+    header.tokens_offset = header.contexts_offset + ALIGN8(contexts_size);
+    header.file_size = header.tokens_offset + ALIGN8(tokens_size);
+
+    write_section(out, &header, sizeof(header));
+    write_section(out, writer->strings.offsets, string_offsets_size);
+    write_section(out, writer->strings.data, writer->strings.size);
+    write_section(out, writer->sources.memory, sources_size);
+    write_section(out, writer->contexts.memory, contexts_size);
+    write_section(out, writer->tokens.memory, tokens_size);
+    return true;
+}
+
+// Is there room for 'count' elements of 'size' bytes at 'offset'?
+static bool table_fits(const token_stream_header *header, uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % 8 == 0 && offset <= header->file_size && count <= (header->file_size - offset) / size;
+}
+
+bool token_stream_open(token_stream *stream, const char *path) {
+    size_t path_len = strlen(path);
+    char *path_copy = malloc(path_len + 1);
+    memcpy(path_copy, path, path_len + 1);
+
+    // Small streams are read instead, sc_allocator memory is aligned enough for the tables too.
+    file_load_with(&stream->file, path_copy, mallocator(), FILE_LOAD_MMAP | FILE_LOAD_SEQUENTIAL);
+    if (!stream->file.contents) {
+        free(path_copy);
+        return false;
+    }
+
+    const token_stream_header *header = (const token_stream_header *)stream->file.contents;
+    stream->header = header;
+
+    bool ok = (size_t)stream->file.size >= sizeof(token_stream_header) && !memcmp(header->magic, TOKEN_STREAM_MAGIC, sizeof(header->magic))
+        && header->version == TOKEN_STREAM_VERSION && header->byte_order == TOKEN_STREAM_BYTE_ORDER
+        && header->file_size <= (uint64_t)stream->file.size
+        && header->string_count < UINT32_MAX && header->source_count < TOKEN_STREAM_NO_SOURCE && header->context_count < UINT32_MAX
+        && table_fits(header, header->string_offsets_offset, header->string_count + 1, sizeof(uint64_t))
+        && table_fits(header, header->string_data_offset, header->string_data_size, 1)
+        && table_fits(header, header->sources_offset, header->source_count, sizeof(token_stream_source))
+        && table_fits(header, header->contexts_offset, header->context_count, sizeof(token_stream_context))
+        && table_fits(header, header->tokens_offset, header->token_count, sizeof(token_stream_token));
+
+    if (ok) {
+        stream->string_offsets = (const uint64_t *)(stream->file.contents + header->string_offsets_offset);
+        stream->string_data = stream->file.contents + header->string_data_offset;
+        stream->sources = (const token_stream_source *)(stream->file.contents + header->sources_offset);
+        stream->contexts = (const token_stream_context *)(stream->file.contents + header->contexts_offset);
+        stream->tokens = (const token_stream_token *)(stream->file.contents + header->tokens_offset);
+    }
+
+    // Parents always come before the sources that refer to them, so there can be no cycles.
+    for (uint64_t i = 0; ok && i < header->source_count; i++) {
+        const token_stream_source *source = &stream->sources[i];
+        ok = (source->kind == TSRC_INCLUDE || source->kind == TSRC_MACRO) && token_stream_string(stream, source->name, NULL)
+            && (source->parent == TOKEN_STREAM_NO_SOURCE || source->parent < i);
+    }
+
+    for (uint64_t i = 0; ok && i < header->context_count; i++) {
+        const token_stream_context *context = &stream->contexts[i];
+        ok = (context->source == TOKEN_STREAM_NO_SOURCE || context->source < header->source_count)
+            && token_stream_string(stream, context->path, NULL) && token_stream_string(stream, context->line_path, NULL);
+    }
+
+    if (!ok) {
+        token_stream_close(stream);
+        return false;
+    }
+
+    return true;
+}
+
+void token_stream_close(token_stream *stream) {
+    free(stream->file.abs_path);
+    file_destroy(&stream->file);
+    stream->header = NULL;
+}
+
+const char *token_stream_string(const token_stream *stream, uint32_t index, size_t *size) {
+    if (index >= stream->header->string_count) {
+        return NULL;
+    }
+
+    uint64_t start = stream->string_offsets[index];
+    uint64_t end = stream->string_offsets[index + 1];
+    if (start >= end || end > stream->header->string_data_size || stream->string_data[end - 1] != '\0') {
+        return NULL;
+    }
+
+    if (size) {
+        *size = end - start - 1;
+    }
+    return stream->string_data + start;
+}
+
+void token_stream_cursor_init(token_stream_cursor *cursor, const token_stream *stream) {
+    cursor->stream = stream;
+    cursor->index = 0;
+    cursor->line = 0;
+    cursor->failed = false;
+}
+
+bool token_stream_next(token_stream_cursor *cursor, token_stream_entry *entry) {
+    const token_stream *stream = cursor->stream;
+    if (cursor->failed || cursor->index >= stream->header->token_count) {
+        return false;
+    }
+
+    const token_stream_token *tok = &stream->tokens[cursor->index++];
+    if (tok->context >= stream->header->context_count) {
+        cursor->failed = true;
+        return false;
+    }
+
+    const token_stream_context *context = &stream->contexts[tok->context];
+    entry->data = token_stream_string(stream, tok->spelling, &entry->size);
+    if (!entry->data) {
+        cursor->failed = true;
+        return false;
+    }
+
+    // The kind comes from the file like everything else, only cast it once we know it is one of ours.
+    if (tok->kind > TOK_COLON) {
+        cursor->failed = true;
+        return false;
+    }
+
+    cursor->line += tok->line_delta;
+
+    entry->kind = (token_kind)tok->kind;
+    entry->has_whitespace = tok->flags & TOKEN_STREAM_WHITESPACE;
+    entry->line_start = tok->flags & TOKEN_STREAM_LINE_START;
+    // Contexts were checked when the stream was opened.
+    entry->path = token_stream_string(stream, context->path, NULL);
+    entry->line = (size_t)cursor->line;
+    entry->column = tok->column;
+    entry->line_path = token_stream_string(stream, context->line_path, NULL);
+    entry->line_line = (size_t)(cursor->line + context->line_offset);
+    entry->source = context->source == TOKEN_STREAM_NO_SOURCE ? NULL : &stream->sources[context->source];
+    return true;
+}
+
+#undef ALIGN8
+#undef TABLE_SLOTS
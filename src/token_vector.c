@@ -1,75 +1,101 @@
-#include <token_vector.h>
-
-void pp_token_vector_init_empty(pp_token_vector *vector) {
-    vector->size = 0;
-    vector->capacity = 0;
-    vector->memory = NULL;
-}
-
-void pp_token_vector_init(pp_token_vector *vector, size_t initial_capacity) {
-    vector->size = 0;
-    vector->capacity = initial_capacity;
-    vector->memory = malloc(initial_capacity * sizeof(pp_token));
-}
-
-void pp_token_vector_push(pp_token_vector *vector, const pp_token *tok) {
-    if (vector->size >= vector->capacity) {
-        if (vector->capacity == 0) vector->capacity = 64;
-        else vector->capacity *= 2;
-        vector->memory = realloc(vector->memory, vector->capacity * sizeof(pp_token));
-    }
-
-    vector->memory[vector->size++] = *tok;
-}
-
-void pp_token_vector_destroy(pp_token_vector *vector) {
-    if (vector->memory) {
-        free(vector->memory);
-        vector->memory = NULL;
-    }
-    vector->size = 0;
-    vector->capacity = 0;
-}
-
-pp_token *pp_token_vector_tail(pp_token_vector *vector) {
-    if (vector->size >= vector->capacity) {
-        if (vector->capacity == 0) vector->capacity = 64;
-        else vector->capacity *= 2;
-        vector->memory = realloc(vector->memory, vector->capacity * sizeof(pp_token));
-    }
-
-    return &vector->memory[vector->size++];
-}
-
-void token_vector_init(token_vector *vector, size_t initial_capacity) {
-    vector->size = 0;
-    vector->capacity = initial_capacity;
-    vector->memory = malloc(initial_capacity * sizeof(token));
-}
-
-void token_vector_push(token_vector *vector, const token *tok) {
-    if (vector->size >= vector->capacity) {
-        vector->capacity *= 2;
-        vector->memory = realloc(vector->memory, vector->capacity * sizeof(token));
-    }
-
-    vector->memory[vector->size++] = *tok;
-}
-
-void token_vector_destroy(token_vector *vector) {
-    if (vector->memory) {
-        free(vector->memory);
-        vector->memory = NULL;
-    }
-    vector->size = 0;
-    vector->capacity = 0;
-}
-
-token *token_vector_tail(token_vector *vector) {
-    if (vector->size >= vector->capacity) {
-        vector->capacity *= 2;
-        vector->memory = realloc(vector->memory, vector->capacity * sizeof(token));
-    }
-
-    return &vector->memory[vector->size++];
-}
+#include <token_vector.h>
+
+// Token storage is released after every line, so a small chunk is enough most of the time.
+#ifndef TOKEN_STORAGE_CHUNK_SIZE
+    #define TOKEN_STORAGE_CHUNK_SIZE 4096
+#endif
+
+void pp_token_vector_init_empty(pp_token_vector *vector) {
+    vector->size = 0;
+    vector->capacity = 0;
+    vector->memory = NULL;
+    vector->allocator = mallocator();
+}
+
+void pp_token_vector_init(pp_token_vector *vector, size_t initial_capacity) {
+    pp_token_vector_init_with(vector, initial_capacity, mallocator());
+}
+
+void pp_token_vector_init_with(pp_token_vector *vector, size_t initial_capacity, sc_allocator *allocator) {
+    vector->size = 0;
+    vector->capacity = initial_capacity;
+    vector->memory = initial_capacity ? sc_alloc(allocator, initial_capacity * sizeof(pp_token)) : NULL;
+    vector->allocator = allocator;
+}
+
+static void pp_token_vector_grow(pp_token_vector *vector) {
+    size_t old_capacity = vector->capacity;
+    if (vector->capacity == 0) vector->capacity = 64;
+    else vector->capacity *= 2;
+    vector->memory = sc_realloc(vector->allocator, vector->memory, old_capacity * sizeof(pp_token), vector->capacity * sizeof(pp_token));
+}
+
+void pp_token_vector_push(pp_token_vector *vector, const pp_token *tok) {
+    if (vector->size >= vector->capacity) {
+        pp_token_vector_grow(vector);
+    }
+
+    vector->memory[vector->size++] = *tok;
+}
+
+void pp_token_vector_destroy(pp_token_vector *vector) {
+    if (vector->memory) {
+        sc_free(vector->allocator, vector->memory);
+        vector->memory = NULL;
+    }
+    vector->size = 0;
+    vector->capacity = 0;
+}
+
+pp_token *pp_token_vector_tail(pp_token_vector *vector) {
+    if (vector->size >= vector->capacity) {
+        pp_token_vector_grow(vector);
+    }
+
+    return &vector->memory[vector->size++];
+}
+
+void token_vector_init(token_vector *vector, size_t initial_capacity) {
+    token_vector_init_with(vector, initial_capacity, mallocator());
+}
+
+void token_vector_init_with(token_vector *vector, size_t initial_capacity, sc_allocator *allocator) {
+    vector->size = 0;
+    vector->capacity = initial_capacity;
+    vector->memory = initial_capacity ? sc_alloc(allocator, initial_capacity * sizeof(token)) : NULL;
+    vector->allocator = allocator;
+    arena_init(&vector->storage, allocator, TOKEN_STORAGE_CHUNK_SIZE);
+}
+
+static void token_vector_grow(token_vector *vector) {
+    size_t old_capacity = vector->capacity;
+    if (vector->capacity == 0) vector->capacity = 64;
+    else vector->capacity *= 2;
+    vector->memory = sc_realloc(vector->allocator, vector->memory, old_capacity * sizeof(token), vector->capacity * sizeof(token));
+}
+
+void token_vector_push(token_vector *vector, const token *tok) {
+    if (vector->size >= vector->capacity) {
+        token_vector_grow(vector);
+    }
+
+    vector->memory[vector->size++] = *tok;
+}
+
+void token_vector_destroy(token_vector *vector) {
+    if (vector->memory) {
+        sc_free(vector->allocator, vector->memory);
+        vector->memory = NULL;
+    }
+    vector->size = 0;
+    vector->capacity = 0;
+    arena_destroy(&vector->storage);
+}
+
+token *token_vector_tail(token_vector *vector) {
+    if (vector->size >= vector->capacity) {
+        token_vector_grow(vector);
+    }
+
+    return &vector->memory[vector->size++];
+}
@@ -1,698 +1,1202 @@
-#include <tokenizer.h>
-#include <token_vector.h>
-#include <ctype.h>
-#include <string.h>
-
-// Newlines != whitespace
-static bool is_whitespace(const char c) {
-    return c == ' ' || c == '\t' || c == '\v' || c == '\f';
-}
-
-static bool is_ident_start(const char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-
-static bool is_ident_char(const char c) {
-    return is_ident_start(c) || isdigit(c);
-}
-
-static void tokenizer_error(size_t index, size_t length, size_t line, size_t column, tokenizer_state *state, const char *error) {
-    // So, we will take the pointer into the data and make a region of 10 characters to the left of it to 10 characters to the right of it.
-    // If we hit a newline in those 10 characters, go until the newline (not including).
-    // If we are not in whitespace after those 10 characters, go until whitespace or newline (unless we overflow buffer).
-    const char *error_ptr = state->data + index;
-
-    size_t start_off = index >= 10 ? 10 : index;
-    size_t end_off = state->data_size - index - length >= 10 ? 10 : state->data_size - index - length;
-
-    const char *start = error_ptr - start_off;
-    const char *end = error_ptr + end_off;
-
-    bool start_corrected = false;
-    bool end_corrected = false;
-
-    for (size_t i = start_off - 1; i >= 0; i--) {
-        if (start[i] == '\n') {
-            start = start + i + 1;
-            start_off = error_ptr - start;
-            start_corrected = true;
-            break;
-        }
-    }
-
-    for (size_t i = length; i <= length + end_off; i++) {
-        if (error_ptr[i] == '\r' || error_ptr[i] == '\n') {
-            end = error_ptr + i;
-            end_off = i;
-            end_corrected = true;
-            break;
-        }
-    }
-
-    if (!start_corrected) {
-        // Ok, let's see where we point at.
-        while (!is_whitespace(start[-1]) && start[-1] != '\n' && start_off <= index - 1) {
-            start--;
-            start_off++;
-        }
-    }
-
-    if (!end_corrected) {
-        while (!is_whitespace(end[1]) && end[1] != '\r' && end[1] != '\n' && end_off < (state->data_size - index)) {
-            end++;
-            end_off++;
-        }
-    }
-
-    // So we write: [state->path]:[line]:[column]: Error: [error]\n
-    //              [15 spaces][state->data[start_off : end_off]]\n
-    //                               ~~~~~~~~
-
-    // We assume that the numbers are 4 long at maximum
-    size_t total_length = strlen(state->path) + 51 + strlen(error) + (end_off + start_off) + (index - start_off) + length;
-
-    char region_buffer[1024];
-    sc_region region_state;
-    sc_allocator region_alloc = make_region_alloc(&region_state, region_buffer, 1024);
-
-    sc_fallback fallback_state;
-    sc_allocator fallback_alloc = make_fallback_alloc(&fallback_state, &region_alloc, mallocator());
-
-    char *space_buff = sc_alloc(&fallback_alloc, start_off + 1);
-    memset(space_buff, ' ', start_off);
-    space_buff[start_off] = '\0';
-
-    char *tilde_buff = sc_alloc(&fallback_alloc, length + 1);
-    memset(tilde_buff, '~', length);
-    tilde_buff[length] = '\0';
-
-    char *data_piece = sc_alloc(&fallback_alloc, end_off + start_off + 1);
-    memcpy(data_piece, error_ptr - start_off, end_off + start_off);
-    data_piece[end_off + start_off] = '\0';
-
-    char *buff = sc_alloc(&fallback_alloc, total_length + 1);
-    snprintf(buff, total_length + 1, "%s:%lu:%lu: Error: %s\n               %s\n               %s%s\n",
-             state->path, line, column, error, data_piece, space_buff, tilde_buff);
-
-    // Just making sure.
-    buff[total_length] = '\0';
-
-    sc_error(false, buff);
-
-    // Free our stuff.
-    sc_free(&fallback_alloc, space_buff);
-    sc_free(&fallback_alloc, tilde_buff);
-    sc_free(&fallback_alloc, data_piece);
-    sc_free(&fallback_alloc, buff);
-
-    sc_destroy_allocator(&fallback_alloc);
-    sc_destroy_allocator(&region_alloc);
-}
-
-// Returns false when we hit EOF.
-static bool get_processed_line(tokenizer_state *state) {
-    string *current = &state->current_data;
-    string_resize(current, 0);
-
-    state->done = 0;
-
-    state->line_start = state->line_end;
-    state->column_start = state->column_end;
-
-    const char *data = state->data + state->index;
-
-    #define HAS_CHARS(N) (state->index + N < state->data_size)
-
-    while (*data != '\n') {
-        // Find backslash newline
-        if (HAS_CHARS(1) && *data == '\\' && data[1] == '\n') {
-            // Skip over.
-            data += 2;
-            state->index += 2;
-            state->line_end++;
-            state->column_end = 1;
-        } else if (HAS_CHARS(2) && *data == '\\' && data[1] == '\r' && data[2] == '\n') {
-            data += 3;
-            state->index += 3;
-            state->line_end++;
-            state->column_end = 1;
-        }
-        // Trigraphs
-        else if (HAS_CHARS(3) && *data == '?' && data[1] == '?') {
-            bool trigraph = true;
-            switch (data[2]) {
-                case '(':
-                    string_push(current, '[');
-                break;
-                case ')':
-                    string_push(current, ']');
-                break;
-                case '<':
-                    string_push(current, '{');
-                break;
-                case '>':
-                    string_push(current, '}');
-                break;
-                case '=':
-                    string_push(current, '#');
-                break;
-                case '/':
-                    string_push(current, '\\');
-                break;
-                case '\'':
-                    string_push(current, '^');
-                break;
-                case '!':
-                    string_push(current, '|');
-                break;
-                case '-':
-                    string_push(current, '~');
-                break;
-                default:
-                    trigraph = false;
-                break;
-            }
-
-            if (!trigraph) {
-                string_append_ptr_size(current, data, 3);
-                state->column_end += 3;
-            } else {
-                state->column_end++;
-            }
-            data += 3;
-            state->index += 3;
-        } else if (HAS_CHARS(1) && *data == '\r' && data[1] == '\n') {
-            data++;
-            state->index++;
-        } else {
-            string_push(current, *data);
-            data++;
-            state->index++;
-            state->column_end++;
-        }
-
-        // We check against -1 so as not to include the terminating null.
-        if (state->index == state->data_size - 1) return false;
-    }
-
-    // Skip past the newline character.
-    data++;
-    state->index++;
-
-    state->line_end++;
-    state->column_end = 1;
-
-    #undef HAS_CHARS
-
-    return true;
-}
-
-static void push_token(pp_token_vector *vec, tokenizer_state *state, size_t *processed, pp_token_kind kind) {
-    static pp_token_kind last_token_kind = PP_TOK_PLACEMARKER;
-
-    pp_token *tok = pp_token_vector_tail(vec);
-    if (*processed == 0) {
-        string_init(&tok->data, 0);
-    } else {
-        substring(&tok->data, &state->current_data, state->done, state->done + *processed);
-    }
-
-    tok->replaceable = true;
-    tok->kind = kind;
-
-    if (last_token_kind == PP_TOK_HASH && kind == PP_TOK_IDENTIFIER) {
-        if (STRING_EQUALS_LITERAL(&tok->data, "include")) {
-            state->in_include = true;
-        }
-    }
-
-    tok->source.path = state->path;
-    tok->source.line = state->line_start;
-    tok->source.column = state->column_start;
-
-    tok->has_whitespace = false;
-
-    state->column_start += *processed;
-
-    state->done += *processed;
-    *processed = 0;
-
-    last_token_kind = kind;
-}
-
-// @TODO: We could probably merge this with get_processed_line and push through all the tokens into the vector
-//        for the whole file or a limit set at call site (to then push to the parser without using too much memory).
-bool tokenize_line(pp_token_vector *vec, tokenizer_state *state) {
-    size_t original_vec_size = vec->size;
-    // Get a processed line.
-    bool result = get_processed_line(state);
-
-    size_t line_size = string_size(&state->current_data);
-    const char *data = string_data(&state->current_data);
-    size_t processed = 0;
-
-    // When we get whitespace, we update the tokenizer state then add the 'has_whitespace' flag to the last added token.
-    #define GOT_WHITESPACE { state->done += processed; state->column_start += processed; processed = 0; \
-                            if (vec->size > original_vec_size) { vec->memory[vec->size - 1].has_whitespace = true; } }
-
-    // So, our line is line "state->current_data"
-    if (state->in_multiline_comment) {
-        // We still are in some multiline comment, skip until we find the end (if we do)
-        while (state->done + 1 < line_size) {
-            if (data[state->done] == '*' && data[state->done + 1] == '/') {
-                state->in_multiline_comment = false;
-                processed += 2;
-                GOT_WHITESPACE;
-                break;
-            }
-
-            state->column_start++;
-            state->done++;
-        }
-
-        if (state->in_multiline_comment && !result) {
-            tokenizer_error(state->multiline_source.index, 2, state->multiline_source.line, state->multiline_source.column, state,
-                            "Unterminated multi line comment.");
-            return result;
-        }
-    }
-
-    // Helper macros to check that enough characters are left and to get data.
-    #define HAS_CHARS(N) (state->done + processed + N < line_size)
-    #define DATA(N) (data[state->done + processed + N])
-
-    bool in_strliteral = false;
-    bool in_charliteral = false;
-
-    while (state->done + processed < line_size) {
-        if (state->in_multiline_comment) {
-            if (HAS_CHARS(1) && DATA(0) == '*' && DATA(1) == '/') {
-                state->in_multiline_comment = false;
-                processed += 2;
-                GOT_WHITESPACE;
-                continue;
-            } else {
-                processed++;
-            }
-        }
-        // Not in a multi line comment or string literal currently
-        else if (!in_strliteral && !in_charliteral && !state->in_include) {
-            // Let's check for single-line comments first.
-            if (HAS_CHARS(1) && DATA(0) == '/' && DATA(1) == '/') {
-                // Ok, we can just signal we got whitespace and peace out.
-                processed += 2;
-                GOT_WHITESPACE;
-                return result;
-            }
-            // Let's check for multi-line comments here.
-            else if (HAS_CHARS(1) && DATA(0) == '/' && DATA(1) == '*') {
-                // Index into data to the start of the multiline comment.
-                // Used for error reporting if the comment never ends.
-                state->multiline_source.index = state->index - line_size + state->done + processed - 2;
-                state->multiline_source.line = state->line_start;
-                state->multiline_source.column = state->column_start;
-
-                state->in_multiline_comment = true;
-                state->column_start += 2;
-                processed += 2;
-            }
-            // Let's check for string literals.
-            else if (DATA(0) == '"') {
-                processed++;
-                in_strliteral = true;
-            }
-            // And character literals.
-            else if (DATA(0) == '\'') {
-                processed++;
-                in_charliteral = true;
-            }
-            // Let's skip whitespace
-            else if (is_whitespace(DATA(0))) {
-                processed++;
-                while (HAS_CHARS(0) && is_whitespace(DATA(0))) { processed++; }
-
-                GOT_WHITESPACE;
-            }
-            // Identifiers
-            else if (is_ident_start(DATA(0))) {
-                processed++;
-                while (HAS_CHARS(0) && is_ident_char(DATA(0))) { processed++; }
-                push_token(vec, state, &processed, PP_TOK_IDENTIFIER);
-            }
-            // Punctuators
-            else if (DATA(0) == '#') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '#') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_HASH);
-                }
-            } else if (DATA(0) == '-') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '>') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_ARROW);
-                } else if (HAS_CHARS(0) && DATA(0) == '-') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_DECREMENT);
-                } else if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_MINUS_ASSIGN);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_MINUS);
-                }
-            } else if (DATA(0) == ',') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_COMMA);
-            } else if (DATA(0) == '?') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_QUESTION_MARK);
-            } else if (DATA(0) == '=') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_EQUALS);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_ASSIGN);
-                }
-            } else if (DATA(0) == '+') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '+') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_INCREMENT);
-                } else if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_PLUS_ASSIGN);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_PLUS);
-                }
-            } else if (DATA(0) == '*') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_STAR_ASSIGN);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_STAR);
-                }
-            } else if (DATA(0) == '/') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_DIV_ASSIGN);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_DIV);
-                }
-            } else if (DATA(0) == '%') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_MOD_ASSIGN);
-                } else if (HAS_CHARS(0) && DATA(0) == '>') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_CLOSE_BRACKET);
-                } else if (HAS_CHARS(0) && DATA(0) == ':') {
-                    processed++;
-                    // Check if we have another one of those.
-                    if (HAS_CHARS(1) && DATA(0) == '%' && DATA(1) == ':') {
-                        processed += 2;
-                        push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
-                    } else if (HAS_CHARS(0) && DATA(0) == '#') {
-                        processed++;
-                        push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
-                    } else {
-                        push_token(vec, state, &processed, PP_TOK_HASH);
-                    }
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_MOD);
-                }
-            } else if (DATA(0) == '!') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_NOT_EQUALS);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_LOGICAL_NOT);
-                }
-            } else if (DATA(0) == '>') {
-                // TODO: DIGRAPHS HERE
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_GREATER_EQUALS);
-                } else if (HAS_CHARS(1) && DATA(0) == '>' && DATA(1) == '=') {
-                    processed += 2;
-                    push_token(vec, state, &processed, PP_TOK_RIGHT_SHIFT_ASSIGN);
-                } else if (HAS_CHARS(0) && DATA(0) == '>') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_RIGHT_SHIFT);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_GREATER);
-                }
-            } else if (DATA(0) == '<') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_LESS_EQUALS);
-                } else if (HAS_CHARS(1) && DATA(0) == '<' && DATA(1) == '=') {
-                    processed += 2;
-                    push_token(vec, state, &processed, PP_TOK_LEFT_SHIFT_ASSIGN);
-                } else if (HAS_CHARS(0) && DATA(0) == '<') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_LEFT_SHIFT);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_LESS);
-                }
-            } else if (DATA(0) == '&') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_AND_ASSIGN);
-                } else if (HAS_CHARS(0) && DATA(0) == '&') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_LOGICAL_AND);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_AND);
-                }
-            } else if (DATA(0) == '|') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_OR_ASSIGN);
-                } else if (HAS_CHARS(0) && DATA(0) == '|') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_LOGICAL_OR);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_OR);
-                }
-            } else if (DATA(0) == '~') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_BITWISE_NOT);
-            } else if (DATA(0) == '^') {
-                processed++;
-                if (HAS_CHARS(0) && DATA(0) == '=') {
-                    processed++;
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_XOR_ASSIGN);
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_BITWISE_XOR);
-                }
-            } else if (DATA(0) == '[') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_OPEN_SQUARE_BRACKET);
-            } else if (DATA(0) == ']') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_CLOSE_SQUARE_BRACKET);
-            } else if (DATA(0) == '{') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_OPEN_BRACKET);
-            } else if (DATA(0) == '}') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_CLOSE_BRACKET);
-            } else if (DATA(0) == '(') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_OPEN_PAREN);
-            } else if (DATA(0) == ')') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_CLOSE_PAREN);
-            } else if (DATA(0) == ';') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_SEMICOLON);
-            } else if (DATA(0) == ':') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_COLON);
-            } else if (DATA(0) == '.') {
-                processed++;
-                if (HAS_CHARS(0) && isdigit(DATA(0))) {
-                    goto do_number;
-                } else {
-                    push_token(vec, state, &processed, PP_TOK_DOT);
-                }
-            } else if (isdigit(DATA(0))) {
-            do_number:
-                processed++;
-                while (HAS_CHARS(0) && (is_ident_char(DATA(0)) || DATA(0) == '.')) {
-                    processed++;
-                    if (DATA(-1) == 'e' || DATA(-1) == 'E' || DATA(-1) == 'p' || DATA(-1) == 'P') {
-                        if (HAS_CHARS(0) && (DATA(0) == '+' || DATA(0) == '-')) {
-                            processed++;
-                        }
-                    }
-                }
-                push_token(vec, state, &processed, PP_TOK_NUMBER);
-            } else {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_OTHER);
-            }
-        } else if (in_strliteral) {
-            if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '"') {
-                // Escaped quote.
-                processed += 2;
-            } else if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\\') {
-                processed += 2;
-            } else if (DATA(0) == '"') {
-                // Finished with the string literal.
-                processed++;
-                // Push the token out.
-                push_token(vec, state, &processed, PP_TOK_STR_LITERAL);
-                in_strliteral = false;
-            } else {
-                processed++;
-            }
-        } else if (in_charliteral) {
-            if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\'') {
-                // Escaped tick
-                processed += 2;
-            } else if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\\') {
-                processed += 2;
-            } else if (DATA(0) == '\'') {
-                processed++;
-                push_token(vec, state, &processed, PP_TOK_CHAR_CONST);
-                in_charliteral = false;
-            } else {
-                processed++;
-            }
-        } else if (state->in_include) {
-            // Let's skip some whitespace.
-            if (is_whitespace(DATA(0))) {
-                processed++;
-                while (HAS_CHARS(0) && is_whitespace(DATA(0))) { processed++; }
-
-                GOT_WHITESPACE;
-            }
-
-            state->in_include = false;
-
-            if (HAS_CHARS(0)) {
-                if (DATA(0) == '"') {
-                    processed++;
-                    while (HAS_CHARS(0)) {
-                        if (DATA(0) == '"') {
-                            // No quote escapes in header includes.
-                            processed++;
-                            push_token(vec, state, &processed, PP_TOK_HEADER_NAME);
-                            break;
-                        }
-                        processed++;
-                    }
-                    if (!HAS_CHARS(0) && processed != 0) {
-                        // TODO: Those 2's should be 1's if we have \n instead of \r\n (I think).
-                        tokenizer_error(state->index - line_size + state->done - 2, processed,
-                                        state->line_start, state->column_start, state, "Relative include not closed on its line.");
-                    }
-                } else if (DATA(0) == '<') {
-                    processed++;
-                    while (HAS_CHARS(0)) {
-                        if (DATA(0) == '>') {
-                            processed++;
-                            push_token(vec, state, &processed, PP_TOK_HEADER_NAME);
-                            break;
-                        }
-                        processed++;
-                    }
-                    if (!HAS_CHARS(0) && processed != 0) {
-                        tokenizer_error(state->index - line_size + state->done - 2, processed,
-                                        state->line_start, state->column_start, state, "Absolute include not closed on its line.");
-                    }
-                }
-            }
-        }
-    }
-
-    // Let's consider newlines as whitespaces.
-    GOT_WHITESPACE;
-
-    if (in_strliteral) {
-        tokenizer_error(state->index - line_size + state->done - 2, processed,
-                        state->line_start, state->column_start, state, "Unterminated string literal.");
-    } else if (in_charliteral) {
-        tokenizer_error(state->index - line_size + state->done - 2, processed,
-                        state->line_start, state->column_start, state, "Unterminated character literal.");
-    }
-
-    #undef DATA
-    #undef HAS_CHARS
-    #undef GOT_WHITESPACE
-
-    return result;
-}
-
-void tokenizer_state_init(tokenizer_state *state, sc_file_cache_handle handle) {
-    state->path = handle_to_file(handle)->abs_path;
-    state->line_start = state->line_end = 1;
-    state->column_start = state->column_end = 1;
-    state->data = handle_to_file(handle)->contents;
-    state->index = 0;
-    state->data_size = handle_to_file(handle)->size;
-    string_init(&state->current_data, 0);
-    state->done = 0;
-    state->in_multiline_comment = false;
-    state->in_include = false;
-}
-
-bool pp_token_concatenate(pp_token *dest, pp_token *left, pp_token *right) {
-    if (right->kind == PP_TOK_PLACEMARKER) {
-        // This works even if both tokens are placemarkers!
-        pp_token_copy(dest, left);
-        return true;
-    } else if (left->kind == PP_TOK_PLACEMARKER) {
-        pp_token_copy(dest, right);
-        return true;
-    }
-
-    if (left->kind == PP_TOK_IDENTIFIER) {
-        if (right->kind != PP_TOK_IDENTIFIER && right->kind != PP_TOK_NUMBER) {
-            return false;
-        }
-
-        // TODO: does this work with all number preprocessor tokens?
-        pp_token_copy(dest, left);
-        string_append(&dest->data, &right->data);
-        return true;
-    }
-
-    if (left->kind == PP_TOK_HASH && right->kind == PP_TOK_HASH) {
-        dest->kind = PP_TOK_CONCAT_DOUBLEHASH;
-        dest->source = left->source;
-        dest->has_whitespace = right->has_whitespace;
-        STRING_FROM_LITERAL(&dest->data, "##");
-        return true;
-    }
-
-    if (left->kind == PP_TOK_NUMBER && right->kind == PP_TOK_NUMBER) {
-        pp_token_copy(dest, left);
-        string_append(&dest->data, &right->data);
-        return true;
-    }
-
-    // TODO: Punctuators.
-
-    return false;
-}
-
-void pp_token_copy(pp_token *dest, pp_token *src) {
-    dest->kind = src->kind;
-    dest->source = src->source;
-    dest->has_whitespace = src->has_whitespace;
-    dest->replaceable = src->replaceable;
-    string_copy(&dest->data, &src->data);
-}
+#include <tokenizer.h>
+#include <token_vector.h>
+#include <ctype.h>
+#include <string.h>
+
+// Newlines != whitespace
+static bool is_whitespace(const char c) {
+    return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+}
+
+static bool is_ident_start(const char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_ident_char(const char c) {
+    return is_ident_start(c) || isdigit(c);
+}
+
+static void tokenizer_error(size_t index, size_t length, size_t line, size_t column, tokenizer_state *state, const char *error) {
+    // So, we will take the pointer into the data and make a region of 10 characters to the left of it to 10 characters to the right of it.
+    // If we hit a newline in those 10 characters, go until the newline (not including).
+    // If we are not in whitespace after those 10 characters, go until whitespace or newline (unless we overflow buffer).
+    const char *error_ptr = state->data + index;
+
+    size_t start_off = index >= 10 ? 10 : index;
+    size_t end_off = state->data_size - index - length >= 10 ? 10 : state->data_size - index - length;
+
+    const char *start = error_ptr - start_off;
+    const char *end = error_ptr + end_off;
+
+    bool start_corrected = false;
+    bool end_corrected = false;
+
+    // Streams drop everything before the current line, so the error can be at the very start of the data.
+    for (size_t i = start_off; i > 0; i--) {
+        if (start[i - 1] == '\n') {
+            start = start + i;
+            start_off = error_ptr - start;
+            start_corrected = true;
+            break;
+        }
+    }
+
+    for (size_t i = length; i <= length + end_off; i++) {
+        if (error_ptr[i] == '\r' || error_ptr[i] == '\n') {
+            end = error_ptr + i;
+            end_off = i;
+            end_corrected = true;
+            break;
+        }
+    }
+
+    if (!start_corrected) {
+        // Ok, let's see where we point at.
+        while (start_off < index && !is_whitespace(start[-1]) && start[-1] != '\n') {
+            start--;
+            start_off++;
+        }
+    }
+
+    if (!end_corrected) {
+        while (!is_whitespace(end[1]) && end[1] != '\r' && end[1] != '\n' && end_off < (state->data_size - index)) {
+            end++;
+            end_off++;
+        }
+    }
+
+    // So we write: [state->path]:[line]:[column]: Error: [error]\n
+    //              [15 spaces][state->data[start_off : end_off]]\n
+    //                               ~~~~~~~~
+
+    // We assume that the numbers are 4 long at maximum
+    size_t total_length = strlen(state->path) + 51 + strlen(error) + (end_off + start_off) + (index - start_off) + length;
+
+    char region_buffer[1024];
+    sc_region region_state;
+    sc_allocator region_alloc = make_region_alloc(&region_state, region_buffer, 1024);
+
+    sc_fallback fallback_state;
+    sc_allocator fallback_alloc = make_fallback_alloc(&fallback_state, &region_alloc, mallocator());
+
+    char *space_buff = sc_alloc(&fallback_alloc, start_off + 1);
+    memset(space_buff, ' ', start_off);
+    space_buff[start_off] = '\0';
+
+    char *tilde_buff = sc_alloc(&fallback_alloc, length + 1);
+    memset(tilde_buff, '~', length);
+    tilde_buff[length] = '\0';
+
+    char *data_piece = sc_alloc(&fallback_alloc, end_off + start_off + 1);
+    memcpy(data_piece, error_ptr - start_off, end_off + start_off);
+    data_piece[end_off + start_off] = '\0';
+
+    char *buff = sc_alloc(&fallback_alloc, total_length + 1);
+    snprintf(buff, total_length + 1, "%s:%lu:%lu: Error: %s\n               %s\n               %s%s\n",
+             state->path, line, column, error, data_piece, space_buff, tilde_buff);
+
+    // Just making sure.
+    buff[total_length] = '\0';
+
+    sc_error(false, buff);
+    state->errored = true;
+
+    // Free our stuff.
+    sc_free(&fallback_alloc, space_buff);
+    sc_free(&fallback_alloc, tilde_buff);
+    sc_free(&fallback_alloc, data_piece);
+    sc_free(&fallback_alloc, buff);
+
+    sc_destroy_allocator(&fallback_alloc);
+    sc_destroy_allocator(&region_alloc);
+}
+
+// Makes sure the whole logical line starting at 'index' is in the stream's buffer, or at least 'window' bytes of it.
+// The part of the buffer before 'index' is dropped, which is what keeps memory bounded.
+static void stream_fill_line(tokenizer_state *state, size_t window) {
+    sc_file_stream *stream = state->stream;
+    size_t scanned = state->index;
+
+    while (true) {
+        // Look for a newline that is not part of a line splice.
+        const char *newline = memchr(stream->buffer + scanned, '\n', stream->size - scanned);
+        while (newline) {
+            size_t at = newline - stream->buffer;
+            bool spliced = (at > state->index && newline[-1] == '\\')
+                        || (at > state->index + 1 && newline[-1] == '\r' && newline[-2] == '\\');
+            if (!spliced) {
+                break;
+            }
+
+            newline = memchr(newline + 1, '\n', stream->size - at - 1);
+        }
+
+        if (newline || stream->eof || stream->size - state->index >= window) {
+            break;
+        }
+
+        size_t consumed = state->index;
+        scanned = stream->size - consumed;
+        file_stream_refill(stream, consumed);
+
+        // An unterminated comment is reported where it started, if we still have that part.
+        if (state->in_multiline_comment) {
+            state->multiline_source.index = state->multiline_source.index >= consumed ? state->multiline_source.index - consumed : 0;
+        }
+
+        state->index = 0;
+        state->data = stream->buffer;
+        state->data_size = stream->size;
+    }
+}
+
+// Did we consume all of the input?
+// For streams, this reads the next chunk if we consumed the buffer, without dropping anything (the current line may still be reported in errors).
+static bool tokenizer_at_end(tokenizer_state *state) {
+    if (state->stream && state->index >= state->data_size && !state->stream->eof) {
+        file_stream_refill(state->stream, 0);
+        state->data = state->stream->buffer;
+        state->data_size = state->stream->size;
+    }
+
+    return state->index >= state->data_size;
+}
+
+// Returns false when we hit EOF.
+// When 'windowed', stops after about TOKENIZER_LINE_WINDOW bytes and sets 'line_continues' if the line goes on.
+static bool get_processed_line(tokenizer_state *state, bool windowed) {
+    string *current = &state->current_data;
+
+    if (state->line_continues) {
+        // Keep what the lexer did not get to, the next window is appended to it.
+        size_t left = string_size(current) - state->done;
+        memmove(string_data(current), string_data(current) + state->done, left);
+        string_resize(current, left);
+    } else {
+        string_resize(current, 0);
+
+        state->line_start = state->line_end;
+        state->column_start = state->column_end;
+    }
+
+    state->done = 0;
+    state->line_continues = false;
+
+    // Always room for a whole window on top of what we kept, so a single long token still makes progress.
+    size_t limit = windowed ? string_size(current) + TOKENIZER_LINE_WINDOW : (size_t)-1;
+    const char *data = state->data + state->index;
+
+    #define HAS_CHARS(N) (state->index + N < state->data_size)
+
+    while (state->index < state->data_size && *data != '\n') {
+        // Streams only hold part of a windowed line, don't split a line splice, trigraph or "\r\n" at the end of the buffer.
+        bool needs_lookahead = (*data == '\\' || *data == '?' || *data == '\r') && !HAS_CHARS(3) && !memchr(data, '\n', state->data_size - state->index);
+        if (string_size(current) >= limit || (needs_lookahead && windowed && state->stream && !state->stream->eof)) {
+            state->line_continues = true;
+            return true;
+        }
+
+        // Find backslash newline
+        if (HAS_CHARS(1) && *data == '\\' && data[1] == '\n') {
+            // Skip over.
+            data += 2;
+            state->index += 2;
+            state->line_end++;
+            state->column_end = 1;
+        } else if (HAS_CHARS(2) && *data == '\\' && data[1] == '\r' && data[2] == '\n') {
+            data += 3;
+            state->index += 3;
+            state->line_end++;
+            state->column_end = 1;
+        }
+        // Trigraphs
+        else if (HAS_CHARS(3) && *data == '?' && data[1] == '?') {
+            bool trigraph = true;
+            switch (data[2]) {
+                case '(':
+                    string_push(current, '[');
+                break;
+                case ')':
+                    string_push(current, ']');
+                break;
+                case '<':
+                    string_push(current, '{');
+                break;
+                case '>':
+                    string_push(current, '}');
+                break;
+                case '=':
+                    string_push(current, '#');
+                break;
+                case '/':
+                    string_push(current, '\\');
+                break;
+                case '\'':
+                    string_push(current, '^');
+                break;
+                case '!':
+                    string_push(current, '|');
+                break;
+                case '-':
+                    string_push(current, '~');
+                break;
+                default:
+                    trigraph = false;
+                break;
+            }
+
+            if (!trigraph) {
+                string_append_ptr_size(current, data, 3);
+                state->column_end += 3;
+            } else {
+                state->column_end++;
+            }
+            data += 3;
+            state->index += 3;
+        } else if (HAS_CHARS(1) && *data == '\r' && data[1] == '\n') {
+            data++;
+            state->index++;
+        } else {
+            string_push(current, *data);
+            data++;
+            state->index++;
+            state->column_end++;
+        }
+    }
+
+    // Last line without a newline.
+    if (state->index >= state->data_size) {
+        // Or just the end of what the stream holds for now.
+        if (windowed && state->stream && !state->stream->eof) {
+            state->line_continues = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Skip past the newline character.
+    data++;
+    state->index++;
+
+    state->line_end++;
+    state->column_end = 1;
+
+    #undef HAS_CHARS
+
+    // We got the last line if the newline was the last character.
+    return !tokenizer_at_end(state);
+}
+
+static void push_token(pp_token_vector *vec, tokenizer_state *state, size_t *processed, pp_token_kind kind) {
+    static pp_token_kind last_token_kind = PP_TOK_PLACEMARKER;
+
+    pp_token *tok = pp_token_vector_tail(vec);
+    if (*processed == 0) {
+        string_init(&tok->data, 0);
+    } else {
+        string_from_ptr_size_with(&tok->data, string_data(&state->current_data) + state->done, *processed, state->allocator);
+    }
+
+    tok->replaceable = true;
+    tok->kind = kind;
+
+    if (last_token_kind == PP_TOK_HASH && kind == PP_TOK_IDENTIFIER) {
+        if (STRING_EQUALS_LITERAL(&tok->data, "include")) {
+            state->in_include = true;
+        }
+    }
+
+    tok->source.path = state->path;
+    tok->source.line = state->line_start;
+    tok->source.column = state->column_start;
+
+    tok->has_whitespace = false;
+
+    state->column_start += *processed;
+
+    state->done += *processed;
+    *processed = 0;
+
+    last_token_kind = kind;
+}
+
+static pp_lexed_file *lexed_file_create(sc_allocator *allocator) {
+    pp_lexed_file *lexed = sc_alloc(allocator, sizeof(pp_lexed_file));
+    lexed->allocator = allocator;
+
+    lexed->token_count = 0;
+    lexed->token_capacity = 256;
+    lexed->tokens = sc_alloc(allocator, lexed->token_capacity * sizeof(pp_token));
+
+    lexed->line_count = 0;
+    lexed->line_capacity = 64;
+    lexed->line_starts = sc_alloc(allocator, lexed->line_capacity * sizeof(size_t));
+    lexed->line_starts[0] = 0;
+
+    lexed->directive_count = 0;
+    lexed->directive_capacity = 16;
+    lexed->directive_lines = sc_alloc(allocator, lexed->directive_capacity * sizeof(size_t));
+
+    lexed->bytes = sizeof(pp_lexed_file) + lexed->token_capacity * sizeof(pp_token)
+                 + (lexed->line_capacity + lexed->directive_capacity) * sizeof(size_t);
+    return lexed;
+}
+
+void pp_lexed_file_destroy(pp_lexed_file *lexed) {
+    for (size_t i = 0; i < lexed->token_count; i++) {
+        string_destroy(&lexed->tokens[i].data);
+    }
+
+    sc_allocator *allocator = lexed->allocator;
+    sc_free(allocator, lexed->tokens);
+    sc_free(allocator, lexed->line_starts);
+    sc_free(allocator, lexed->directive_lines);
+    sc_free(allocator, lexed);
+}
+
+// Copies a freshly lexed line into the recording and hands the recording to the file cache once we reach the end of the file.
+static void record_line(tokenizer_state *state, pp_token *tokens, size_t count, bool last) {
+    pp_lexed_file *lexed = state->recording;
+
+    // Windows of a long line would replay as separate lines, so we don't record those files either.
+    if (state->errored || state->line_continues) {
+        pp_lexed_file_destroy(lexed);
+        state->recording = NULL;
+        return;
+    }
+
+    // We need room for the next line's start too.
+    if (lexed->line_count + 2 > lexed->line_capacity) {
+        lexed->bytes += lexed->line_capacity * sizeof(size_t);
+        lexed->line_capacity *= 2;
+        lexed->line_starts = sc_realloc(lexed->allocator, lexed->line_starts, lexed->line_capacity / 2 * sizeof(size_t),
+                                        lexed->line_capacity * sizeof(size_t));
+    }
+
+    if (count > 0 && tokens[0].kind == PP_TOK_HASH) {
+        if (lexed->directive_count >= lexed->directive_capacity) {
+            lexed->bytes += lexed->directive_capacity * sizeof(size_t);
+            lexed->directive_capacity *= 2;
+            lexed->directive_lines = sc_realloc(lexed->allocator, lexed->directive_lines, lexed->directive_capacity / 2 * sizeof(size_t),
+                                                lexed->directive_capacity * sizeof(size_t));
+        }
+
+        lexed->directive_lines[lexed->directive_count++] = lexed->line_count;
+    }
+
+    if (lexed->token_count + count > lexed->token_capacity) {
+        size_t old_capacity = lexed->token_capacity;
+        while (lexed->token_count + count > lexed->token_capacity) {
+            lexed->token_capacity *= 2;
+        }
+
+        lexed->bytes += (lexed->token_capacity - old_capacity) * sizeof(pp_token);
+        lexed->tokens = sc_realloc(lexed->allocator, lexed->tokens, old_capacity * sizeof(pp_token), lexed->token_capacity * sizeof(pp_token));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pp_token *copy = &lexed->tokens[lexed->token_count++];
+        pp_token_copy_with(copy, &tokens[i], lexed->allocator);
+
+        if (!is_small_string(&copy->data)) {
+            lexed->bytes += string_capacity(&copy->data) + 1;
+        }
+    }
+
+    lexed->line_starts[++lexed->line_count] = lexed->token_count;
+
+    if (last) {
+        if (!file_cache_set_lexed(state->handle, lexed, lexed->bytes, (lexed_destroy_func)pp_lexed_file_destroy)) {
+            pp_lexed_file_destroy(lexed);
+        }
+        state->recording = NULL;
+    } else if (!file_cache_lexed_fits(state->handle.cache, lexed->bytes)) {
+        // Too big for what is left of the budget, stop wasting time.
+        pp_lexed_file_destroy(lexed);
+        state->recording = NULL;
+    }
+}
+
+static bool replay_line(pp_token_vector *vec, tokenizer_state *state) {
+    pp_lexed_file *lexed = state->replay;
+    size_t line = state->replay_line++;
+
+    bool directive = lexed->line_starts[line] < lexed->line_starts[line + 1] && lexed->tokens[lexed->line_starts[line]].kind == PP_TOK_HASH;
+    if (state->directives_only && !directive) {
+        return state->replay_line < lexed->line_count;
+    }
+
+    for (size_t i = lexed->line_starts[line]; i < lexed->line_starts[line + 1]; i++) {
+        pp_token_copy_with(pp_token_vector_tail(vec), &lexed->tokens[i], state->allocator);
+    }
+
+    return state->replay_line < lexed->line_count;
+}
+
+// Is the next line one we need to lex in directives only mode?
+// We are conservative here: anything that could hide a '#' at the start of the line (comments, trigraphs) goes through the lexer.
+static bool starts_directive(tokenizer_state *state) {
+    if (state->in_multiline_comment) {
+        return true;
+    }
+
+    const char *data = state->data;
+    size_t i = state->index;
+
+    while (i < state->data_size) {
+        if (data[i] == ' ' || data[i] == '\t' || data[i] == '\v' || data[i] == '\f') {
+            i++;
+        } else if (data[i] == '\\' && i + 1 < state->data_size && data[i + 1] == '\n') {
+            i += 2;
+        } else if (data[i] == '\\' && i + 2 < state->data_size && data[i + 1] == '\r' && data[i + 2] == '\n') {
+            i += 3;
+        } else {
+            return data[i] == '#' || data[i] == '?' || (data[i] == '/' && i + 1 < state->data_size && data[i + 1] == '*');
+        }
+    }
+
+    return false;
+}
+
+// Moves past a line without lexing it, only keeping track of literals, comments and line splices.
+// Returns false when we hit EOF, like get_processed_line.
+static bool skip_line(tokenizer_state *state) {
+    const char *data = state->data;
+    size_t size = state->data_size;
+    size_t i = state->index;
+    size_t column = state->column_end;
+
+    state->line_start = state->line_end;
+    state->column_start = state->column_end;
+
+    #define HAS_CHARS(N) (i + N < size)
+
+    // Quote character of the literal we are in, if any.
+    char quote = '\0';
+    bool escaped = false;
+    bool in_line_comment = false;
+
+    while (i < size && data[i] != '\n') {
+        char c = data[i];
+
+        if (c == '\\' && HAS_CHARS(1) && data[i + 1] == '\n') {
+            i += 2;
+            state->line_end++;
+            column = 1;
+            continue;
+        } else if (c == '\\' && HAS_CHARS(2) && data[i + 1] == '\r' && data[i + 2] == '\n') {
+            i += 3;
+            state->line_end++;
+            column = 1;
+            continue;
+        }
+
+        if (state->in_multiline_comment) {
+            if (c == '*' && HAS_CHARS(1) && data[i + 1] == '/') {
+                state->in_multiline_comment = false;
+                i++;
+                column++;
+            }
+        } else if (in_line_comment) {
+            // Nothing to do until the end of the line.
+        } else if (quote != '\0') {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == quote) {
+                quote = '\0';
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '/' && HAS_CHARS(1) && data[i + 1] == '/') {
+            in_line_comment = true;
+        } else if (c == '/' && HAS_CHARS(1) && data[i + 1] == '*') {
+            state->multiline_source.index = i;
+            state->multiline_source.line = state->line_end;
+            state->multiline_source.column = column;
+
+            state->in_multiline_comment = true;
+            i++;
+            column++;
+        }
+
+        i++;
+        column++;
+    }
+
+    #undef HAS_CHARS
+
+    if (i >= size) {
+        state->index = i;
+        state->column_end = column;
+
+        if (state->in_multiline_comment) {
+            tokenizer_error(state->multiline_source.index, 2, state->multiline_source.line, state->multiline_source.column, state,
+                            "Unterminated multi line comment.");
+        }
+        return false;
+    }
+
+    // Skip past the newline character.
+    state->index = i + 1;
+    state->line_end++;
+    state->column_end = 1;
+
+    return !tokenizer_at_end(state);
+}
+
+static bool lex_line(pp_token_vector *vec, tokenizer_state *state, bool windowed);
+
+bool tokenize_line(pp_token_vector *vec, tokenizer_state *state) {
+    if (state->replay) {
+        return replay_line(vec, state);
+    }
+
+    if (state->stream) {
+        stream_fill_line(state, TOKENIZER_LINE_WINDOW);
+    }
+
+    // Directives need their whole line, and so do lines we skip.
+    bool windowed = state->line_continues || (!state->directives_only && !starts_directive(state));
+    if (state->stream && !windowed) {
+        stream_fill_line(state, (size_t)-1);
+    }
+
+    if (!state->line_continues && state->directives_only && !starts_directive(state)) {
+        return skip_line(state);
+    }
+
+    size_t first_token = vec->size;
+    bool result = lex_line(vec, state, windowed);
+
+    if (state->recording) {
+        record_line(state, vec->memory + first_token, vec->size - first_token, !result);
+    }
+
+    return result;
+}
+
+// @TODO: We could probably merge this with get_processed_line and push through all the tokens into the vector
+//        for the whole file or a limit set at call site (to then push to the parser without using too much memory).
+static bool lex_line(pp_token_vector *vec, tokenizer_state *state, bool windowed) {
+    size_t original_vec_size = vec->size;
+    // Get a processed line.
+    bool result = get_processed_line(state, windowed);
+
+    size_t line_size = string_size(&state->current_data);
+    const char *data = string_data(&state->current_data);
+    size_t processed = 0;
+
+    // The rest of a windowed line is in a single line comment.
+    if (state->in_line_comment) {
+        state->done = line_size;
+        state->in_line_comment = state->line_continues;
+        return result;
+    }
+
+    // Where we go back to if the window cut the line short, the next window is lexed from there.
+    // The window can't end in the middle of a token, and neither between an identifier and what could be a '(' nor inside parentheses:
+    // function like macro calls across lines are not handled well, so we keep them in one window.
+    size_t boundary_done = state->done;
+    size_t boundary_column = state->column_start;
+    size_t boundary_size = vec->size;
+    size_t parentheses = 0;
+    size_t counted = vec->size;
+    // Where the body of a multi line comment that opened on this line starts.
+    size_t comment_body = 0;
+
+    // When we get whitespace, we update the tokenizer state then add the 'has_whitespace' flag to the last added token.
+    #define GOT_WHITESPACE { state->done += processed; state->column_start += processed; processed = 0; \
+                            if (vec->size > original_vec_size) { vec->memory[vec->size - 1].has_whitespace = true; } }
+
+    // So, our line is line "state->current_data"
+    if (state->in_multiline_comment) {
+        // We still are in some multiline comment, skip until we find the end (if we do)
+        while (state->done + 1 < line_size) {
+            if (data[state->done] == '*' && data[state->done + 1] == '/') {
+                state->in_multiline_comment = false;
+                processed += 2;
+                GOT_WHITESPACE;
+                break;
+            }
+
+            state->column_start++;
+            state->done++;
+        }
+
+        if (state->in_multiline_comment && !result) {
+            tokenizer_error(state->multiline_source.index, 2, state->multiline_source.line, state->multiline_source.column, state,
+                            "Unterminated multi line comment.");
+            return result;
+        }
+    }
+
+    // Helper macros to check that enough characters are left and to get data.
+    #define HAS_CHARS(N) (state->done + processed + N < line_size)
+    #define DATA(N) (data[state->done + processed + N])
+
+    bool in_strliteral = false;
+    bool in_charliteral = false;
+
+    while (state->done + processed < line_size) {
+        if (windowed && processed == 0 && !in_strliteral && !in_charliteral && !state->in_multiline_comment) {
+            for (; counted < vec->size; counted++) {
+                if (vec->memory[counted].kind == PP_TOK_OPEN_PAREN) {
+                    parentheses++;
+                } else if (vec->memory[counted].kind == PP_TOK_CLOSE_PAREN && parentheses > 0) {
+                    parentheses--;
+                }
+            }
+
+            bool after_identifier = vec->size > original_vec_size && vec->memory[vec->size - 1].kind == PP_TOK_IDENTIFIER;
+            if (parentheses == 0 && (!after_identifier || (DATA(0) != '(' && DATA(0) != '/' && !is_whitespace(DATA(0))))) {
+                boundary_done = state->done;
+                boundary_column = state->column_start;
+                boundary_size = vec->size;
+            }
+        }
+
+        if (state->in_multiline_comment) {
+            if (HAS_CHARS(1) && DATA(0) == '*' && DATA(1) == '/') {
+                state->in_multiline_comment = false;
+                processed += 2;
+                GOT_WHITESPACE;
+                continue;
+            } else {
+                processed++;
+            }
+        }
+        // Not in a multi line comment or string literal currently
+        else if (!in_strliteral && !in_charliteral && !state->in_include) {
+            // Let's check for single-line comments first.
+            if (HAS_CHARS(1) && DATA(0) == '/' && DATA(1) == '/') {
+                // Ok, we can just signal we got whitespace and peace out.
+                processed += 2;
+                GOT_WHITESPACE;
+                state->done = line_size;
+                state->in_line_comment = state->line_continues;
+                return result;
+            }
+            // Let's check for multi-line comments here.
+            else if (HAS_CHARS(1) && DATA(0) == '/' && DATA(1) == '*') {
+                // Index into data to the start of the multiline comment.
+                // Used for error reporting if the comment never ends.
+                // The line can start at the very beginning of the data (always the case for streams), don't wrap around.
+                size_t comment_index = state->index - line_size + state->done + processed;
+                state->multiline_source.index = comment_index >= 2 ? comment_index - 2 : 0;
+                state->multiline_source.line = state->line_start;
+                state->multiline_source.column = state->column_start;
+
+                state->in_multiline_comment = true;
+                state->column_start += 2;
+                processed += 2;
+                comment_body = state->done + processed;
+            }
+            // Let's check for string literals.
+            else if (DATA(0) == '"') {
+                processed++;
+                in_strliteral = true;
+            }
+            // And character literals.
+            else if (DATA(0) == '\'') {
+                processed++;
+                in_charliteral = true;
+            }
+            // Let's skip whitespace
+            else if (is_whitespace(DATA(0))) {
+                processed++;
+                while (HAS_CHARS(0) && is_whitespace(DATA(0))) { processed++; }
+
+                GOT_WHITESPACE;
+            }
+            // Identifiers
+            else if (is_ident_start(DATA(0))) {
+                processed++;
+                while (HAS_CHARS(0) && is_ident_char(DATA(0))) { processed++; }
+                push_token(vec, state, &processed, PP_TOK_IDENTIFIER);
+            }
+            // Punctuators
+            else if (DATA(0) == '#') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '#') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_HASH);
+                }
+            } else if (DATA(0) == '-') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '>') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_ARROW);
+                } else if (HAS_CHARS(0) && DATA(0) == '-') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_DECREMENT);
+                } else if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_MINUS_ASSIGN);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_MINUS);
+                }
+            } else if (DATA(0) == ',') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_COMMA);
+            } else if (DATA(0) == '?') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_QUESTION_MARK);
+            } else if (DATA(0) == '=') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_EQUALS);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_ASSIGN);
+                }
+            } else if (DATA(0) == '+') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '+') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_INCREMENT);
+                } else if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_PLUS_ASSIGN);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_PLUS);
+                }
+            } else if (DATA(0) == '*') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_STAR_ASSIGN);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_STAR);
+                }
+            } else if (DATA(0) == '/') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_DIV_ASSIGN);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_DIV);
+                }
+            } else if (DATA(0) == '%') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_MOD_ASSIGN);
+                } else if (HAS_CHARS(0) && DATA(0) == '>') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_CLOSE_BRACKET);
+                } else if (HAS_CHARS(0) && DATA(0) == ':') {
+                    processed++;
+                    // Check if we have another one of those.
+                    if (HAS_CHARS(1) && DATA(0) == '%' && DATA(1) == ':') {
+                        processed += 2;
+                        push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
+                    } else if (HAS_CHARS(0) && DATA(0) == '#') {
+                        processed++;
+                        push_token(vec, state, &processed, PP_TOK_DOUBLEHASH);
+                    } else {
+                        push_token(vec, state, &processed, PP_TOK_HASH);
+                    }
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_MOD);
+                }
+            } else if (DATA(0) == '!') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_NOT_EQUALS);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_LOGICAL_NOT);
+                }
+            } else if (DATA(0) == '>') {
+                // TODO: DIGRAPHS HERE
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_GREATER_EQUALS);
+                } else if (HAS_CHARS(1) && DATA(0) == '>' && DATA(1) == '=') {
+                    processed += 2;
+                    push_token(vec, state, &processed, PP_TOK_RIGHT_SHIFT_ASSIGN);
+                } else if (HAS_CHARS(0) && DATA(0) == '>') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_RIGHT_SHIFT);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_GREATER);
+                }
+            } else if (DATA(0) == '<') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_LESS_EQUALS);
+                } else if (HAS_CHARS(1) && DATA(0) == '<' && DATA(1) == '=') {
+                    processed += 2;
+                    push_token(vec, state, &processed, PP_TOK_LEFT_SHIFT_ASSIGN);
+                } else if (HAS_CHARS(0) && DATA(0) == '<') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_LEFT_SHIFT);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_LESS);
+                }
+            } else if (DATA(0) == '&') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_AND_ASSIGN);
+                } else if (HAS_CHARS(0) && DATA(0) == '&') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_LOGICAL_AND);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_AND);
+                }
+            } else if (DATA(0) == '|') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_OR_ASSIGN);
+                } else if (HAS_CHARS(0) && DATA(0) == '|') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_LOGICAL_OR);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_OR);
+                }
+            } else if (DATA(0) == '~') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_BITWISE_NOT);
+            } else if (DATA(0) == '^') {
+                processed++;
+                if (HAS_CHARS(0) && DATA(0) == '=') {
+                    processed++;
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_XOR_ASSIGN);
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_BITWISE_XOR);
+                }
+            } else if (DATA(0) == '[') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_OPEN_SQUARE_BRACKET);
+            } else if (DATA(0) == ']') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_CLOSE_SQUARE_BRACKET);
+            } else if (DATA(0) == '{') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_OPEN_BRACKET);
+            } else if (DATA(0) == '}') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_CLOSE_BRACKET);
+            } else if (DATA(0) == '(') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_OPEN_PAREN);
+            } else if (DATA(0) == ')') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_CLOSE_PAREN);
+            } else if (DATA(0) == ';') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_SEMICOLON);
+            } else if (DATA(0) == ':') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_COLON);
+            } else if (DATA(0) == '.') {
+                processed++;
+                if (HAS_CHARS(0) && isdigit(DATA(0))) {
+                    goto do_number;
+                } else {
+                    push_token(vec, state, &processed, PP_TOK_DOT);
+                }
+            } else if (isdigit(DATA(0))) {
+            do_number:
+                processed++;
+                while (HAS_CHARS(0) && (is_ident_char(DATA(0)) || DATA(0) == '.')) {
+                    processed++;
+                    if (DATA(-1) == 'e' || DATA(-1) == 'E' || DATA(-1) == 'p' || DATA(-1) == 'P') {
+                        if (HAS_CHARS(0) && (DATA(0) == '+' || DATA(0) == '-')) {
+                            processed++;
+                        }
+                    }
+                }
+                push_token(vec, state, &processed, PP_TOK_NUMBER);
+            } else {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_OTHER);
+            }
+        } else if (in_strliteral) {
+            if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '"') {
+                // Escaped quote.
+                processed += 2;
+            } else if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\\') {
+                processed += 2;
+            } else if (DATA(0) == '"') {
+                // Finished with the string literal.
+                processed++;
+                // Push the token out.
+                push_token(vec, state, &processed, PP_TOK_STR_LITERAL);
+                in_strliteral = false;
+            } else {
+                processed++;
+            }
+        } else if (in_charliteral) {
+            if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\'') {
+                // Escaped tick
+                processed += 2;
+            } else if (HAS_CHARS(1) && DATA(0) == '\\' && DATA(1) == '\\') {
+                processed += 2;
+            } else if (DATA(0) == '\'') {
+                processed++;
+                push_token(vec, state, &processed, PP_TOK_CHAR_CONST);
+                in_charliteral = false;
+            } else {
+                processed++;
+            }
+        } else if (state->in_include) {
+            // Let's skip some whitespace.
+            if (is_whitespace(DATA(0))) {
+                processed++;
+                while (HAS_CHARS(0) && is_whitespace(DATA(0))) { processed++; }
+
+                GOT_WHITESPACE;
+            }
+
+            state->in_include = false;
+
+            if (HAS_CHARS(0)) {
+                if (DATA(0) == '"') {
+                    processed++;
+                    while (HAS_CHARS(0)) {
+                        if (DATA(0) == '"') {
+                            // No quote escapes in header includes.
+                            processed++;
+                            push_token(vec, state, &processed, PP_TOK_HEADER_NAME);
+                            break;
+                        }
+                        processed++;
+                    }
+                    if (!HAS_CHARS(0) && processed != 0) {
+                        // TODO: Those 2's should be 1's if we have \n instead of \r\n (I think).
+                        tokenizer_error(state->index - line_size + state->done - 2, processed,
+                                        state->line_start, state->column_start, state, "Relative include not closed on its line.");
+                    }
+                } else if (DATA(0) == '<') {
+                    processed++;
+                    while (HAS_CHARS(0)) {
+                        if (DATA(0) == '>') {
+                            processed++;
+                            push_token(vec, state, &processed, PP_TOK_HEADER_NAME);
+                            break;
+                        }
+                        processed++;
+                    }
+                    if (!HAS_CHARS(0) && processed != 0) {
+                        tokenizer_error(state->index - line_size + state->done - 2, processed,
+                                        state->line_start, state->column_start, state, "Absolute include not closed on its line.");
+                    }
+                }
+            }
+        }
+    }
+
+    if (state->line_continues) {
+        if (state->in_multiline_comment) {
+            // Keep a last '*' around in case the window split a "*/".
+            size_t keep = line_size > comment_body && data[line_size - 1] == '*' ? 1 : 0;
+            processed = line_size - keep - state->done;
+            GOT_WHITESPACE;
+        } else {
+            // Whatever we were lexing may go on in the next window, lex it again from its start.
+            for (size_t i = boundary_size; i < vec->size; i++) {
+                string_destroy(&vec->memory[i].data);
+            }
+            vec->size = boundary_size;
+            state->done = boundary_done;
+            state->column_start = boundary_column;
+        }
+
+        return result;
+    }
+
+    // Let's consider newlines as whitespaces.
+    GOT_WHITESPACE;
+
+    if (in_strliteral) {
+        tokenizer_error(state->index - line_size + state->done - 2, processed,
+                        state->line_start, state->column_start, state, "Unterminated string literal.");
+    } else if (in_charliteral) {
+        tokenizer_error(state->index - line_size + state->done - 2, processed,
+                        state->line_start, state->column_start, state, "Unterminated character literal.");
+    }
+
+    #undef DATA
+    #undef HAS_CHARS
+    #undef GOT_WHITESPACE
+
+    return result;
+}
+
+// Lines are usually too long for a small string, so the line buffer gets memory from our allocator straight away.
+static void tokenizer_line_init(tokenizer_state *state) {
+    string_init(&state->current_data, 0);
+    string_reserve_with(&state->current_data, 128, state->allocator);
+}
+
+void tokenizer_state_init(tokenizer_state *state, sc_file_cache_handle handle) {
+    tokenizer_state_init_with(state, handle, mallocator());
+}
+
+void tokenizer_state_init_with(tokenizer_state *state, sc_file_cache_handle handle, sc_allocator *allocator) {
+    state->allocator = allocator;
+    // We hold on to the contents, they must not be evicted.
+    file_cache_pin(handle);
+    state->handle = handle;
+    state->stream = NULL;
+    state->path = handle_to_file(handle)->abs_path;
+    state->line_start = state->line_end = 1;
+    state->column_start = state->column_end = 1;
+    state->data = handle_to_file(handle)->contents;
+    state->index = 0;
+    state->data_size = handle_to_file(handle)->size;
+    tokenizer_line_init(state);
+    state->done = 0;
+    state->in_multiline_comment = false;
+    state->in_line_comment = false;
+    state->line_continues = false;
+    state->in_include = false;
+    state->errored = false;
+
+    state->replay = file_cache_get_lexed(handle);
+    state->replay_line = 0;
+    state->recording = NULL;
+    state->directives_only = false;
+
+    if (!state->replay && file_cache_lexed_fits(handle.cache, sizeof(pp_lexed_file))) {
+        state->recording = lexed_file_create(handle.cache->alloc);
+    }
+
+    // Once per file, the bytes go through as they are.
+    sc_file *file = handle_to_file(handle);
+    if (!file->utf8_reported && file->utf8_error < (size_t)file->size) {
+        file->utf8_reported = true;
+
+        size_t line = 1;
+        size_t line_start = 0;
+        for (size_t i = 0; i < file->utf8_error; i++) {
+            if (file->contents[i] == '\n') {
+                line++;
+                line_start = i + 1;
+            }
+        }
+
+        sc_warning("%s:%zu:%zu: Invalid UTF-8.", state->path, line, file->utf8_error - line_start + 1);
+    }
+}
+
+void tokenizer_state_init_stream(tokenizer_state *state, sc_file_cache *cache, sc_file_stream *stream, const char *path) {
+    tokenizer_state_init_stream_with(state, cache, stream, path, mallocator());
+}
+
+void tokenizer_state_init_stream_with(tokenizer_state *state, sc_file_cache *cache, sc_file_stream *stream, const char *path, sc_allocator *allocator) {
+    state->allocator = allocator;
+    state->handle = (sc_file_cache_handle) { .cache = cache, .index = 0 };
+    state->stream = stream;
+    state->path = path;
+    state->line_start = state->line_end = 1;
+    state->column_start = state->column_end = 1;
+    tokenizer_line_init(state);
+    state->done = 0;
+    state->in_multiline_comment = false;
+    state->in_line_comment = false;
+    state->line_continues = false;
+    state->in_include = false;
+    state->errored = false;
+
+    // Nothing to replay or record, we don't keep the input around.
+    state->replay = NULL;
+    state->replay_line = 0;
+    state->recording = NULL;
+    state->directives_only = false;
+
+    file_stream_refill(stream, 0);
+    state->data = stream->buffer;
+    state->index = 0;
+    state->data_size = stream->size;
+}
+
+void tokenizer_state_destroy(tokenizer_state *state) {
+    string_destroy(&state->current_data);
+    if (!state->stream) {
+        file_cache_unpin(state->handle);
+    }
+
+    // We never got to the end of the file.
+    if (state->recording) {
+        pp_lexed_file_destroy(state->recording);
+        state->recording = NULL;
+    }
+}
+
+void tokenizer_directives_only(tokenizer_state *state) {
+    state->directives_only = true;
+
+    if (state->recording) {
+        pp_lexed_file_destroy(state->recording);
+        state->recording = NULL;
+    }
+}
+
+bool pp_token_concatenate(pp_token *dest, pp_token *left, pp_token *right) {
+    return pp_token_concatenate_with(dest, left, right, mallocator());
+}
+
+bool pp_token_concatenate_with(pp_token *dest, pp_token *left, pp_token *right, sc_allocator *allocator) {
+    if (right->kind == PP_TOK_PLACEMARKER) {
+        // This works even if both tokens are placemarkers!
+        pp_token_copy_with(dest, left, allocator);
+        return true;
+    } else if (left->kind == PP_TOK_PLACEMARKER) {
+        pp_token_copy_with(dest, right, allocator);
+        return true;
+    }
+
+    if (left->kind == PP_TOK_IDENTIFIER) {
+        if (right->kind != PP_TOK_IDENTIFIER && right->kind != PP_TOK_NUMBER) {
+            return false;
+        }
+
+        // TODO: does this work with all number preprocessor tokens?
+        pp_token_copy_with(dest, left, allocator);
+        string_reserve_with(&dest->data, string_size(&left->data) + string_size(&right->data), allocator);
+        string_append(&dest->data, &right->data);
+        return true;
+    }
+
+    if (left->kind == PP_TOK_HASH && right->kind == PP_TOK_HASH) {
+        dest->kind = PP_TOK_CONCAT_DOUBLEHASH;
+        dest->source = left->source;
+        dest->has_whitespace = right->has_whitespace;
+        dest->replaceable = false;
+        STRING_FROM_LITERAL(&dest->data, "##");
+        return true;
+    }
+
+    if (left->kind == PP_TOK_NUMBER && right->kind == PP_TOK_NUMBER) {
+        pp_token_copy_with(dest, left, allocator);
+        string_reserve_with(&dest->data, string_size(&left->data) + string_size(&right->data), allocator);
+        string_append(&dest->data, &right->data);
+        return true;
+    }
+
+    // TODO: Punctuators.
+
+    return false;
+}
+
+void pp_token_copy(pp_token *dest, pp_token *src) {
+    pp_token_copy_with(dest, src, mallocator());
+}
+
+void pp_token_copy_with(pp_token *dest, pp_token *src, sc_allocator *allocator) {
+    dest->kind = src->kind;
+    dest->source = src->source;
+    dest->has_whitespace = src->has_whitespace;
+    dest->replaceable = src->replaceable;
+    string_copy_with(&dest->data, &src->data, allocator);
+}
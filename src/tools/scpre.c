@@ -1,53 +1,338 @@
-// The SCC preprocessor as an executable.
-#include <preprocessor.h>
-#include <stdio.h>
-
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <input file> <output file>\n", argv[0]);
-        return 0;
-    }
-
-    char *in_path = argv[1];
-    char *out_path = argv[2];
-
-    sc_file_cache cache;
-    file_cache_init(&cache, mallocator());
-    sc_file_cache_handle handle = file_cache_load(&cache, in_path);
-
-    tokenizer_state state;
-    tokenizer_state_init(&state, handle);
-
-    pp_token_vector line_vec;
-    pp_token_vector_init(&line_vec, 128);
-
-    // We'll go line by line to append newlines for a more human readable form.
-    token_vector translation_line;
-    token_vector_init(&translation_line, 128);
-
-    preprocessor_state pp_state;
-    preprocessor_state_init(&pp_state, &state, &translation_line, &line_vec);
-
-    FILE *out = fopen(out_path, "w");
-
-    bool ok = true;
-    while (ok) {
-        ok = preprocess_line(&pp_state);
-        for (size_t i = 0; i < translation_line.size; i++) {
-            fwrite(string_data(&translation_line.memory[i].data), 1, string_size(&translation_line.memory[i].data), out);
-            if (i < translation_line.size - 1 && translation_line.memory[i].has_whitespace) {
-                putc(' ', out);
-            }
-        }
-        if (translation_line.size != 0) {
-            // Write a newline!
-            putc('\n', out);
-        }
-
-        translation_line.size = 0;
-    }
-
-    fclose(out);
-
-    return 0;
-}
+// The SCC preprocessor as an executable.
+#include <preprocessor.h>
+#include <token_stream.h>
+#include <sc_prefetch.h>
+#include <sc_tracking_alloc.h>
+#include <sc_vfs.h>
+#include <stdio.h>
+#include <string.h>
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-M | -B | -R] [-S] [-I<include directory>...] [-V<path>=<file>...] <input file> <output file>\n", name);
+    printf("  -M  Write the files the input includes as a Makefile rule instead of preprocessing it.\n");
+    printf("  -B  Write the tokens as a binary token stream (see token_stream.h) instead of text.\n");
+    printf("  -R  Read a binary token stream written with -B and write it as text, like scpre would have.\n");
+    printf("  -V<path>=<file>  Read <file> wherever <path> is read, whether or not <path> exists.\n");
+    printf("  -S  Print cache counters and the memory used by the tokenizer, macros, header cache, file cache (with the prefetcher,\n");
+    printf("      standard input and -V files) and output (lines, buffers, -B tables) to stderr.\n");
+    printf("      The include directories, their lookup cache and the -V table itself are not counted.\n");
+    printf("  Use '-' as the input file to read from standard input, which is streamed instead of read at once.\n");
+}
+
+// Spaces need to be escaped in Makefile rules.
+static void write_dependency(sc_output *out, const char *path, size_t *line_len) {
+    size_t len = strlen(path);
+    if (*line_len + len + 1 > 78) {
+        output_puts(out, " \\\n");
+        *line_len = 0;
+    }
+
+    output_putc(out, ' ');
+    for (const char *c = path; *c; c++) {
+        if (*c == ' ') {
+            output_putc(out, '\\');
+        }
+        output_putc(out, *c);
+    }
+
+    *line_len += len + 1;
+}
+
+// "dir/file.c: ..." -> "file.o: ..."
+static void write_dependencies(sc_output *out, sc_file_cache *cache, const char *in_path) {
+    const char *name = strrchr(in_path, '/');
+    name = name ? name + 1 : in_path;
+    const char *extension = strrchr(name, '.');
+    size_t name_len = extension ? (size_t)(extension - name) : strlen(name);
+
+    output_write(out, name, name_len);
+    output_puts(out, ".o:");
+    size_t line_len = name_len + 3;
+
+    // The file cache keeps the path of every file we read, starting with the input, even if it evicted the file since.
+    for (size_t i = 0; i < cache->loaded_paths.size; i++) {
+        write_dependency(out, cache->loaded_paths.memory[i], &line_len);
+    }
+
+    output_putc(out, '\n');
+}
+
+// Same layout as pp_text_writer: a token starting an output line ends the previous one.
+static void write_token_stream_text(const char *in_path, const char *out_path) {
+    token_stream stream;
+    if (!token_stream_open(&stream, in_path)) {
+        sc_error(true, "Could not read token stream '%s'.", in_path);
+    }
+
+    sc_output out;
+    if (!output_open_mapped(&out, out_path) && !output_open(&out, out_path)) {
+        sc_error(true, "Could not open output file '%s'.", out_path);
+    }
+
+    token_stream_cursor cursor;
+    token_stream_cursor_init(&cursor, &stream);
+
+    token_stream_entry entry;
+    bool line_open = false;
+    bool space = false;
+    while (token_stream_next(&cursor, &entry)) {
+        if (entry.line_start && line_open) {
+            output_putc(&out, '\n');
+        } else if (space) {
+            output_putc(&out, ' ');
+        }
+
+        output_write(&out, entry.data, entry.size);
+        space = entry.has_whitespace;
+        line_open = true;
+    }
+
+    if (line_open) {
+        output_putc(&out, '\n');
+    }
+
+    if (cursor.failed) {
+        sc_error(true, "Token stream '%s' is corrupt.", in_path);
+    }
+
+    if (!output_close(&out)) {
+        sc_error(true, "Could not write output file '%s'.", out_path);
+    }
+
+    token_stream_close(&stream);
+}
+
+// Subsystems we track memory of with -S.
+enum {
+    MEMORY_TOKENIZER,
+    MEMORY_MACROS,
+    MEMORY_HEADER_CACHE,
+    MEMORY_FILE_CACHE,
+    MEMORY_OUTPUT,
+    MEMORY_SUBSYSTEM_COUNT
+};
+
+static const char *memory_subsystem_names[MEMORY_SUBSYSTEM_COUNT] = { "tokenizer", "macros", "header cache", "file cache", "output" };
+
+int main(int argc, char *argv[]) {
+    char *in_path = NULL;
+    char *out_path = NULL;
+    bool dependencies_only = false;
+    bool binary = false;
+    bool read_stream = false;
+    bool memory_stats = false;
+
+    sc_path_table include_paths;
+    path_table_init(&include_paths);
+
+    // "<path>=<file>" arguments of -V, split in place.
+    char **overlays = malloc(argc * sizeof(char *));
+    size_t overlay_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-M")) {
+            dependencies_only = true;
+        } else if (!strcmp(argv[i], "-B")) {
+            binary = true;
+        } else if (!strcmp(argv[i], "-R")) {
+            read_stream = true;
+        } else if (!strcmp(argv[i], "-S")) {
+            memory_stats = true;
+        } else if (!strncmp(argv[i], "-I", 2)) {
+            // Accept both "-Idir" and "-I dir".
+            if (argv[i][2] != '\0') {
+                path_table_add(&include_paths, argv[i] + 2);
+            } else if (i + 1 < argc) {
+                path_table_add(&include_paths, argv[++i]);
+            } else {
+                print_usage(argv[0]);
+                return 0;
+            }
+        } else if (!strncmp(argv[i], "-V", 2)) {
+            char *overlay = argv[i][2] != '\0' ? argv[i] + 2 : i + 1 < argc ? argv[++i] : NULL;
+            if (!overlay || !strchr(overlay, '=') || overlay[0] == '=') {
+                print_usage(argv[0]);
+                return 0;
+            }
+
+            overlays[overlay_count++] = overlay;
+        } else if (!in_path) {
+            in_path = argv[i];
+        } else if (!out_path) {
+            out_path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+
+    // The modes exclude each other, -M would win and the token stream would be dropped on the floor.
+    if (!in_path || !out_path || dependencies_only + binary + read_stream > 1) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    // Reading a token stream needs none of the preprocessor.
+    if (read_stream) {
+        write_token_stream_text(in_path, out_path);
+        path_table_destroy(&include_paths);
+        free(overlays);
+        return 0;
+    }
+
+    // With -S, every subsystem allocates through a tracking allocator of its own.
+    sc_tracking memory_tracking[MEMORY_SUBSYSTEM_COUNT];
+    sc_allocator tracking_allocators[MEMORY_SUBSYSTEM_COUNT];
+    sc_allocator *allocators[MEMORY_SUBSYSTEM_COUNT];
+    for (size_t i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+        if (memory_stats) {
+            tracking_allocators[i] = make_tracking_alloc(&memory_tracking[i], mallocator(), memory_subsystem_names[i]);
+            allocators[i] = &tracking_allocators[i];
+        } else {
+            allocators[i] = mallocator();
+        }
+    }
+
+    // The VFS holds on to the contents of the overlay files, they stay loaded until the file cache is gone.
+    sc_vfs vfs;
+    vfs_init(&vfs);
+    sc_file *overlay_files = malloc((overlay_count + 1) * sizeof(sc_file));
+    for (size_t i = 0; i < overlay_count; i++) {
+        char *separator = strchr(overlays[i], '=');
+        *separator = '\0';
+
+        file_load(&overlay_files[i], separator + 1, allocators[MEMORY_FILE_CACHE]);
+        if (!overlay_files[i].contents) {
+            sc_error(true, "Could not open overlay file '%s'.", separator + 1);
+        }
+
+        vfs_add(&vfs, overlays[i], overlay_files[i].contents, overlay_files[i].size);
+    }
+
+    sc_file_cache cache;
+    file_cache_init(&cache, allocators[MEMORY_FILE_CACHE]);
+    if (overlay_count > 0) {
+        file_cache_use_vfs(&cache, &vfs);
+        path_table_use_vfs(&include_paths, &vfs);
+    }
+
+    // Start loading includes in the background as soon as we have seen the input file.
+    sc_prefetcher prefetcher;
+    prefetcher_init_with(&prefetcher, &include_paths, allocators[MEMORY_FILE_CACHE]);
+    file_cache_use_prefetcher(&cache, &prefetcher);
+
+    tokenizer_state state;
+    sc_file_stream stream;
+    bool streaming = !strcmp(in_path, "-");
+
+    if (streaming) {
+        if (!file_stream_open_with(&stream, in_path, FILE_STREAM_CHUNK_SIZE, allocators[MEMORY_FILE_CACHE])) {
+            sc_error(true, "Could not open standard input.");
+        }
+
+        tokenizer_state_init_stream_with(&state, &cache, &stream, "<stdin>", allocators[MEMORY_TOKENIZER]);
+    } else {
+        sc_file_cache_handle handle = file_cache_load(&cache, in_path);
+
+        if (!handle.cache) {
+            sc_error(true, "Could not open input file '%s'.", in_path);
+        }
+
+        tokenizer_state_init_with(&state, handle, allocators[MEMORY_TOKENIZER]);
+    }
+
+    pp_token_vector line_vec;
+    pp_token_vector_init_with(&line_vec, 128, allocators[MEMORY_TOKENIZER]);
+
+    // We'll go line by line to append newlines for a more human readable form.
+    token_vector translation_line;
+    token_vector_init_with(&translation_line, 128, allocators[MEMORY_OUTPUT]);
+
+    preprocessor_state pp_state;
+    preprocessor_state_init_with(&pp_state, &state, &translation_line, &line_vec, &include_paths, allocators[MEMORY_MACROS]);
+
+    pp_header_cache header_cache;
+    header_cache_init_with(&header_cache, allocators[MEMORY_HEADER_CACHE]);
+    preprocessor_use_header_cache(&pp_state, &header_cache);
+
+    if (dependencies_only) {
+        preprocessor_directives_only(&pp_state);
+    }
+
+    // Regular files are written through a mapping, anything else (pipes, devices) through a buffer.
+    sc_output out;
+    if (!output_open_mapped_with(&out, out_path, allocators[MEMORY_OUTPUT]) && !output_open_with(&out, out_path, allocators[MEMORY_OUTPUT])) {
+        sc_error(true, "Could not open output file '%s'.", out_path);
+    }
+
+    pp_text_writer writer;
+    pp_text_writer_init(&writer, &out);
+
+    token_stream_writer stream_writer;
+    if (binary) {
+        token_stream_writer_init_with(&stream_writer, allocators[MEMORY_OUTPUT]);
+    }
+
+    bool ok = true;
+    while (ok) {
+        ok = preprocess_line(&pp_state);
+        if (binary) {
+            token_stream_writer_line(&stream_writer, &pp_state, &translation_line);
+        } else {
+            pp_text_writer_line(&writer, &pp_state, &translation_line);
+        }
+
+        // Nothing holds on to output tokens, so we don't keep the whole output in memory.
+        preprocessor_release_output(&translation_line);
+    }
+
+    if (dependencies_only) {
+        write_dependencies(&out, &cache, in_path);
+    } else if (binary) {
+        if (!token_stream_writer_finish(&stream_writer, &out)) {
+            sc_error(true, "The translation unit is too big for a token stream.");
+        }
+        token_stream_writer_destroy(&stream_writer);
+    }
+
+    if (!output_close(&out)) {
+        sc_error(true, "Could not write output file '%s'.", out_path);
+    }
+
+    preprocessor_state_destroy(&pp_state);
+    pp_token_vector_destroy(&line_vec);
+    token_vector_destroy(&translation_line);
+    tokenizer_state_destroy(&state);
+    if (streaming) {
+        file_stream_close(&stream);
+    }
+
+    file_cache_use_prefetcher(&cache, NULL);
+    prefetcher_destroy(&prefetcher);
+
+    // The prefetcher thread is joined, so its counters are final. Nothing goes to stdout, it can be the output.
+    if (memory_stats) {
+        fprintf(stderr, "Prefetcher: %zu files prefetched, %zu used.\n", prefetcher.prefetched, prefetcher.used);
+        fprintf(stderr, "File cache: %zu hits, %zu misses, %zu evictions.\n", cache.hits, cache.misses, cache.evictions);
+        fprintf(stderr, "Include lookup cache: %zu hits, %zu misses.\n", include_paths.lookup_cache.hits, include_paths.lookup_cache.misses);
+        fprintf(stderr, "Header cache: %zu hits, %zu misses.\n", header_cache.hits, header_cache.misses);
+    }
+
+    header_cache_destroy(&header_cache);
+    path_table_destroy(&include_paths);
+    file_cache_destroy(&cache);
+
+    for (size_t i = 0; i < overlay_count; i++) {
+        file_destroy(&overlay_files[i]);
+    }
+    free(overlay_files);
+    free(overlays);
+    vfs_destroy(&vfs);
+
+    // Everything that has an owner is freed by now, what is still live leaked.
+    if (memory_stats) {
+        tracking_report(stderr, memory_tracking, MEMORY_SUBSYSTEM_COUNT);
+    }
+
+    return 0;
+}
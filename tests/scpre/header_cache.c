@@ -0,0 +1,15 @@
+// Headers included again under the same relevant macros are replayed from the header cache.
+#include "headers/config.h"
+#undef CONFIG_BITS
+#include "headers/config.h"
+int bits = CONFIG_BITS;
+
+#define USE_WIDE
+#undef CONFIG_BITS
+#include "headers/config.h"
+int wide_bits = CONFIG_BITS;
+
+#include "headers/guarded.h"
+#include "headers/guarded.h"
+#include "headers/guarded.h"
+int value = GUARDED_VALUE;
@@ -0,0 +1,8 @@
+// Unguarded, its result depends on USE_WIDE.
+#ifdef USE_WIDE
+typedef long config_int;
+#define CONFIG_BITS 64
+#else
+typedef int config_int;
+#define CONFIG_BITS 32
+#endif
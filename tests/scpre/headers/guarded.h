@@ -0,0 +1,8 @@
+#ifndef GUARDED_H
+#define GUARDED_H
+
+#define GUARDED_VALUE 42
+
+int guarded_function(int value);
+
+#endif
@@ -0,0 +1,5 @@
+// Not valid UTF-8 on line 3.
+#ifdef SECOND
+const char *bytes = "(";
+#endif
+int utf8_value;
@@ -0,0 +1,8 @@
+// Includes are looked up next to the including file.
+// The second include is skipped by the include guard.
+#include "headers/guarded.h"
+#include "headers/guarded.h"
+
+int main() {
+    return guarded_function(GUARDED_VALUE);
+}
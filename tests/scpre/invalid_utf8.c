@@ -0,0 +1,8 @@
+// Included three times with different macros, so the header cache can not replay it.
+// The warning about its invalid UTF-8 must still show only once.
+#include "headers/invalid_utf8.h"
+#define SECOND
+#include "headers/invalid_utf8.h"
+#undef SECOND
+#define THIRD
+#include "headers/invalid_utf8.h"
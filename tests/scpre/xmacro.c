@@ -0,0 +1,11 @@
+// Unguarded header included multiple times, re-inclusions replay the cached tokens.
+#define COLOR(name, value) name = value,
+enum colors {
+#include "headers/colors.inc"
+};
+#undef COLOR
+
+#define COLOR(name, value) #name,
+const char *color_names[] = {
+#include "headers/colors.inc"
+};
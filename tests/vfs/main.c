@@ -0,0 +1,9 @@
+// Run with overlays for shadowed.h, only.h and angled.h (see the vfs test in the Makefile).
+// shadowed.h exists on disk too, the overlay must win. The other two only exist in the overlay.
+#include "shadowed.h"
+#include "only.h"
+#include <angled.h>
+
+int main() {
+    return SHADOWED_VALUE + ONLY_VALUE + ANGLED_VALUE;
+}
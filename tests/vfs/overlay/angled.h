@@ -0,0 +1,3 @@
+// Found through the include directories.
+#define ANGLED_VALUE 3
+int angled(void);
@@ -0,0 +1,2 @@
+#define ONLY_VALUE 2
+int only(void);
@@ -0,0 +1,2 @@
+#define SHADOWED_VALUE 1
+int shadowed(void);
@@ -0,0 +1,3 @@
+// Hidden by overlay/shadowed.h, reading this is a bug.
+#error "shadowed.h was read from disk instead of the overlay"
+#define SHADOWED_VALUE 0